@@ -15,6 +15,13 @@
     ptr gpa_getkernel32()
         returns the module handle for kernel32.dll
 
+    Code that needs every loaded module rather than just kernel32 can walk the
+    loader's module list from its head:
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_getmodulelist()
+        returns the address of PEB_LDR_DATA.InMemoryOrderModuleList
+
     Then call the following function to obtain the address of GetProcAddress.
     We define GetProcAddress_t as a function pointer type for convenience.
 
@@ -76,7 +83,7 @@ ptr gpa_getkernel32() {
     __asm__ (
         "movq %%gs:0x60, %%rax\n\t"     // rax := PEB
         "movq 0x18(%%rax), %%rax\n\t"   // rax := PEB_LDR_DATA
-        "movq 0x20(%%rax), %%rax\n\t"   // rax := InInitializationOrderModuleList
+        "movq 0x20(%%rax), %%rax\n\t"   // rax := InMemoryOrderModuleList.Flink
         "movq (%%rax), %%rax\n\t"       // 2nd module (1st is the exe itself)
         "movq (%%rax), %%rax\n\t"       // 3rd module (2nd is ntdll) 
         "movq 0x20(%%rax), %%rax\n\t"   // dllbase for kernel32
@@ -87,6 +94,22 @@ ptr gpa_getkernel32() {
     return modulehandle;
 }
 
+// the head of the same list, for code that wants to walk all of it.
+// entries are LDR_DATA_TABLE_ENTRY.InMemoryOrderLinks, so relative to
+// each link DllBase is at +0x20 (as above) and SizeOfImage at +0x30.
+ptr gpa_getmodulelist() {
+    ptr listhead = 0;
+    __asm__ (
+        "movq %%gs:0x60, %%rax\n\t"     // rax := PEB
+        "movq 0x18(%%rax), %%rax\n\t"   // rax := PEB_LDR_DATA
+        "leaq 0x20(%%rax), %%rax\n\t"   // rax := &InMemoryOrderModuleList
+        : "=a" (listhead)               // return value
+        :                               // no input
+        :                               // no clobber
+    );
+    return listhead;
+}
+
 // ditto, __asm__ is messy but worth it for this initial part
 inline static gpa_PIMAGE_EXPORT_DIRECTORY gpa_getexportdir(ptr modulehandle) {
     gpa_PIMAGE_EXPORT_DIRECTORY exportdirectory = 0;
@@ -106,14 +129,55 @@ inline static gpa_PIMAGE_EXPORT_DIRECTORY gpa_getexportdir(ptr modulehandle) {
     return exportdirectory;
 }
 
-// since we have no external dependencies, implement the only
-// CRT function we need
+// since we have no external dependencies, implement the few
+// CRT string functions we need. the comparison is done on unsigned
+// bytes so the result can also be used for ordering (export tables
+// and archive symbol tables are sorted that way).
 inline static int gpa_strcmp(char *a, char *b) {
     while (*a && *b && *a == *b) {
         a++;
         b++;
     }
-    return *a - *b;
+    return (u8)*a - (u8)*b;
+}
+
+inline static u64 gpa_strlen(char *s) {
+    char *p = s;
+    while (*p) {
+        p++;
+    }
+    return p - s;
+}
+
+// gpa_strcmp for when b lives in an untrusted buffer that ends n bytes
+// after it: b is treated as terminated there
+inline static int gpa_strcmpn(char *a, char *b, u64 n) {
+    while (n && *a && *a == *b) {
+        a++;
+        b++;
+        n--;
+    }
+    return (u8)*a - (u8)(n ? *b : 0);
+}
+
+// the name hash every index and cache in the tooling agrees on:
+// FNV-1a with a murmur3 finalizer, so the high bits are usable too.
+// reads at most n bytes, for names in untrusted buffers.
+inline static u32 gpa_hashn(char *s, u64 n) {
+    u32 h = 0x811c9dc5;
+    while (n-- && *s) {
+        h = (h ^ (u8)*s++) * 0x01000193;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+inline static u32 gpa_hash(char *s) {
+    return gpa_hashn(s, ~(u64)0);
 }
 
 // our return type
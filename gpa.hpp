@@ -0,0 +1,375 @@
+/*
+    gpa.hpp
+    per-call-site resolve-once function pointers for C++.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    auto alloc = gpa::proc<"VirtualAlloc">(k32);
+
+    Each call site gets its own static slot. The first call resolves the name,
+    and every later call is one relaxed atomic load. The name is a template
+    argument, so its hash is computed at compile time. The result is a
+    correctly typed function pointer for names that have a gpa::signature, and
+    for any other name whose type is passed explicitly:
+
+    auto lstrlen = gpa::proc<"lstrlenA", int (GPA_WINAPI *)(const char *)>(k32);
+
+    Resolution does not go through GetProcAddress. It binary searches the
+    module's export name table. The compile-time hash keys a small table
+    shared by the whole process, so ten call sites that all want VirtualAlloc
+    from the same module search for it once. Forwarded exports are handed to
+    kernel32's GetProcAddress, found with gpa_getgetprocaddress once per
+    process. A name
+    that does not resolve gives a null pointer and is retried on the next
+    call.
+
+    A call site is expected to always pass the same module, which is how
+    these are used. A site that passes different modules keeps whichever
+    pointer it resolved first.
+
+    The layer is header-only and freestanding: no CRT, no exceptions, no RTTI,
+    no standard headers, only compiler builtins. It needs C++20 for class-type
+    template arguments and lambdas in unevaluated contexts. It links against
+    getprocaddress.c, which must be compiled as C somewhere in the program.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    template <gpa::name Name, typename Fn = gpa::signature<Name>::type> Fn gpa::proc(ptr modulehandle)
+        the resolve-once pointer for Name in modulehandle
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa::kernel32()
+        gpa_getkernel32(), for symmetry
+*/
+
+#ifndef _GPA_HPP
+#define _GPA_HPP
+#define _GPA_HPP_DEBUG 0
+
+#if !defined(_BASIC_TYPES_DEFINED)
+#define _BASIC_TYPES_DEFINED
+typedef char                 i8;
+typedef short               i16;
+typedef int                 i32;
+typedef long long           i64;
+typedef unsigned char        u8;
+typedef unsigned short      u16;
+typedef unsigned int        u32;
+typedef unsigned long long  u64;
+typedef void*               ptr;
+typedef unsigned short      wchar;
+#endif
+
+#ifndef GetProcAddress_t_defined
+#define GetProcAddress_t_defined
+typedef ptr (*GetProcAddress_t)(ptr modulehandle, char *name);
+#endif
+
+extern "C" ptr gpa_getkernel32();
+extern "C" GetProcAddress_t gpa_getgetprocaddress(ptr modulehandle);
+
+// the Win64 calling convention, spelled out so the types are right on any target
+#define GPA_WINAPI __attribute__((ms_abi))
+#define GPA_PROC_SHARED 256
+
+namespace gpa {
+
+// a string literal as a template argument
+template <u32 N>
+struct name {
+    char text[N];
+    consteval name(const char (&s)[N]) {
+        for (u32 i = 0; i < N; i++) {
+            text[i] = s[i];
+        }
+    }
+};
+
+// gpa_hashn from getprocaddress.c, usable in constant expressions
+constexpr u32 hash(const char *s, u64 n) {
+    u32 h = 0x811c9dc5;
+    while (n-- && *s) {
+        h = (h ^ (u8)*s++) * 0x01000193;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+template <name Name>
+consteval u32 hashof() {
+    return hash(Name.text, sizeof(Name.text));
+}
+
+// typed pointers for common names; anything else is named explicitly
+template <name Name> struct signature;
+template <> struct signature<"GetProcAddress">   { typedef ptr  (GPA_WINAPI *type)(ptr module, const char *name); };
+template <> struct signature<"GetModuleHandleA"> { typedef ptr  (GPA_WINAPI *type)(const char *name); };
+template <> struct signature<"LoadLibraryA">     { typedef ptr  (GPA_WINAPI *type)(const char *name); };
+template <> struct signature<"FreeLibrary">      { typedef i32  (GPA_WINAPI *type)(ptr module); };
+template <> struct signature<"VirtualAlloc">     { typedef ptr  (GPA_WINAPI *type)(ptr address, u64 size, u32 type, u32 protect); };
+template <> struct signature<"VirtualFree">      { typedef i32  (GPA_WINAPI *type)(ptr address, u64 size, u32 type); };
+template <> struct signature<"VirtualProtect">   { typedef i32  (GPA_WINAPI *type)(ptr address, u64 size, u32 protect, u32 *old); };
+template <> struct signature<"GetStdHandle">     { typedef ptr  (GPA_WINAPI *type)(u32 handle); };
+template <> struct signature<"WriteFile">        { typedef i32  (GPA_WINAPI *type)(ptr file, const void *buffer, u32 size, u32 *written, ptr overlapped); };
+template <> struct signature<"GetLastError">     { typedef u32  (GPA_WINAPI *type)(); };
+template <> struct signature<"ExitProcess">      { typedef void (GPA_WINAPI *type)(u32 code); };
+
+namespace detail {
+
+inline int strcmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (u8)*a - (u8)*b;
+}
+
+// kernel32's GetProcAddress, for forwarded exports. racing threads store the
+// same pointer
+inline GetProcAddress_t getprocaddress;
+
+inline GetProcAddress_t forwarder() {
+    GetProcAddress_t found = __atomic_load_n(&getprocaddress, __ATOMIC_RELAXED);
+    if (!found) {
+        found = gpa_getgetprocaddress(gpa_getkernel32());
+        __atomic_store_n(&getprocaddress, found, __ATOMIC_RELAXED);
+    }
+    return found;
+}
+
+// binary search of the export name table, as gpa_modview does for pe_loaded.
+// a forwarded export is left to the caller: 0, with forwarded set
+inline ptr search(ptr modulehandle, const char *name, int *forwarded) {
+    u8 *base = (u8*)modulehandle;
+    u8 *nt   = base + *(u32*)(base + 0x3c);
+    u8 *dirs = nt + 0x18 + (*(u16*)(nt + 0x18) == 0x20b ? 0x70 : 0x60);
+    u32 exportrva  = *(u32*)dirs;
+    u32 exportsize = *(u32*)(dirs + 4);
+    if (!exportrva) {
+        return 0;
+    }
+    u32 *dir       = (u32*)(base + exportrva);
+    u32  count     = dir[6];           // NumberOfNames
+    u32 *functions = (u32*)(base + dir[7]);
+    u32 *names     = (u32*)(base + dir[8]);
+    u16 *ordinals  = (u16*)(base + dir[9]);
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        int cmp = strcmp(name, (char*)base + names[mid]);
+        if (cmp == 0) {
+            u32 rva = functions[ordinals[mid]];
+            if (rva - exportrva < exportsize) {
+                *forwarded = 1;
+                return 0;
+            }
+            return base + rva;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return 0;
+}
+
+struct shared {
+    ptr         module;
+    const char *name;
+    ptr         address;
+};
+
+inline shared table[GPA_PROC_SHARED];
+inline u32    tablelock;
+#if _GPA_HPP_DEBUG
+inline u32    slowpaths;        // calls that found their site's slot empty
+#endif
+
+inline void lock() {
+    while (__atomic_exchange_n(&tablelock, 1, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+}
+
+inline void unlock() {
+    __atomic_store_n(&tablelock, 0, __ATOMIC_RELEASE);
+}
+
+// the entry for module and name, the empty one where it would go, or 0 if
+// the table is full. called under tablelock
+inline shared *find(ptr modulehandle, u32 hash, const char *name) {
+    for (u32 probe = 0; probe < GPA_PROC_SHARED; probe++) {
+        shared *entry = &table[(hash + probe) % GPA_PROC_SHARED];
+        if (!entry->module || (entry->module == modulehandle && strcmp(entry->name, name) == 0)) {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+// the slow path, taken once per call site. the shared table is filled
+// under a spinlock; contention only happens on first calls
+[[gnu::noinline, gnu::cold]]
+inline ptr resolve(ptr modulehandle, u32 hash, const char *name) {
+    lock();
+#if _GPA_HPP_DEBUG
+    slowpaths++;
+#endif
+    shared *entry = find(modulehandle, hash, name);
+    if (entry && entry->module) {
+        ptr address = entry->address;
+        unlock();
+        return address;
+    }
+    int forwarded = 0;
+    ptr address = search(modulehandle, name, &forwarded);
+    if (forwarded) {
+        // GetProcAddress may load the forward's target, and its DllMain may
+        // come back here: call it unlocked, then look for the entry again
+        unlock();
+        GetProcAddress_t getprocaddress = forwarder();
+        address = getprocaddress ? getprocaddress(modulehandle, (char*)name) : 0;
+        lock();
+        entry = find(modulehandle, hash, name);
+    }
+    // not shared yet: remember it if it resolved
+    if (address && entry && !entry->module) {
+        entry->module  = modulehandle;
+        entry->name    = name;
+        entry->address = address;
+    }
+    unlock();
+    return address;
+}
+
+} // namespace detail
+
+// Site defaults to a fresh closure type, so every call site instantiates its
+// own function and with it its own slot
+template <name Name, typename Fn = typename signature<Name>::type, typename Site = decltype([] {})>
+[[gnu::always_inline]] inline Fn proc(ptr modulehandle) {
+    static ptr slot;
+    ptr address = __atomic_load_n(&slot, __ATOMIC_RELAXED);
+    if (__builtin_expect(!address, 0)) {
+        address = detail::resolve(modulehandle, hashof<Name>(), Name.text);
+        __atomic_store_n(&slot, address, __ATOMIC_RELAXED);
+    }
+    return (Fn)address;
+}
+
+inline ptr kernel32() {
+    return gpa_getkernel32();
+}
+
+} // namespace gpa
+
+// development code: first-call and steady-state cost against a synthetic
+// module. the pointers are never called, only resolved. build with
+//     gcc -O2 -c gpa_synth.c -o synth.o
+//     g++ -std=c++20 -O2 -x c++ gpa.hpp -x none synth.o     (with _GPA_HPP_DEBUG set)
+#if _GPA_HPP_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+typedef struct _gpa_SYNTH_EXPORT {
+    char *name;
+    u32   slot;
+    u32   rva;
+    char *forwarder;
+} gpa_SYNTH_EXPORT;
+u64 gpa_synth_pe_size(gpa_SYNTH_EXPORT *exports, u32 count);
+u64 gpa_synth_pe(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count, u32 timestamp, int filelayout);
+}
+
+static double gpa_hpp_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_hpp_byname(const void *a, const void *b) {
+    return strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+typedef void (*gpa_hpp_fn)();
+
+// sixteen distinct call sites, each resolving a different name once
+#define GPA_HPP_SITES(X) \
+    X("VirtualAlloc") X("VirtualFree") X("VirtualProtect") X("GetStdHandle") X("WriteFile") \
+    X("GetLastError") X("ExitProcess") X("LoadLibraryA") X("FreeLibrary") X("GetModuleHandleA") \
+    X("CreateFileA") X("ReadFile") X("CloseHandle") X("Sleep") X("HeapAlloc") X("HeapFree")
+
+int main(int argc, char *argv[]) {
+    // a kernel32-sized export table around the names above
+    const char *real[] = {
+#define GPA_HPP_NAME(n) n,
+        GPA_HPP_SITES(GPA_HPP_NAME)
+    };
+    u32 count = 1600, nreal = sizeof(real) / sizeof(*real);
+    gpa_SYNTH_EXPORT *exports = (gpa_SYNTH_EXPORT*)calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = (char*)malloc(32);
+        if (i < nreal) {
+            strcpy(exports[i].name, real[i]);
+        } else {
+            snprintf(exports[i].name, 32, "%sInternal%04u", real[i % nreal], i);
+        }
+        exports[i].rva = 0x1000 + 16 * i;
+    }
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_hpp_byname);
+    for (u32 i = 0; i < count; i++) {
+        exports[i].slot = i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = (u8*)malloc(capacity);
+    gpa_synth_pe(image, capacity, exports, count, 0, 0);
+    ptr k32 = image;
+
+    u32 wrong = 0;
+    double t0 = gpa_hpp_now();
+#define GPA_HPP_FIRST(n) wrong += !gpa::proc<n, gpa_hpp_fn>(k32);
+    GPA_HPP_SITES(GPA_HPP_FIRST)
+    double t1 = gpa_hpp_now();
+    // the same names again from new call sites: served by the shared table,
+    // but each site still starts with an empty slot of its own
+    u32 before = gpa::detail::slowpaths;
+#define GPA_HPP_AGAIN(n) wrong += !gpa::proc<n, gpa_hpp_fn>(k32);
+    GPA_HPP_SITES(GPA_HPP_AGAIN)
+    double t2 = gpa_hpp_now();
+    wrong += gpa::detail::slowpaths - before != nreal;
+    printf("first call: %.0f ns searching, %.0f ns from the shared table\n",
+           (t1 - t0) * 1e9 / nreal, (t2 - t1) * 1e9 / nreal);
+
+    // typed results. two sites for one name take the slow path once each,
+    // and a site called again keeps its slot
+    before = gpa::detail::slowpaths;
+    auto alloc = gpa::proc<"VirtualAlloc">(k32);
+    auto again = gpa::proc<"VirtualAlloc">(k32);
+    wrong += (u8*)alloc - image != 0x1000 + 16 * 0 || (ptr)alloc != (ptr)again;
+    wrong += gpa::detail::slowpaths - before != 2;
+    for (int i = 0; i < 3; i++) {
+        wrong += !gpa::proc<"VirtualFree", gpa_hpp_fn>(k32);
+    }
+    wrong += gpa::detail::slowpaths - before != 3;
+    wrong += gpa::proc<"NoSuchExport", gpa_hpp_fn>(k32) != 0;
+
+    u32 iterations = 100000000;
+    u64 sum = 0;
+    double t3 = gpa_hpp_now();
+    for (u32 i = 0; i < iterations; i++) {
+        sum += (u64)gpa::proc<"HeapAlloc", gpa_hpp_fn>(k32);
+        __asm__ volatile("" : "+r"(sum));
+    }
+    double t4 = gpa_hpp_now();
+    printf("steady state: %.2f ns per call, %u wrong (%llx)\n", (t4 - t3) * 1e9 / iterations, wrong,
+           (unsigned long long)sum);
+    return wrong != 0;
+}
+#endif // _GPA_HPP_DEBUG
+#endif // _GPA_HPP
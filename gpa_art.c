@@ -0,0 +1,700 @@
+/*
+    gpa_art.c
+    an adaptive radix tree over a module's export names.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    The hash index in gpa_index.c has no order, and the binary search in
+    gpa_modview.c pays a string compare per level. An adaptive radix tree
+    (Leis et al., ICDE 2013) walks the name a byte at a time. Inner nodes
+    come in four sizes (4, 16, 48 and 256 children) and grow as children are
+    added. Runs of bytes shared by a whole subtree are stored once in the node
+    (path compression). Up to 8 of those bytes are kept in the node; longer
+    runs are skipped optimistically and checked at the leaf. An exact lookup
+    costs O(name length) no matter how many names there are. The tree keeps
+    byte order, so it can list every name under a prefix in sorted order.
+
+    Leaves are not nodes: a child reference with the low bit set is the name
+    index itself, and keys are read from the module's name table when needed.
+    The terminating NUL is part of every key, so no key is a prefix of
+    another. Nodes are carved out of a caller-supplied arena and referenced
+    by 32-bit offsets into it. Nodes replaced on growth go onto free lists
+    per size.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_art_size(u32 count)
+        arena bytes that are always enough for count names
+    void gpa_art_init(gpa_ART *art, ptr arena, u64 capacity)
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_artbuild(gpa_MODVIEW *view, gpa_ART *art)
+        inserts every export name, 0 if the arena ran out
+    int gpa_<backend>_artlookup(gpa_MODVIEW *view, gpa_ART *art, char *name, gpa_EXPORT *exp)
+        exact lookup, 1 and exp filled on a hit
+    u32 gpa_<backend>_artprefix(gpa_MODVIEW *view, gpa_ART *art, char *prefix,
+                                gpa_EXPORT_CALLBACK callback, ptr context)
+        calls back for every export whose name starts with prefix, in name order,
+        until the callback returns 0. returns the number of callbacks made
+*/
+
+#ifndef _GPA_ART_C
+#define _GPA_ART_C
+#define _GPA_ART_DEBUG 0
+#include "gpa_modview.c"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GPA_ART_NODE4       0
+#define GPA_ART_NODE16      1
+#define GPA_ART_NODE48      2
+#define GPA_ART_NODE256     3
+#define GPA_ART_PREFIX      8       // prefix bytes stored in a node, longer ones are skipped
+
+typedef struct _gpa_ART_NODE {
+    u8    type;
+    u8    count;                // children, Node256 counts 256 as 0
+    u16   reserved;
+    u32   prefixlength;
+    u8    prefix[GPA_ART_PREFIX];
+} gpa_ART_NODE;
+
+typedef struct _gpa_ART_NODE4 {
+    gpa_ART_NODE header;
+    u8    keys[4];              // sorted
+    u32   children[4];
+} gpa_ART_NODE4;
+
+typedef struct _gpa_ART_NODE16 {
+    gpa_ART_NODE header;
+    u8    keys[16];             // sorted
+    u32   children[16];
+} gpa_ART_NODE16;
+
+typedef struct _gpa_ART_NODE48 {
+    gpa_ART_NODE header;
+    u8    slots[256];           // child slot + 1 for each byte, 0 = none
+    u32   children[48];
+} gpa_ART_NODE48;
+
+typedef struct _gpa_ART_NODE256 {
+    gpa_ART_NODE header;
+    u32   children[256];
+} gpa_ART_NODE256;
+
+typedef struct _gpa_ART {
+    u8   *arena;
+    u64   used;
+    u64   capacity;
+    u32   root;                 // child reference: 0 empty, odd a leaf, even a node offset
+    u32   count;
+    u32   free[4];              // per node type, linked through the first word
+} gpa_ART;
+
+// child references
+#define GPA_ART_ISLEAF(ref)     ((ref) & 1)
+#define GPA_ART_LEAF(index)     ((u32)(index) << 1 | 1)
+#define GPA_ART_INDEX(ref)      ((ref) >> 1)
+#define GPA_ART_NODE(art, ref)  ((gpa_ART_NODE*)((art)->arena + (ref)))
+
+typedef char *(*gpa_ART_NAME)(gpa_MODVIEW *view, u32 i);
+
+static const u32 gpa_art_nodesize[4] = {
+    sizeof(gpa_ART_NODE4), sizeof(gpa_ART_NODE16), sizeof(gpa_ART_NODE48), sizeof(gpa_ART_NODE256)
+};
+
+// every inner node has at least 2, 5, 17 or 49 children, and a tree over
+// count keys has fewer than 2 * count child references in all. the worst
+// bytes per reference, counting the smaller nodes a node grew out of, is
+// a minimal Node48: (464 + 96 + 36) / 17 < 36
+u64 gpa_art_size(u32 count) {
+    return 72ull * count + 64;
+}
+
+void gpa_art_init(gpa_ART *art, ptr arena, u64 capacity) {
+    art->arena    = arena;
+    art->used     = 16;         // offset 0 means "no child"
+    art->capacity = capacity < 0xfffffff0ull ? capacity : 0xfffffff0ull;
+    art->root     = 0;
+    art->count    = 0;
+    for (u32 t = 0; t < 4; t++) {
+        art->free[t] = 0;
+    }
+}
+
+inline static u32 gpa_art_alloc(gpa_ART *art, u32 type) {
+    u32 ref = art->free[type];
+    if (ref) {
+        art->free[type] = *(u32*)(art->arena + ref);
+    } else {
+        if (gpa_art_nodesize[type] > art->capacity - art->used) {
+            return 0;
+        }
+        ref = (u32)art->used;
+        art->used += gpa_art_nodesize[type];
+    }
+    u32 *words = (u32*)(art->arena + ref);
+    for (u32 i = 0; i < gpa_art_nodesize[type] / 4; i++) {
+        words[i] = 0;
+    }
+    GPA_ART_NODE(art, ref)->type = type;
+    return ref;
+}
+
+inline static void gpa_art_release(gpa_ART *art, u32 ref) {
+    u32 type = GPA_ART_NODE(art, ref)->type;
+    *(u32*)(art->arena + ref) = art->free[type];
+    art->free[type] = ref;
+}
+
+// the reference slot for byte c, 0 if there is none
+inline static u32 *gpa_art_child(gpa_ART *art, u32 ref, u8 c) {
+    gpa_ART_NODE *node = GPA_ART_NODE(art, ref);
+    switch (node->type) {
+    case GPA_ART_NODE4: {
+        gpa_ART_NODE4 *n = (gpa_ART_NODE4*)node;
+        for (u32 i = 0; i < node->count; i++) {
+            if (n->keys[i] == c) {
+                return &n->children[i];
+            }
+        }
+        return 0;
+    }
+    case GPA_ART_NODE16: {
+        gpa_ART_NODE16 *n = (gpa_ART_NODE16*)node;
+#if defined(__SSE2__)
+        __m128i match = _mm_cmpeq_epi8(_mm_set1_epi8((char)c), _mm_loadu_si128((__m128i*)n->keys));
+        u32 bits = (u32)_mm_movemask_epi8(match) & ((1u << node->count) - 1);
+        return bits ? &n->children[__builtin_ctz(bits)] : 0;
+#else
+        for (u32 i = 0; i < node->count; i++) {
+            if (n->keys[i] == c) {
+                return &n->children[i];
+            }
+        }
+        return 0;
+#endif
+    }
+    case GPA_ART_NODE48: {
+        gpa_ART_NODE48 *n = (gpa_ART_NODE48*)node;
+        return n->slots[c] ? &n->children[n->slots[c] - 1] : 0;
+    }
+    default: {
+        gpa_ART_NODE256 *n = (gpa_ART_NODE256*)node;
+        return n->children[c] ? &n->children[c] : 0;
+    }
+    }
+}
+
+// adds child for byte c to the node at *ref, growing it into a new node
+// (and updating *ref) if it is full. 0 if the arena ran out
+inline static int gpa_art_addchild(gpa_ART *art, u32 *ref, u8 c, u32 child) {
+    gpa_ART_NODE *node = GPA_ART_NODE(art, *ref);
+    u32 type = node->type;
+    if ((type == GPA_ART_NODE4 && node->count == 4) || (type == GPA_ART_NODE16 && node->count == 16)
+        || (type == GPA_ART_NODE48 && node->count == 48)) {
+        u32 grown = gpa_art_alloc(art, type + 1);
+        if (!grown) {
+            return 0;
+        }
+        node = GPA_ART_NODE(art, *ref);
+        gpa_ART_NODE *bigger = GPA_ART_NODE(art, grown);
+        bigger->count        = node->count;
+        bigger->prefixlength = node->prefixlength;
+        for (u32 i = 0; i < GPA_ART_PREFIX; i++) {
+            bigger->prefix[i] = node->prefix[i];
+        }
+        if (type == GPA_ART_NODE4) {
+            gpa_ART_NODE4 *from = (gpa_ART_NODE4*)node;
+            gpa_ART_NODE16 *to  = (gpa_ART_NODE16*)bigger;
+            for (u32 i = 0; i < 4; i++) {
+                to->keys[i]     = from->keys[i];
+                to->children[i] = from->children[i];
+            }
+        } else if (type == GPA_ART_NODE16) {
+            gpa_ART_NODE16 *from = (gpa_ART_NODE16*)node;
+            gpa_ART_NODE48 *to   = (gpa_ART_NODE48*)bigger;
+            for (u32 i = 0; i < 16; i++) {
+                to->slots[from->keys[i]] = i + 1;
+                to->children[i]          = from->children[i];
+            }
+        } else {
+            gpa_ART_NODE48 *from = (gpa_ART_NODE48*)node;
+            gpa_ART_NODE256 *to  = (gpa_ART_NODE256*)bigger;
+            for (u32 b = 0; b < 256; b++) {
+                if (from->slots[b]) {
+                    to->children[b] = from->children[from->slots[b] - 1];
+                }
+            }
+        }
+        gpa_art_release(art, *ref);
+        *ref = grown;
+        node = bigger;
+        type++;
+    }
+    if (type == GPA_ART_NODE4 || type == GPA_ART_NODE16) {
+        // both keep keys sorted, for ordered iteration
+        u8  *keys     = type == GPA_ART_NODE4 ? ((gpa_ART_NODE4*)node)->keys : ((gpa_ART_NODE16*)node)->keys;
+        u32 *children = type == GPA_ART_NODE4 ? ((gpa_ART_NODE4*)node)->children : ((gpa_ART_NODE16*)node)->children;
+        u32 i = node->count;
+        while (i > 0 && keys[i - 1] > c) {
+            keys[i]     = keys[i - 1];
+            children[i] = children[i - 1];
+            i--;
+        }
+        keys[i]     = c;
+        children[i] = child;
+    } else if (type == GPA_ART_NODE48) {
+        gpa_ART_NODE48 *n = (gpa_ART_NODE48*)node;
+        n->children[node->count] = child;
+        n->slots[c] = node->count + 1;
+    } else {
+        ((gpa_ART_NODE256*)node)->children[c] = child;
+    }
+    node->count++;
+    return 1;
+}
+
+// any leaf below ref; all of them share the node's prefix
+inline static u32 gpa_art_anyleaf(gpa_ART *art, u32 ref) {
+    while (!GPA_ART_ISLEAF(ref)) {
+        gpa_ART_NODE *node = GPA_ART_NODE(art, ref);
+        switch (node->type) {
+        case GPA_ART_NODE4:  ref = ((gpa_ART_NODE4*)node)->children[0]; break;
+        case GPA_ART_NODE16: ref = ((gpa_ART_NODE16*)node)->children[0]; break;
+        case GPA_ART_NODE48: ref = ((gpa_ART_NODE48*)node)->children[0]; break;
+        default: {
+            u32 *children = ((gpa_ART_NODE256*)node)->children;
+            while (!*children) {
+                children++;
+            }
+            ref = *children;
+        }
+        }
+    }
+    return ref;
+}
+
+// key is length bytes plus its terminator, and safe to read that far
+inline static int gpa_art_insert(gpa_ART *art, gpa_MODVIEW *view, gpa_ART_NAME getname, char *key, u64 length, u32 index) {
+    u8 *k = (u8*)key;
+    u32 *ref = &art->root;
+    u64 depth = 0;
+    for (;;) {
+        if (*ref == 0) {
+            *ref = GPA_ART_LEAF(index);
+            art->count++;
+            return 1;
+        }
+        if (GPA_ART_ISLEAF(*ref)) {
+            // split the leaf: a Node4 holding the bytes both keys share
+            u8 *other = (u8*)getname(view, GPA_ART_INDEX(*ref));
+            u64 common = 0;
+            while (k[depth + common] == other[depth + common]) {
+                if (depth + common == length) {
+                    return 1;   // duplicate name, the first one wins
+                }
+                common++;
+            }
+            u32 split = gpa_art_alloc(art, GPA_ART_NODE4);
+            if (!split) {
+                return 0;
+            }
+            gpa_ART_NODE *node = GPA_ART_NODE(art, split);
+            node->prefixlength = (u32)common;
+            for (u32 i = 0; i < common && i < GPA_ART_PREFIX; i++) {
+                node->prefix[i] = k[depth + i];
+            }
+            u32 leaf = *ref;
+            *ref = split;
+            gpa_art_addchild(art, ref, other[depth + common], leaf);
+            gpa_art_addchild(art, ref, k[depth + common], GPA_ART_LEAF(index));
+            art->count++;
+            return 1;
+        }
+        gpa_ART_NODE *node = GPA_ART_NODE(art, *ref);
+        if (node->prefixlength) {
+            // beyond the stored bytes, the prefix comes from a key below the node
+            u8 *full = node->prefixlength > GPA_ART_PREFIX
+                ? (u8*)getname(view, GPA_ART_INDEX(gpa_art_anyleaf(art, *ref))) + depth : node->prefix;
+            // a prefix never holds a NUL, so the key's terminator always mismatches
+            u32 mismatch = 0;
+            while (mismatch < node->prefixlength && depth + mismatch < length && full[mismatch] == k[depth + mismatch]) {
+                mismatch++;
+            }
+            if (mismatch < node->prefixlength) {
+                u32 split = gpa_art_alloc(art, GPA_ART_NODE4);
+                if (!split) {
+                    return 0;
+                }
+                node = GPA_ART_NODE(art, *ref);
+                gpa_ART_NODE *top = GPA_ART_NODE(art, split);
+                top->prefixlength = mismatch;
+                for (u32 i = 0; i < mismatch && i < GPA_ART_PREFIX; i++) {
+                    top->prefix[i] = full[i];
+                }
+                // the old node keeps what follows the branching byte
+                u8 branch = full[mismatch];
+                node->prefixlength -= mismatch + 1;
+                for (u32 i = 0; i < node->prefixlength && i < GPA_ART_PREFIX; i++) {
+                    node->prefix[i] = full[mismatch + 1 + i];
+                }
+                u32 old = *ref;
+                *ref = split;
+                gpa_art_addchild(art, ref, branch, old);
+                gpa_art_addchild(art, ref, k[depth + mismatch], GPA_ART_LEAF(index));
+                art->count++;
+                return 1;
+            }
+            depth += node->prefixlength;
+        }
+        u32 *child = gpa_art_child(art, *ref, k[depth]);
+        if (!child) {
+            if (!gpa_art_addchild(art, ref, k[depth], GPA_ART_LEAF(index))) {
+                return 0;
+            }
+            art->count++;
+            return 1;
+        }
+        // the terminator's child is this very name, inserted before
+        if (depth == length) {
+            return 1;
+        }
+        ref = child;
+        depth++;
+    }
+}
+
+// the name index for key, or -1
+inline static i64 gpa_art_find(gpa_ART *art, gpa_MODVIEW *view, gpa_ART_NAME getname, char *key) {
+    u8 *k = (u8*)key;
+    u64 length = gpa_strlen(key);
+    u32 ref = art->root;
+    u64 depth = 0;
+    while (ref) {
+        if (GPA_ART_ISLEAF(ref)) {
+            char *candidate = getname(view, GPA_ART_INDEX(ref));
+            return candidate && gpa_modview_strcmp(view, key, candidate) == 0 ? (i64)GPA_ART_INDEX(ref) : -1;
+        }
+        gpa_ART_NODE *node = GPA_ART_NODE(art, ref);
+        if (node->prefixlength) {
+            // a branching byte must follow the prefix, at the latest key's NUL
+            if (depth + node->prefixlength > length) {
+                return -1;
+            }
+            for (u32 i = 0; i < node->prefixlength && i < GPA_ART_PREFIX; i++) {
+                if (node->prefix[i] != k[depth + i]) {
+                    return -1;
+                }
+            }
+            depth += node->prefixlength;
+        }
+        u32 *child = gpa_art_child(art, ref, k[depth]);
+        ref = child ? *child : 0;
+        // nothing continues past the terminator but a leaf
+        if (depth == length && ref && !GPA_ART_ISLEAF(ref)) {
+            return -1;
+        }
+        depth++;
+    }
+    return -1;
+}
+
+typedef int (*gpa_ART_EXPORT)(gpa_MODVIEW *view, u32 i, gpa_EXPORT *exp);
+
+// in-order walk below ref. returns 0 once a callback asked to stop
+static int gpa_art_walk(gpa_ART *art, gpa_MODVIEW *view, gpa_ART_EXPORT getexport, u32 ref,
+                        gpa_EXPORT_CALLBACK callback, ptr context, u32 *calls) {
+    if (GPA_ART_ISLEAF(ref)) {
+        gpa_EXPORT exp;
+        if (!getexport(view, GPA_ART_INDEX(ref), &exp)) {
+            return 1;
+        }
+        (*calls)++;
+        return callback(context, &exp) != 0;
+    }
+    gpa_ART_NODE *node = GPA_ART_NODE(art, ref);
+    switch (node->type) {
+    case GPA_ART_NODE4:
+    case GPA_ART_NODE16: {
+        u32 *children = node->type == GPA_ART_NODE4 ? ((gpa_ART_NODE4*)node)->children : ((gpa_ART_NODE16*)node)->children;
+        for (u32 i = 0; i < node->count; i++) {
+            if (!gpa_art_walk(art, view, getexport, children[i], callback, context, calls)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    case GPA_ART_NODE48: {
+        gpa_ART_NODE48 *n = (gpa_ART_NODE48*)node;
+        for (u32 b = 0; b < 256; b++) {
+            if (n->slots[b] && !gpa_art_walk(art, view, getexport, n->children[n->slots[b] - 1], callback, context, calls)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    default: {
+        gpa_ART_NODE256 *n = (gpa_ART_NODE256*)node;
+        for (u32 b = 0; b < 256; b++) {
+            if (n->children[b] && !gpa_art_walk(art, view, getexport, n->children[b], callback, context, calls)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    }
+}
+
+inline static u32 gpa_art_prefix(gpa_ART *art, gpa_MODVIEW *view, gpa_ART_NAME getname, gpa_ART_EXPORT getexport,
+                                 char *prefix, gpa_EXPORT_CALLBACK callback, ptr context) {
+    u8 *p = (u8*)prefix;
+    u64 length = gpa_strlen(prefix);
+    u32 ref = art->root;
+    u64 depth = 0;
+    u32 calls = 0;
+    // descend until the prefix is used up, never past its end; everything
+    // below then matches
+    while (ref && depth < length) {
+        if (GPA_ART_ISLEAF(ref)) {
+            break;
+        }
+        gpa_ART_NODE *node = GPA_ART_NODE(art, ref);
+        if (node->prefixlength) {
+            u8 *full = node->prefixlength > GPA_ART_PREFIX
+                ? (u8*)getname(view, GPA_ART_INDEX(gpa_art_anyleaf(art, ref))) + depth : node->prefix;
+            for (u32 i = 0; i < node->prefixlength && depth + i < length; i++) {
+                if (full[i] != p[depth + i]) {
+                    return 0;
+                }
+            }
+            depth += node->prefixlength;
+            if (depth >= length) {
+                break;
+            }
+        }
+        u32 *child = gpa_art_child(art, ref, p[depth]);
+        ref = child ? *child : 0;
+        depth++;
+    }
+    if (!ref) {
+        return 0;
+    }
+    if (GPA_ART_ISLEAF(ref)) {
+        // the path so far was only checked where nodes branched
+        char *name = getname(view, GPA_ART_INDEX(ref));
+        u64 remaining = name ? gpa_modview_remaining(view, name) : 0;
+        for (u64 i = 0; i < length; i++) {
+            if (i >= remaining || (u8)name[i] != p[i]) {
+                return 0;
+            }
+        }
+    }
+    gpa_art_walk(art, view, getexport, ref, callback, context, &calls);
+    return calls;
+}
+
+#define GPA_ART_DEFINE(backend)                                                                 \
+    int gpa_##backend##_artbuild(gpa_MODVIEW *view, gpa_ART *art) {                             \
+        u32 count = gpa_##backend##_count(view);                                                \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            char *name = gpa_##backend##_name(view, i);                                         \
+            if (!name) {                                                                        \
+                continue;                                                                       \
+            }                                                                                   \
+            /* names without a terminator inside the image are left out */                      \
+            u64 remaining = gpa_modview_remaining(view, name), length = 0;                      \
+            while (length < remaining && name[length]) {                                        \
+                length++;                                                                       \
+            }                                                                                   \
+            if (length < remaining                                                              \
+                && !gpa_art_insert(art, view, gpa_##backend##_name, name, length, i)) {         \
+                return 0;                                                                       \
+            }                                                                                   \
+        }                                                                                       \
+        return 1;                                                                               \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_artlookup(gpa_MODVIEW *view, gpa_ART *art, char *name, gpa_EXPORT *exp) { \
+        i64 i = gpa_art_find(art, view, gpa_##backend##_name, name);                            \
+        return i >= 0 && gpa_##backend##_export(view, (u32)i, exp);                             \
+    }                                                                                           \
+                                                                                                \
+    u32 gpa_##backend##_artprefix(gpa_MODVIEW *view, gpa_ART *art, char *prefix,                \
+                                  gpa_EXPORT_CALLBACK callback, ptr context) {                  \
+        return gpa_art_prefix(art, view, gpa_##backend##_name, gpa_##backend##_export,          \
+                              prefix, callback, context);                                       \
+    }
+
+GPA_ART_DEFINE(pe_loaded)
+GPA_ART_DEFINE(pe_file)
+GPA_ART_DEFINE(elf)
+
+// development code: lookups against the linear scan gpa_getgetprocaddress
+// does and the binary search in gpa_modview, plus prefix queries
+#if _GPA_ART_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_art_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_art_byname(const void *a, const void *b) {
+    return gpa_strcmp(*(char**)a, *(char**)b);
+}
+
+typedef struct {
+    char *last;
+    u32   unordered;
+} gpa_art_order;
+
+static int gpa_art_collect(ptr context, gpa_EXPORT *exp) {
+    gpa_art_order *order = context;
+    order->unordered += order->last && gpa_strcmp(order->last, exp->name) >= 0;
+    order->last = exp->name;
+    return 1;
+}
+
+// the loop in gpa_getgetprocaddress, for any name
+static u32 gpa_art_linear(gpa_MODVIEW *view, char *name) {
+    for (u32 i = 0; i < view->count; i++) {
+        if (gpa_strcmp((char*)view->base + view->names[i], name) == 0) {
+            return view->functions[view->ordinals[i]];
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // names built from the kind of pieces real exports are made of
+    char *heads[] = { "Nt", "Zw", "Rtl", "Ldr", "Etw", "Create", "Get", "Set", "Query", "Open", "Close",
+                      "Enum", "Reg", "Crypt", "Wsa", "Virtual", "Heap", "Local", "Global", "Find" };
+    char *bodies[] = { "File", "Process", "Thread", "Key", "Value", "Event", "Mutex", "Section", "Memory",
+                       "Token", "Object", "Module", "Window", "Path", "String", "Unicode", "Time", "Info",
+                       "Information", "Handle", "Pipe", "Port", "Timer", "Semaphore" };
+    char *tails[] = { "", "A", "W", "Ex", "ExA", "ExW", "2", "Internal" };
+    u32 nh = sizeof(heads) / sizeof(*heads), nb = sizeof(bodies) / sizeof(*bodies), nt = sizeof(tails) / sizeof(*tails);
+    char **names = malloc(sizeof(char*) * nh * nb * nb * nt);
+    u32 count = 0;
+    for (u32 h = 0; h < nh; h++) {
+        for (u32 b1 = 0; b1 < nb; b1++) {
+            for (u32 b2 = 0; b2 < nb; b2++) {
+                for (u32 t = 0; t < nt; t++) {
+                    if (((h * 131 + b1 * 31 + b2 * 7 + t) * 2654435761u >> 16) % 8 == 0) {
+                        char *name = malloc(64);
+                        snprintf(name, 64, "%s%s%s%s", heads[h], bodies[b1], b1 == b2 ? "" : bodies[b2], tails[t]);
+                        names[count++] = name;
+                    }
+                }
+            }
+        }
+    }
+    qsort(names, count, sizeof(char*), gpa_art_byname);
+    u32 unique = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0) {
+            names[unique++] = names[i];
+        }
+    }
+    count = unique < 65535 ? unique : 65535;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    u64 namebytes = 0;
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = names[i];
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+        namebytes += strlen(names[i]) + 1;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity);
+    gpa_MODVIEW view;
+    gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+
+    gpa_ART art;
+    u64 arenasize = gpa_art_size(count);
+    gpa_art_init(&art, malloc(arenasize), arenasize);
+    double t0 = gpa_art_now();
+    int built = gpa_pe_loaded_artbuild(&view, &art);
+    double t1 = gpa_art_now();
+    printf("%u names (%llu bytes of text): built %d in %.2f ms, arena %llu bytes (%.1f per name, bound %llu)\n",
+           count, (unsigned long long)namebytes, built, (t1 - t0) * 1e3, (unsigned long long)art.used,
+           (double)art.used / count, (unsigned long long)arenasize);
+
+    u32 wrong = 0;
+    gpa_EXPORT exp;
+    for (u32 i = 0; i < count; i++) {
+        wrong += !gpa_pe_loaded_artlookup(&view, &art, names[i], &exp) || exp.address != exports[i].rva;
+    }
+    char *misses[] = { "", "N", "NtFil", "NtFileFileX", "ZwZwZw", "NtFileProcessExAA" };
+    for (u32 i = 0; i < sizeof(misses) / sizeof(*misses); i++) {
+        wrong += gpa_pe_loaded_artlookup(&view, &art, misses[i], &exp) && gpa_strcmp(exp.name, misses[i]) != 0;
+    }
+
+    // a repeated name that is a prefix of one between: the first stays
+    gpa_SYNTH_EXPORT repeated[] = { { .name = "foo", .rva = 0x1000 }, { .name = "foobar", .rva = 0x2000 },
+                                    { .name = "foo", .rva = 0x3000 } };
+    u8 *elf = malloc(0x10000);
+    u64 elfsize = gpa_synth_elf(elf, 0x10000, repeated, 3);
+    gpa_MODVIEW elfview;
+    gpa_ART elfart;
+    gpa_art_init(&elfart, malloc(gpa_art_size(3)), gpa_art_size(3));
+    u32 calls = gpa_elf_open(&elfview, elf, elfsize) && gpa_elf_artbuild(&elfview, &elfart)
+        ? gpa_elf_artprefix(&elfview, &elfart, "f", gpa_art_collect, &(gpa_art_order){ 0, 0 }) : 0;
+    wrong += elfart.count != 2 || calls != 2
+        || !gpa_elf_artlookup(&elfview, &elfart, "foo", &exp) || exp.address != 0x1000
+        || !gpa_elf_artlookup(&elfview, &elfart, "foobar", &exp) || exp.address != 0x2000
+        || gpa_elf_artlookup(&elfview, &elfart, "fo", &exp);
+    printf("lookups: %u wrong\n", wrong);
+
+    u32 *order = malloc(sizeof(u32) * count);
+    for (u32 i = 0; i < count; i++) {
+        order[i] = (u32)((i * 2654435761ull) % count);
+    }
+    u32 rounds = 2000000 / count + 1, sample = count < 2000 ? count : 2000;
+    u64 sum = 0;
+    double t2 = gpa_art_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < count; i++) {
+            gpa_pe_loaded_artlookup(&view, &art, names[order[i]], &exp);
+            sum += exp.address;
+        }
+    }
+    double t3 = gpa_art_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < count; i++) {
+            gpa_pe_loaded_lookup(&view, names[order[i]], &exp);
+            sum += exp.address;
+        }
+    }
+    double t4 = gpa_art_now();
+    for (u32 i = 0; i < sample; i++) {
+        sum += gpa_art_linear(&view, names[order[i]]);
+    }
+    double t5 = gpa_art_now();
+    u64 lookups = (u64)rounds * count;
+    printf("art %.1f ns, binary search %.1f ns, linear scan %.1f ns per lookup (%llx)\n",
+           (t3 - t2) * 1e9 / lookups, (t4 - t3) * 1e9 / lookups, (t5 - t4) * 1e9 / sample, (unsigned long long)sum);
+
+    char *prefixes[] = { "NtFile", "RtlUnicodeStr", "GetProcess", "GetProc", "Zw", "Q", "NtNothing", "" };
+    for (u32 i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+        gpa_art_order ordered = { 0, 0 };
+        u32 expected = 0, plen = strlen(prefixes[i]);
+        for (u32 j = 0; j < count; j++) {
+            expected += strncmp(names[j], prefixes[i], plen) == 0;
+        }
+        double t6 = gpa_art_now();
+        u32 got = gpa_pe_loaded_artprefix(&view, &art, prefixes[i], gpa_art_collect, &ordered);
+        double t7 = gpa_art_now();
+        printf("prefix \"%s\": %u names (expected %u), %u out of order, %.1f us\n", prefixes[i], got, expected,
+               ordered.unordered, (t7 - t6) * 1e6);
+        wrong += got != expected || ordered.unordered;
+    }
+    return wrong != 0;
+}
+#endif // _GPA_ART_DEBUG
+#endif // _GPA_ART_C
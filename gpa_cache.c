@@ -0,0 +1,339 @@
+/*
+    gpa_cache.c
+    a small hot-symbol cache in front of export lookups.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Lookup traffic is heavily skewed: a few names make up most calls. The cache
+    is 2-way set associative, one 64-byte line per set, keyed by gpa_hash of
+    the name mixed with the module. A hit costs hashing the name, one line
+    probe and a compare against the export's own name, so a hash collision
+    cannot return the wrong function; it never touches the export tables or
+    the module's headers. Misses fall through to the module view's binary
+    search. gpa_cache_getprocaddress keeps the views of the last few modules
+    that missed open, so a miss does not reparse the headers either.
+
+    With admission enabled, a TinyLFU-style count-min sketch (4-bit counters,
+    periodically halved) estimates how often each key is asked for, and a miss
+    only replaces a set's LRU victim if it is asked for more often than the
+    victim. One-off lookups then cannot flush the hot set.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_cache_init(gpa_CACHE *cache, gpa_CACHE_SET *sets, u32 numsets,
+                        u64 *sketch, u32 sketchwords)
+        sets up a cache over caller storage. numsets and sketchwords must be powers
+        of two; sketch may be 0 to admit every miss
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_cache_getprocaddress(gpa_CACHE *cache, ptr modulehandle, char *name)
+        gpa_getgetprocaddress-style lookup of any name in a loaded module, cached.
+        forwarded exports are not resolved and return 0, as with the plain loop.
+        the cache must be dropped (gpa_cache_init) when a module is unloaded
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_cache_lookup(gpa_CACHE *cache, gpa_MODVIEW *view, char *name, gpa_EXPORT *exp)
+        the same over any pe_loaded view, filling in the whole export
+*/
+
+#ifndef _GPA_CACHE_C
+#define _GPA_CACHE_C
+#define _GPA_CACHE_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_CACHE_WAYS          2
+#define GPA_CACHE_SAMPLE        16      // sketch ages after this many increments per counter word
+#define GPA_CACHE_VIEWS         4       // modules gpa_cache_getprocaddress keeps open
+
+// two ways fill exactly one cache line
+typedef struct _gpa_CACHE_WAY {
+    u64   key;                  // name hash mixed with the module, 0 = empty
+    char *name;                 // the export's own name, for verification
+    u32   address;              // function rva
+    u32   ordinal;              // biased
+    u32   module;               // module base >> 16, loaded images are 64k aligned
+    u32   nameindex : 31;
+    u32   lru : 1;              // way[0] only: the least recently used way
+} gpa_CACHE_WAY;
+
+typedef struct _gpa_CACHE_SET {
+    gpa_CACHE_WAY way[GPA_CACHE_WAYS];
+} __attribute__((aligned(64))) gpa_CACHE_SET;
+
+typedef struct _gpa_CACHE {
+    gpa_CACHE_SET *sets;
+    gpa_MODVIEW views[GPA_CACHE_VIEWS];     // opened modules, for misses
+    u32   nextview;
+    u32   setmask;
+    u64  *sketch;               // 16 4-bit counters per word
+    u32   sketchmask;
+    u32   increments;
+    u32   resetat;
+    u64   hits;
+    u64   misses;
+    u64   admitted;
+    u64   rejected;
+} gpa_CACHE;
+
+void gpa_cache_init(gpa_CACHE *cache, gpa_CACHE_SET *sets, u32 numsets, u64 *sketch, u32 sketchwords) {
+    for (u32 i = 0; i < numsets; i++) {
+        for (u32 w = 0; w < GPA_CACHE_WAYS; w++) {
+            sets[i].way[w].key = 0;
+        }
+        sets[i].way[0].lru = 0;
+    }
+    for (u32 i = 0; sketch && i < sketchwords; i++) {
+        sketch[i] = 0;
+    }
+    cache->sets       = sets;
+    cache->setmask    = numsets - 1;
+    cache->sketch     = sketch;
+    cache->sketchmask = sketchwords - 1;
+    cache->increments = 0;
+    cache->resetat    = sketchwords * GPA_CACHE_SAMPLE;
+    cache->hits = cache->misses = cache->admitted = cache->rejected = 0;
+    for (u32 i = 0; i < GPA_CACHE_VIEWS; i++) {
+        cache->views[i].base = 0;
+    }
+    cache->nextview = 0;
+}
+
+inline static u64 gpa_cache_key(u8 *module, u32 hash) {
+    u64 key = ((u64)module >> 12) * 0x9e3779b97f4a7c15ull ^ ((u64)hash << 32 | hash);
+    return key | 1;             // never 0, that marks an empty way
+}
+
+// count-min sketch: four 4-bit counters per key, one in each of four words
+inline static u32 gpa_cache_counter(gpa_CACHE *cache, u64 key, u32 row, u64 **word) {
+    u64 h = key * (0x9e3779b97f4a7c15ull + 2 * row);
+    *word = &cache->sketch[(h >> 32) & cache->sketchmask];
+    return ((h >> 28) & 15) * 4;
+}
+
+inline static u32 gpa_cache_frequency(gpa_CACHE *cache, u64 key) {
+    u32 frequency = 15;
+    for (u32 row = 0; row < 4; row++) {
+        u64 *word;
+        u32 shift = gpa_cache_counter(cache, key, row, &word);
+        u32 count = (*word >> shift) & 15;
+        frequency = count < frequency ? count : frequency;
+    }
+    return frequency;
+}
+
+inline static void gpa_cache_increment(gpa_CACHE *cache, u64 key) {
+    for (u32 row = 0; row < 4; row++) {
+        u64 *word;
+        u32 shift = gpa_cache_counter(cache, key, row, &word);
+        if (((*word >> shift) & 15) != 15) {
+            *word += 1ull << shift;
+        }
+    }
+    // aging: halve every counter so old popularity fades
+    if (++cache->increments >= cache->resetat) {
+        for (u32 i = 0; i <= cache->sketchmask; i++) {
+            cache->sketch[i] = (cache->sketch[i] >> 1) & 0x7777777777777777ull;
+        }
+        cache->increments /= 2;
+    }
+}
+
+// the hit path: one set probed, nothing of the module read but the name
+inline static gpa_CACHE_WAY *gpa_cache_probe(gpa_CACHE *cache, u8 *base, char *name, u64 *key, gpa_CACHE_SET **set) {
+    *key = gpa_cache_key(base, gpa_hash(name));
+    *set = &cache->sets[(*key >> 40) & cache->setmask];
+    u32 module = (u32)((u64)base >> 16);
+    if (cache->sketch) {
+        gpa_cache_increment(cache, *key);
+    }
+    for (u32 w = 0; w < GPA_CACHE_WAYS; w++) {
+        gpa_CACHE_WAY *way = &(*set)->way[w];
+        if (way->key == *key && way->module == module && gpa_strcmp(name, way->name) == 0) {
+            (*set)->way[0].lru = w ^ 1;
+            cache->hits++;
+            return way;
+        }
+    }
+    cache->misses++;
+    return 0;
+}
+
+// the miss path: the view's binary search, then admission
+static int gpa_cache_fill(gpa_CACHE *cache, gpa_MODVIEW *view, char *name, u64 key, gpa_CACHE_SET *set, gpa_EXPORT *exp) {
+    if (!gpa_pe_loaded_lookup(view, name, exp)) {
+        return 0;
+    }
+    // forwarders are rare and would need their string kept, so they always miss
+    if (exp->forwarder) {
+        return 1;
+    }
+    u32 lru = set->way[0].lru;
+    gpa_CACHE_WAY *victim = &set->way[lru];
+    if (cache->sketch && victim->key && gpa_cache_frequency(cache, key) <= gpa_cache_frequency(cache, victim->key)) {
+        cache->rejected++;
+        return 1;
+    }
+    cache->admitted++;
+    victim->key       = key;
+    victim->name      = exp->name;
+    victim->address   = (u32)exp->address;
+    victim->ordinal   = exp->ordinal;
+    victim->nameindex = exp->index;
+    victim->module    = (u32)((u64)view->base >> 16);
+    set->way[0].lru   = lru ^ 1;
+    return 1;
+}
+
+int gpa_cache_lookup(gpa_CACHE *cache, gpa_MODVIEW *view, char *name, gpa_EXPORT *exp) {
+    u64 key;
+    gpa_CACHE_SET *set;
+    gpa_CACHE_WAY *way = gpa_cache_probe(cache, view->base, name, &key, &set);
+    if (way) {
+        exp->name      = way->name;
+        exp->address   = way->address;
+        exp->index     = way->nameindex;
+        exp->ordinal   = way->ordinal;
+        exp->forwarder = 0;
+        return 1;
+    }
+    return gpa_cache_fill(cache, view, name, key, set, exp);
+}
+
+// the module's view, opened on its first miss and kept while it is one of
+// the last GPA_CACHE_VIEWS modules to miss
+static gpa_MODVIEW *gpa_cache_view(gpa_CACHE *cache, u8 *base) {
+    for (u32 i = 0; i < GPA_CACHE_VIEWS; i++) {
+        if (cache->views[i].base == base) {
+            return &cache->views[i];
+        }
+    }
+    gpa_MODVIEW *view = &cache->views[cache->nextview];
+    cache->nextview = (cache->nextview + 1) % GPA_CACHE_VIEWS;
+    if (!gpa_pe_loaded_open(view, base, 0)) {
+        view->base = 0;
+        return 0;
+    }
+    return view;
+}
+
+ptr gpa_cache_getprocaddress(gpa_CACHE *cache, ptr modulehandle, char *name) {
+    u64 key;
+    gpa_CACHE_SET *set;
+    gpa_CACHE_WAY *way = gpa_cache_probe(cache, modulehandle, name, &key, &set);
+    if (way) {
+        return modulehandle + way->address;
+    }
+    gpa_MODVIEW *view = gpa_cache_view(cache, modulehandle);
+    gpa_EXPORT exp;
+    if (!view || !gpa_cache_fill(cache, view, name, key, set, &exp) || exp.forwarder) {
+        return 0;
+    }
+    return modulehandle + exp.address;
+}
+
+// development code: zipfian lookup streams against a synthetic module,
+// with and without admission
+#if _GPA_CACHE_DEBUG
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_cache_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u64 gpa_cache_rng = 88172645463325252ull;
+
+static double gpa_cache_uniform() {
+    gpa_cache_rng ^= gpa_cache_rng << 13;
+    gpa_cache_rng ^= gpa_cache_rng >> 7;
+    gpa_cache_rng ^= gpa_cache_rng << 17;
+    return (gpa_cache_rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int main(int argc, char *argv[]) {
+    u32 count   = 20000;
+    u32 queries = 2000000;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, "Api%08uEx", i);
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = aligned_alloc(0x10000, (capacity + 0xffff) & ~0xffffull);
+    gpa_synth_pe(image, capacity, exports, count, 0, 0);
+
+    // sampled by inverting the zipf cdf; popular ranks scattered over the table
+    double *cdf = malloc(count * sizeof(double));
+    u32 *stream = malloc(queries * sizeof(u32));
+    double skews[] = { 0.8, 1.0, 1.2 };
+    static gpa_CACHE_SET sets[512];
+    static u64 sketch[2048];
+    for (u32 s = 0; s < 3; s++) {
+        double total = 0;
+        for (u32 i = 0; i < count; i++) {
+            cdf[i] = (total += 1.0 / pow(i + 1, skews[s]));
+        }
+        for (u32 q = 0; q < queries; q++) {
+            double u = gpa_cache_uniform() * total;
+            u32 lo = 0, hi = count - 1;
+            while (lo < hi) {
+                u32 mid = (lo + hi) / 2;
+                if (cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            stream[q] = (lo * 7919u) % count;
+        }
+        for (int admission = 0; admission < 2; admission++) {
+            gpa_CACHE cache;
+            gpa_cache_init(&cache, sets, 512, admission ? sketch : 0, 2048);
+            u64 sum = 0;
+            double t0 = gpa_cache_now();
+            for (u32 q = 0; q < queries; q++) {
+                sum += (u64)gpa_cache_getprocaddress(&cache, image, exports[stream[q]].name);
+            }
+            double t1 = gpa_cache_now();
+            printf("zipf %.1f, %-9s hit rate %5.1f%%, %5.1f ns/lookup\n", skews[s],
+                   admission ? "tinylfu" : "lru", 100.0 * cache.hits / queries, (t1 - t0) * 1e9 / queries);
+            if (sum == 0) {
+                return 1;
+            }
+        }
+        double t0 = gpa_cache_now();
+        u64 sum = 0;
+        for (u32 q = 0; q < queries; q++) {
+            gpa_MODVIEW view;
+            gpa_EXPORT exp;
+            gpa_pe_loaded_open(&view, image, 0);
+            gpa_pe_loaded_lookup(&view, exports[stream[q]].name, &exp);
+            sum += exp.address;
+        }
+        double t1 = gpa_cache_now();
+        printf("zipf %.1f, uncached                   %5.1f ns/lookup\n", skews[s], (t1 - t0) * 1e9 / queries);
+    }
+
+    // the hit path alone
+    gpa_CACHE cache;
+    gpa_cache_init(&cache, sets, 512, 0, 0);
+    u64 sum = 0;
+    for (u32 i = 0; i < 64; i++) {
+        sum += (u64)gpa_cache_getprocaddress(&cache, image, exports[i * 101].name);
+    }
+    double t0 = gpa_cache_now();
+    for (u32 q = 0; q < queries; q++) {
+        sum += (u64)gpa_cache_getprocaddress(&cache, image, exports[(q % 64) * 101].name);
+    }
+    double t1 = gpa_cache_now();
+    printf("all hits: %.1f ns/lookup, hit rate %.1f%% (%llx)\n", (t1 - t0) * 1e9 / queries,
+           100.0 * cache.hits / (cache.hits + cache.misses), (unsigned long long)sum);
+    return 0;
+}
+#endif // _GPA_CACHE_DEBUG
+#endif // _GPA_CACHE_C
@@ -0,0 +1,432 @@
+/*
+    gpa_coldidx.c
+    a side index that keeps lookups in a cold image down to one page.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Right after a module is mapped, every page of it a lookup reads is a page
+    fault, and a fault on a page that is not in the page cache is a disk
+    read. A linear walk like gpa_getgetprocaddress's reads AddressOfNames and
+    every name up to the match; a binary search still touches the headers,
+    the directory, AddressOfNames, a dozen name pages on the way down, then
+    AddressOfNameOrdinals and AddressOfFunctions. gpa_index only skips the
+    dozen.
+
+    The cold index is built once (from the on-disk file, or from a warm
+    mapping) and kept next to the module: a hash table whose slots carry
+    everything a lookup would otherwise fetch from the image, the name's
+    RVA and the function's RVA, index and ordinal, plus the export data
+    directory range for spotting forwarders. A slot is 16 bytes, so slots
+    tile pages exactly: 16 bits of the name's hash filter the probes (the
+    home slot comes from its top bits), and the ordinal is kept unbiased, as
+    AddressOfNameOrdinals holds it, with the base once in the header. At
+    most half full and rounded to a power of two, that is 32 to 64 bytes per
+    name. A lookup hashes the name, reads one slot of the index, and reads
+    the image exactly once, to confirm the name itself: one name page, or
+    two when the name straddles a page boundary. The headers, the directory
+    and the three arrays are never read.
+
+    Over the debug build's 2500-name image, measured on cold file mappings
+    (page cache dropped, no readahead) and with page traps: a lookup touches
+    1 image page, against 11 for the linear walk, 9 for the binary search
+    and 6 for gpa_index. The index adds its header page, once, and one slot
+    page per lookup.
+
+    The index is in RVA space, so one built from the file serves the loaded
+    image. Staleness is caught by gpa_coldidx_validate with the quick
+    fingerprint (gpa_fingerprint.c), which reads the directory page, once.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_coldidx_size(u32 count)
+        bytes needed for an index over count names, 0 if the index would
+        not fit its u32 size
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_COLDIDX *gpa_<backend>_coldbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint)
+        builds the index into buffer (gpa_coldidx_size bytes, any content), for
+        the pe_loaded and pe_file backends; 0 if the module has too many names
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_coldidx_validate(gpa_COLDIDX *index, u64 size, u64 fingerprint)
+        checks an index that came from somewhere else (a file, another process)
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_coldidx_lookup(gpa_COLDIDX *index, ptr image, u64 size, char *name, gpa_EXPORT *exp)
+        looks a name up in a loaded image, returns 1 and fills exp on a hit.
+        size 0 means a trusted, unbounded image
+*/
+
+#ifndef _GPA_COLDIDX_C
+#define _GPA_COLDIDX_C
+#define _GPA_COLDIDX_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_COLDIDX_MAGIC       0x43415047      // "GPAC"
+#define GPA_COLDIDX_VERSION     2
+#define GPA_COLDIDX_MAXCOUNT    (1u << 30)      // names; keeps the slot doubling inside u32
+
+typedef struct _gpa_COLDIDX {
+    u32   magic;
+    u32   version;
+    u64   fingerprint;          // quick fingerprint of the module it was built from
+    u32   count;                // names in the module
+    u32   numslots;             // power of two
+    u32   slots;                // offset of the slot array from the header
+    u32   size;                 // total bytes, header included
+    u32   exportrva;            // export data directory, forwarders point into it
+    u32   exportsize;
+    u32   ordinalbase;          // the directory's Base, added to every slot's ordinal
+} gpa_COLDIDX;
+
+typedef struct _gpa_COLDIDX_SLOT {
+    u32   namerva;              // 0 marks an empty slot
+    u32   rva;                  // of the function, or of the forwarder string
+    u32   index;                // in AddressOfNames
+    u16   tag;                  // low 16 bits of the name's hash
+    u16   ordinal;              // unbiased
+} gpa_COLDIDX_SLOT;
+
+// at most half full, as gpa_index
+inline static u32 gpa_coldidx_numslots(u32 count) {
+    if (count > GPA_COLDIDX_MAXCOUNT) {
+        return 0;
+    }
+    u64 n = 16;
+    while (n < 2ull * count) {
+        n <<= 1;
+    }
+    return (u32)n;
+}
+
+u64 gpa_coldidx_size(u32 count) {
+    u64 size = sizeof(gpa_COLDIDX) + (u64)gpa_coldidx_numslots(count) * sizeof(gpa_COLDIDX_SLOT);
+    // the header's size is a u32, which gives out well before the slot count
+    return gpa_coldidx_numslots(count) && size <= 0xffffffffull ? size : 0;
+}
+
+inline static gpa_COLDIDX_SLOT *gpa_coldidx_slots(gpa_COLDIDX *index) {
+    return (gpa_COLDIDX_SLOT*)((u8*)index + index->slots);
+}
+
+inline static u32 gpa_coldidx_home(gpa_COLDIDX *index, u32 hash) {
+    return (u32)(((u64)hash * index->numslots) >> 32);
+}
+
+int gpa_coldidx_validate(gpa_COLDIDX *index, u64 size, u64 fingerprint) {
+    if (size < sizeof(gpa_COLDIDX) || index->magic != GPA_COLDIDX_MAGIC || index->version != GPA_COLDIDX_VERSION
+        || index->fingerprint != fingerprint || index->size > size) {
+        return 0;
+    }
+    u32 n = index->numslots;
+    return n >= 16 && (n & (n - 1)) == 0 && index->count <= n / 2 && index->slots >= sizeof(gpa_COLDIDX)
+        && (u64)index->slots + (u64)n * sizeof(gpa_COLDIDX_SLOT) <= index->size;
+}
+
+int gpa_coldidx_lookup(gpa_COLDIDX *index, ptr image, u64 size, char *name, gpa_EXPORT *exp) {
+    gpa_COLDIDX_SLOT *slots = gpa_coldidx_slots(index);
+    u8 *base  = image;
+    u64 limit = size ? size : ~(u64)0;
+    u32 hash  = gpa_hash(name);
+    u32 mask  = index->numslots - 1;
+    u32 slot  = gpa_coldidx_home(index, hash);
+    for (u32 probes = 0; probes < index->numslots && slots[slot].namerva; probes++) {
+        gpa_COLDIDX_SLOT *s = &slots[slot];
+        // the name is the only thing read from the image
+        if (s->tag == (u16)hash && s->namerva < limit
+            && gpa_strcmpn(name, (char*)base + s->namerva, limit - s->namerva) == 0) {
+            exp->name      = (char*)base + s->namerva;
+            exp->address   = s->rva;
+            exp->index     = s->index;
+            exp->ordinal   = s->ordinal + index->ordinalbase;
+            exp->forwarder = s->rva - index->exportrva < index->exportsize ? (char*)base + s->rva : 0;
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+#define GPA_COLDIDX_DEFINE(backend)                                                             \
+    gpa_COLDIDX *gpa_##backend##_coldbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint) {    \
+        gpa_COLDIDX *index = buffer;                                                            \
+        u32 count = gpa_##backend##_count(view);                                                \
+        if (!gpa_coldidx_size(count)) {                                                         \
+            return 0;                                                                           \
+        }                                                                                       \
+        index->magic       = GPA_COLDIDX_MAGIC;                                                 \
+        index->version     = GPA_COLDIDX_VERSION;                                               \
+        index->fingerprint = fingerprint;                                                       \
+        index->count       = count;                                                             \
+        index->numslots    = gpa_coldidx_numslots(count);                                       \
+        index->slots       = sizeof(gpa_COLDIDX);                                               \
+        index->size        = (u32)gpa_coldidx_size(count);                                      \
+        index->exportrva   = view->exportrva;                                                   \
+        index->exportsize  = view->exportsize;                                                  \
+        index->ordinalbase = view->exportdir->Base;                                             \
+        gpa_COLDIDX_SLOT *slots = gpa_coldidx_slots(index);                                     \
+        for (u32 i = 0; i < index->numslots; i++) {                                             \
+            slots[i].tag     = 0;                                                               \
+            slots[i].namerva = 0;                                                               \
+        }                                                                                       \
+        u32 mask = index->numslots - 1;                                                         \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            gpa_EXPORT exp;                                                                     \
+            if (!view->names[i] || !gpa_##backend##_export(view, i, &exp)) {                    \
+                continue;                                                                       \
+            }                                                                                   \
+            u32 hash = gpa_hashn(exp.name, gpa_modview_remaining(view, exp.name));              \
+            u32 slot = gpa_coldidx_home(index, hash);                                           \
+            while (slots[slot].namerva) {                                                       \
+                slot = (slot + 1) & mask;                                                       \
+            }                                                                                   \
+            slots[slot].namerva = view->names[i];                                               \
+            slots[slot].rva     = (u32)exp.address;                                             \
+            slots[slot].index   = i;                                                            \
+            slots[slot].tag     = (u16)hash;                                                    \
+            slots[slot].ordinal = (u16)(exp.ordinal - index->ordinalbase);                      \
+        }                                                                                       \
+        return index;                                                                           \
+    }
+
+GPA_COLDIDX_DEFINE(pe_loaded)
+GPA_COLDIDX_DEFINE(pe_file)
+
+// development code: distinct image pages touched per lookup, on a cold file
+// mapping (mincore and fault counts) and exactly (page traps)
+#if _GPA_COLDIDX_DEBUG
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gpa_fingerprint.c"
+#include "gpa_index.c"
+#include "gpa_synth.c"
+
+#define GPA_COLDIDX_PAGE 4096
+
+static int gpa_coldidx_byname(const void *a, const void *b) {
+    return strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+static u32 gpa_coldidx_random(u32 n) {
+    static u64 state = 0x9e3779b97f4a7c15ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (u32)((state >> 11) % n);
+}
+
+// the strategies, each given only the image (and its index, if any)
+static u64 gpa_coldidx_scan(u8 *image, u64 size, ptr index, char *name) {
+    (void)size;                 // trusted image
+    (void)index;                // no index
+    // gpa_getgetprocaddress's loop
+    gpa_PIMAGE_EXPORT_DIRECTORY dir = gpa_getexportdir(image);
+    u32 *names = (u32*)(image + dir->AddressOfNames);
+    for (u32 i = 0; i < dir->NumberOfNames; i++) {
+        if (gpa_strcmp((char*)image + names[i], name) == 0) {
+            return ((u32*)(image + dir->AddressOfFunctions))[((u16*)(image + dir->AddressOfNameOrdinals))[i]];
+        }
+    }
+    return 0;
+}
+
+static u64 gpa_coldidx_binary(u8 *image, u64 size, ptr index, char *name) {
+    (void)index;                // no index
+    gpa_MODVIEW view;
+    gpa_EXPORT exp;
+    return gpa_pe_loaded_open(&view, image, size) && gpa_pe_loaded_lookup(&view, name, &exp) ? exp.address : 0;
+}
+
+static u64 gpa_coldidx_hashindex(u8 *image, u64 size, ptr index, char *name) {
+    gpa_MODVIEW view;
+    gpa_EXPORT exp;
+    return gpa_pe_loaded_open(&view, image, size) && gpa_pe_loaded_indexlookup(&view, index, name, &exp) ? exp.address : 0;
+}
+
+static u64 gpa_coldidx_cold(u8 *image, u64 size, ptr index, char *name) {
+    gpa_EXPORT exp;
+    return gpa_coldidx_lookup(index, image, size, name, &exp) ? exp.address : 0;
+}
+
+typedef u64 (*gpa_COLDIDX_STRATEGY)(u8 *image, u64 size, ptr index, char *name);
+
+// exact count: the image copy starts inaccessible and each first touch of a
+// page traps once, records it and opens the page up
+static u8  *gpa_trapbase;
+static u64  gpa_trapsize;
+static u32  gpa_trapped;
+
+static void gpa_coldidx_trap(int sig, siginfo_t *info, void *context) {
+    (void)sig;                  // only SIGSEGV is installed
+    (void)context;
+    u8 *page = (u8*)((u64)info->si_addr & ~(u64)(GPA_COLDIDX_PAGE - 1));
+    if (page < gpa_trapbase || page >= gpa_trapbase + gpa_trapsize) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    mprotect(page, GPA_COLDIDX_PAGE, PROT_READ);
+    gpa_trapped++;
+}
+
+static u32 gpa_coldidx_resident(ptr base, u64 size) {
+    u64 pages = (size + GPA_COLDIDX_PAGE - 1) / GPA_COLDIDX_PAGE;
+    unsigned char vec[pages];
+    u32 n = 0;
+    mincore(base, size, vec);
+    for (u64 i = 0; i < pages; i++) {
+        n += vec[i] & 1;
+    }
+    return n;
+}
+
+static u64 gpa_coldidx_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+// drops the file from the page cache and maps it again, without readahead
+static u8 *gpa_coldidx_coldmap(int fd, u64 size) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    u8 *base = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    madvise(base, size, MADV_RANDOM);
+    return base;
+}
+
+int main(int argc, char *argv[]) {
+    // a system-DLL-sized export table
+    u32 count = argc > 1 ? atoi(argv[1]) : 2500;
+    const char *heads[] = {"Nt", "Zw", "Rtl", "Ldr", "Etw", "Csr", "Dbg", "Tp", "Alpc", "Ki"};
+    const char *bodies[] = {"Query", "Set", "Create", "Open", "Allocate", "Free", "Map", "Unmap", "Wait",
+                            "Enumerate", "Register", "Initialize"};
+    const char *objects[] = {"File", "Key", "Section", "Thread", "Process", "Event", "Token", "Object",
+                             "Heap", "Module", "Timer", "Port", "Job", "Value", "Information", "Context"};
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(64);
+        snprintf(exports[i].name, 64, "%s%s%s%s%u", heads[i % 10], bodies[i / 10 % 12], objects[i / 120 % 16],
+                 i % 3 ? "Ex" : "", i / 1920);
+    }
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_coldidx_byname);
+    for (u32 i = 0; i < count; i++) {
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    exports[7].forwarder = "NTDLL.RtlForwarded";
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = aligned_alloc(GPA_COLDIDX_PAGE, (capacity + GPA_COLDIDX_PAGE - 1) & ~(u64)(GPA_COLDIDX_PAGE - 1));
+    u64 size = gpa_synth_pe(image, capacity, exports, count, 0x5f000000, 0);
+
+    // both indexes are built from the file layout of the same module, as a
+    // build machine would, and used on the loaded one
+    u8 *file = malloc(capacity);
+    u64 filesize = gpa_synth_pe(file, capacity, exports, count, 0x5f000000, 1);
+    gpa_MODVIEW fileview, view;
+    gpa_pe_file_open(&fileview, file, filesize);
+    gpa_pe_loaded_open(&view, image, size);
+    u64 fingerprint = gpa_fingerprint_view(&view, 1);
+    u64 coldsize = gpa_coldidx_size(count), indexsize = gpa_index_size(count);
+    gpa_COLDIDX *cold = gpa_pe_file_coldbuild(&fileview, malloc(coldsize), gpa_fingerprint_view(&fileview, 1));
+    gpa_INDEX *hashindex = gpa_pe_file_indexbuild(&fileview, malloc(indexsize), fingerprint);
+    u32 wrong = !gpa_coldidx_validate(cold, coldsize, fingerprint) || gpa_coldidx_validate(cold, coldsize, fingerprint + 1);
+    // counts whose slots would not fit the u32 size are refused, not wrapped
+    wrong += gpa_coldidx_size(0xffffffff) != 0 || gpa_coldidx_size(1u << 28) != 0
+             || gpa_coldidx_size(1u << 26) == 0;
+
+    // every name agrees with the modview lookup, forwarder included; misses miss
+    for (u32 i = 0; i < count; i++) {
+        gpa_EXPORT a, b;
+        int fa = gpa_coldidx_lookup(cold, image, size, exports[i].name, &a);
+        int fb = gpa_pe_loaded_lookup(&view, exports[i].name, &b);
+        wrong += fa != fb || !fa || a.address != b.address || a.index != b.index || a.ordinal != b.ordinal
+                 || (a.forwarder == 0) != (b.forwarder == 0) || (a.forwarder && strcmp(a.forwarder, b.forwarder));
+        char missing[80];
+        snprintf(missing, sizeof(missing), "%sMissing", exports[i].name);
+        wrong += gpa_coldidx_lookup(cold, image, size, missing, &a);
+    }
+    printf("%u names: image %llu KB (%llu pages), cold index %llu KB, gpa_index %llu KB, %u wrong\n", count,
+           (unsigned long long)size >> 10, (unsigned long long)(size + GPA_COLDIDX_PAGE - 1) / GPA_COLDIDX_PAGE,
+           (unsigned long long)coldsize >> 10, (unsigned long long)indexsize >> 10, wrong);
+
+    // image and indexes as files, so that their pages can really be cold
+    char imagepath[] = "/tmp/gpa_coldidx_image_XXXXXX", idxpath[] = "/tmp/gpa_coldidx_idx_XXXXXX";
+    char hashpath[] = "/tmp/gpa_coldidx_hash_XXXXXX";
+    int imagefd = mkstemp(imagepath), idxfd = mkstemp(idxpath), hashfd = mkstemp(hashpath);
+    wrong += write(imagefd, image, size) != (ssize_t)size || write(idxfd, cold, coldsize) != (ssize_t)coldsize
+             || write(hashfd, hashindex, indexsize) != (ssize_t)indexsize;
+    fsync(imagefd);
+    fsync(idxfd);
+    fsync(hashfd);
+    unlink(imagepath);
+    unlink(idxpath);
+    unlink(hashpath);
+
+    struct {
+        const char *label;
+        gpa_COLDIDX_STRATEGY lookup;
+        int fd;
+        u64 indexsize;
+    } strategies[] = {
+        {"linear scan",   gpa_coldidx_scan,      -1,     0},
+        {"binary search", gpa_coldidx_binary,    -1,     0},
+        {"gpa_index",     gpa_coldidx_hashindex, hashfd, indexsize},
+        {"cold index",    gpa_coldidx_cold,      idxfd,  coldsize},
+    };
+    struct sigaction trap = {0};
+    trap.sa_sigaction = gpa_coldidx_trap;
+    trap.sa_flags     = SA_SIGINFO;
+    sigaction(SIGSEGV, &trap, 0);
+    u8 *copy = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memcpy(copy, image, size);
+    gpa_trapbase = copy;
+    gpa_trapsize = (size + GPA_COLDIDX_PAGE - 1) & ~(u64)(GPA_COLDIDX_PAGE - 1);
+
+    u32 lookups = argc > 2 ? atoi(argv[2]) : 200;
+    printf("per lookup, %u random names:     image pages: traps  resident  faults | index pages resident\n", lookups);
+    for (u32 s = 0; s < sizeof(strategies) / sizeof(*strategies); s++) {
+        u64 trapped = 0, resident = 0, faults = 0, indexresident = 0;
+        for (u32 q = 0; q < lookups; q++) {
+            char *name = exports[gpa_coldidx_random(count)].name;
+            // exact, on the trapping copy; the index is not counted here
+            mprotect(copy, gpa_trapsize, PROT_NONE);
+            gpa_trapped = 0;
+            u64 expect = strategies[s].lookup(copy, size, strategies[s].fd < 0 ? 0 : (s == 2 ? (ptr)hashindex : (ptr)cold), name);
+            trapped += gpa_trapped;
+            mprotect(copy, gpa_trapsize, PROT_READ);
+
+            // the same lookup on cold file mappings
+            u8 *mapped = gpa_coldidx_coldmap(imagefd, size);
+            u8 *index  = strategies[s].fd < 0 ? 0 : gpa_coldidx_coldmap(strategies[s].fd, strategies[s].indexsize);
+            u64 before = gpa_coldidx_faults();
+            u64 found  = strategies[s].lookup(mapped, size, index, name);
+            faults   += gpa_coldidx_faults() - before;
+            resident += gpa_coldidx_resident(mapped, size);
+            if (index) {
+                indexresident += gpa_coldidx_resident(index, strategies[s].indexsize);
+                munmap(index, strategies[s].indexsize);
+            }
+            munmap(mapped, size);
+            wrong += found != expect || !found;
+        }
+        printf("  %-30s %18.2f %9.2f %7.2f | %8.2f\n", strategies[s].label, (double)trapped / lookups,
+               (double)resident / lookups, (double)faults / lookups, (double)indexresident / lookups);
+    }
+
+    // what validation costs, once per process
+    u8 *mapped = gpa_coldidx_coldmap(imagefd, size);
+    u64 before = gpa_coldidx_faults();
+    gpa_MODVIEW coldview;
+    wrong += !gpa_pe_loaded_open(&coldview, mapped, size) || gpa_fingerprint_view(&coldview, 1) != fingerprint;
+    printf("validation: %llu faults, %u pages resident\n", (unsigned long long)(gpa_coldidx_faults() - before),
+           gpa_coldidx_resident(mapped, size));
+    munmap(mapped, size);
+    printf("%u wrong\n", wrong);
+    return wrong != 0;
+}
+#endif // _GPA_COLDIDX_DEBUG
+#endif // _GPA_COLDIDX_C
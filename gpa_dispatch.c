@@ -0,0 +1,351 @@
+/*
+    gpa_dispatch.c
+    declarative dispatch tables, filled in one pass per module.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Code that talks to the OS through function pointers tends to keep a
+    large struct of them, filled by one lookup each. Here the table is
+    declared once as an X-macro of (module, name, type) rows:
+
+        #define MY_API(X)                                   \
+            X(ntdll,    NtClose,      NtClose_t)            \
+            X(kernel32, VirtualAlloc, VirtualAlloc_t)
+
+        GPA_DISPATCH_DEFINE(my_api, MY_API)
+
+    This defines a struct my_api with one typed member per row, and
+    u32 my_api_fill(my_api *table, gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing).
+    The fill sorts the rows by (module, name) once and caches that order.
+    It then merge-joins each module's rows against the module's sorted
+    export name table, galloping ahead, so a module is walked once no
+    matter how many rows name it. Forwarded exports go through kernel32's
+    GetProcAddress, found at most once per fill.
+
+    Every row that did not resolve is set in the missing bitmap: bit i for
+    row i in declaration order, GPA_DISPATCH_WORDS(rows) words. Its member
+    is left 0. That includes rows whose module is not in the modules array.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 <table>_fill(<table> *table, gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing)
+        resolves every row, returns how many resolved. modules maps the module
+        names used in the rows to loaded module handles
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_dispatch_fill(ptr table, gpa_DISPATCH_ENTRY *entries, u32 count,
+                          gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing, u16 *scratch)
+        the same over a hand-made row array (scratch holds count entries)
+*/
+
+#ifndef _GPA_DISPATCH_C
+#define _GPA_DISPATCH_C
+#define _GPA_DISPATCH_DEBUG 0
+#include "gpa_modview.c"
+
+typedef struct _gpa_DISPATCH_ENTRY {
+    char *module;
+    char *name;
+    u32   offset;               // of the pointer in the table
+} gpa_DISPATCH_ENTRY;
+
+typedef struct _gpa_DISPATCH_MODULE {
+    char *name;                 // as spelled in the rows, e.g. "kernel32"
+    ptr   handle;
+} gpa_DISPATCH_MODULE;
+
+#define GPA_DISPATCH_WORDS(rows)                    (((rows) + 63) / 64)
+#define GPA_DISPATCH_MISSING(missing, row)          (((missing)[(row) / 64] >> ((row) % 64)) & 1)
+
+#define GPA_DISPATCH_MEMBER(module, name, type)     type name;
+#define GPA_DISPATCH_ROW(module, name, type)        { #module, #name, __builtin_offsetof(gpa_dispatch_self, name) },
+
+#define GPA_DISPATCH_DEFINE(table, LIST)                                                        \
+    typedef struct _##table {                                                                   \
+        LIST(GPA_DISPATCH_MEMBER)                                                               \
+    } table;                                                                                    \
+                                                                                                \
+    u32 table##_fill(table *t, gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing) {      \
+        typedef table gpa_dispatch_self;                                                        \
+        static gpa_DISPATCH_ENTRY entries[] = { LIST(GPA_DISPATCH_ROW) };                       \
+        static u16 order[sizeof(entries) / sizeof(*entries)];                                   \
+        static u32 ordered;                                                                     \
+        u16 scratch[sizeof(entries) / sizeof(*entries)];                                        \
+        return gpa_dispatch_fillordered(t, entries, sizeof(entries) / sizeof(*entries), modules, \
+                                        nmodules, missing, scratch, order, &ordered);           \
+    }
+
+// the first name slot at or after from that does not sort below name.
+// strides ahead from from, doubling each time, then bisects the last
+// stride. the first stride is the expected gap between wanted names
+inline static u32 gpa_dispatch_gallop(gpa_MODVIEW *view, u32 from, char *name, u32 step) {
+    u32 count = gpa_pe_loaded_count(view);
+    u32 lo = from, hi = from;
+    while (hi < count) {
+        char *candidate = gpa_pe_loaded_name(view, hi);
+        if (candidate && gpa_modview_strcmp(view, name, candidate) <= 0) {
+            break;
+        }
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = hi < count ? hi : count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        char *candidate = gpa_pe_loaded_name(view, mid);
+        if (candidate && gpa_modview_strcmp(view, name, candidate) <= 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// rows by (module, name). insertion sort: tables are written by hand and
+// rarely have more than a few hundred rows, and the order is cached
+inline static void gpa_dispatch_sort(gpa_DISPATCH_ENTRY *entries, u32 count, u16 *order) {
+    for (u32 i = 0; i < count; i++) {
+        u32 j = i;
+        while (j > 0) {
+            gpa_DISPATCH_ENTRY *previous = &entries[order[j - 1]];
+            int cmp = gpa_strcmp(previous->module, entries[i].module);
+            if (cmp < 0 || (cmp == 0 && gpa_strcmp(previous->name, entries[i].name) <= 0)) {
+                break;
+            }
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (u16)i;
+    }
+}
+
+// cache/ordered: where the generated fill keeps the sorted order. 0 is
+// unsorted, 1 being written, 2 ready; the first caller to finish a sort
+// publishes it, the others use their own until then
+inline static u32 gpa_dispatch_fillordered(ptr table, gpa_DISPATCH_ENTRY *entries, u32 count,
+                                           gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing,
+                                           u16 *scratch, u16 *cache, u32 *ordered) {
+    u16 *order = scratch;
+    if (cache && __atomic_load_n(ordered, __ATOMIC_ACQUIRE) == 2) {
+        order = cache;
+    } else {
+        gpa_dispatch_sort(entries, count, scratch);
+        u32 unsorted = 0;
+        if (cache && __atomic_compare_exchange_n(ordered, &unsorted, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            for (u32 i = 0; i < count; i++) {
+                cache[i] = scratch[i];
+            }
+            __atomic_store_n(ordered, 2, __ATOMIC_RELEASE);
+        }
+    }
+    for (u32 i = 0; i < GPA_DISPATCH_WORDS(count); i++) {
+        missing[i] = count - 64 * i >= 64 ? ~0ull : (1ull << (count - 64 * i)) - 1;
+    }
+    for (u32 i = 0; i < count; i++) {
+        *(ptr*)((u8*)table + entries[i].offset) = 0;
+    }
+    u32 resolved = 0;
+    GetProcAddress_t getprocaddress = 0;    // kernel32's, on the first forwarded row
+    for (u32 m = 0; m < nmodules; m++) {
+        // this module's rows are a contiguous, name-sorted run of order
+        u32 first = 0;
+        while (first < count && gpa_strcmp(entries[order[first]].module, modules[m].name) != 0) {
+            first++;
+        }
+        gpa_MODVIEW view;
+        if (first == count || !modules[m].handle || !gpa_pe_loaded_open(&view, modules[m].handle, 0)) {
+            continue;
+        }
+        u32 last = first;
+        while (last < count && gpa_strcmp(entries[order[last]].module, modules[m].name) == 0) {
+            last++;
+        }
+        u32 position = 0;
+        for (u32 r = first; r < last; r++) {
+            gpa_DISPATCH_ENTRY *entry = &entries[order[r]];
+            u32 gap = (gpa_pe_loaded_count(&view) - position) / (last - r + 1);
+            position = gpa_dispatch_gallop(&view, position, entry->name, gap ? gap : 1);
+            gpa_EXPORT exp;
+            if (position >= gpa_pe_loaded_count(&view) || gpa_modview_strcmp(&view, entry->name, gpa_pe_loaded_name(&view, position)) != 0
+                || !gpa_pe_loaded_export(&view, position, &exp)) {
+                continue;
+            }
+            ptr address = (u8*)modules[m].handle + exp.address;
+            if (exp.forwarder) {
+                getprocaddress = getprocaddress ? getprocaddress : gpa_getgetprocaddress(gpa_getkernel32());
+                address = getprocaddress ? getprocaddress(modules[m].handle, entry->name) : 0;
+            }
+            if (address) {
+                *(ptr*)((u8*)table + entry->offset) = address;
+                missing[order[r] / 64] &= ~(1ull << (order[r] % 64));
+                resolved++;
+            }
+        }
+    }
+    return resolved;
+}
+
+u32 gpa_dispatch_fill(ptr table, gpa_DISPATCH_ENTRY *entries, u32 count,
+                      gpa_DISPATCH_MODULE *modules, u32 nmodules, u64 *missing, u16 *scratch) {
+    return gpa_dispatch_fillordered(table, entries, count, modules, nmodules, missing, scratch, 0, 0);
+}
+
+// development code: a table over two synthetic modules, filled against
+// one lookup per row the way gpa_getgetprocaddress does it
+#if _GPA_DISPATCH_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+typedef i32 (*NtStatus_t)(ptr, ...);
+typedef ptr (*Win32_t)(ptr, ...);
+
+#define GPA_DEBUG_API(X)                                                                        \
+    X(ntdll, NtAllocateVirtualMemory, NtStatus_t) X(ntdll, NtFreeVirtualMemory, NtStatus_t)     \
+    X(ntdll, NtProtectVirtualMemory, NtStatus_t) X(ntdll, NtQueryVirtualMemory, NtStatus_t)     \
+    X(ntdll, NtCreateFile, NtStatus_t) X(ntdll, NtOpenFile, NtStatus_t)                         \
+    X(ntdll, NtReadFile, NtStatus_t) X(ntdll, NtWriteFile, NtStatus_t)                          \
+    X(ntdll, NtClose, NtStatus_t) X(ntdll, NtQueryInformationFile, NtStatus_t)                  \
+    X(ntdll, NtSetInformationFile, NtStatus_t) X(ntdll, NtCreateSection, NtStatus_t)            \
+    X(ntdll, NtMapViewOfSection, NtStatus_t) X(ntdll, NtUnmapViewOfSection, NtStatus_t)         \
+    X(ntdll, NtQuerySystemInformation, NtStatus_t) X(ntdll, NtQueryInformationProcess, NtStatus_t) \
+    X(ntdll, NtCreateThreadEx, NtStatus_t) X(ntdll, NtWaitForSingleObject, NtStatus_t)          \
+    X(ntdll, NtDelayExecution, NtStatus_t) X(ntdll, NtTerminateProcess, NtStatus_t)             \
+    X(ntdll, RtlInitUnicodeString, NtStatus_t) X(ntdll, RtlAllocateHeap, NtStatus_t)            \
+    X(ntdll, RtlFreeHeap, NtStatus_t) X(ntdll, RtlGetVersion, NtStatus_t)                       \
+    X(ntdll, LdrLoadDll, NtStatus_t) X(ntdll, LdrGetProcedureAddress, NtStatus_t)               \
+    X(ntdll, NtNotInThisBuild, NtStatus_t)                                                      \
+    X(kernel32, VirtualAlloc, Win32_t) X(kernel32, VirtualFree, Win32_t)                        \
+    X(kernel32, VirtualProtect, Win32_t) X(kernel32, CreateFileA, Win32_t)                      \
+    X(kernel32, CreateFileW, Win32_t) X(kernel32, ReadFile, Win32_t)                            \
+    X(kernel32, WriteFile, Win32_t) X(kernel32, CloseHandle, Win32_t)                           \
+    X(kernel32, GetStdHandle, Win32_t) X(kernel32, GetLastError, Win32_t)                       \
+    X(kernel32, LoadLibraryA, Win32_t) X(kernel32, LoadLibraryW, Win32_t)                       \
+    X(kernel32, FreeLibrary, Win32_t) X(kernel32, GetModuleHandleA, Win32_t)                    \
+    X(kernel32, GetModuleHandleW, Win32_t) X(kernel32, GetProcAddress, Win32_t)                 \
+    X(kernel32, ExitProcess, Win32_t) X(kernel32, Sleep, Win32_t)                               \
+    X(kernel32, HeapAlloc, Win32_t) X(kernel32, HeapFree, Win32_t)                              \
+    X(kernel32, GetProcessHeap, Win32_t) X(kernel32, CreateThread, Win32_t)                     \
+    X(kernel32, WaitForSingleObject, Win32_t) X(kernel32, GetTickCount64, Win32_t)              \
+    X(kernel32, QueryPerformanceCounter, Win32_t) X(kernel32, MultiByteToWideChar, Win32_t)     \
+    X(kernel32, WideCharToMultiByte, Win32_t) X(user32, MessageBoxA, Win32_t)
+
+GPA_DISPATCH_DEFINE(gpa_debug_api, GPA_DEBUG_API)
+
+static double gpa_dispatch_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_dispatch_byname(const void *a, const void *b) {
+    return gpa_strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+// the rows' names plus filler, as a loaded image
+static u8 *gpa_dispatch_module(char *module, u32 count, u32 seed) {
+    static gpa_DISPATCH_ENTRY rows[] = {
+#define GPA_DEBUG_ROW(module, name, type) { #module, #name, 0 },
+        GPA_DEBUG_API(GPA_DEBUG_ROW)
+    };
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    u32 n = 0;
+    for (u32 i = 0; i < sizeof(rows) / sizeof(*rows); i++) {
+        if (strcmp(rows[i].module, module) == 0 && strcmp(rows[i].name, "NtNotInThisBuild") != 0) {
+            exports[n++].name = rows[i].name;
+        }
+    }
+    for (u32 i = n; i < count; i++) {
+        exports[i].name = malloc(48);
+        snprintf(exports[i].name, 48, "%s%05uInternal", rows[(i * seed) % (sizeof(rows) / sizeof(*rows))].name, i);
+    }
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_dispatch_byname);
+    for (u32 i = 0; i < count; i++) {
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity);
+    gpa_synth_pe(image, capacity, exports, count, 0, 0);
+    return image;
+}
+
+// gpa_getgetprocaddress's loop for any name
+static ptr gpa_dispatch_linear(ptr modulehandle, char *name) {
+    gpa_PIMAGE_EXPORT_DIRECTORY exportdirectory = gpa_getexportdir(modulehandle);
+    u32 *names = (u32*)((u8*)modulehandle + exportdirectory->AddressOfNames);
+    u32 *functions = (u32*)((u8*)modulehandle + exportdirectory->AddressOfFunctions);
+    u16 *ordinals = (u16*)((u8*)modulehandle + exportdirectory->AddressOfNameOrdinals);
+    for (u32 i = 0; i < exportdirectory->NumberOfNames; i++) {
+        if (gpa_strcmp((char*)modulehandle + names[i], name) == 0) {
+            return (u8*)modulehandle + functions[ordinals[i]];
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    gpa_DISPATCH_MODULE modules[] = {
+        { "ntdll",    gpa_dispatch_module("ntdll", 2400, 7) },
+        { "kernel32", gpa_dispatch_module("kernel32", 1600, 13) },
+    };
+    static gpa_DISPATCH_ENTRY rows[] = {
+        GPA_DEBUG_API(GPA_DEBUG_ROW)
+    };
+    u32 nrows = sizeof(rows) / sizeof(*rows);
+    gpa_debug_api api;
+    u64 missing[GPA_DISPATCH_WORDS(sizeof(gpa_debug_api) / sizeof(ptr))];
+    u32 resolved = gpa_debug_api_fill(&api, modules, 2, missing);
+    printf("%u of %u rows resolved, missing:", resolved, nrows);
+    for (u32 i = 0; i < nrows; i++) {
+        if (GPA_DISPATCH_MISSING(missing, i)) {
+            printf(" %s!%s", rows[i].module, rows[i].name);
+        }
+    }
+    printf("\n");
+
+    // every resolved member agrees with a plain lookup
+    u32 wrong = 0;
+    for (u32 i = 0; i < nrows; i++) {
+        ptr expected = 0;
+        for (u32 m = 0; m < 2; m++) {
+            if (strcmp(rows[i].module, modules[m].name) == 0) {
+                expected = gpa_dispatch_linear(modules[m].handle, rows[i].name);
+            }
+        }
+        wrong += ((ptr*)&api)[i] != expected || GPA_DISPATCH_MISSING(missing, i) != (expected == 0);
+    }
+    printf("%u wrong, api.VirtualAlloc - kernel32 = %#llx\n", wrong,
+           (unsigned long long)((u8*)api.VirtualAlloc - (u8*)modules[1].handle));
+
+    u32 rounds = 2000;
+    double t0 = gpa_dispatch_now();
+    for (u32 r = 0; r < rounds; r++) {
+        gpa_debug_api_fill(&api, modules, 2, missing);
+    }
+    double t1 = gpa_dispatch_now();
+    u64 sum = 0;
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < nrows; i++) {
+            ptr handle = rows[i].module[0] == 'n' ? modules[0].handle : modules[1].handle;
+            sum += (u64)gpa_dispatch_linear(handle, rows[i].name);
+        }
+    }
+    double t2 = gpa_dispatch_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < nrows; i++) {
+            gpa_MODVIEW view;
+            gpa_EXPORT exp;
+            gpa_pe_loaded_open(&view, rows[i].module[0] == 'n' ? modules[0].handle : modules[1].handle, 0);
+            sum += gpa_pe_loaded_lookup(&view, rows[i].name, &exp) ? exp.address : 0;
+        }
+    }
+    double t3 = gpa_dispatch_now();
+    printf("fill %.1f us, per-row linear lookups %.1f us, per-row binary search %.1f us (%llx)\n",
+           (t1 - t0) * 1e6 / rounds, (t2 - t1) * 1e6 / rounds, (t3 - t2) * 1e6 / rounds, (unsigned long long)sum);
+    return wrong != 0;
+}
+#endif // _GPA_DISPATCH_DEBUG
+#endif // _GPA_DISPATCH_C
@@ -0,0 +1,272 @@
+/*
+    gpa_fingerprint.c
+    cheap identification of a module's export table, for cache validation.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Anything that caches lookup results across runs or processes needs to know
+    whether the module it was built from has changed. The fingerprint combines
+    the export directory header (TimeDateStamp, counts, ordinal base, versions)
+    with a hash of AddressOfFunctions and AddressOfNames. Both arrays hold
+    RVAs, so the loaded and the on-disk layout of a module give the same value.
+    The quick mode reads only the directory header.
+
+    The hash is in the style of xxh3: eight 64-bit lanes take one 64-byte
+    stripe at a time with a 32x32->64 multiply per lane, keyed by a sliding
+    window over a fixed secret and scrambled every 16 stripes so order
+    matters. The SSE2 path and the portable path compute the same value.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_fingerprint(ptr modulehandle) / u64 gpa_fingerprint_quick(ptr modulehandle)
+        full / header-only fingerprint of a loaded module
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_fingerprint_view(gpa_MODVIEW *view, int quick)
+        the same for any PE module view (pe_loaded or pe_file), 0 if it has no exports
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_fphash(ptr data, u64 length, u64 seed)
+        the underlying bulk hash
+*/
+
+#ifndef _GPA_FINGERPRINT_C
+#define _GPA_FINGERPRINT_C
+#define _GPA_FINGERPRINT_DEBUG 0
+#include "gpa_modview.c"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GPA_FPHASH_STRIPE           64
+#define GPA_FPHASH_BLOCK_STRIPES    16
+#define GPA_FPHASH_PRIME32          0x9e3779b1ull
+#define GPA_FPHASH_PRIME64          0x9e3779b185ebca87ull
+
+// splitmix64 output; stripe s is keyed by words s..s+7, the scramble by 16..23
+static const u64 gpa_fphash_secret[24] __attribute__((aligned(16))) = {
+    0xad06b6cf62f59442ull, 0xaa6e44a7df872073ull, 0x3b7eb5641ae954f6ull, 0x824ff7400d464b4full,
+    0x22ff80392f5b18b5ull, 0x496780d1b77f90aeull, 0xf016b239d8d2b5afull, 0x58b08b08192abe49ull,
+    0x94f6d0eab1619920ull, 0x68259fc1cc25f5c0ull, 0x72809037faaf900aull, 0x6f6edd4023d6aab4ull,
+    0xd2fd4c6483fa6fc6ull, 0xd70902ab53b3d38eull, 0xe8fc6ee48da5fb7cull, 0x878008a05723d6aaull,
+    0xad9682928951b2e2ull, 0x4b0b6036eccda124ull, 0xc8799e77eff8f8ceull, 0x59ed8e95ee48b29full,
+    0x337aaf47f7e3935aull, 0xb880c6ae8d31460dull, 0x6d1dbddf7e38616aull, 0xd9faa5b57c1aea1dull,
+};
+
+inline static u64 gpa_fphash_read64(u8 *p) {
+    u64 v;
+    __builtin_memcpy(&v, p, 8);
+    return v;
+}
+
+inline static void gpa_fphash_stripe_scalar(u64 *acc, u8 *data, const u64 *key) {
+    for (int i = 0; i < 8; i++) {
+        u64 v  = gpa_fphash_read64(data + 8 * i);
+        u64 dk = v ^ key[i];
+        acc[i ^ 1] += v;
+        acc[i]     += (dk & 0xffffffff) * (dk >> 32);
+    }
+}
+
+inline static void gpa_fphash_scramble_scalar(u64 *acc) {
+    for (int i = 0; i < 8; i++) {
+        u64 a = acc[i];
+        a ^= a >> 47;
+        a ^= gpa_fphash_secret[16 + i];
+        acc[i] = a * GPA_FPHASH_PRIME32;
+    }
+}
+
+#if defined(__SSE2__)
+inline static void gpa_fphash_stripe_sse2(__m128i *acc, u8 *data, const u64 *key) {
+    for (int i = 0; i < 4; i++) {
+        __m128i v  = _mm_loadu_si128((__m128i*)data + i);
+        __m128i dk = _mm_xor_si128(v, _mm_loadu_si128((__m128i*)key + i));
+        __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+    }
+}
+
+inline static void gpa_fphash_scramble_sse2(__m128i *acc) {
+    __m128i prime = _mm_set1_epi32((u32)GPA_FPHASH_PRIME32);
+    for (int i = 0; i < 4; i++) {
+        __m128i a  = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+        a = _mm_xor_si128(a, _mm_load_si128((__m128i*)(gpa_fphash_secret + 16) + i));
+        __m128i lo = _mm_mul_epu32(a, prime);
+        __m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+}
+#endif
+
+inline static u64 gpa_fphash_fold(u64 a, u64 b) {
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (u64)product ^ (u64)(product >> 64);
+}
+
+inline static u64 gpa_fphash_finish(u64 *acc, u64 length, u64 seed) {
+    u64 h = length * GPA_FPHASH_PRIME64 + seed;
+    for (int i = 0; i < 4; i++) {
+        h += gpa_fphash_fold(acc[2 * i] ^ gpa_fphash_secret[2 * i + 1], acc[2 * i + 1] ^ gpa_fphash_secret[2 * i + 2]);
+    }
+    h ^= h >> 37;
+    h *= 0x165667919e3779f9ull;
+    return h ^ (h >> 32);
+}
+
+// the trailing partial stripe is zero padded; the length in the final mix
+// keeps "abc" and "abc\0" apart
+#define GPA_FPHASH_BODY(stripe, scramble, acc, data, length)                                    \
+    do {                                                                                        \
+        u64 stripes = length / GPA_FPHASH_STRIPE;                                               \
+        u64 s = 0;                                                                              \
+        for (; s < stripes; s++) {                                                              \
+            stripe(acc, data + s * GPA_FPHASH_STRIPE, gpa_fphash_secret + s % GPA_FPHASH_BLOCK_STRIPES); \
+            if (s % GPA_FPHASH_BLOCK_STRIPES == GPA_FPHASH_BLOCK_STRIPES - 1) {                 \
+                scramble(acc);                                                                  \
+            }                                                                                   \
+        }                                                                                       \
+        u64 rest = length % GPA_FPHASH_STRIPE;                                                  \
+        if (rest) {                                                                             \
+            u8 last[GPA_FPHASH_STRIPE] = { 0 };                                                 \
+            __builtin_memcpy(last, data + s * GPA_FPHASH_STRIPE, rest);                         \
+            stripe(acc, last, gpa_fphash_secret + s % GPA_FPHASH_BLOCK_STRIPES);                \
+        }                                                                                       \
+    } while (0)
+
+u64 gpa_fphash_scalar(ptr data, u64 length, u64 seed) {
+    u64 acc[8] = {
+        GPA_FPHASH_PRIME32, GPA_FPHASH_PRIME64, seed, ~seed,
+        GPA_FPHASH_PRIME64 ^ seed, GPA_FPHASH_PRIME32 << 32, seed * GPA_FPHASH_PRIME64, GPA_FPHASH_PRIME32 + seed,
+    };
+    GPA_FPHASH_BODY(gpa_fphash_stripe_scalar, gpa_fphash_scramble_scalar, acc, (u8*)data, length);
+    return gpa_fphash_finish(acc, length, seed);
+}
+
+#if defined(__SSE2__)
+u64 gpa_fphash_sse2(ptr data, u64 length, u64 seed) {
+    u64 init[8] __attribute__((aligned(16))) = {
+        GPA_FPHASH_PRIME32, GPA_FPHASH_PRIME64, seed, ~seed,
+        GPA_FPHASH_PRIME64 ^ seed, GPA_FPHASH_PRIME32 << 32, seed * GPA_FPHASH_PRIME64, GPA_FPHASH_PRIME32 + seed,
+    };
+    __m128i acc[4];
+    for (int i = 0; i < 4; i++) {
+        acc[i] = _mm_load_si128((__m128i*)init + i);
+    }
+    GPA_FPHASH_BODY(gpa_fphash_stripe_sse2, gpa_fphash_scramble_sse2, acc, (u8*)data, length);
+    for (int i = 0; i < 4; i++) {
+        _mm_store_si128((__m128i*)init + i, acc[i]);
+    }
+    return gpa_fphash_finish(init, length, seed);
+}
+#endif
+
+u64 gpa_fphash(ptr data, u64 length, u64 seed) {
+#if defined(__SSE2__)
+    return gpa_fphash_sse2(data, length, seed);
+#else
+    return gpa_fphash_scalar(data, length, seed);
+#endif
+}
+
+u64 gpa_fingerprint_view(gpa_MODVIEW *view, int quick) {
+    gpa_PIMAGE_EXPORT_DIRECTORY dir = view->exportdir;
+    if (!dir) {
+        return 0;
+    }
+    // everything in the header except Characteristics (always 0) and the
+    // array rvas, which the full mode covers through their contents
+    u32 header[6] = {
+        dir->TimeDateStamp, dir->MajorVersion | ((u32)dir->MinorVersion << 16), dir->Name,
+        dir->Base, dir->NumberOfFunctions, dir->NumberOfNames,
+    };
+    u64 h = gpa_fphash(header, sizeof(header), 0);
+    if (quick) {
+        return h;
+    }
+    h = gpa_fphash(view->functions, 4ull * dir->NumberOfFunctions, h);
+    return gpa_fphash(view->names, 4ull * dir->NumberOfNames, h);
+}
+
+u64 gpa_fingerprint(ptr modulehandle) {
+    gpa_MODVIEW view;
+    return gpa_pe_loaded_open(&view, modulehandle, 0) ? gpa_fingerprint_view(&view, 0) : 0;
+}
+
+u64 gpa_fingerprint_quick(ptr modulehandle) {
+    gpa_MODVIEW view;
+    return gpa_pe_loaded_open(&view, modulehandle, 0) ? gpa_fingerprint_view(&view, 1) : 0;
+}
+
+// development code: hash throughput, scalar/SSE2 agreement, and layout stability
+#if _GPA_FINGERPRINT_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_fingerprint_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    u64 length = 64ull << 20;
+    u8 *data = malloc(length + 64);
+    for (u64 i = 0; i < length + 64; i++) {
+        data[i] = (u8)(i * 2654435761u >> 13);
+    }
+    u32 mismatches = 0;
+    for (u64 n = 0; n < 3000; n += 7) {
+        mismatches += gpa_fphash_scalar(data + 1, n, n) != gpa_fphash(data + 1, n, n);
+    }
+    printf("scalar/simd mismatches: %u\n", mismatches);
+    double t0 = gpa_fingerprint_now();
+    u64 h = gpa_fphash_scalar(data, length, 0);
+    double t1 = gpa_fingerprint_now();
+    u64 h2 = gpa_fphash(data, length, 0);
+    double t2 = gpa_fingerprint_now();
+    printf("scalar %.2f GB/s, gpa_fphash %.2f GB/s (%s)\n", length / (t1 - t0) / 1e9,
+           length / (t2 - t1) / 1e9, h == h2 ? "equal" : "DIFFERENT");
+
+    u32 count = argc > 1 ? atoi(argv[1]) : 30000;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, "Nt%08uObject", i);
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 32 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *loaded = malloc(capacity), *file = malloc(capacity);
+    u64 loadedsize = gpa_synth_pe(loaded, capacity, exports, count, 0x5f000000, 0);
+    u64 filesize   = gpa_synth_pe(file, capacity, exports, count, 0x5f000000, 1);
+    gpa_MODVIEW lv, fv;
+    gpa_pe_loaded_open(&lv, loaded, loadedsize);
+    gpa_pe_file_open(&fv, file, filesize);
+    u64 full = gpa_fingerprint_view(&lv, 0), quick = gpa_fingerprint_view(&lv, 1);
+    printf("loaded == file: full %s, quick %s\n", full == gpa_fingerprint_view(&fv, 0) ? "yes" : "NO",
+           quick == gpa_fingerprint_view(&fv, 1) ? "yes" : "NO");
+
+    // move one function: the full fingerprint must notice, the quick one can't
+    exports[count / 2].rva += 16;
+    gpa_synth_pe(loaded, capacity, exports, count, 0x5f000000, 0);
+    printf("rva change: full %s, quick %s\n", full != gpa_fingerprint_view(&lv, 0) ? "changed" : "SAME",
+           quick == gpa_fingerprint_view(&lv, 1) ? "same" : "changed");
+
+    u32 rounds = 1000;
+    t0 = gpa_fingerprint_now();
+    for (u32 r = 0; r < rounds; r++) {
+        h += gpa_fingerprint_view(&lv, 0);
+    }
+    t1 = gpa_fingerprint_now();
+    for (u32 r = 0; r < rounds; r++) {
+        h += gpa_fingerprint_view(&lv, 1);
+    }
+    t2 = gpa_fingerprint_now();
+    printf("%u exports: full %.1f us, quick %.1f ns (%llx)\n", count, (t1 - t0) * 1e6 / rounds,
+           (t2 - t1) * 1e9 / rounds, (unsigned long long)h);
+    return 0;
+}
+#endif // _GPA_FINGERPRINT_DEBUG
+#endif // _GPA_FINGERPRINT_C
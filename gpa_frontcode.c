@@ -0,0 +1,417 @@
+/*
+    gpa_frontcode.c
+    a front-coded dictionary of a module's sorted export names.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Persistent or shared indexes that keep their own copy of every name cost
+    megabytes over many modules, and sorted export names are highly
+    redundant: neighbours share most of their text. Front coding stores each
+    block of 16 names as one full header name followed by 15
+    (shared prefix length, suffix) pairs against the previous name.
+
+    Lookup binary searches the block headers, then scans one block. The scan
+    does not decode names: it tracks how much of the query the previous name
+    matched. Each entry's shared prefix length is enough to tell whether the
+    entry sorts before the query, after it, or needs its suffix compared. So
+    a lookup costs about log2(count / 16) full compares plus one short
+    sequential pass.
+
+    The dictionary is offset-only like gpa_index.c. The rank of a name is its
+    index in AddressOfNames, so a hit leads straight to the export. Only PE
+    backends are covered, because ELF symbol tables are not sorted.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_<backend>_frontcodesize(gpa_MODVIEW *view)
+    gpa_FRONTCODE *gpa_<backend>_frontcode(gpa_MODVIEW *view, ptr buffer, u64 fingerprint)
+        exact bytes needed, and the build into a buffer that large. both return
+        0 if the name table is not strictly sorted
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    i64 gpa_frontcode_find(gpa_FRONTCODE *dict, char *name)
+        the rank of name, or -1
+    u64 gpa_frontcode_get(gpa_FRONTCODE *dict, u32 rank, char *buffer, u64 capacity)
+        decodes the name with that rank, returns its length (0 if out of range
+        or longer than capacity - 1)
+    int gpa_<backend>_frontcodelookup(gpa_MODVIEW *view, gpa_FRONTCODE *dict, char *name,
+                                      gpa_EXPORT *exp)
+        find, then the export itself
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_frontcode_validate(gpa_FRONTCODE *dict, u64 size, u64 fingerprint)
+        checks a dictionary that came from somewhere else
+*/
+
+#ifndef _GPA_FRONTCODE_C
+#define _GPA_FRONTCODE_C
+#define _GPA_FRONTCODE_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_FRONTCODE_MAGIC     0x46415047      // "GPAF"
+#define GPA_FRONTCODE_VERSION   1
+#define GPA_FRONTCODE_BLOCK     16
+
+typedef struct _gpa_FRONTCODE {
+    u32   magic;
+    u32   version;
+    u64   fingerprint;
+    u32   count;
+    u32   numblocks;
+    u32   blocks;               // offset of u32[numblocks], each a block's offset from data
+    u32   data;
+    u32   size;
+} gpa_FRONTCODE;
+
+// lengths are ULEB128, so nearly always one byte
+inline static u8 *gpa_frontcode_putlength(u8 *p, u64 value, u64 *size) {
+    do {
+        u8 byte = value & 0x7f;
+        value >>= 7;
+        if (p) {
+            *p++ = byte | (value ? 0x80 : 0);
+        }
+        (*size)++;
+    } while (value);
+    return p;
+}
+
+inline static u64 gpa_frontcode_length(u8 **p, u8 *end) {
+    u64 value = 0;
+    for (u32 shift = 0; *p < end && shift < 64; shift += 7) {
+        u8 byte = *(*p)++;
+        value |= (u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    *p = end;
+    return 0;
+}
+
+typedef char *(*gpa_FRONTCODE_NAME)(gpa_MODVIEW *view, u32 i);
+
+// one pass that either measures (dict == 0) or writes. returns the size
+inline static u64 gpa_frontcode_encode(gpa_MODVIEW *view, gpa_FRONTCODE_NAME getname, u32 count,
+                                       gpa_FRONTCODE *dict, u64 fingerprint) {
+    u32 numblocks = (count + GPA_FRONTCODE_BLOCK - 1) / GPA_FRONTCODE_BLOCK;
+    u64 data = sizeof(gpa_FRONTCODE) + 4ull * numblocks;
+    u64 size = 0;
+    u8 *out = dict ? (u8*)dict + data : 0;
+    u32 *blocks = dict ? (u32*)((u8*)dict + sizeof(gpa_FRONTCODE)) : 0;
+    char *previous = 0;
+    u64 previouslength = 0;
+    for (u32 i = 0; i < count; i++) {
+        char *name = getname(view, i);
+        if (!name) {
+            return 0;
+        }
+        u64 remaining = gpa_modview_remaining(view, name), length = 0;
+        while (length < remaining && name[length]) {
+            length++;
+        }
+        if (length == remaining || (previous && gpa_strcmp(previous, name) >= 0)) {
+            return 0;           // unterminated, or not strictly sorted
+        }
+        u64 shared = 0;
+        if (i % GPA_FRONTCODE_BLOCK == 0) {
+            if (blocks) {
+                blocks[i / GPA_FRONTCODE_BLOCK] = (u32)size;
+            }
+        } else {
+            while (shared < previouslength && shared < length && previous[shared] == name[shared]) {
+                shared++;
+            }
+            out = gpa_frontcode_putlength(out, shared, &size);
+            out = gpa_frontcode_putlength(out, length - shared, &size);
+        }
+        // headers keep their terminator so the block search can gpa_strcmp them
+        u64 bytes = length - shared + (i % GPA_FRONTCODE_BLOCK == 0);
+        for (u64 j = 0; out && j < bytes; j++) {
+            *out++ = name[shared + j];
+        }
+        size += bytes;
+        previous = name;
+        previouslength = length;
+    }
+    size += data;
+    if (size > 0xffffffffull) {
+        return 0;
+    }
+    if (dict) {
+        dict->magic       = GPA_FRONTCODE_MAGIC;
+        dict->version     = GPA_FRONTCODE_VERSION;
+        dict->fingerprint = fingerprint;
+        dict->count       = count;
+        dict->numblocks   = numblocks;
+        dict->blocks      = sizeof(gpa_FRONTCODE);
+        dict->data        = (u32)data;
+        dict->size        = (u32)size;
+    }
+    return size;
+}
+
+int gpa_frontcode_validate(gpa_FRONTCODE *dict, u64 size, u64 fingerprint) {
+    if (size < sizeof(gpa_FRONTCODE) || dict->magic != GPA_FRONTCODE_MAGIC || dict->version != GPA_FRONTCODE_VERSION
+        || dict->fingerprint != fingerprint || dict->size > size) {
+        return 0;
+    }
+    if (dict->numblocks != (dict->count + GPA_FRONTCODE_BLOCK - 1) / GPA_FRONTCODE_BLOCK
+        || dict->blocks < sizeof(gpa_FRONTCODE) || (u64)dict->blocks + 4ull * dict->numblocks > dict->data
+        || dict->data > dict->size) {
+        return 0;
+    }
+    // every header must be terminated inside the dictionary
+    u32 *blocks = (u32*)((u8*)dict + dict->blocks);
+    for (u32 b = 0; b < dict->numblocks; b++) {
+        u8 *p = (u8*)dict + dict->data + blocks[b], *end = (u8*)dict + dict->size;
+        if (blocks[b] >= dict->size - dict->data) {
+            return 0;
+        }
+        while (p < end && *p) {
+            p++;
+        }
+        if (p == end) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+inline static char *gpa_frontcode_header(gpa_FRONTCODE *dict, u32 block) {
+    u32 *blocks = (u32*)((u8*)dict + dict->blocks);
+    return (char*)dict + dict->data + blocks[block];
+}
+
+i64 gpa_frontcode_find(gpa_FRONTCODE *dict, char *name) {
+    if (dict->count == 0) {
+        return -1;
+    }
+    // the last block whose header is not above name
+    u32 lo = 0, hi = dict->numblocks;
+    while (hi - lo > 1) {
+        u32 mid = (lo + hi) / 2;
+        if (gpa_strcmp(gpa_frontcode_header(dict, mid), name) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    u8 *p = (u8*)gpa_frontcode_header(dict, lo), *end = (u8*)dict + dict->size;
+    u8 *q = (u8*)name;
+    u64 matched = 0;
+    while (p[matched] && p[matched] == q[matched]) {
+        matched++;
+    }
+    if (p[matched] == q[matched]) {
+        return (i64)lo * GPA_FRONTCODE_BLOCK;
+    }
+    if (p[matched] > q[matched]) {
+        return -1;              // only possible in block 0
+    }
+    p += matched;
+    while (*p++) {
+    }
+    // invariant: the previous name sorts below name and shares matched bytes with it
+    u32 last = lo * GPA_FRONTCODE_BLOCK + GPA_FRONTCODE_BLOCK;
+    last = last < dict->count ? last : dict->count;
+    for (u32 rank = lo * GPA_FRONTCODE_BLOCK + 1; rank < last; rank++) {
+        u64 shared = gpa_frontcode_length(&p, end);
+        u64 suffix = gpa_frontcode_length(&p, end);
+        if (suffix > (u64)(end - p)) {
+            return -1;
+        }
+        if (shared > matched) {
+            // agrees with the previous name where that one was below name
+            p += suffix;
+            continue;
+        }
+        if (shared < matched) {
+            return -1;          // differs from name where the previous one agreed: above it
+        }
+        u64 j = 0;
+        while (j < suffix && p[j] == q[matched + j]) {
+            j++;
+        }
+        if (j == suffix) {
+            if (q[matched + j] == 0) {
+                return rank;
+            }
+            // a proper prefix of name sorts below it
+        } else if (q[matched + j] == 0 || p[j] > q[matched + j]) {
+            return -1;
+        }
+        matched += j;
+        p += suffix;
+    }
+    return -1;
+}
+
+u64 gpa_frontcode_get(gpa_FRONTCODE *dict, u32 rank, char *buffer, u64 capacity) {
+    if (rank >= dict->count || capacity == 0) {
+        return 0;
+    }
+    u8 *p = (u8*)gpa_frontcode_header(dict, rank / GPA_FRONTCODE_BLOCK), *end = (u8*)dict + dict->size;
+    u64 length = 0;
+    while (*p) {
+        if (length + 1 >= capacity) {
+            return 0;
+        }
+        buffer[length++] = *p++;
+    }
+    p++;
+    for (u32 i = 0; i < rank % GPA_FRONTCODE_BLOCK; i++) {
+        u64 shared = gpa_frontcode_length(&p, end);
+        u64 suffix = gpa_frontcode_length(&p, end);
+        if (shared > length || suffix > (u64)(end - p) || shared + suffix + 1 > capacity) {
+            return 0;
+        }
+        for (u64 j = 0; j < suffix; j++) {
+            buffer[shared + j] = p[j];
+        }
+        length = shared + suffix;
+        p += suffix;
+    }
+    buffer[length] = 0;
+    return length;
+}
+
+#define GPA_FRONTCODE_DEFINE(backend)                                                           \
+    u64 gpa_##backend##_frontcodesize(gpa_MODVIEW *view) {                                      \
+        return gpa_frontcode_encode(view, gpa_##backend##_name, gpa_##backend##_count(view), 0, 0); \
+    }                                                                                           \
+                                                                                                \
+    gpa_FRONTCODE *gpa_##backend##_frontcode(gpa_MODVIEW *view, ptr buffer, u64 fingerprint) {  \
+        u64 size = gpa_frontcode_encode(view, gpa_##backend##_name, gpa_##backend##_count(view), \
+                                        buffer, fingerprint);                                   \
+        return size ? buffer : 0;                                                               \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_frontcodelookup(gpa_MODVIEW *view, gpa_FRONTCODE *dict, char *name, gpa_EXPORT *exp) { \
+        i64 rank = gpa_frontcode_find(dict, name);                                              \
+        return rank >= 0 && rank < gpa_##backend##_count(view) && gpa_##backend##_export(view, (u32)rank, exp); \
+    }
+
+GPA_FRONTCODE_DEFINE(pe_loaded)
+GPA_FRONTCODE_DEFINE(pe_file)
+
+// development code: compression and lookup latency against the raw name
+// table, on names shaped like real Win32 exports
+#if _GPA_FRONTCODE_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_frontcode_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_frontcode_byname(const void *a, const void *b) {
+    return gpa_strcmp(*(char**)a, *(char**)b);
+}
+
+// the rank find should give: the name's position, or -1
+static i64 gpa_frontcode_expected(char **names, u32 count, char *name) {
+    char **hit = bsearch(&name, names, count, sizeof(char*), gpa_frontcode_byname);
+    return hit ? hit - names : -1;
+}
+
+int main(int argc, char *argv[]) {
+    char *heads[] = { "Nt", "Zw", "Rtl", "Ldr", "Etw", "Create", "Get", "Set", "Query", "Open", "Close",
+                      "Enum", "Reg", "Crypt", "Wsa", "Virtual", "Heap", "Local", "Global", "Find" };
+    char *bodies[] = { "File", "Process", "Thread", "Key", "Value", "Event", "Mutex", "Section", "Memory",
+                       "Token", "Object", "Module", "Window", "Path", "String", "Unicode", "Time", "Info",
+                       "Information", "Handle", "Pipe", "Port", "Timer", "Semaphore" };
+    char *tails[] = { "", "A", "W", "Ex", "ExA", "ExW", "2", "Internal" };
+    u32 nh = sizeof(heads) / sizeof(*heads), nb = sizeof(bodies) / sizeof(*bodies), nt = sizeof(tails) / sizeof(*tails);
+    char **names = malloc(sizeof(char*) * nh * nb * nb * nt);
+    u32 count = 0;
+    for (u32 h = 0; h < nh; h++) {
+        for (u32 b1 = 0; b1 < nb; b1++) {
+            for (u32 b2 = 0; b2 < nb; b2++) {
+                for (u32 t = 0; t < nt; t++) {
+                    if (((h * 131 + b1 * 31 + b2 * 7 + t) * 2654435761u >> 16) % 4 == 0) {
+                        char *name = malloc(64);
+                        snprintf(name, 64, "%s%s%s%s", heads[h], bodies[b1], b1 == b2 ? "" : bodies[b2], tails[t]);
+                        names[count++] = name;
+                    }
+                }
+            }
+        }
+    }
+    qsort(names, count, sizeof(char*), gpa_frontcode_byname);
+    u32 unique = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0) {
+            names[unique++] = names[i];
+        }
+    }
+    count = unique < 65535 ? unique : 65535;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    u64 text = 0;
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = names[i];
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+        text += strlen(names[i]) + 1;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity);
+    gpa_MODVIEW view;
+    gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+
+    u64 size = gpa_pe_loaded_frontcodesize(&view);
+    gpa_FRONTCODE *dict = gpa_pe_loaded_frontcode(&view, malloc(size), 0x1234);
+    // raw: what gpa_getexportdir points at, the name text plus AddressOfNames
+    u64 raw = text + 4ull * count;
+    printf("%u names: raw %llu bytes, front coded %llu bytes (%.2fx), valid %d\n", count,
+           (unsigned long long)raw, (unsigned long long)size, (double)raw / size,
+           dict && gpa_frontcode_validate(dict, size, 0x1234));
+
+    u32 wrong = 0;
+    char decoded[256];
+    gpa_EXPORT exp;
+    for (u32 i = 0; i < count; i++) {
+        wrong += gpa_frontcode_find(dict, names[i]) != i;
+        wrong += gpa_frontcode_get(dict, i, decoded, sizeof(decoded)) != strlen(names[i]) || strcmp(decoded, names[i]);
+        wrong += !gpa_pe_loaded_frontcodelookup(&view, dict, names[i], &exp) || exp.address != exports[i].rva;
+        // near misses on both sides of every name
+        char probe[80];
+        snprintf(probe, sizeof(probe), "%s_", names[i]);
+        wrong += gpa_frontcode_find(dict, probe) != gpa_frontcode_expected(names, count, probe);
+        strcpy(probe, names[i]);
+        probe[strlen(probe) - 1] = 0;
+        wrong += gpa_frontcode_find(dict, probe) != gpa_frontcode_expected(names, count, probe);
+    }
+    wrong += gpa_frontcode_find(dict, "") >= 0 || gpa_frontcode_find(dict, "\x7f") >= 0 || gpa_frontcode_find(dict, "A") >= 0;
+    printf("round trip: %u wrong\n", wrong);
+
+    u32 *order = malloc(sizeof(u32) * count);
+    for (u32 i = 0; i < count; i++) {
+        order[i] = (u32)((i * 2654435761ull) % count);
+    }
+    u32 rounds = 2000000 / count + 1;
+    u64 sum = 0;
+    double t0 = gpa_frontcode_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < count; i++) {
+            sum += gpa_frontcode_find(dict, names[order[i]]);
+        }
+    }
+    double t1 = gpa_frontcode_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < count; i++) {
+            gpa_pe_loaded_lookup(&view, names[order[i]], &exp);
+            sum += exp.index;
+        }
+    }
+    double t2 = gpa_frontcode_now();
+    u64 lookups = (u64)rounds * count;
+    printf("front coded %.1f ns, binary search over raw names %.1f ns per lookup (%llx)\n",
+           (t1 - t0) * 1e9 / lookups, (t2 - t1) * 1e9 / lookups, (unsigned long long)sum);
+    return wrong != 0;
+}
+#endif // _GPA_FRONTCODE_DEBUG
+#endif // _GPA_FRONTCODE_C
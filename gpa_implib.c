@@ -0,0 +1,464 @@
+/*
+    gpa_implib.c
+    symbol lookup in COFF import libraries (.lib archives) through the
+    archive's second linker member.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Answers "which DLL provides symbol X" without parsing every archive member.
+    The second linker member holds a sorted symbol table with member offsets, so
+    a lookup is a binary search over names that point straight into the mapped
+    archive; nothing is copied. The only allocation is one array of name offsets,
+    needed because the table stores the names back to back.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_implib_open(gpa_IMPLIB *lib, char *path)
+        maps an archive read-only and indexes it. returns 1 on success
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_implib_attach(gpa_IMPLIB *lib, ptr data, u64 size)
+        indexes an archive that is already in memory. returns 1 on success
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_implib_close(gpa_IMPLIB *lib)
+        releases the index (and the mapping, if gpa_implib_open made it)
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_implib_find(gpa_IMPLIB *lib, char *name, gpa_IMPLIB_SYMBOL *symbol)
+        binary searches for a symbol and describes the member providing it
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    char *gpa_implib_finddll(gpa_IMPLIB *lib, char *name, u32 *length)
+        returns the dll name providing a symbol (not NUL-terminated), or 0
+*/
+
+#ifndef _GPA_IMPLIB_C
+#define _GPA_IMPLIB_C
+#define _GPA_IMPLIB_DEBUG 0
+#include "gpa_linux.c"
+
+#define GPA_ARCHIVE_SIGNATURE       "!<arch>\n"
+#define GPA_ARCHIVE_HEADER_SIZE     60
+#define GPA_IMPORT_OBJECT_SIZE      20
+#define GPA_IMPORT_LONG_FORMAT      0xff
+
+// https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#archive-library-file-format
+// every member starts with this header. all fields are space-padded ascii.
+#pragma pack(push, 1)
+typedef struct _gpa_ARCHIVE_MEMBER_HEADER {
+    char  Name[16];
+    char  Date[12];
+    char  UserID[6];
+    char  GroupID[6];
+    char  Mode[8];
+    char  Size[10];
+    char  EndHeader[2];
+} gpa_ARCHIVE_MEMBER_HEADER, *gpa_PARCHIVE_MEMBER_HEADER;
+
+// short import members replace a whole object file with this header,
+// followed by the symbol name and the dll name
+typedef struct _gpa_IMPORT_OBJECT_HEADER {
+    u16   Sig1;                 // 0
+    u16   Sig2;                 // 0xffff
+    u16   Version;
+    u16   Machine;
+    u32   TimeDateStamp;
+    u32   SizeOfData;
+    u16   OrdinalOrHint;
+    u16   TypeInfo;             // type:2, nametype:3, reserved:11
+} gpa_IMPORT_OBJECT_HEADER, *gpa_PIMPORT_OBJECT_HEADER;
+#pragma pack(pop)
+
+typedef struct _gpa_IMPLIB {
+    u8   *base;
+    u64   size;
+    u32   nummembers;
+    u32  *memberoffsets;        // second linker member, little-endian
+    u32   numsymbols;
+    u16  *indices;              // 1-based into memberoffsets, one per symbol
+    char *strings;              // sorted, NUL-terminated, back to back
+    u32  *nameoffsets;          // built by us: offset of each name in strings
+    char *longnames;            // the "//" member, if present
+    u64   longnamessize;
+    u8    mapped;
+} gpa_IMPLIB;
+
+typedef struct _gpa_IMPLIB_SYMBOL {
+    char *name;                 // inside the archive
+    char *dll;                  // inside the archive, not NUL-terminated
+    u32   dlllength;
+    u32   memberoffset;
+    u16   ordinalorhint;
+    u8    type;                 // code/data/const, or GPA_IMPORT_LONG_FORMAT
+    u8    nametype;
+} gpa_IMPLIB_SYMBOL;
+
+inline static u32 gpa_implib_read32le(u8 *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+// member sizes are decimal ascii, space-padded
+inline static u64 gpa_implib_membersize(gpa_PARCHIVE_MEMBER_HEADER header) {
+    u64 size = 0;
+    for (u64 i = 0; i < sizeof(header->Size) && header->Size[i] >= '0' && header->Size[i] <= '9'; i++) {
+        size = size * 10 + (header->Size[i] - '0');
+    }
+    return size;
+}
+
+// returns the member header at offset, or 0 if it (or its data) is out of bounds
+inline static gpa_PARCHIVE_MEMBER_HEADER gpa_implib_member(gpa_IMPLIB *lib, u64 offset, u64 *datasize) {
+    if (offset + GPA_ARCHIVE_HEADER_SIZE > lib->size) {
+        return 0;
+    }
+    gpa_PARCHIVE_MEMBER_HEADER header = (gpa_PARCHIVE_MEMBER_HEADER)(lib->base + offset);
+    if (header->EndHeader[0] != '`' || header->EndHeader[1] != '\n') {
+        return 0;
+    }
+    *datasize = gpa_implib_membersize(header);
+    if (*datasize > lib->size - offset - GPA_ARCHIVE_HEADER_SIZE) {
+        return 0;
+    }
+    return header;
+}
+
+inline static u64 gpa_implib_nextmember(u64 offset, u64 datasize) {
+    // members are aligned to even offsets
+    return (offset + GPA_ARCHIVE_HEADER_SIZE + datasize + 1) & ~(u64)1;
+}
+
+void gpa_implib_close(gpa_IMPLIB *lib) {
+    if (lib->nameoffsets) {
+        gpa_freepages(lib->nameoffsets, (u64)lib->numsymbols * sizeof(u32));
+    }
+    if (lib->mapped) {
+        gpa_unmapfile(lib->base, lib->size);
+    }
+    lib->nameoffsets = 0;
+    lib->base = 0;
+}
+
+int gpa_implib_attach(gpa_IMPLIB *lib, ptr data, u64 size) {
+    u8 *signature = (u8*)GPA_ARCHIVE_SIGNATURE;
+    u64 datasize;
+    lib->base = data;
+    lib->size = size;
+    lib->mapped = 0;
+    lib->nameoffsets = 0;
+    lib->longnames = 0;
+    lib->longnamessize = 0;
+    if (size < 8) {
+        return 0;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (lib->base[i] != signature[i]) {
+            return 0;
+        }
+    }
+
+    // the first linker member is big-endian and unsorted, we only skip it
+    u64 offset = 8;
+    gpa_PARCHIVE_MEMBER_HEADER header = gpa_implib_member(lib, offset, &datasize);
+    if (!header || header->Name[0] != '/' || header->Name[1] != ' ') {
+        return 0;
+    }
+    offset = gpa_implib_nextmember(offset, datasize);
+    header = gpa_implib_member(lib, offset, &datasize);
+    if (!header || header->Name[0] != '/' || header->Name[1] != ' ' || datasize < 8) {
+        return 0;   // no second linker member (e.g. a GNU archive)
+    }
+
+    // second linker member: u32 m, u32 offsets[m], u32 n, u16 indices[n], strings
+    u8 *member = (u8*)header + GPA_ARCHIVE_HEADER_SIZE;
+    u8 *end    = member + datasize;
+    lib->nummembers    = gpa_implib_read32le(member);
+    lib->memberoffsets = (u32*)(member + 4);
+    if ((u64)lib->nummembers * 4 + 8 > datasize) {
+        return 0;
+    }
+    u8 *p = member + 4 + (u64)lib->nummembers * 4;
+    lib->numsymbols = gpa_implib_read32le(p);
+    lib->indices    = (u16*)(p + 4);
+    if ((u64)lib->numsymbols * 2 > (u64)(end - p - 4)) {
+        return 0;
+    }
+    lib->strings = (char*)(p + 4 + (u64)lib->numsymbols * 2);
+
+    // optional longnames member right after it
+    u64 next = gpa_implib_nextmember(offset, datasize);
+    gpa_PARCHIVE_MEMBER_HEADER longnames = gpa_implib_member(lib, next, &datasize);
+    if (longnames && longnames->Name[0] == '/' && longnames->Name[1] == '/') {
+        lib->longnames     = (char*)longnames + GPA_ARCHIVE_HEADER_SIZE;
+        lib->longnamessize = datasize;
+    }
+
+    // one pass over the string table to make it randomly accessible. this also
+    // proves every name is terminated inside the member, so the binary search
+    // can use gpa_strcmp without bounds checks.
+    if (lib->numsymbols) {
+        lib->nameoffsets = gpa_allocpages((u64)lib->numsymbols * sizeof(u32));
+        if (!lib->nameoffsets) {
+            return 0;
+        }
+    }
+    char *s = lib->strings;
+    for (u32 i = 0; i < lib->numsymbols; i++) {
+        lib->nameoffsets[i] = s - lib->strings;
+        while (s < (char*)end && *s) {
+            s++;
+        }
+        if (s >= (char*)end) {
+            gpa_implib_close(lib);
+            return 0;
+        }
+        s++;
+    }
+    return 1;
+}
+
+int gpa_implib_open(gpa_IMPLIB *lib, char *path) {
+    u64 size = 0;
+    ptr base = gpa_mapfile(path, &size);
+    if (!base) {
+        return 0;
+    }
+    if (!gpa_implib_attach(lib, base, size)) {
+        gpa_unmapfile(base, size);
+        return 0;
+    }
+    lib->mapped = 1;
+    return 1;
+}
+
+// member names are "NAME/" or "/offset" into the longnames member
+inline static char *gpa_implib_membername(gpa_IMPLIB *lib, gpa_PARCHIVE_MEMBER_HEADER header, u32 *length) {
+    char *name = header->Name;
+    u64 limit  = sizeof(header->Name);
+    if (name[0] == '/' && name[1] >= '0' && name[1] <= '9') {
+        u64 offset = 0;
+        for (u64 i = 1; i < sizeof(header->Name) && name[i] >= '0' && name[i] <= '9'; i++) {
+            offset = offset * 10 + (name[i] - '0');
+        }
+        if (!lib->longnames || offset >= lib->longnamessize) {
+            return 0;
+        }
+        name  = lib->longnames + offset;
+        limit = lib->longnamessize - offset;
+    }
+    u32 n = 0;
+    while (n < limit && name[n] != '/' && name[n] != '\0' && name[n] != '\n') {
+        n++;
+    }
+    *length = n;
+    return name;
+}
+
+// fills in everything we know about symbol number i
+int gpa_implib_symbol(gpa_IMPLIB *lib, u32 i, gpa_IMPLIB_SYMBOL *symbol) {
+    u64 datasize;
+    if (i >= lib->numsymbols) {
+        return 0;
+    }
+    u16 index = lib->indices[i];
+    if (index == 0 || index > lib->nummembers) {
+        return 0;
+    }
+    symbol->name          = lib->strings + lib->nameoffsets[i];
+    symbol->memberoffset  = gpa_implib_read32le((u8*)&lib->memberoffsets[index - 1]);
+    symbol->dll           = 0;
+    symbol->dlllength     = 0;
+    symbol->ordinalorhint = 0;
+    symbol->type          = GPA_IMPORT_LONG_FORMAT;
+    symbol->nametype      = 0;
+
+    gpa_PARCHIVE_MEMBER_HEADER header = gpa_implib_member(lib, symbol->memberoffset, &datasize);
+    if (!header) {
+        return 0;
+    }
+    gpa_PIMPORT_OBJECT_HEADER import = (gpa_PIMPORT_OBJECT_HEADER)((u8*)header + GPA_ARCHIVE_HEADER_SIZE);
+    if (datasize >= GPA_IMPORT_OBJECT_SIZE && import->Sig1 == 0 && import->Sig2 == 0xffff) {
+        // short import: symbol name\0 dll name\0
+        char *data = (char*)import + GPA_IMPORT_OBJECT_SIZE;
+        u64 avail  = datasize - GPA_IMPORT_OBJECT_SIZE;
+        if (import->SizeOfData < avail) {
+            avail = import->SizeOfData;
+        }
+        u64 n = 0;
+        while (n < avail && data[n]) {
+            n++;
+        }
+        if (n + 1 < avail) {
+            symbol->dll = data + n + 1;
+            avail -= n + 1;
+            while (symbol->dlllength < avail && symbol->dll[symbol->dlllength]) {
+                symbol->dlllength++;
+            }
+        }
+        symbol->ordinalorhint = import->OrdinalOrHint;
+        symbol->type          = import->TypeInfo & 3;
+        symbol->nametype      = (import->TypeInfo >> 2) & 7;
+    }
+    if (!symbol->dll) {
+        // long-format members (import descriptors, thunks) are named after the dll
+        symbol->dll = gpa_implib_membername(lib, header, &symbol->dlllength);
+    }
+    return 1;
+}
+
+int gpa_implib_find(gpa_IMPLIB *lib, char *name, gpa_IMPLIB_SYMBOL *symbol) {
+    u32 lo = 0;
+    u32 hi = lib->numsymbols;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        int cmp = gpa_strcmp(name, lib->strings + lib->nameoffsets[mid]);
+        if (cmp == 0) {
+            return gpa_implib_symbol(lib, mid, symbol);
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return 0;
+}
+
+char *gpa_implib_finddll(gpa_IMPLIB *lib, char *name, u32 *length) {
+    gpa_IMPLIB_SYMBOL symbol;
+    if (!gpa_implib_find(lib, name, &symbol)) {
+        return 0;
+    }
+    *length = symbol.dlllength;
+    return symbol.dll;
+}
+
+// development code: builds a synthetic import library in memory and times
+// the binary search against a linear walk of the string table
+#if _GPA_IMPLIB_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double gpa_implib_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u8 *gpa_implib_putheader(u8 *p, char *name, u64 size) {
+    char buf[GPA_ARCHIVE_HEADER_SIZE + 1];
+    snprintf(buf, sizeof(buf), "%-16s%-12s%-6s%-6s%-8s%-10llu`\n", name, "0", "", "", "644", (unsigned long long)size);
+    memcpy(p, buf, GPA_ARCHIVE_HEADER_SIZE);
+    return p + GPA_ARCHIVE_HEADER_SIZE;
+}
+
+int main(int argc, char *argv[]) {
+    u32 numnames = argc > 1 ? (u32)strtoul(argv[1], 0, 10) : 200000;
+    u32 numdlls  = 64;
+    // the second linker member's u16 indices reach 65535 members, so past that
+    // each member provides several consecutive symbols, as X and __imp_X share one
+    u32 permember  = numnames > 65535 ? (numnames + 65534) / 65535 : 1;
+    u32 nummembers = (numnames + permember - 1) / permember;
+    u8 *archive  = calloc(1, (u64)numnames * 160 + 4096);
+    u32 *offsets = calloc(nummembers ? nummembers : 1, sizeof(u32));
+    char name[64], dll[32];
+
+    // signature, an empty first linker member, then the second one
+    u8 *p = archive;
+    memcpy(p, GPA_ARCHIVE_SIGNATURE, 8);
+    p += 8;
+    p = gpa_implib_putheader(p, "/", 4);
+    memset(p, 0, 4);
+    p += 4;
+    u64 stringsize = 0;
+    for (u32 i = 0; i < numnames; i++) {
+        stringsize += snprintf(name, sizeof(name), "Function%07u", i) + 1;
+    }
+    u64 linkersize = 4 + 4ull * nummembers + 4 + 2ull * numnames + stringsize;
+    p = gpa_implib_putheader(p, "/", linkersize);
+    u8 *linker = p;
+    p += (linkersize + 1) & ~1ull;
+
+    // one short import member per permember symbols, named after the first one
+    for (u32 i = 0; i < nummembers; i++) {
+        int n = snprintf(name, sizeof(name), "Function%07u", i * permember) + 1;
+        int d = snprintf(dll, sizeof(dll), "dll%03u.dll", i % numdlls) + 1;
+        offsets[i] = p - archive;
+        p = gpa_implib_putheader(p, "dll/", GPA_IMPORT_OBJECT_SIZE + n + d);
+        gpa_PIMPORT_OBJECT_HEADER import = (gpa_PIMPORT_OBJECT_HEADER)p;
+        memset(import, 0, GPA_IMPORT_OBJECT_SIZE);
+        import->Sig2 = 0xffff;
+        import->Machine = 0x8664;
+        import->SizeOfData = n + d;
+        import->OrdinalOrHint = i & 0xffff;
+        p += GPA_IMPORT_OBJECT_SIZE;
+        memcpy(p, name, n);
+        memcpy(p + n, dll, d);
+        p += (n + d + 1) & ~1;
+    }
+    u64 size = p - archive;
+
+    // sorted symbol table; our names sort the same way they were generated
+    u8 *q = linker;
+    memcpy(q, &nummembers, 4);
+    memcpy(q + 4, offsets, 4ull * nummembers);
+    q += 4 + 4ull * nummembers;
+    memcpy(q, &numnames, 4);
+    q += 4;
+    for (u32 i = 0; i < numnames; i++) {
+        u16 index = (u16)(i / permember + 1);
+        memcpy(q + 2ull * i, &index, 2);
+    }
+    q += 2ull * numnames;
+    for (u32 i = 0; i < numnames; i++) {
+        q += snprintf((char*)q, 64, "Function%07u", i) + 1;
+    }
+
+    gpa_IMPLIB lib;
+    double t0 = gpa_implib_now();
+    if (!gpa_implib_attach(&lib, archive, size)) {
+        printf("attach failed\n");
+        return 1;
+    }
+    double t1 = gpa_implib_now();
+    printf("archive: %llu bytes, %u symbols in %u members, index built in %.3f ms\n",
+           (unsigned long long)size, lib.numsymbols, lib.nummembers, (t1 - t0) * 1e3);
+
+    // every symbol, in a scattered order; each must land on its own member's dll
+    u32 queries = numnames;
+    char (*names)[24] = malloc(24ull * (queries ? queries : 1));
+    for (u32 i = 0; i < queries; i++) {
+        snprintf(names[i], sizeof(names[i]), "Function%07u", (u32)((i * 7919ull) % queries));
+    }
+    u32 found = 0;
+    t0 = gpa_implib_now();
+    for (u32 i = 0; i < queries; i++) {
+        gpa_IMPLIB_SYMBOL symbol;
+        if (gpa_implib_find(&lib, names[i], &symbol) && symbol.dlllength == 10
+            && (u32)strtoul(symbol.dll + 3, 0, 10) == (u32)((i * 7919ull) % queries) / permember % numdlls) {
+            found++;
+        }
+    }
+    t1 = gpa_implib_now();
+    printf("binary search: %u/%u found, %.1f ns/lookup\n", found, queries, (t1 - t0) * 1e9 / queries);
+
+    u32 linear = queries < 2000 ? queries : 2000;
+    found = 0;
+    t0 = gpa_implib_now();
+    for (u32 i = 0; i < linear; i++) {
+        char *s = lib.strings;
+        for (u32 j = 0; j < lib.numsymbols; j++) {
+            if (gpa_strcmp(names[i], s) == 0) {
+                found++;
+                break;
+            }
+            s += gpa_strlen(s) + 1;
+        }
+    }
+    t1 = gpa_implib_now();
+    printf("linear scan:   %u/%u found, %.1f ns/lookup\n", found, linear, (t1 - t0) * 1e9 / linear);
+    gpa_implib_close(&lib);
+    return 0;
+}
+#endif // _GPA_IMPLIB_DEBUG
+#endif // _GPA_IMPLIB_C
@@ -0,0 +1,165 @@
+/*
+    gpa_index.c
+    a position-independent hash index over a module's export names.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    The index holds no pointers: a header, then an open-addressing table of
+    (name hash, name index) slots, all addressed by offsets from the header.
+    Names are not copied; a hit is confirmed against the module's own name
+    table through its gpa_modview backend. That makes the index valid in any
+    address space that maps the same module, as long as the fingerprint in the
+    header matches - which is what lets processes share one (see gpa_shidx.c).
+
+    Slots are homed by the top bits of the hash and probed linearly.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_index_size(u32 count)
+        bytes needed for an index over count names, 0 past GPA_INDEX_MAXCOUNT
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_INDEX *gpa_<backend>_indexbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint)
+        builds the index into buffer (gpa_index_size bytes, any content), 0 if
+        the view has more names than an index holds
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_indexlookup(gpa_MODVIEW *view, gpa_INDEX *index, char *name, gpa_EXPORT *exp)
+        looks a name up, returns 1 and fills exp on a hit
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_index_validate(gpa_INDEX *index, u64 size, u64 fingerprint)
+        checks an index that came from somewhere else (a file, another process)
+*/
+
+#ifndef _GPA_INDEX_C
+#define _GPA_INDEX_C
+#include "gpa_modview.c"
+
+#define GPA_INDEX_MAGIC     0x58415047      // "GPAX"
+#define GPA_INDEX_VERSION   1
+#define GPA_INDEX_MAXCOUNT  (1u << 30)      // names; twice as many slots still fit in u32
+
+typedef struct _gpa_INDEX {
+    u32   magic;
+    u32   version;
+    u64   fingerprint;          // of the module the index was built from
+    u32   count;                // name slots in the module
+    u32   numslots;             // power of two
+    u32   slots;                // offset of the slot array from the header
+    u32   size;                 // total bytes, header included
+} gpa_INDEX;
+
+typedef struct _gpa_INDEX_SLOT {
+    u32   hash;
+    u32   index;                // name index + 1, 0 marks an empty slot
+} gpa_INDEX_SLOT;
+
+// at most half full, so probe sequences stay short. count comes from the
+// view, so it is bounded before it can run the slot count past 32 bits: 0
+// means too many
+inline static u32 gpa_index_numslots(u32 count) {
+    if (count > GPA_INDEX_MAXCOUNT) {
+        return 0;
+    }
+    u64 n = 16;
+    while (n < 2ull * count) {
+        n <<= 1;
+    }
+    return (u32)n;
+}
+
+u64 gpa_index_size(u32 count) {
+    u32 n = gpa_index_numslots(count);
+    return n ? sizeof(gpa_INDEX) + (u64)n * sizeof(gpa_INDEX_SLOT) : 0;
+}
+
+inline static gpa_INDEX_SLOT *gpa_index_slots(gpa_INDEX *index) {
+    return (gpa_INDEX_SLOT*)((u8*)index + index->slots);
+}
+
+// top bits of the hash pick the home slot
+inline static u32 gpa_index_home(gpa_INDEX *index, u32 hash) {
+    return (u32)(((u64)hash * index->numslots) >> 32);
+}
+
+// the header alone, for builders that clear the slots themselves
+inline static void gpa_index_header(gpa_INDEX *index, u32 count, u64 fingerprint) {
+    index->magic       = GPA_INDEX_MAGIC;
+    index->version     = GPA_INDEX_VERSION;
+    index->fingerprint = fingerprint;
+    index->count       = count;
+    index->numslots    = gpa_index_numslots(count);
+    index->slots       = sizeof(gpa_INDEX);
+    index->size        = (u32)gpa_index_size(count);
+}
+
+inline static void gpa_index_init(gpa_INDEX *index, u32 count, u64 fingerprint) {
+    gpa_index_header(index, count, fingerprint);
+    gpa_INDEX_SLOT *slots = gpa_index_slots(index);
+    for (u32 i = 0; i < index->numslots; i++) {
+        slots[i].hash  = 0;
+        slots[i].index = 0;
+    }
+}
+
+inline static void gpa_index_insert(gpa_INDEX *index, u32 hash, u32 i) {
+    gpa_INDEX_SLOT *slots = gpa_index_slots(index);
+    u32 mask = index->numslots - 1;
+    u32 slot = gpa_index_home(index, hash);
+    while (slots[slot].index) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot].hash  = hash;
+    slots[slot].index = i + 1;
+}
+
+int gpa_index_validate(gpa_INDEX *index, u64 size, u64 fingerprint) {
+    if (size < sizeof(gpa_INDEX) || index->magic != GPA_INDEX_MAGIC || index->version != GPA_INDEX_VERSION
+        || index->fingerprint != fingerprint || index->size > size) {
+        return 0;
+    }
+    u32 n = index->numslots;
+    return n >= 16 && (n & (n - 1)) == 0 && index->count <= n / 2 && index->slots >= sizeof(gpa_INDEX)
+        && (u64)index->slots + (u64)n * sizeof(gpa_INDEX_SLOT) <= index->size;
+}
+
+#define GPA_INDEX_DEFINE(backend)                                                               \
+    gpa_INDEX *gpa_##backend##_indexbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint) {     \
+        gpa_INDEX *index = buffer;                                                              \
+        u32 count = gpa_##backend##_count(view);                                                \
+        if (!gpa_index_numslots(count)) {                                                       \
+            return 0;                                                                           \
+        }                                                                                       \
+        gpa_index_init(index, count, fingerprint);                                              \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            char *name = gpa_##backend##_name(view, i);                                         \
+            if (name) {                                                                         \
+                gpa_index_insert(index, gpa_hashn(name, gpa_modview_remaining(view, name)), i);             \
+            }                                                                                   \
+        }                                                                                       \
+        return index;                                                                           \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_indexlookup(gpa_MODVIEW *view, gpa_INDEX *index, char *name, gpa_EXPORT *exp) { \
+        gpa_INDEX_SLOT *slots = gpa_index_slots(index);                                         \
+        u32 count = gpa_##backend##_count(view);                                                \
+        u32 hash  = gpa_hash(name);                                                             \
+        u32 mask  = index->numslots - 1;                                                        \
+        u32 slot  = gpa_index_home(index, hash);                                                \
+        for (u32 probes = 0; probes < index->numslots && slots[slot].index; probes++) {         \
+            u32 i = slots[slot].index - 1;                                                      \
+            if (slots[slot].hash == hash && i < count) {                                        \
+                char *candidate = gpa_##backend##_name(view, i);                                \
+                if (candidate && gpa_modview_strcmp(view, name, candidate) == 0) {              \
+                    return gpa_##backend##_export(view, i, exp);                                \
+                }                                                                               \
+            }                                                                                   \
+            slot = (slot + 1) & mask;                                                           \
+        }                                                                                       \
+        return 0;                                                                               \
+    }
+
+GPA_INDEX_DEFINE(pe_loaded)
+GPA_INDEX_DEFINE(pe_file)
+GPA_INDEX_DEFINE(elf)
+
+#endif // _GPA_INDEX_C
@@ -0,0 +1,333 @@
+/*
+    gpa_intern.c
+    a string interning pool for export names shared across modules.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Tooling that indexes many modules, or many versions of the same module,
+    keeps seeing the same names: every ntdll build exports NtClose, and
+    kernel32 and kernelbase share most of their export tables. The pool
+    stores each distinct name once and hands out a 32-bit ID for it. A module
+    is then represented by one ID per name slot. Asking whether two modules
+    export the same name becomes an integer compare, and every copy of a name
+    after the first costs 4 bytes instead of the string.
+
+    IDs start at 1, so 0 can mean "no name" in an ID array. The pool is
+    offset-only like gpa_index.c and can be written out and mapped back as-is.
+    It lives in one caller buffer with fixed limits. When a limit is reached,
+    gpa_intern returns 0 and the pool is left unchanged.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_intern_size(u32 capacity, u32 stringcapacity)
+    gpa_INTERN *gpa_intern_init(ptr buffer, u32 capacity, u32 stringcapacity)
+        a pool for up to capacity distinct names holding stringcapacity bytes of
+        text (terminators included). size is 0 and init returns 0 for limits
+        beyond GPA_INTERN_MAXCAPACITY or a pool past 4 GB
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_intern(gpa_INTERN *pool, char *name, u64 n)
+        the ID of name (read up to n bytes or its terminator), added if new
+    u32 gpa_intern_find(gpa_INTERN *pool, char *name)
+        the ID of name if it is in the pool, 0 otherwise
+    char *gpa_intern_string(gpa_INTERN *pool, u32 id)
+        the text behind an ID
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_<backend>_intern(gpa_MODVIEW *view, gpa_INTERN *pool, u32 *ids)
+        interns every export name of a module, ids[i] being the ID for name slot i
+        (gpa_modview_count entries). returns the slots interned, which is short
+        of the count if the pool filled up
+    u32 gpa_intern_module(gpa_INTERN *pool, ptr modulehandle, u32 *ids)
+        the same straight from a loaded module's export directory
+*/
+
+#ifndef _GPA_INTERN_C
+#define _GPA_INTERN_C
+#define _GPA_INTERN_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_INTERN_MAGIC    0x49415047      // "GPAI"
+#define GPA_INTERN_VERSION  1
+#define GPA_INTERN_MAXCAPACITY  (1u << 30)  // names; twice as many slots still fit in u32
+
+typedef struct _gpa_INTERN {
+    u32   magic;
+    u32   version;
+    u32   count;                // distinct names, IDs are 1..count
+    u32   capacity;
+    u32   numslots;             // power of two, at least twice capacity
+    u32   stringsize;           // bytes of text used
+    u32   stringcapacity;
+    u32   offsets;              // u32[capacity + 1]: text offset of each ID, from strings
+    u32   slots;                // gpa_INTERN_SLOT[numslots]
+    u32   strings;
+    u32   size;
+} gpa_INTERN;
+
+typedef struct _gpa_INTERN_SLOT {
+    u32   hash;
+    u32   id;                   // 0 marks an empty slot
+} gpa_INTERN_SLOT;
+
+// 0 for a capacity that would run the slot count past 32 bits
+inline static u32 gpa_intern_numslots(u32 capacity) {
+    if (capacity > GPA_INTERN_MAXCAPACITY) {
+        return 0;
+    }
+    u64 n = 16;
+    while (n < 2ull * capacity) {
+        n <<= 1;
+    }
+    return (u32)n;
+}
+
+// everything in the pool is a 32-bit offset, so it must stay under 4 GB
+u64 gpa_intern_size(u32 capacity, u32 stringcapacity) {
+    u32 n = gpa_intern_numslots(capacity);
+    u64 size = sizeof(gpa_INTERN) + 4ull * ((u64)capacity + 1) + (u64)n * sizeof(gpa_INTERN_SLOT) + stringcapacity;
+    return n && size <= 0xffffffffull ? size : 0;
+}
+
+gpa_INTERN *gpa_intern_init(ptr buffer, u32 capacity, u32 stringcapacity) {
+    gpa_INTERN *pool = buffer;
+    if (!gpa_intern_size(capacity, stringcapacity)) {
+        return 0;
+    }
+    pool->magic          = GPA_INTERN_MAGIC;
+    pool->version        = GPA_INTERN_VERSION;
+    pool->count          = 0;
+    pool->capacity       = capacity;
+    pool->numslots       = gpa_intern_numslots(capacity);
+    pool->stringsize     = 0;
+    pool->stringcapacity = stringcapacity;
+    pool->offsets        = sizeof(gpa_INTERN);
+    pool->slots          = pool->offsets + 4 * (capacity + 1);
+    pool->strings        = pool->slots + pool->numslots * sizeof(gpa_INTERN_SLOT);
+    pool->size           = (u32)gpa_intern_size(capacity, stringcapacity);
+    gpa_INTERN_SLOT *slots = (gpa_INTERN_SLOT*)((u8*)pool + pool->slots);
+    for (u32 i = 0; i < pool->numslots; i++) {
+        slots[i].id = 0;
+    }
+    return pool;
+}
+
+inline static char *gpa_intern_string(gpa_INTERN *pool, u32 id) {
+    u32 *offsets = (u32*)((u8*)pool + pool->offsets);
+    return (char*)pool + pool->strings + offsets[id];
+}
+
+// the slot holding name, or the empty slot where it would go
+inline static gpa_INTERN_SLOT *gpa_intern_probe(gpa_INTERN *pool, char *name, u64 n, u32 hash) {
+    gpa_INTERN_SLOT *slots = (gpa_INTERN_SLOT*)((u8*)pool + pool->slots);
+    u32 mask = pool->numslots - 1;
+    u32 slot = (u32)(((u64)hash * pool->numslots) >> 32);
+    while (slots[slot].id) {
+        if (slots[slot].hash == hash && gpa_strcmpn(gpa_intern_string(pool, slots[slot].id), name, n) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &slots[slot];
+}
+
+u32 gpa_intern(gpa_INTERN *pool, char *name, u64 n) {
+    u32 hash = gpa_hashn(name, n);
+    gpa_INTERN_SLOT *slot = gpa_intern_probe(pool, name, n, hash);
+    if (slot->id) {
+        return slot->id;
+    }
+    u64 length = 0;
+    while (length < n && name[length]) {
+        length++;
+    }
+    if (pool->count >= pool->capacity || length + 1 > pool->stringcapacity - pool->stringsize) {
+        return 0;
+    }
+    u32 id = ++pool->count;
+    u32 *offsets = (u32*)((u8*)pool + pool->offsets);
+    offsets[id] = pool->stringsize;
+    char *text = (char*)pool + pool->strings + pool->stringsize;
+    for (u64 i = 0; i < length; i++) {
+        text[i] = name[i];
+    }
+    text[length] = 0;
+    pool->stringsize += (u32)length + 1;
+    slot->hash = hash;
+    slot->id   = id;
+    return id;
+}
+
+u32 gpa_intern_find(gpa_INTERN *pool, char *name) {
+    return gpa_intern_probe(pool, name, ~(u64)0, gpa_hash(name))->id;
+}
+
+#define GPA_INTERN_DEFINE(backend)                                                              \
+    u32 gpa_##backend##_intern(gpa_MODVIEW *view, gpa_INTERN *pool, u32 *ids) {                 \
+        u32 count = gpa_##backend##_count(view);                                                \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            char *name = gpa_##backend##_name(view, i);                                         \
+            ids[i] = 0;                                                                         \
+            if (name && !(ids[i] = gpa_intern(pool, name, gpa_modview_remaining(view, name)))) { \
+                return i;                                                                       \
+            }                                                                                   \
+        }                                                                                       \
+        return count;                                                                           \
+    }
+
+GPA_INTERN_DEFINE(pe_loaded)
+GPA_INTERN_DEFINE(pe_file)
+GPA_INTERN_DEFINE(elf)
+
+u32 gpa_intern_module(gpa_INTERN *pool, ptr modulehandle, u32 *ids) {
+    gpa_MODVIEW view;
+    if (!gpa_pe_loaded_open(&view, modulehandle, 0)) {
+        return 0;
+    }
+    return gpa_pe_loaded_intern(&view, pool, ids);
+}
+
+// development code: a corpus of several versions of a few related modules,
+// measuring what interning saves and what a cross-module compare costs
+#if _GPA_INTERN_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_intern_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_intern_byname(const void *a, const void *b) {
+    return gpa_strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+static int gpa_intern_byid(const void *a, const void *b) {
+    u32 x = *(u32*)a, y = *(u32*)b;
+    return x < y ? -1 : x > y;
+}
+
+#define FAMILIES    3
+#define VERSIONS    8
+
+int main(int argc, char *argv[]) {
+    // three families that overlap the way ntdll, kernelbase and kernel32 do;
+    // each version adds names and retires a few
+    char *prefixes[FAMILIES] = { "Rtl", "Base", "Kernel" };
+    u32 basecount[FAMILIES]  = { 2400, 1600, 1400 };
+    gpa_MODVIEW views[FAMILIES * VERSIONS];
+    u64 rawbytes = 0, names = 0;
+    for (u32 f = 0; f < FAMILIES; f++) {
+        for (u32 v = 0; v < VERSIONS; v++) {
+            u32 count = basecount[f] + 40 * v;
+            gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+            u32 n = 0;
+            for (u32 i = 0; i < count; i++) {
+                if ((i * 31 + v) % 97 == 0) {
+                    continue;
+                }
+                exports[n].name = malloc(48);
+                // kernelbase and kernel32 re-export a good share of the Rtl names
+                if (f > 0 && i % 3 == 0) {
+                    snprintf(exports[n].name, 48, "RtlFunctionNumber%05u", i);
+                } else {
+                    snprintf(exports[n].name, 48, "%sFunctionNumber%05u", prefixes[f], i);
+                }
+                exports[n].slot = n;
+                exports[n].rva  = 0x1000 + 16 * n;
+                rawbytes += strlen(exports[n].name) + 1;
+                n++;
+            }
+            qsort(exports, n, sizeof(gpa_SYNTH_EXPORT), gpa_intern_byname);
+            for (u32 i = 0; i < n; i++) {
+                exports[i].slot = i;
+            }
+            u64 capacity = gpa_synth_pe_size(exports, n);
+            u8 *image = malloc(capacity);
+            gpa_pe_loaded_open(&views[f * VERSIONS + v], image, gpa_synth_pe(image, capacity, exports, n, v, 0));
+            names += n;
+        }
+    }
+
+    u32 poolcapacity = 16384, stringcapacity = 512 * 1024;
+    u64 poolsize = gpa_intern_size(poolcapacity, stringcapacity);
+    gpa_INTERN *pool = gpa_intern_init(malloc(poolsize), poolcapacity, stringcapacity);
+    u32 *ids[FAMILIES * VERSIONS];
+    double t0 = gpa_intern_now();
+    for (u32 m = 0; m < FAMILIES * VERSIONS; m++) {
+        ids[m] = malloc(4 * gpa_pe_loaded_count(&views[m]));
+        if (gpa_pe_loaded_intern(&views[m], pool, ids[m]) != gpa_pe_loaded_count(&views[m])) {
+            printf("pool full\n");
+            return 1;
+        }
+    }
+    double t1 = gpa_intern_now();
+    // raw: the text plus a pointer per name. interned: the text once, the
+    // pool's own tables at their used size, and an ID per name
+    u64 pooled = pool->stringsize + 4ull * pool->count + (u64)gpa_intern_numslots(pool->count) * sizeof(gpa_INTERN_SLOT);
+    u64 raw = rawbytes + 8 * names;
+    u64 interned = pooled + 4 * names;
+    printf("%u modules, %llu names, %u distinct, interned in %.2f ms\n", FAMILIES * VERSIONS,
+           (unsigned long long)names, pool->count, (t1 - t0) * 1e3);
+    printf("raw %llu bytes, interned %llu bytes (%.1f%% saved)\n", (unsigned long long)raw,
+           (unsigned long long)interned, 100.0 - 100.0 * interned / raw);
+
+    // every ID maps back to the name it came from
+    u32 wrong = 0;
+    for (u32 m = 0; m < FAMILIES * VERSIONS; m++) {
+        for (u32 i = 0; i < gpa_pe_loaded_count(&views[m]); i++) {
+            char *name = gpa_pe_loaded_name(&views[m], i);
+            wrong += gpa_strcmp(gpa_intern_string(pool, ids[m][i]), name) != 0 || gpa_intern_find(pool, name) != ids[m][i];
+        }
+    }
+    printf("round trip: %u wrong, unknown name gives %u\n", wrong, gpa_intern_find(pool, "NoSuchFunction"));
+    // limits past what 32-bit offsets address are refused, not looped on
+    wrong += gpa_intern_size(0xffffffffu, 0) != 0 || gpa_intern_size(1u << 28, 0) != 0
+          || gpa_intern_init(pool, 0xffffffffu, 0) != 0;
+
+    // names kernel32 v0 shares with ntdll v7: merge of sorted ID arrays
+    // against a merge of the sorted name tables
+    gpa_MODVIEW *a = &views[2 * VERSIONS], *b = &views[VERSIONS - 1];
+    u32 na = gpa_pe_loaded_count(a), nb = gpa_pe_loaded_count(b);
+    u32 *sa = malloc(4 * na), *sb = malloc(4 * nb);
+    memcpy(sa, ids[2 * VERSIONS], 4 * na);
+    memcpy(sb, ids[VERSIONS - 1], 4 * nb);
+    qsort(sa, na, 4, gpa_intern_byid);
+    qsort(sb, nb, 4, gpa_intern_byid);
+    u32 common = 0, commonbyname = 0;
+    double t2 = gpa_intern_now();
+    for (u32 r = 0; r < 1000; r++) {
+        common = 0;
+        for (u32 i = 0, j = 0; i < na && j < nb; ) {
+            if (sa[i] == sb[j]) {
+                common++, i++, j++;
+            } else if (sa[i] < sb[j]) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+    }
+    double t3 = gpa_intern_now();
+    for (u32 r = 0; r < 1000; r++) {
+        commonbyname = 0;
+        for (u32 i = 0, j = 0; i < na && j < nb; ) {
+            int cmp = gpa_strcmp(gpa_pe_loaded_name(a, i), gpa_pe_loaded_name(b, j));
+            if (cmp == 0) {
+                commonbyname++, i++, j++;
+            } else if (cmp < 0) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+    }
+    double t4 = gpa_intern_now();
+    printf("common names: %u by id in %.1f us, %u by string in %.1f us\n", common, (t3 - t2) * 1e3,
+           commonbyname, (t4 - t3) * 1e3);
+    return wrong != 0 || common != commonbyname;
+}
+#endif // _GPA_INTERN_DEBUG
+#endif // _GPA_INTERN_C
@@ -0,0 +1,704 @@
+/*
+    gpa_jit.c
+    a fixed set of names compiled to x86-64 code at runtime.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Resolving the same few hundred names against every version of a module
+    repeats the same generic search each time. gpa_jit_compile turns the name
+    set into a function that classifies a string in one pass: a decision tree
+    over the name bytes (a compiled trie), with no tables to walk. Runs of
+    bytes that every remaining candidate shares become 8/4/2/1-byte immediate
+    compares; bytes where candidates differ become a balanced tree of
+    cmp al, imm8 branches. Each leaf returns the name's index in the set.
+
+    Wide compares can read up to 7 bytes past the point where an input that
+    does not match ends, so the function is emitted twice: once with them, and
+    once byte by byte, and the caller says how many bytes are readable at the
+    name. Names inside a module view always have their remaining image, so
+    the wide tree is the one that runs; arbitrary strings can pass 0.
+
+    The code is written into an anonymous read-write mapping which is then
+    flipped to read-execute (mmap/mprotect on Linux; VirtualAlloc/VirtualProtect
+    on Windows, resolved through gpa_bootstrap). Nothing is writable and
+    executable at once.
+
+    When it pays: the walk touches every export of the module, so its cost
+    grows with the module, not with the set. Against a module that already
+    has a gpa_index the index wins (402 names over 1.4k-7.1k exports: 29-35 us
+    of index lookups against 70-76 us of walk). The JIT is worth building
+    when the set is resolved against many modules or versions that are each
+    seen once and never indexed: it beats per-name binary search (~85 us)
+    and a fresh index build plus lookups (~250 us), and its ~0.75 ms compile
+    is paid back after 3-4 such modules against the fresh index, but only
+    after tens to hundreds against binary search, which costs nearly as
+    little as the walk. For a module that is looked up again and again,
+    build its index instead.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_jit_compile(gpa_JIT *jit, char **names, u32 count, ptr scratch)
+        compiles the set, returns 1 on success. scratch is count u32s. names
+        may repeat; the first index of a repeated name is the one returned
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    i32 gpa_jit_classify(gpa_JIT *jit, char *name, u64 remaining)
+        the index of name in the set, or -1. remaining is the number of bytes
+        readable at name, 0 if unknown
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_<backend>_jitresolve(gpa_MODVIEW *view, gpa_JIT *jit, gpa_EXPORT *exports, u64 *found)
+        one walk over the module's names, classifying each. fills exports[k]
+        and sets bit k of found (count bits, cleared first) for every name k of
+        the set the module exports, returns how many
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_jit_free(gpa_JIT *jit)
+        releases the code
+*/
+
+#ifndef _GPA_JIT_C
+#define _GPA_JIT_C
+#define _GPA_JIT_DEBUG 0
+#include "gpa_modview.c"
+#include "gpa_once.c"
+
+#define GPA_JIT_ENTRY           16          // the shared fail stub sits in front of the entry
+#define GPA_JIT_PAGE            4096
+
+// the generated function: index of the name, or -1
+typedef i32 (*gpa_JIT_FN)(char *name, u64 remaining);
+
+typedef struct _gpa_JIT {
+    gpa_JIT_FN classify;
+    u8        *code;
+    u64        size;                // of the mapping
+    u32        count;
+    u32        maxlength;           // longest name, the wide tree reads no further than its NUL
+} gpa_JIT;
+
+typedef struct _gpa_JIT_EMIT {
+    u8    *code;                    // 0 while measuring
+    u64    at;
+    char **names;
+    u32   *order;                   // set indices sorted by name
+    int    wide;
+} gpa_JIT_EMIT;
+
+inline static void gpa_jit_u8(gpa_JIT_EMIT *e, u8 b) {
+    if (e->code) {
+        e->code[e->at] = b;
+    }
+    e->at++;
+}
+
+inline static void gpa_jit_u32(gpa_JIT_EMIT *e, u32 v) {
+    for (u32 i = 0; i < 4; i++) {
+        gpa_jit_u8(e, (u8)(v >> 8 * i));
+    }
+}
+
+inline static void gpa_jit_patch(gpa_JIT_EMIT *e, u64 at, u64 target) {
+    u32 displacement = (u32)(target - (at + 4));
+    for (u32 i = 0; e->code && i < 4; i++) {
+        e->code[at + i] = (u8)(displacement >> 8 * i);
+    }
+}
+
+// jcc rel32 (jmp when cc is 0), returns where the displacement goes
+inline static u64 gpa_jit_jump(gpa_JIT_EMIT *e, u8 cc) {
+    if (cc) {
+        gpa_jit_u8(e, 0x0f);
+        gpa_jit_u8(e, cc);
+    } else {
+        gpa_jit_u8(e, 0xe9);
+    }
+    u64 at = e->at;
+    gpa_jit_u32(e, 0);
+    return at;
+}
+
+#define GPA_JIT_JMP             0x00
+#define GPA_JIT_JB              0x82
+#define GPA_JIT_JE              0x84
+#define GPA_JIT_JNE             0x85
+#define GPA_JIT_JA              0x87
+
+inline static void gpa_jit_fail(gpa_JIT_EMIT *e, u8 cc) {
+    gpa_jit_patch(e, gpa_jit_jump(e, cc), 0);
+}
+
+// the name is in r8 and the readable length in r9 in both ABIs: volatile
+// everywhere, so nothing needs saving. [r8 + disp32] is modrm 0x80 | reg << 3
+inline static void gpa_jit_operand(gpa_JIT_EMIT *e, u8 reg, u32 offset) {
+    gpa_jit_u8(e, 0x80 | reg << 3);
+    gpa_jit_u32(e, offset);
+}
+
+// cmp [r8 + offset], bytes, for a run every candidate shares; jne to fail
+static void gpa_jit_run(gpa_JIT_EMIT *e, char *name, u32 from, u32 to) {
+    while (from < to) {
+        u32 n = to - from;
+        n = !e->wide ? 1 : n >= 8 ? 8 : n >= 4 ? 4 : n >= 2 ? 2 : 1;
+        u8 *bytes = (u8*)name + from;
+        if (n == 8) {
+            gpa_jit_u8(e, 0x48);                    // mov rax, imm64
+            gpa_jit_u8(e, 0xb8);
+            for (u32 i = 0; i < 8; i++) {
+                gpa_jit_u8(e, bytes[i]);
+            }
+            gpa_jit_u8(e, 0x49);                    // cmp [r8 + offset], rax
+            gpa_jit_u8(e, 0x39);
+            gpa_jit_operand(e, 0, from);
+        } else {
+            if (n == 2) {
+                gpa_jit_u8(e, 0x66);
+            }
+            gpa_jit_u8(e, 0x41);                    // cmp [r8 + offset], imm
+            gpa_jit_u8(e, n == 1 ? 0x80 : 0x81);
+            gpa_jit_operand(e, 7, from);
+            for (u32 i = 0; i < n; i++) {
+                gpa_jit_u8(e, bytes[i]);
+            }
+        }
+        gpa_jit_fail(e, GPA_JIT_JNE);
+        from += n;
+    }
+}
+
+inline static void gpa_jit_leaf(gpa_JIT_EMIT *e, u32 lo, u32 hi) {
+    u32 index = e->order[lo];
+    for (u32 i = lo + 1; i < hi; i++) {
+        index = e->order[i] < index ? e->order[i] : index;
+    }
+    gpa_jit_u8(e, 0xb8);                            // mov eax, index
+    gpa_jit_u32(e, index);
+    gpa_jit_u8(e, 0xc3);
+}
+
+// compare tree over the distinct bytes of groups [a, b) with al loaded.
+// jumps to each group are left for the caller to patch
+static void gpa_jit_branch(gpa_JIT_EMIT *e, u8 *values, u32 *patches, u32 a, u32 b) {
+    while (b - a > 4) {
+        u32 m = a + (b - a) / 2;
+        gpa_jit_u8(e, 0x3c);                        // cmp al, imm8
+        gpa_jit_u8(e, values[m]);
+        patches[m] = (u32)gpa_jit_jump(e, GPA_JIT_JE);
+        u32 below = (u32)gpa_jit_jump(e, GPA_JIT_JB);
+        gpa_jit_branch(e, values, patches, m + 1, b);
+        gpa_jit_patch(e, below, e->at);
+        b = m;
+    }
+    for (u32 g = a; g < b; g++) {
+        gpa_jit_u8(e, 0x3c);
+        gpa_jit_u8(e, values[g]);
+        patches[g] = (u32)gpa_jit_jump(e, GPA_JIT_JE);
+    }
+    gpa_jit_fail(e, GPA_JIT_JMP);
+}
+
+// names order[lo, hi) agree on their first depth bytes, none of them NUL
+static void gpa_jit_node(gpa_JIT_EMIT *e, u32 lo, u32 hi, u32 depth) {
+    char *first = e->names[e->order[lo]];
+    char *last  = e->names[e->order[hi - 1]];
+    // sorted, so if the first and last agree on a byte everyone does
+    u32 start = depth;
+    while (first[depth] == last[depth]) {
+        if (!first[depth++]) {
+            gpa_jit_run(e, first, start, depth);
+            gpa_jit_leaf(e, lo, hi);
+            return;
+        }
+    }
+    gpa_jit_run(e, first, start, depth);
+
+    u8  values[256];
+    u32 bounds[257];
+    u32 patches[256];
+    u32 groups = 0;
+    for (u32 i = lo; i < hi; i++) {
+        u8 c = (u8)e->names[e->order[i]][depth];
+        if (groups == 0 || values[groups - 1] != c) {
+            values[groups] = c;
+            bounds[groups++] = i;
+        }
+    }
+    bounds[groups] = hi;
+    gpa_jit_u8(e, 0x41);                            // movzx eax, byte [r8 + depth]
+    gpa_jit_u8(e, 0x0f);
+    gpa_jit_u8(e, 0xb6);
+    gpa_jit_operand(e, 0, depth);
+    gpa_jit_branch(e, values, patches, 0, groups);
+    for (u32 g = 0; g < groups; g++) {
+        gpa_jit_patch(e, patches[g], e->at);
+        if (values[g] == 0) {
+            gpa_jit_leaf(e, bounds[g], bounds[g + 1]);
+        } else {
+            gpa_jit_node(e, bounds[g], bounds[g + 1], depth + 1);
+        }
+    }
+}
+
+static void gpa_jit_function(gpa_JIT_EMIT *e, u32 count, u32 maxlength) {
+    // fail stub at 0, padded with int3 up to the entry
+    gpa_jit_u8(e, 0xb8);
+    gpa_jit_u32(e, 0xffffffff);
+    gpa_jit_u8(e, 0xc3);
+    while (e->at < GPA_JIT_ENTRY) {
+        gpa_jit_u8(e, 0xcc);
+    }
+#if defined(_WIN32)
+    u8 prologue[] = { 0x49, 0x89, 0xc8, 0x49, 0x89, 0xd1 };   // mov r8, rcx; mov r9, rdx
+#else
+    u8 prologue[] = { 0x49, 0x89, 0xf8, 0x49, 0x89, 0xf1 };   // mov r8, rdi; mov r9, rsi
+#endif
+    for (u32 i = 0; i < sizeof(prologue); i++) {
+        gpa_jit_u8(e, prologue[i]);
+    }
+    if (count == 0) {
+        gpa_jit_fail(e, GPA_JIT_JMP);
+        return;
+    }
+    gpa_jit_u8(e, 0x49);                            // cmp r9, maxlength
+    gpa_jit_u8(e, 0x81);
+    gpa_jit_u8(e, 0xf9);
+    gpa_jit_u32(e, maxlength);
+    u64 wide = gpa_jit_jump(e, GPA_JIT_JA);
+    e->wide = 0;
+    gpa_jit_node(e, 0, count, 0);
+    gpa_jit_patch(e, wide, e->at);
+    e->wide = 1;
+    gpa_jit_node(e, 0, count, 0);
+}
+
+inline static void gpa_jit_siftdown(char **names, u32 *order, u32 root, u32 n) {
+    for (;;) {
+        u32 child = 2 * root + 1;
+        if (child >= n) {
+            return;
+        }
+        if (child + 1 < n && gpa_strcmp(names[order[child]], names[order[child + 1]]) < 0) {
+            child++;
+        }
+        if (gpa_strcmp(names[order[root]], names[order[child]]) >= 0) {
+            return;
+        }
+        u32 t = order[root];
+        order[root]  = order[child];
+        order[child] = t;
+        root = child;
+    }
+}
+
+#if defined(_WIN32)
+typedef ptr (*gpa_VIRTUALALLOC)(ptr address, u64 size, u32 type, u32 protect);
+typedef i32 (*gpa_VIRTUALPROTECT)(ptr address, u64 size, u32 protect, u32 *old);
+typedef i32 (*gpa_VIRTUALFREE)(ptr address, u64 size, u32 type);
+
+inline static ptr gpa_jit_kernel32(char *name) {
+    gpa_BOOTSTRAP *bootstrap = gpa_bootstrap();
+    return bootstrap->getprocaddress(bootstrap->kernel32, name);
+}
+
+static ptr gpa_jit_map(u64 size) {
+    gpa_VIRTUALALLOC virtualalloc = (gpa_VIRTUALALLOC)gpa_jit_kernel32("VirtualAlloc");
+    return virtualalloc ? virtualalloc(0, size, 0x3000, 0x04) : 0;     // reserve | commit, read-write
+}
+
+static int gpa_jit_seal(ptr code, u64 size) {
+    u32 old;
+    gpa_VIRTUALPROTECT virtualprotect = (gpa_VIRTUALPROTECT)gpa_jit_kernel32("VirtualProtect");
+    return virtualprotect && virtualprotect(code, size, 0x20, &old);   // execute-read
+}
+
+static void gpa_jit_unmap(ptr code, u64 size) {
+    gpa_VIRTUALFREE virtualfree = (gpa_VIRTUALFREE)gpa_jit_kernel32("VirtualFree");
+    if (virtualfree) {
+        virtualfree(code, 0, 0x8000);                                   // release
+    }
+}
+#else
+static ptr gpa_jit_map(u64 size) {
+    return gpa_allocpages(size);
+}
+
+static int gpa_jit_seal(ptr code, u64 size) {
+    return gpa_sys_mprotect(code, size, GPA_PROT_READ | GPA_PROT_EXEC) == 0;
+}
+
+static void gpa_jit_unmap(ptr code, u64 size) {
+    gpa_freepages(code, size);
+}
+#endif
+
+int gpa_jit_compile(gpa_JIT *jit, char **names, u32 count, ptr scratch) {
+    gpa_JIT_EMIT e = { 0, 0, names, scratch, 0 };
+    u32 maxlength = 0;
+    for (u32 i = 0; i < count; i++) {
+        u64 length = gpa_strlen(names[i]);
+        if (length > 0x7fffffff) {
+            return 0;
+        }
+        maxlength = length > maxlength ? (u32)length : maxlength;
+        e.order[i] = i;
+    }
+    for (u32 i = count / 2; i-- > 0; ) {
+        gpa_jit_siftdown(names, e.order, i, count);
+    }
+    for (u32 end = count; end > 1; end--) {
+        u32 t = e.order[0];
+        e.order[0]       = e.order[end - 1];
+        e.order[end - 1] = t;
+        gpa_jit_siftdown(names, e.order, 0, end - 1);
+    }
+    // once to measure, once for real
+    gpa_jit_function(&e, count, maxlength);
+    u64 size = (e.at + GPA_JIT_PAGE - 1) & ~(u64)(GPA_JIT_PAGE - 1);
+    e.code = gpa_jit_map(size);
+    if (!e.code) {
+        return 0;
+    }
+    e.at = 0;
+    gpa_jit_function(&e, count, maxlength);
+    if (!gpa_jit_seal(e.code, size)) {
+        gpa_jit_unmap(e.code, size);
+        return 0;
+    }
+    jit->classify  = (gpa_JIT_FN)(e.code + GPA_JIT_ENTRY);
+    jit->code      = e.code;
+    jit->size      = size;
+    jit->count     = count;
+    jit->maxlength = maxlength;
+    return 1;
+}
+
+inline static i32 gpa_jit_classify(gpa_JIT *jit, char *name, u64 remaining) {
+    return jit->classify(name, remaining);
+}
+
+void gpa_jit_free(gpa_JIT *jit) {
+    if (jit->code) {
+        gpa_jit_unmap(jit->code, jit->size);
+        jit->code = 0;
+    }
+}
+
+#define GPA_JIT_DEFINE(backend)                                                                 \
+    u32 gpa_##backend##_jitresolve(gpa_MODVIEW *view, gpa_JIT *jit, gpa_EXPORT *exports, u64 *found) { \
+        u32 resolved = 0;                                                                       \
+        for (u32 w = 0; w < (jit->count + 63) / 64; w++) {                                      \
+            found[w] = 0;                                                                       \
+        }                                                                                       \
+        u32 count = gpa_##backend##_count(view);                                                \
+        for (u32 i = 0; i < count && resolved < jit->count; i++) {                              \
+            char *name = gpa_##backend##_name(view, i);                                         \
+            i32 k = name ? jit->classify(name, gpa_modview_remaining(view, name)) : -1;         \
+            if (k >= 0 && !(found[k / 64] >> (k % 64) & 1)                                      \
+                && gpa_##backend##_export(view, i, &exports[k])) {                              \
+                found[k / 64] |= 1ull << (k % 64);                                              \
+                resolved++;                                                                     \
+            }                                                                                   \
+        }                                                                                       \
+        return resolved;                                                                        \
+    }
+
+GPA_JIT_DEFINE(pe_loaded)
+GPA_JIT_DEFINE(pe_file)
+GPA_JIT_DEFINE(elf)
+
+// just some debug code used during development
+#if _GPA_JIT_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_index.c"
+#include "gpa_synth.c"
+
+static double gpa_jit_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_jit_byname(const void *a, const void *b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+static u64 gpa_jit_rng = 88172645463325252ull;
+
+static u32 gpa_jit_random(u32 n) {
+    gpa_jit_rng ^= gpa_jit_rng << 13;
+    gpa_jit_rng ^= gpa_jit_rng >> 7;
+    gpa_jit_rng ^= gpa_jit_rng << 17;
+    return (u32)((gpa_jit_rng >> 11) % n);
+}
+
+// the generic alternatives for classifying a string against the set
+typedef struct _gpa_JIT_SETHASH {
+    u32   *slots;               // set index + 1
+    u32    mask;
+    char **names;
+} gpa_JIT_SETHASH;
+
+static i32 gpa_jit_sethash(gpa_JIT_SETHASH *h, char *name) {
+    for (u32 slot = gpa_hash(name) & h->mask; h->slots[slot]; slot = (slot + 1) & h->mask) {
+        if (strcmp(h->names[h->slots[slot] - 1], name) == 0) {
+            return h->slots[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+static i32 gpa_jit_setsearch(char **sorted, u32 *sortedindex, u32 count, char *name) {
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, sorted[mid]);
+        if (cmp == 0) {
+            return sortedindex[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    char *heads[] = { "Nt", "Zw", "Rtl", "Ldr", "Etw", "Create", "Get", "Set", "Query", "Open", "Close",
+                      "Enum", "Reg", "Crypt", "Wsa", "Virtual", "Heap", "Local", "Global", "Find" };
+    char *bodies[] = { "File", "Process", "Thread", "Key", "Value", "Event", "Mutex", "Section", "Memory",
+                       "Token", "Object", "Module", "Window", "Path", "String", "Unicode", "Time", "Info",
+                       "Information", "Handle", "Pipe", "Port", "Timer", "Semaphore" };
+    char *tails[] = { "", "A", "W", "Ex", "ExA", "ExW", "2", "Internal" };
+    u32 nh = sizeof(heads) / sizeof(*heads), nb = sizeof(bodies) / sizeof(*bodies), nt = sizeof(tails) / sizeof(*tails);
+    char **corpus = malloc(sizeof(char*) * nh * nb * nb * nt);
+    u32 total = 0;
+    for (u32 h = 0; h < nh; h++) {
+        for (u32 b1 = 0; b1 < nb; b1++) {
+            for (u32 b2 = 0; b2 < nb; b2++) {
+                for (u32 t = 0; t < nt; t++) {
+                    if (((h * 131 + b1 * 31 + b2 * 7 + t) * 2654435761u >> 16) % 4 == 0) {
+                        char *name = malloc(64);
+                        snprintf(name, 64, "%s%s%s%s", heads[h], bodies[b1], b1 == b2 ? "" : bodies[b2], tails[t]);
+                        corpus[total++] = name;
+                    }
+                }
+            }
+        }
+    }
+    qsort(corpus, total, sizeof(char*), gpa_jit_byname);
+    u32 unique = 0;
+    for (u32 i = 0; i < total; i++) {
+        if (unique == 0 || strcmp(corpus[unique - 1], corpus[i]) != 0) {
+            corpus[unique++] = corpus[i];
+        }
+    }
+    total = unique;
+
+    // the fixed set: 400 names in no particular order, plus one repeat and one
+    // the corpus never produces
+    u32 setcount = 402;
+    char **set = malloc(sizeof(char*) * setcount);
+    for (u32 i = 0; i < 400; i++) {
+        set[i] = corpus[gpa_jit_random(total)];
+    }
+    set[400] = set[17];
+    set[401] = "NotInAnyVersion";
+    u32 *scratch = malloc(sizeof(u32) * setcount);
+    gpa_JIT jit;
+    double t = gpa_jit_now();
+    if (!gpa_jit_compile(&jit, set, setcount, scratch)) {
+        printf("compile failed\n");
+        return 1;
+    }
+    t = gpa_jit_now() - t;
+    double compiletime = t;
+    printf("%u names compiled in %.1f us, %llu bytes mapped, longest name %u\n", setcount, t * 1e6,
+           (unsigned long long)jit.size, jit.maxlength);
+
+    // classification must agree with strcmp everywhere, through both trees
+    u32 wrong = 0;
+    for (u32 i = 0; i < total; i++) {
+        i32 expected = -1;
+        for (u32 k = 0; k < setcount && expected < 0; k++) {
+            expected = strcmp(set[k], corpus[i]) == 0 ? (i32)k : -1;
+        }
+        wrong += gpa_jit_classify(&jit, corpus[i], ~0ull) != expected;
+        wrong += gpa_jit_classify(&jit, corpus[i], 0) != expected;
+    }
+    char *near[] = { "", "N", "Nt", "NtFil", "NtFileX", "NotInAnyVersio", "NotInAnyVersionX" };
+    for (u32 i = 0; i < sizeof(near) / sizeof(*near); i++) {
+        i32 expected = -1;
+        for (u32 k = 0; k < setcount && expected < 0; k++) {
+            expected = strcmp(set[k], near[i]) == 0 ? (i32)k : -1;
+        }
+        wrong += gpa_jit_classify(&jit, near[i], 0) != expected;
+    }
+    // a name at the very end of a page, followed by a guard page: the narrow tree must not fault
+    u8 *pages = gpa_allocpages(2 * GPA_JIT_PAGE);
+    gpa_sys_mprotect(pages + GPA_JIT_PAGE, GPA_JIT_PAGE, 0);
+    char *edge = (char*)pages + GPA_JIT_PAGE - (strlen(set[5]) + 1);
+    strcpy(edge, set[5]);
+    wrong += gpa_jit_classify(&jit, edge, strlen(set[5]) + 1) != 5;
+    edge[strlen(edge) - 1] = 0;
+    wrong += gpa_jit_classify(&jit, edge, strlen(edge) + 2) != -1;
+    printf("classified %u corpus names and %u near misses twice: %u wrong\n", total,
+           (u32)(sizeof(near) / sizeof(*near)), wrong);
+
+    // the set hashed and sorted the usual ways, for the classification race
+    gpa_JIT_SETHASH sethash = { calloc(1024, sizeof(u32)), 1023, set };
+    char **sorted = malloc(sizeof(char*) * setcount);
+    u32 *sortedindex = malloc(sizeof(u32) * setcount);
+    for (u32 k = setcount; k-- > 0; ) {
+        u32 slot = gpa_hash(set[k]) & sethash.mask;
+        while (sethash.slots[slot] && strcmp(set[sethash.slots[slot] - 1], set[k]) != 0) {
+            slot = (slot + 1) & sethash.mask;
+        }
+        sethash.slots[slot] = k + 1;
+    }
+    for (u32 k = 0; k < setcount; k++) {
+        sorted[k] = set[k];
+    }
+    qsort(sorted, setcount, sizeof(char*), gpa_jit_byname);
+    for (u32 k = 0; k < setcount; k++) {
+        for (u32 j = 0; j < setcount; j++) {
+            if (set[j] == sorted[k] || strcmp(set[j], sorted[k]) == 0) {
+                sortedindex[k] = j;
+                break;
+            }
+        }
+    }
+    // in table order the names stream through the cache as in a module walk;
+    // in random order every classification starts with a miss on the name
+    u32 *probe = malloc(sizeof(u32) * 1000000);
+    char *orders[] = { "table order", "random order" };
+    for (u32 o = 0; o < 2; o++) {
+        for (u32 i = 0; i < 1000000; i++) {
+            probe[i] = o ? gpa_jit_random(total) : i % total;
+        }
+        i64 sum[3] = { 0 };
+        double tc[3];
+        t = gpa_jit_now();
+        for (u32 i = 0; i < 1000000; i++) {
+            sum[0] += gpa_jit_classify(&jit, corpus[probe[i]], 64);
+        }
+        tc[0] = gpa_jit_now() - t;
+        t = gpa_jit_now();
+        for (u32 i = 0; i < 1000000; i++) {
+            sum[1] += gpa_jit_sethash(&sethash, corpus[probe[i]]);
+        }
+        tc[1] = gpa_jit_now() - t;
+        t = gpa_jit_now();
+        for (u32 i = 0; i < 1000000; i++) {
+            sum[2] += gpa_jit_setsearch(sorted, sortedindex, setcount, corpus[probe[i]]);
+        }
+        tc[2] = gpa_jit_now() - t;
+        printf("classify a corpus name, %s: jit %.1f ns, hash %.1f ns, binary search %.1f ns (%s)\n",
+               orders[o], tc[0] * 1e3, tc[1] * 1e3, tc[2] * 1e3,
+               sum[0] == sum[1] && sum[1] == sum[2] ? "agree" : "DISAGREE");
+    }
+
+    // whole-set resolution against several module versions: one jit walk over
+    // each export table, against per-name binary search and a fresh gpa_index
+    u32 versions = 8, reps = 50;
+    double tj = 0, tb = 0, th = 0, thl = 0;
+    u32 mismatches = 0;
+    gpa_EXPORT *viajit = malloc(sizeof(gpa_EXPORT) * setcount);
+    u64 found[(402 + 63) / 64];
+    for (u32 v = 0; v < versions; v++) {
+        u32 count = 1500 + v * 1000;
+        gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+        // every set name, except one in eight per version, then corpus filler
+        u32 n = 0;
+        char **chosen = malloc(sizeof(char*) * (count + setcount));
+        for (u32 k = 0; k < 400; k++) {
+            if ((k + v) % 8) {
+                chosen[n++] = set[k];
+            }
+        }
+        while (n < count) {
+            chosen[n++] = corpus[gpa_jit_random(total)];
+        }
+        qsort(chosen, n, sizeof(char*), gpa_jit_byname);
+        u32 m = 0;
+        for (u32 i = 0; i < n; i++) {
+            if (m == 0 || strcmp(chosen[m - 1], chosen[i]) != 0) {
+                chosen[m++] = chosen[i];
+            }
+        }
+        count = m;
+        for (u32 i = 0; i < count; i++) {
+            exports[i].name = chosen[i];
+            exports[i].slot = i;
+            exports[i].rva  = 0x1000 + 16 * i + v;
+        }
+        u64 capacity = gpa_synth_pe_size(exports, count);
+        u8 *image = malloc(capacity);
+        gpa_MODVIEW view;
+        gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+        ptr index = malloc(gpa_index_size(count));
+        gpa_pe_loaded_indexbuild(&view, index, 0);
+        gpa_EXPORT exp;
+        u32 resolved = 0;
+
+        t = gpa_jit_now();
+        for (u32 r = 0; r < reps; r++) {
+            resolved = gpa_pe_loaded_jitresolve(&view, &jit, viajit, found);
+        }
+        tj += (gpa_jit_now() - t) / reps;
+        t = gpa_jit_now();
+        for (u32 r = 0; r < reps; r++) {
+            for (u32 k = 0; k < setcount; k++) {
+                gpa_pe_loaded_lookup(&view, set[k], &exp);
+            }
+        }
+        tb += (gpa_jit_now() - t) / reps;
+        t = gpa_jit_now();
+        for (u32 r = 0; r < reps; r++) {
+            gpa_pe_loaded_indexbuild(&view, index, 0);
+            for (u32 k = 0; k < setcount; k++) {
+                gpa_pe_loaded_indexlookup(&view, index, set[k], &exp);
+            }
+        }
+        th += (gpa_jit_now() - t) / reps;
+        t = gpa_jit_now();
+        for (u32 r = 0; r < reps; r++) {
+            for (u32 k = 0; k < setcount; k++) {
+                gpa_pe_loaded_indexlookup(&view, index, set[k], &exp);
+            }
+        }
+        thl += (gpa_jit_now() - t) / reps;
+
+        // the same answers as binary search, for the first index of each name
+        u32 expect = 0;
+        for (u32 k = 0; k < setcount; k++) {
+            int first = 1;
+            for (u32 j = 0; j < k && first; j++) {
+                first = strcmp(set[j], set[k]) != 0;
+            }
+            int hit = gpa_pe_loaded_lookup(&view, set[k], &exp);
+            int got = found[k / 64] >> (k % 64) & 1;
+            expect += first && hit;
+            mismatches += first ? hit != got || (hit && viajit[k].address != exp.address) : got;
+        }
+        mismatches += resolved != expect;
+        printf("  version %u: %5u exports, %3u of the set resolved\n", v, count, resolved);
+        free(index);
+        free(image);
+        free(chosen);
+        free(exports);
+    }
+    printf("whole set per version: jit walk %.1f us, binary search %.1f us, index build+lookups %.1f us, "
+           "prebuilt index lookups %.1f us; %u mismatches\n", tj / versions * 1e6, tb / versions * 1e6,
+           th / versions * 1e6, thl / versions * 1e6, mismatches);
+    // compile is paid once; the walk only wins against modules with no index
+    printf("jit vs prebuilt index: %.2fx; compile repaid after %.0f unindexed modules vs a fresh index, "
+           "%.0f vs binary search\n", tj / thl, compiletime / ((th - tj) / versions),
+           tb > tj ? compiletime / ((tb - tj) / versions) : -1.0);
+    gpa_jit_free(&jit);
+    return 0;
+}
+#endif // _GPA_JIT_DEBUG
+#endif // _GPA_JIT_C
@@ -0,0 +1,468 @@
+/*
+    gpa_learned.c
+    a learned index over a module's sorted export names.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Sorted export names map to their positions through a monotonic function,
+    and within the text that follows a common prefix the names are spread
+    fairly evenly. A RadixSpline (Kipf et al., aiDM 2020) models that
+    function on 64-bit keys. A key is the first 8 name bytes after the prefix
+    all names share, read big-endian so integer order matches name order.
+
+    The model has two levels. A radix table over the top bits of the key
+    narrows the search to a few spline knots. Linear interpolation between
+    the two knots around the key then predicts a position. The greedy
+    spline corridor keeps that prediction within a build-time error bound of
+    the first name with the same key. The bound actually reached is measured
+    after the build and stored. Names longer than 8 bytes can share a key,
+    and the wanted name may sit further into such a run, so the search
+    gallops right from the window when the name is beyond its end. A lookup
+    is one radix probe, a short knot search, and a binary search of the
+    window with full compares.
+
+    The model is an accelerator: offset-only like gpa_index.c, optional, and
+    falling back to the plain binary search when absent. Only PE backends
+    are covered, because ELF symbol tables are not sorted.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_learned_size(u32 count, u32 radixbits)
+        bytes that are always enough for a model over count names
+    gpa_LEARNED *gpa_<backend>_learnedbuild(gpa_MODVIEW *view, ptr buffer, u32 radixbits,
+                                            u32 maxerror, u64 fingerprint)
+        builds the model with a radix table of 2^radixbits entries, 0 if the
+        name table is not strictly sorted
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_learnedlookup(gpa_MODVIEW *view, gpa_LEARNED *model, char *name, gpa_EXPORT *exp)
+        looks a name up through the model, or by binary search if model is 0
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_learned_validate(gpa_LEARNED *model, u64 size, u64 fingerprint)
+        checks a model that came from somewhere else: the header, that the
+        tables fit, and that knots and radix entries are ordered and in range
+        so predict never indexes past them. O(numknots + 2^radixbits)
+*/
+
+#ifndef _GPA_LEARNED_C
+#define _GPA_LEARNED_C
+#define _GPA_LEARNED_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_LEARNED_MAGIC       0x53415047      // "GPAS"
+#define GPA_LEARNED_VERSION     1
+#define GPA_LEARNED_MAXRADIX    24
+
+typedef struct _gpa_LEARNED {
+    u32   magic;
+    u32   version;
+    u64   fingerprint;
+    u32   count;
+    u32   skip;                 // length of the prefix every name shares
+    u32   error;                // measured bound on |prediction - position|
+    u32   maxrun;               // most names sharing one key
+    u32   numknots;
+    u32   radixbits;
+    u32   shift;                // radix slot is (key - minkey) >> shift
+    u32   knots;                // offset of gpa_LEARNED_KNOT[numknots]
+    u32   radix;                // offset of u32[2^radixbits + 1]
+    u32   size;
+    u64   minkey;
+} gpa_LEARNED;
+
+typedef struct _gpa_LEARNED_KNOT {
+    u64   key;
+    u32   position;
+    u32   reserved;
+} gpa_LEARNED_KNOT;
+
+u64 gpa_learned_size(u32 count, u32 radixbits) {
+    return sizeof(gpa_LEARNED) + (u64)(count + 1) * sizeof(gpa_LEARNED_KNOT) + 4ull * ((1ull << radixbits) + 1);
+}
+
+// 8 bytes from p, big-endian, zero past the terminator
+inline static u64 gpa_learned_key(u8 *p, u64 remaining) {
+    u64 key = 0;
+    u32 i = 0;
+    for (; i < 8 && i < remaining && p[i]; i++) {
+        key = key << 8 | p[i];
+    }
+    return key << (8 * (8 - i));
+}
+
+inline static u32 gpa_learned_predict(gpa_LEARNED *model, u64 key) {
+    gpa_LEARNED_KNOT *knots = (gpa_LEARNED_KNOT*)((u8*)model + model->knots);
+    u32 *radix = (u32*)((u8*)model + model->radix);
+    if (key <= model->minkey) {
+        return knots[0].position;
+    }
+    u64 slot = (key - model->minkey) >> model->shift;
+    if (slot >= (1ull << model->radixbits)) {
+        return knots[model->numknots - 1].position;
+    }
+    // the last knot at or below key is in [radix[slot] - 1, radix[slot + 1])
+    u32 lo = radix[slot] ? radix[slot] - 1 : 0, hi = radix[slot + 1];
+    while (hi - lo > 1) {
+        u32 mid = (lo + hi) / 2;
+        if (knots[mid].key <= key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo + 1 >= model->numknots) {
+        return knots[lo].position;
+    }
+    // interpolate on the top 32 significant bits of the key span, which keeps
+    // the product in 64 bits; the measured error includes the rounding
+    gpa_LEARNED_KNOT *a = &knots[lo], *b = &knots[lo + 1];
+    u64 span = b->key - a->key, offset = key - a->key;
+    u32 bits = 64 - __builtin_clzll(span);
+    if (bits > 32) {
+        span   >>= bits - 32;
+        offset >>= bits - 32;
+    }
+    return a->position + (u32)(offset * (b->position - a->position) / span);
+}
+
+typedef char *(*gpa_LEARNED_NAME)(gpa_MODVIEW *view, u32 i);
+
+inline static gpa_LEARNED *gpa_learned_build(gpa_MODVIEW *view, gpa_LEARNED_NAME getname, u32 count,
+                                             ptr buffer, u32 radixbits, u32 maxerror, u64 fingerprint) {
+    if (count == 0 || radixbits > GPA_LEARNED_MAXRADIX) {
+        return 0;
+    }
+    // the shared prefix, and that the table is sorted
+    char *first = getname(view, 0);
+    if (!first) {
+        return 0;
+    }
+    u64 skip = gpa_modview_remaining(view, first);
+    for (u32 i = 1; i < count; i++) {
+        char *previous = getname(view, i - 1), *name = getname(view, i);
+        if (!name || gpa_modview_strcmp(view, previous, name) >= 0) {
+            return 0;
+        }
+        u64 shared = 0;
+        while (shared < skip && first[shared] && first[shared] == name[shared]) {
+            shared++;
+        }
+        skip = shared;
+    }
+
+    gpa_LEARNED *model = buffer;
+    gpa_LEARNED_KNOT *knots = (gpa_LEARNED_KNOT*)((u8*)model + sizeof(gpa_LEARNED));
+    u32 numknots = 0;
+    // greedy spline corridor over the first position of every distinct key.
+    // slopes are kept as exact fractions: position delta over key delta
+    u64 basekey = 0, previouskey = 0;
+    u32 baseposition = 0, previousposition = 0, run = 0, maxrun = 0;
+    i64 uppernum = 0, lowernum = 0;
+    u64 upperden = 0, lowerden = 0;
+    for (u32 i = 0; i < count; i++) {
+        char *name = getname(view, i);
+        u64 key = gpa_learned_key((u8*)name + skip, gpa_modview_remaining(view, name) - skip);
+        if (i > 0 && key == previouskey) {
+            maxrun = ++run > maxrun ? run : maxrun;
+            continue;
+        }
+        run = 1;
+        maxrun = maxrun ? maxrun : 1;
+        if (i == 0) {
+            knots[numknots++] = (gpa_LEARNED_KNOT){ key, i, 0 };
+            basekey = key, baseposition = i;
+        } else {
+            u64 dx = key - basekey;
+            i64 dy = (i64)i - baseposition;
+            // outside the corridor: dy / dx above upper or below lower
+            int outside = upperden && ((__int128)dy * upperden > (__int128)uppernum * dx
+                                       || (__int128)dy * lowerden < (__int128)lowernum * dx);
+            if (outside) {
+                knots[numknots++] = (gpa_LEARNED_KNOT){ previouskey, previousposition, 0 };
+                basekey = previouskey, baseposition = previousposition;
+                dx = key - basekey;
+                dy = (i64)i - baseposition;
+                upperden = lowerden = 0;
+            }
+            // narrow the corridor to pass within maxerror of this point
+            i64 up = dy + maxerror, down = dy - maxerror;
+            if (!upperden || (__int128)up * upperden < (__int128)uppernum * dx) {
+                uppernum = up, upperden = dx;
+            }
+            if (!lowerden || (__int128)down * lowerden > (__int128)lowernum * dx) {
+                lowernum = down, lowerden = dx;
+            }
+        }
+        previouskey = key, previousposition = i;
+    }
+    if (knots[numknots - 1].key != previouskey) {
+        knots[numknots++] = (gpa_LEARNED_KNOT){ previouskey, previousposition, 0 };
+    }
+
+    model->magic       = GPA_LEARNED_MAGIC;
+    model->version     = GPA_LEARNED_VERSION;
+    model->fingerprint = fingerprint;
+    model->count       = count;
+    model->skip        = (u32)skip;
+    model->maxrun      = maxrun;
+    model->numknots    = numknots;
+    model->radixbits   = radixbits;
+    model->minkey      = knots[0].key;
+    model->knots       = sizeof(gpa_LEARNED);
+    model->radix       = model->knots + numknots * sizeof(gpa_LEARNED_KNOT);
+    model->size        = (u32)(model->radix + 4ull * ((1ull << radixbits) + 1));
+    u64 range = previouskey - model->minkey;
+    u32 bits  = range ? 64 - __builtin_clzll(range) : 0;
+    model->shift = bits > radixbits ? bits - radixbits : 0;
+    // radix[s]: knots whose slot is below s
+    u32 *radix = (u32*)((u8*)model + model->radix);
+    u32 k = 0;
+    for (u64 s = 0; s <= (1ull << radixbits); s++) {
+        while (k < numknots && ((knots[k].key - model->minkey) >> model->shift) < s) {
+            k++;
+        }
+        radix[s] = k;
+    }
+    // the bound the model really achieves, rounding included
+    u32 error = 0;
+    for (u32 i = 0; i < count; i++) {
+        char *name = getname(view, i);
+        u64 key = gpa_learned_key((u8*)name + skip, gpa_modview_remaining(view, name) - skip);
+        if (i > 0 && key == previouskey) {
+            continue;
+        }
+        u32 predicted = gpa_learned_predict(model, key);
+        u32 distance  = predicted > i ? predicted - i : i - predicted;
+        error = distance > error ? distance : error;
+        previouskey = key;
+    }
+    model->error = error;
+    return model;
+}
+
+int gpa_learned_validate(gpa_LEARNED *model, u64 size, u64 fingerprint) {
+    if (size < sizeof(gpa_LEARNED) || model->magic != GPA_LEARNED_MAGIC || model->version != GPA_LEARNED_VERSION
+        || model->fingerprint != fingerprint || model->size > size) {
+        return 0;
+    }
+    if (!model->numknots || model->numknots > model->count + 1 || model->radixbits > GPA_LEARNED_MAXRADIX
+        || model->shift >= 64 || model->knots < sizeof(gpa_LEARNED) || model->knots % 8 || model->radix % 4
+        || (u64)model->knots + (u64)model->numknots * sizeof(gpa_LEARNED_KNOT) > model->radix
+        || (u64)model->radix + 4ull * ((1ull << model->radixbits) + 1) > model->size) {
+        return 0;
+    }
+    // predict interpolates between neighbouring knots, so keys must strictly
+    // increase (a zero span divides by zero) and positions must not go back
+    gpa_LEARNED_KNOT *knots = (gpa_LEARNED_KNOT*)((u8*)model + model->knots);
+    if (knots[0].key != model->minkey || knots[0].position > model->count) {
+        return 0;
+    }
+    for (u32 k = 1; k < model->numknots; k++) {
+        if (knots[k].key <= knots[k - 1].key || knots[k].position < knots[k - 1].position
+            || knots[k].position > model->count) {
+            return 0;
+        }
+    }
+    // predict reads knots[radix[slot] - 1] through knots[radix[slot + 1] - 1]
+    u32 *radix = (u32*)((u8*)model + model->radix);
+    for (u64 s = 0; s <= (1ull << model->radixbits); s++) {
+        if (radix[s] > model->numknots || (s && radix[s] < radix[s - 1])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#define GPA_LEARNED_DEFINE(backend)                                                             \
+    gpa_LEARNED *gpa_##backend##_learnedbuild(gpa_MODVIEW *view, ptr buffer, u32 radixbits,     \
+                                              u32 maxerror, u64 fingerprint) {                  \
+        return gpa_learned_build(view, gpa_##backend##_name, gpa_##backend##_count(view),       \
+                                 buffer, radixbits, maxerror, fingerprint);                     \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_learnedlookup(gpa_MODVIEW *view, gpa_LEARNED *model, char *name, gpa_EXPORT *exp) { \
+        u32 count = gpa_##backend##_count(view);                                                \
+        if (!model || model->count != count) {                                                  \
+            return gpa_##backend##_lookup(view, name, exp);                                     \
+        }                                                                                       \
+        /* a name without the shared prefix cannot be there */                                  \
+        char *first = gpa_##backend##_name(view, 0);                                            \
+        for (u32 i = 0; i < model->skip; i++) {                                                 \
+            if (name[i] != first[i]) {                                                          \
+                return 0;                                                                       \
+            }                                                                                   \
+        }                                                                                       \
+        u32 predicted = gpa_learned_predict(model, gpa_learned_key((u8*)name + model->skip, ~(u64)0)); \
+        u32 lo = predicted > model->error ? predicted - model->error : 0;                       \
+        u64 hi = (u64)predicted + model->error + 1;                                             \
+        /* the first name with this key is in [lo, hi). the name itself may be */               \
+        /* further into a run of equal keys, so gallop right until passed */                    \
+        for (u64 step = model->error + 1; hi < count; step *= 2) {                              \
+            char *candidate = gpa_##backend##_name(view, (u32)hi - 1);                          \
+            if (!candidate || gpa_modview_strcmp(view, name, candidate) <= 0) {                 \
+                break;                                                                          \
+            }                                                                                   \
+            lo  = (u32)hi;                                                                      \
+            hi += step;                                                                         \
+        }                                                                                       \
+        hi = hi < count ? hi : count;                                                           \
+        while (lo < hi) {                                                                       \
+            u32 mid = (u32)((lo + hi) / 2);                                                     \
+            char *candidate = gpa_##backend##_name(view, mid);                                  \
+            int cmp = candidate ? gpa_modview_strcmp(view, name, candidate) : -1;               \
+            if (cmp == 0) {                                                                     \
+                return gpa_##backend##_export(view, mid, exp);                                  \
+            }                                                                                   \
+            if (cmp < 0) {                                                                      \
+                hi = mid;                                                                       \
+            } else {                                                                            \
+                lo = mid + 1;                                                                   \
+            }                                                                                   \
+        }                                                                                       \
+        return 0;                                                                               \
+    }
+
+GPA_LEARNED_DEFINE(pe_loaded)
+GPA_LEARNED_DEFINE(pe_file)
+
+// development code: error bounds, model size and latency against binary
+// search and the linear walk in gpa_getgetprocaddress
+#if _GPA_LEARNED_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_learned_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_learned_byname(const void *a, const void *b) {
+    return gpa_strcmp(*(char**)a, *(char**)b);
+}
+
+static u32 gpa_learned_linear(gpa_MODVIEW *view, char *name) {
+    for (u32 i = 0; i < view->count; i++) {
+        if (gpa_strcmp((char*)view->base + view->names[i], name) == 0) {
+            return view->functions[view->ordinals[i]];
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    char *heads[] = { "Nt", "Zw", "Rtl", "Ldr", "Etw", "Create", "Get", "Set", "Query", "Open", "Close",
+                      "Enum", "Reg", "Crypt", "Wsa", "Virtual", "Heap", "Local", "Global", "Find" };
+    char *bodies[] = { "File", "Process", "Thread", "Key", "Value", "Event", "Mutex", "Section", "Memory",
+                       "Token", "Object", "Module", "Window", "Path", "String", "Unicode", "Time", "Info",
+                       "Information", "Handle", "Pipe", "Port", "Timer", "Semaphore" };
+    char *tails[] = { "", "A", "W", "Ex", "ExA", "ExW", "2", "Internal" };
+    u32 nh = sizeof(heads) / sizeof(*heads), nb = sizeof(bodies) / sizeof(*bodies), nt = sizeof(tails) / sizeof(*tails);
+    char **names = malloc(sizeof(char*) * nh * nb * nb * nt);
+    u32 count = 0;
+    for (u32 h = 0; h < nh; h++) {
+        for (u32 b1 = 0; b1 < nb; b1++) {
+            for (u32 b2 = 0; b2 < nb; b2++) {
+                for (u32 t = 0; t < nt; t++) {
+                    if (((h * 131 + b1 * 31 + b2 * 7 + t) * 2654435761u >> 16) % 4 == 0) {
+                        char *name = malloc(64);
+                        snprintf(name, 64, "%s%s%s%s", heads[h], bodies[b1], b1 == b2 ? "" : bodies[b2], tails[t]);
+                        names[count++] = name;
+                    }
+                }
+            }
+        }
+    }
+    qsort(names, count, sizeof(char*), gpa_learned_byname);
+    u32 unique = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0) {
+            names[unique++] = names[i];
+        }
+    }
+    count = unique < 65535 ? unique : 65535;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = names[i];
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity);
+    gpa_MODVIEW view;
+    gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+
+    u32 *order = malloc(sizeof(u32) * count);
+    for (u32 i = 0; i < count; i++) {
+        order[i] = (u32)((i * 2654435761ull) % count);
+    }
+    u32 rounds = 2000000 / count + 1;
+    u64 lookups = (u64)rounds * count, sum = 0;
+    gpa_EXPORT exp;
+    double t0 = gpa_learned_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < count; i++) {
+            gpa_pe_loaded_lookup(&view, names[order[i]], &exp);
+            sum += exp.address;
+        }
+    }
+    double t1 = gpa_learned_now();
+    for (u32 i = 0; i < 2000; i++) {
+        sum += gpa_learned_linear(&view, names[order[i]]);
+    }
+    double t2 = gpa_learned_now();
+    printf("%u names: binary search %.1f ns, linear walk %.1f ns per lookup\n", count,
+           (t1 - t0) * 1e9 / lookups, (t2 - t1) * 1e9 / 2000);
+
+    u32 bounds[] = { 4, 16, 64, 256 };
+    u32 wrong = 0;
+    for (u32 b = 0; b < 4; b++) {
+        u64 size = gpa_learned_size(count, 12);
+        gpa_LEARNED *model = gpa_pe_loaded_learnedbuild(&view, malloc(size), 12, bounds[b], 7);
+        if (!model || !gpa_learned_validate(model, size, 7)) {
+            printf("build failed\n");
+            return 1;
+        }
+        // a radix entry past the knots, then out of order, and knots out of order
+        u32 *radix = (u32*)((u8*)model + model->radix);
+        gpa_LEARNED_KNOT *knots = (gpa_LEARNED_KNOT*)((u8*)model + model->knots);
+        u32 saved = radix[1];
+        radix[1] = model->numknots + 1;
+        wrong += gpa_learned_validate(model, size, 7);
+        radix[1] = radix[2] + 1;
+        wrong += radix[2] < model->numknots && gpa_learned_validate(model, size, 7);
+        radix[1] = saved;
+        u64 savedkey = knots[1].key;
+        knots[1].key = knots[0].key;
+        wrong += gpa_learned_validate(model, size, 7);
+        knots[1].key = savedkey;
+        u32 savedposition = knots[1].position;
+        knots[1].position = model->count + 1;
+        wrong += gpa_learned_validate(model, size, 7);
+        knots[1].position = savedposition;
+        wrong += !gpa_learned_validate(model, size, 7);
+        for (u32 i = 0; i < count; i++) {
+            wrong += !gpa_pe_loaded_learnedlookup(&view, model, names[i], &exp) || exp.address != exports[i].rva;
+            char probe[80];
+            snprintf(probe, sizeof(probe), "%sZ", names[i]);
+            wrong += gpa_pe_loaded_learnedlookup(&view, model, probe, &exp);
+        }
+        double t3 = gpa_learned_now();
+        for (u32 r = 0; r < rounds; r++) {
+            for (u32 i = 0; i < count; i++) {
+                gpa_pe_loaded_learnedlookup(&view, model, names[order[i]], &exp);
+                sum += exp.address;
+            }
+        }
+        double t4 = gpa_learned_now();
+        printf("bound %3u: %5u knots, %6u bytes, error %3u, longest run %3u, skip %u: %.1f ns per lookup, %u wrong\n",
+               bounds[b], model->numknots, model->size, model->error, model->maxrun, model->skip,
+               (t4 - t3) * 1e9 / lookups, wrong);
+    }
+    printf("(%llx)\n", (unsigned long long)sum);
+    return wrong != 0;
+}
+#endif // _GPA_LEARNED_DEBUG
+#endif // _GPA_LEARNED_C
@@ -0,0 +1,196 @@
+/*
+    gpa_linux.c
+    raw x86-64 linux system calls for the getprocaddress tooling.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    The indexing tools run on Linux build machines and treat Windows images and
+    import libraries as plain data. To stay true to the no-CRT rule of
+    getprocaddress.c, the handful of system calls they need are issued directly.
+    Raw calls return the kernel result, i.e. a negative errno on failure.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_mapfile(char *path, u64 *size)
+        maps a whole file read-only, returns 0 on failure
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_unmapfile(ptr base, u64 size)
+        releases a mapping returned by gpa_mapfile
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_allocpages(u64 size) / void gpa_freepages(ptr base, u64 size)
+        anonymous zero-filled memory straight from the kernel
+*/
+
+#ifndef _GPA_LINUX_C
+#define _GPA_LINUX_C
+#include "getprocaddress.c"
+
+#define GPA_SYS_read            0
+#define GPA_SYS_write           1
+#define GPA_SYS_open            2
+#define GPA_SYS_close           3
+#define GPA_SYS_fstat           5
+#define GPA_SYS_mmap            9
+#define GPA_SYS_mprotect        10
+#define GPA_SYS_munmap          11
+#define GPA_SYS_getpid          39
+#define GPA_SYS_ftruncate       77
+#define GPA_SYS_rename          82
+#define GPA_SYS_unlink          87
+#define GPA_SYS_futex           202
+#define GPA_SYS_io_uring_setup  425
+#define GPA_SYS_io_uring_enter  426
+
+#define GPA_O_RDONLY            0
+#define GPA_O_RDWR              2
+#define GPA_O_CREAT             0100
+#define GPA_O_EXCL              0200
+#define GPA_PROT_READ           1
+#define GPA_PROT_WRITE          2
+#define GPA_PROT_EXEC           4
+#define GPA_MAP_SHARED          1
+#define GPA_MAP_PRIVATE         2
+#define GPA_MAP_ANONYMOUS       0x20
+#define GPA_MAP_POPULATE        0x8000
+#define GPA_MAP_FAILED(p)       ((u64)(p) > (u64)-4096)
+#define GPA_FUTEX_WAIT_PRIVATE  128     // FUTEX_WAIT | FUTEX_PRIVATE_FLAG
+#define GPA_FUTEX_WAKE_PRIVATE  129
+
+// struct stat as the x86-64 kernel lays it out
+typedef struct _gpa_STAT {
+    u64   st_dev;
+    u64   st_ino;
+    u64   st_nlink;
+    u32   st_mode;
+    u32   st_uid;
+    u32   st_gid;
+    u32   pad0;
+    u64   st_rdev;
+    i64   st_size;
+    i64   st_blksize;
+    i64   st_blocks;
+    i64   st_time[6];
+    i64   reserved[3];
+} gpa_STAT;
+
+inline static i64 gpa_syscall6(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5, i64 a6) {
+    i64 ret;
+    register i64 r10 __asm__("r10") = a4;
+    register i64 r8  __asm__("r8")  = a5;
+    register i64 r9  __asm__("r9")  = a6;
+    __asm__ volatile (
+        "syscall"
+        : "=a" (ret)
+        : "a" (n), "D" (a1), "S" (a2), "d" (a3), "r" (r10), "r" (r8), "r" (r9)
+        : "rcx", "r11", "memory"    // the kernel uses rcx/r11 for the return
+    );
+    return ret;
+}
+
+#define gpa_syscall3(n, a1, a2, a3) gpa_syscall6((n), (i64)(a1), (i64)(a2), (i64)(a3), 0, 0, 0)
+
+inline static i64 gpa_sys_read(i32 fd, ptr buf, u64 count) {
+    return gpa_syscall3(GPA_SYS_read, fd, buf, count);
+}
+
+inline static i64 gpa_sys_write(i32 fd, ptr buf, u64 count) {
+    return gpa_syscall3(GPA_SYS_write, fd, buf, count);
+}
+
+inline static i32 gpa_sys_open(char *path, i32 flags, i32 mode) {
+    return (i32)gpa_syscall3(GPA_SYS_open, path, flags, mode);
+}
+
+inline static i32 gpa_sys_close(i32 fd) {
+    return (i32)gpa_syscall3(GPA_SYS_close, fd, 0, 0);
+}
+
+inline static i32 gpa_sys_fstat(i32 fd, gpa_STAT *st) {
+    return (i32)gpa_syscall3(GPA_SYS_fstat, fd, st, 0);
+}
+
+inline static ptr gpa_sys_mmap(ptr addr, u64 length, i32 prot, i32 flags, i32 fd, i64 offset) {
+    return (ptr)gpa_syscall6(GPA_SYS_mmap, (i64)addr, length, prot, flags, fd, offset);
+}
+
+inline static i32 gpa_sys_munmap(ptr addr, u64 length) {
+    return (i32)gpa_syscall3(GPA_SYS_munmap, addr, length, 0);
+}
+
+inline static i32 gpa_sys_mprotect(ptr addr, u64 length, i32 prot) {
+    return (i32)gpa_syscall3(GPA_SYS_mprotect, addr, length, prot);
+}
+
+inline static i32 gpa_sys_getpid() {
+    return (i32)gpa_syscall3(GPA_SYS_getpid, 0, 0, 0);
+}
+
+inline static i32 gpa_sys_ftruncate(i32 fd, u64 length) {
+    return (i32)gpa_syscall3(GPA_SYS_ftruncate, fd, length, 0);
+}
+
+inline static i32 gpa_sys_rename(char *from, char *to) {
+    return (i32)gpa_syscall3(GPA_SYS_rename, from, to, 0);
+}
+
+inline static i32 gpa_sys_unlink(char *path) {
+    return (i32)gpa_syscall3(GPA_SYS_unlink, path, 0, 0);
+}
+
+// sleeps while *addr == value, no timeout. returns early (-EAGAIN, -EINTR)
+// if the value already changed or on a signal, so callers always recheck.
+inline static i32 gpa_sys_futexwait(u32 *addr, u32 value) {
+    return (i32)gpa_syscall6(GPA_SYS_futex, (i64)addr, GPA_FUTEX_WAIT_PRIVATE, value, 0, 0, 0);
+}
+
+inline static i32 gpa_sys_futexwake(u32 *addr, u32 count) {
+    return (i32)gpa_syscall6(GPA_SYS_futex, (i64)addr, GPA_FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
+
+inline static i32 gpa_sys_io_uring_setup(u32 entries, ptr params) {
+    return (i32)gpa_syscall3(GPA_SYS_io_uring_setup, entries, params, 0);
+}
+
+inline static i32 gpa_sys_io_uring_enter(i32 fd, u32 submit, u32 complete, u32 flags) {
+    return (i32)gpa_syscall6(GPA_SYS_io_uring_enter, fd, submit, complete, flags, 0, 0);
+}
+
+ptr gpa_mapfile(char *path, u64 *size) {
+    gpa_STAT st;
+    ptr base = 0;
+    i32 fd = gpa_sys_open(path, GPA_O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    if (gpa_sys_fstat(fd, &st) == 0 && st.st_size > 0) {
+        base = gpa_sys_mmap(0, st.st_size, GPA_PROT_READ, GPA_MAP_PRIVATE, fd, 0);
+        if (GPA_MAP_FAILED(base)) {
+            base = 0;
+        } else {
+            *size = st.st_size;
+        }
+    }
+    // the mapping keeps its own reference to the file
+    gpa_sys_close(fd);
+    return base;
+}
+
+void gpa_unmapfile(ptr base, u64 size) {
+    if (base) {
+        gpa_sys_munmap(base, size);
+    }
+}
+
+ptr gpa_allocpages(u64 size) {
+    ptr base = gpa_sys_mmap(0, size, GPA_PROT_READ | GPA_PROT_WRITE,
+                            GPA_MAP_PRIVATE | GPA_MAP_ANONYMOUS, -1, 0);
+    return GPA_MAP_FAILED(base) ? 0 : base;
+}
+
+void gpa_freepages(ptr base, u64 size) {
+    if (base) {
+        gpa_sys_munmap(base, size);
+    }
+}
+
+#endif // _GPA_LINUX_C
@@ -0,0 +1,443 @@
+/*
+    gpa_macho.c
+    symbol lookup in Mach-O images through the dyld export trie.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    The Mach-O counterpart of gpa_getgetprocaddress, for tooling that handles macOS
+    binaries as data. Both LC_DYLD_EXPORTS_TRIE and the older LC_DYLD_INFO(_ONLY)
+    export area are understood. Lookups walk the trie one edge at a time, so the
+    cost depends on the name length rather than on the number of exports.
+    Every read is bounds checked against the buffer; images are untrusted input.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_macho_open(gpa_MACHO *macho, ptr image, u64 size)
+        locates the export trie in a 64-bit Mach-O image, returns 1 on success
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_macho_lookup(gpa_MACHO *macho, char *name, gpa_MACHO_EXPORT *symbol)
+        walks the trie for name (with its leading underscore) and decodes its
+        terminal info: address, flags, re-export target, resolver
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_macho_getprocaddress(ptr image, u64 size, char *name)
+        returns image + the export's address, or 0 if it is missing, re-exported
+        or thread-local (its value is a TLV descriptor, not code). an absolute
+        symbol's value is returned as is. the address is relative to the mach
+        header, so this is exact for loaded images and for __TEXT symbols of a
+        file mapped as-is
+*/
+
+#ifndef _GPA_MACHO_C
+#define _GPA_MACHO_C
+#define _GPA_MACHO_DEBUG 0
+#include "getprocaddress.c"
+
+#define GPA_MH_MAGIC_64                 0xfeedfacf
+#define GPA_LC_DYLD_INFO                0x22
+#define GPA_LC_DYLD_INFO_ONLY           0x80000022
+#define GPA_LC_DYLD_EXPORTS_TRIE        0x80000033
+
+#define GPA_EXPORT_SYMBOL_FLAGS_KIND_MASK           0x03
+#define GPA_EXPORT_SYMBOL_FLAGS_KIND_REGULAR        0x00
+#define GPA_EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL   0x01
+#define GPA_EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE       0x02
+#define GPA_EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION     0x04
+#define GPA_EXPORT_SYMBOL_FLAGS_REEXPORT            0x08
+#define GPA_EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER   0x10
+
+// https://github.com/apple-oss-distributions/xnu/blob/main/EXTERNAL_HEADERS/mach-o/loader.h
+#pragma pack(push, 1)
+typedef struct _gpa_MACH_HEADER_64 {
+    u32   magic;
+    i32   cputype;
+    i32   cpusubtype;
+    u32   filetype;
+    u32   ncmds;
+    u32   sizeofcmds;
+    u32   flags;
+    u32   reserved;
+} gpa_MACH_HEADER_64, *gpa_PMACH_HEADER_64;
+
+typedef struct _gpa_LOAD_COMMAND {
+    u32   cmd;
+    u32   cmdsize;
+} gpa_LOAD_COMMAND, *gpa_PLOAD_COMMAND;
+
+typedef struct _gpa_LINKEDIT_DATA_COMMAND {
+    u32   cmd;
+    u32   cmdsize;
+    u32   dataoff;
+    u32   datasize;
+} gpa_LINKEDIT_DATA_COMMAND, *gpa_PLINKEDIT_DATA_COMMAND;
+
+typedef struct _gpa_DYLD_INFO_COMMAND {
+    u32   cmd;
+    u32   cmdsize;
+    u32   rebase_off;
+    u32   rebase_size;
+    u32   bind_off;
+    u32   bind_size;
+    u32   weak_bind_off;
+    u32   weak_bind_size;
+    u32   lazy_bind_off;
+    u32   lazy_bind_size;
+    u32   export_off;
+    u32   export_size;
+} gpa_DYLD_INFO_COMMAND, *gpa_PDYLD_INFO_COMMAND;
+#pragma pack(pop)
+
+typedef struct _gpa_MACHO {
+    u8   *image;
+    u64   size;
+    u8   *trie;
+    u32   triesize;
+} gpa_MACHO;
+
+typedef struct _gpa_MACHO_EXPORT {
+    u64   flags;
+    u64   address;              // relative to the mach header; stub for resolvers
+    u64   resolver;             // STUB_AND_RESOLVER only
+    u64   ordinal;              // REEXPORT only: dylib ordinal (1-based)
+    char *importname;           // REEXPORT only: name in that dylib, 0 if unchanged
+} gpa_MACHO_EXPORT;
+
+// decodes one ULEB128 from [*p, end). on overflow or truncation *p is set
+// to end so the caller's next bounds check fails.
+inline static u64 gpa_macho_uleb(u8 **p, u8 *end) {
+    u64 value = 0;
+    u32 shift = 0;
+    while (*p < end) {
+        u8 byte = *(*p)++;
+        if (shift < 64) {
+            value |= (u64)(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    *p = end;
+    return 0;
+}
+
+int gpa_macho_open(gpa_MACHO *macho, ptr image, u64 size) {
+    gpa_PMACH_HEADER_64 header = (gpa_PMACH_HEADER_64)image;
+    macho->image    = image;
+    macho->size     = size;
+    macho->trie     = 0;
+    macho->triesize = 0;
+    if (size < sizeof(gpa_MACH_HEADER_64) || header->magic != GPA_MH_MAGIC_64) {
+        return 0;
+    }
+    u8 *cmds = (u8*)image + sizeof(gpa_MACH_HEADER_64);
+    u8 *end  = (u8*)image + size;
+    if (header->sizeofcmds > (u64)(end - cmds)) {
+        return 0;
+    }
+    end = cmds + header->sizeofcmds;
+    u64 off = 0, len = 0;
+    for (u32 i = 0; i < header->ncmds; i++) {
+        gpa_PLOAD_COMMAND cmd = (gpa_PLOAD_COMMAND)cmds;
+        if ((u64)(end - cmds) < sizeof(gpa_LOAD_COMMAND) || cmd->cmdsize < sizeof(gpa_LOAD_COMMAND)
+            || cmd->cmdsize > (u64)(end - cmds)) {
+            return 0;
+        }
+        if (cmd->cmd == GPA_LC_DYLD_EXPORTS_TRIE && cmd->cmdsize >= sizeof(gpa_LINKEDIT_DATA_COMMAND)) {
+            // the newer command wins over dyld_info if both are present
+            off = ((gpa_PLINKEDIT_DATA_COMMAND)cmd)->dataoff;
+            len = ((gpa_PLINKEDIT_DATA_COMMAND)cmd)->datasize;
+            break;
+        }
+        if ((cmd->cmd == GPA_LC_DYLD_INFO || cmd->cmd == GPA_LC_DYLD_INFO_ONLY)
+            && cmd->cmdsize >= sizeof(gpa_DYLD_INFO_COMMAND)) {
+            off = ((gpa_PDYLD_INFO_COMMAND)cmd)->export_off;
+            len = ((gpa_PDYLD_INFO_COMMAND)cmd)->export_size;
+        }
+        cmds += cmd->cmdsize;
+    }
+    if (len == 0 || off > size || len > size - off) {
+        return 0;
+    }
+    macho->trie     = (u8*)image + off;
+    macho->triesize = (u32)len;
+    return 1;
+}
+
+int gpa_macho_lookup(gpa_MACHO *macho, char *name, gpa_MACHO_EXPORT *symbol) {
+    u8 *start = macho->trie;
+    u8 *end   = start + macho->triesize;
+    u8 *p     = start;
+    // every edge consumes at least one character, so the walk cannot outlive the name
+    for (;;) {
+        u64 terminalsize = gpa_macho_uleb(&p, end);
+        if (terminalsize > (u64)(end - p)) {
+            return 0;
+        }
+        if (*name == '\0') {
+            if (terminalsize == 0) {
+                return 0;       // a prefix of other exports, not an export itself
+            }
+            u8 *q = p;
+            u8 *terminalend = p + terminalsize;
+            symbol->flags      = gpa_macho_uleb(&q, terminalend);
+            symbol->address    = 0;
+            symbol->resolver   = 0;
+            symbol->ordinal    = 0;
+            symbol->importname = 0;
+            if (symbol->flags & GPA_EXPORT_SYMBOL_FLAGS_REEXPORT) {
+                symbol->ordinal = gpa_macho_uleb(&q, terminalend);
+                u8 *s = q;
+                while (s < terminalend && *s) {
+                    s++;
+                }
+                if (s >= terminalend) {
+                    return 0;
+                }
+                if (*q) {
+                    symbol->importname = (char*)q;
+                }
+            } else {
+                symbol->address = gpa_macho_uleb(&q, terminalend);
+                if (symbol->flags & GPA_EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) {
+                    symbol->resolver = gpa_macho_uleb(&q, terminalend);
+                }
+            }
+            return 1;
+        }
+        p += terminalsize;
+        if (p >= end) {
+            return 0;
+        }
+        u8 children = *p++;
+        u8 *next = 0;
+        for (u32 i = 0; i < children && !next; i++) {
+            // edge labels of siblings never share a first character
+            char *n = name;
+            u8 *label = p;
+            while (p < end && *p && *p == (u8)*n) {
+                p++;
+                n++;
+            }
+            if (p >= end) {
+                return 0;
+            }
+            if (*p == '\0' && p != label) {
+                p++;
+                u64 offset = gpa_macho_uleb(&p, end);
+                if (offset >= macho->triesize) {
+                    return 0;
+                }
+                name = n;
+                next = start + offset;
+            } else if (p != label) {
+                return 0;       // diverged inside the only candidate edge
+            } else {
+                while (p < end && *p) {
+                    p++;
+                }
+                p++;
+                gpa_macho_uleb(&p, end);
+            }
+        }
+        if (!next) {
+            return 0;
+        }
+        p = next;
+    }
+}
+
+ptr gpa_macho_getprocaddress(ptr image, u64 size, char *name) {
+    gpa_MACHO macho;
+    gpa_MACHO_EXPORT symbol;
+    if (!gpa_macho_open(&macho, image, size) || !gpa_macho_lookup(&macho, name, &symbol)) {
+        return 0;
+    }
+    if (symbol.flags & GPA_EXPORT_SYMBOL_FLAGS_REEXPORT) {
+        return 0;
+    }
+    switch (symbol.flags & GPA_EXPORT_SYMBOL_FLAGS_KIND_MASK) {
+    case GPA_EXPORT_SYMBOL_FLAGS_KIND_REGULAR:
+        return image + symbol.address;
+    case GPA_EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE:
+        return (ptr)symbol.address;
+    default:
+        return 0;
+    }
+}
+
+// development code: builds a synthetic Mach-O with an export trie,
+// checks every name round-trips and times lookups
+#if _GPA_MACHO_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double gpa_macho_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// child offsets are written as padded 5-byte ULEB128 so they can be patched later
+static u8 *gpa_macho_putuleb(u8 *p, u64 value, int pad) {
+    do {
+        u8 byte = value & 0x7f;
+        value >>= 7;
+        if (value || pad > 1) {
+            byte |= 0x80;
+        }
+        *p++ = byte;
+        pad--;
+    } while (value || pad > 0);
+    return p;
+}
+
+static char **gpa_macho_names;
+
+static u8 *gpa_macho_putnode(u8 *trie, u8 *p, u32 lo, u32 hi, u32 depth) {
+    // terminal info if the first name ends exactly here. the last four names
+    // of every thousand exercise the re-export, resolver, absolute and
+    // thread-local encodings.
+    if (gpa_macho_names[lo][depth] == '\0') {
+        u8 info[32], *q = info;
+        if (lo % 1000 == 999) {
+            q = gpa_macho_putuleb(q, GPA_EXPORT_SYMBOL_FLAGS_REEXPORT, 0);
+            q = gpa_macho_putuleb(q, 2, 0);
+            memcpy(q, "_other", 7);
+            q += 7;
+        } else if (lo % 1000 == 998) {
+            q = gpa_macho_putuleb(q, GPA_EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER, 0);
+            q = gpa_macho_putuleb(q, 0x1000 + lo * 16, 0);
+            q = gpa_macho_putuleb(q, 0x2000, 0);
+        } else if (lo % 1000 == 997) {
+            q = gpa_macho_putuleb(q, GPA_EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE, 0);
+            q = gpa_macho_putuleb(q, 0x1000 + lo * 16, 0);
+        } else if (lo % 1000 == 996) {
+            q = gpa_macho_putuleb(q, GPA_EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL, 0);
+            q = gpa_macho_putuleb(q, 0x1000 + lo * 16, 0);
+        } else {
+            q = gpa_macho_putuleb(q, 0, 0);
+            q = gpa_macho_putuleb(q, 0x1000 + lo * 16, 0);
+        }
+        p = gpa_macho_putuleb(p, q - info, 0);
+        memcpy(p, info, q - info);
+        p += q - info;
+        lo++;
+    } else {
+        *p++ = 0;
+    }
+    u8 *count = p++;
+    u8 *slots[256];
+    u32 groups[257], numgroups = 0;
+    for (u32 i = lo; i < hi; i++) {
+        if (i == lo || gpa_macho_names[i][depth] != gpa_macho_names[i - 1][depth]) {
+            groups[numgroups++] = i;
+        }
+    }
+    groups[numgroups] = hi;
+    *count = numgroups;
+    u32 ends[256];
+    for (u32 g = 0; g < numgroups; g++) {
+        // the edge runs to the longest prefix shared by the whole group
+        char *first = gpa_macho_names[groups[g]];
+        char *last  = gpa_macho_names[groups[g + 1] - 1];
+        u32 end = depth + 1;
+        while (first[end] && first[end] == last[end]) {
+            end++;
+        }
+        memcpy(p, first + depth, end - depth);
+        p += end - depth;
+        *p++ = 0;
+        slots[g] = p;
+        ends[g] = end;
+        p += 5;
+    }
+    for (u32 g = 0; g < numgroups; g++) {
+        gpa_macho_putuleb(slots[g], p - trie, 5);
+        p = gpa_macho_putnode(trie, p, groups[g], groups[g + 1], ends[g]);
+    }
+    return p;
+}
+
+static int gpa_macho_cmp(const void *a, const void *b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+int main(int argc, char *argv[]) {
+    u32 numnames = argc > 1 ? atoi(argv[1]) : 100000;
+    char *prefixes[] = { "_NS", "_CF", "_objc_", "_dispatch_", "_pthread_", "_Sec", "_xpc_" };
+    gpa_macho_names = malloc(numnames * sizeof(char*));
+    for (u32 i = 0; i < numnames; i++) {
+        gpa_macho_names[i] = malloc(48);
+        snprintf(gpa_macho_names[i], 48, "%sSymbol%u", prefixes[i % 7], i * 2654435761u % 1000003);
+    }
+    qsort(gpa_macho_names, numnames, sizeof(char*), gpa_macho_cmp);
+    u32 unique = 1;
+    for (u32 i = 1; i < numnames; i++) {
+        if (strcmp(gpa_macho_names[i], gpa_macho_names[unique - 1])) {
+            gpa_macho_names[unique++] = gpa_macho_names[i];
+        }
+    }
+    numnames = unique;
+
+    u8 *image = calloc(1, 4096 + numnames * 64ull);
+    gpa_PMACH_HEADER_64 header = (gpa_PMACH_HEADER_64)image;
+    header->magic = GPA_MH_MAGIC_64;
+    header->ncmds = 1;
+    header->sizeofcmds = sizeof(gpa_LINKEDIT_DATA_COMMAND);
+    gpa_PLINKEDIT_DATA_COMMAND cmd = (gpa_PLINKEDIT_DATA_COMMAND)(header + 1);
+    cmd->cmd = GPA_LC_DYLD_EXPORTS_TRIE;
+    cmd->cmdsize = sizeof(gpa_LINKEDIT_DATA_COMMAND);
+    cmd->dataoff = 4096;
+    u8 *trie = image + 4096;
+    cmd->datasize = gpa_macho_putnode(trie, trie, 0, numnames, 0) - trie;
+    u64 size = 4096 + cmd->datasize;
+    printf("%u exports, trie %u bytes\n", numnames, cmd->datasize);
+
+    gpa_MACHO macho;
+    gpa_MACHO_EXPORT symbol;
+    if (!gpa_macho_open(&macho, image, size)) {
+        printf("open failed\n");
+        return 1;
+    }
+    u32 ok = 0;
+    for (u32 i = 0; i < numnames; i++) {
+        if (!gpa_macho_lookup(&macho, gpa_macho_names[i], &symbol)) {
+            continue;
+        }
+        if (i % 1000 == 999) {
+            ok += (symbol.flags & GPA_EXPORT_SYMBOL_FLAGS_REEXPORT) && symbol.ordinal == 2
+                  && strcmp(symbol.importname, "_other") == 0
+                  && !gpa_macho_getprocaddress(image, size, gpa_macho_names[i]);
+        } else if (i % 1000 == 998) {
+            ok += symbol.address == 0x1000 + i * 16 && symbol.resolver == 0x2000;
+        } else if (i % 1000 == 997) {
+            ok += gpa_macho_getprocaddress(image, size, gpa_macho_names[i]) == (ptr)(0x1000 + i * 16ull);
+        } else if (i % 1000 == 996) {
+            ok += symbol.address == 0x1000 + i * 16 && !gpa_macho_getprocaddress(image, size, gpa_macho_names[i]);
+        } else {
+            ok += gpa_macho_getprocaddress(image, size, gpa_macho_names[i]) == image + 0x1000 + i * 16;
+        }
+    }
+    printf("round trip: %u/%u\n", ok, numnames);
+    char *missing[] = { "", "_", "_NS", "_NSSymbol", "_NSSymbol1x", "_zzz", "_CFSymbol99999999" };
+    for (u32 i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+        if (gpa_macho_lookup(&macho, missing[i], &symbol)) {
+            printf("unexpected hit: '%s'\n", missing[i]);
+        }
+    }
+
+    u32 rounds = 10, found = 0;
+    double t0 = gpa_macho_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < numnames; i++) {
+            found += gpa_macho_lookup(&macho, gpa_macho_names[(i * 7919u) % numnames], &symbol);
+        }
+    }
+    double t1 = gpa_macho_now();
+    printf("trie lookup: %.1f ns/lookup (%u hits)\n", (t1 - t0) * 1e9 / ((double)rounds * numnames), found);
+    return 0;
+}
+#endif // _GPA_MACHO_DEBUG
+#endif // _GPA_MACHO_C
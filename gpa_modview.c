@@ -0,0 +1,468 @@
+/*
+    gpa_modview.c
+    one export API over PE images (loaded or file layout) and ELF shared objects.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    gpa_getexportdir only understands a loaded PE32+ image. A module view wraps
+    an image in one of several backends that all expose the same operations.
+    Dispatch is static: every backend supplies a few primitives named
+    gpa_<backend>_<op>, and GPA_MODVIEW_DEFINE stamps out the generic
+    algorithms (lookup, symbolize, enumerate) for it. Calls go through
+    gpa_modview(backend, op), which is plain token pasting, so each backend
+    gets its own fully inlined copy and nobody pays for an indirect call.
+
+    backends:
+        pe_loaded   a PE image as the loader maps it (rva == offset)
+        pe_file     a PE file as it is on disk (rvas go through the section table)
+        elf         an ELF64 shared object file, exports taken from .dynsym
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_modview(b, open)(gpa_MODVIEW *view, ptr image, u64 size)
+        parses the image, returns 1 on success. size 0 means "trusted, unbounded",
+        which only makes sense for pe_loaded on a real loaded module
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_modview(b, lookup)(gpa_MODVIEW *view, char *name, gpa_EXPORT *exp)
+        finds an export by name. binary search where the backend keeps names
+        sorted (PE), a linear walk otherwise (ELF)
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_modview(b, symbolize)(gpa_MODVIEW *view, u64 address, gpa_EXPORT *exp, u64 *displacement)
+        finds the export with the highest address not above the given one
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_modview(b, enumerate)(gpa_MODVIEW *view, gpa_EXPORT_CALLBACK callback, ptr context)
+        calls back for every export until the callback returns 0
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_modview(b, count)(gpa_MODVIEW *view) / int gpa_modview(b, export)(view, i, exp)
+        the primitives themselves: slot count, and export number i (0 if slot i
+        holds no export). for PE, i is the index into AddressOfNames
+*/
+
+#ifndef _GPA_MODVIEW_C
+#define _GPA_MODVIEW_C
+#define _GPA_MODVIEW_DEBUG 0
+#include "getprocaddress.c"
+
+#define gpa_modview(backend, op) gpa_##backend##_##op
+
+typedef struct _gpa_EXPORT {
+    char *name;
+    u64   address;              // rva for PE, st_value for ELF
+    u32   index;                // the slot it came from
+    u32   ordinal;              // PE: biased ordinal. ELF: symbol table index
+    char *forwarder;            // PE: "DLL.Name" if forwarded, else 0
+} gpa_EXPORT;
+
+typedef int (*gpa_EXPORT_CALLBACK)(ptr context, gpa_EXPORT *exp);
+
+typedef struct _gpa_MODVIEW {
+    u8   *base;
+    u8   *end;                  // one past the last readable byte
+    u32   count;
+    // PE: translated export directory and its arrays
+    gpa_PIMAGE_EXPORT_DIRECTORY exportdir;
+    u32  *names;
+    u16  *ordinals;
+    u32  *functions;
+    u32   exportrva;            // export data directory, forwarders point into it
+    u32   exportsize;
+    // PE file layout: section table, plus the section holding the exports
+    // as a fast path since nearly every translation lands there
+    u8   *sections;
+    u32   numsections;
+    u32   fastlo;
+    u32   fasthi;
+    u32   fastraw;
+    // ELF: .dynsym and its string table
+    u8   *symbols;
+    char *strings;
+    u64   stringsize;
+} gpa_MODVIEW;
+
+// bytes left in the view from p on, 0 for a p outside it. done on integers:
+// an unbounded view ends at the top of the address space, and the compiler
+// may assume pointer differences that large cannot happen.
+inline static u64 gpa_modview_remaining(gpa_MODVIEW *view, ptr p) {
+    return (u64)p < (u64)view->base || (u64)p > (u64)view->end ? 0 : (u64)view->end - (u64)p;
+}
+
+// the bounded string compare that every backend uses
+inline static int gpa_modview_strcmp(gpa_MODVIEW *view, char *name, char *exportname) {
+    return gpa_strcmpn(name, exportname, gpa_modview_remaining(view, exportname));
+}
+
+inline static ptr gpa_modview_check(gpa_MODVIEW *view, u8 *p, u64 length) {
+    if ((u64)p < (u64)view->base || (u64)p > (u64)view->end || length > gpa_modview_remaining(view, p)) {
+        return 0;
+    }
+    return p;
+}
+
+// --- PE, common to both layouts ----------------------------------------------------------
+
+// returns the export entry of the data directory, { VirtualAddress, Size }.
+// handles PE32 as well as PE32+; the headers are identical in both layouts.
+inline static u32 *gpa_pe_exportdatadir(gpa_MODVIEW *view, u8 **sections, u32 *numsections) {
+    if (!gpa_modview_check(view, view->base, 0x40)) {
+        return 0;
+    }
+    u8 *nt = view->base + *(u32*)(view->base + 0x3c);
+    // through the PE32+ export data directory entry, which ends at nt + 0x90
+    if (!gpa_modview_check(view, nt, 0x90) || *(u32*)nt != 0x00004550) {
+        return 0;
+    }
+    u16 magic    = *(u16*)(nt + 0x18);
+    u32 dataoff  = magic == 0x20b ? 0x70 : 0x60;
+    u32 numdirs  = *(u32*)(nt + 0x18 + dataoff - 4);
+    *sections    = nt + 0x18 + *(u16*)(nt + 0x14);
+    *numsections = *(u16*)(nt + 0x06);
+    if ((magic != 0x20b && magic != 0x10b) || numdirs == 0 || *(u16*)(nt + 0x14) < dataoff + 8
+        || !gpa_modview_check(view, *sections, 40ull * *numsections)) {
+        return 0;
+    }
+    return (u32*)(nt + 0x18 + dataoff);
+}
+
+// the rest of the PE setup, once the backend knows how to translate rvas
+#define GPA_PE_OPEN_EXPORTS(backend, view)                                                      \
+    do {                                                                                        \
+        view->exportdir = gpa_##backend##_rva(view, view->exportrva, sizeof(gpa_IMAGE_EXPORT_DIRECTORY)); \
+        if (!view->exportdir) {                                                                 \
+            return 0;                                                                           \
+        }                                                                                       \
+        view->count     = view->exportdir->NumberOfNames;                                       \
+        view->names     = gpa_##backend##_rva(view, view->exportdir->AddressOfNames, 4ull * view->count); \
+        view->ordinals  = gpa_##backend##_rva(view, view->exportdir->AddressOfNameOrdinals, 2ull * view->count); \
+        view->functions = gpa_##backend##_rva(view, view->exportdir->AddressOfFunctions, 4ull * view->exportdir->NumberOfFunctions); \
+        if (!view->names || !view->ordinals || !view->functions) {                              \
+            return 0;                                                                           \
+        }                                                                                       \
+    } while (0)
+
+#define GPA_PE_EXPORT(backend, view, i, exp)                                                    \
+    do {                                                                                        \
+        u32 ordinal = view->ordinals[i];                                                        \
+        if (ordinal >= view->exportdir->NumberOfFunctions) {                                    \
+            return 0;                                                                           \
+        }                                                                                       \
+        exp->name      = gpa_##backend##_rva(view, view->names[i], 1);                          \
+        exp->address   = view->functions[ordinal];                                              \
+        exp->index     = i;                                                                     \
+        exp->ordinal   = ordinal + view->exportdir->Base;                                       \
+        exp->forwarder = 0;                                                                     \
+        if (exp->address - view->exportrva < view->exportsize) {                                \
+            exp->forwarder = gpa_##backend##_rva(view, (u32)exp->address, 1);                   \
+        }                                                                                       \
+        return exp->name != 0;                                                                  \
+    } while (0)
+
+// --- pe_loaded ---------------------------------------------------------------------------
+
+#define gpa_pe_loaded_SORTED 1
+
+inline static ptr gpa_pe_loaded_rva(gpa_MODVIEW *view, u32 rva, u64 length) {
+    return gpa_modview_check(view, view->base + rva, length);
+}
+
+inline static char *gpa_pe_loaded_name(gpa_MODVIEW *view, u32 i) {
+    return gpa_pe_loaded_rva(view, view->names[i], 1);
+}
+
+inline static u32 gpa_pe_loaded_count(gpa_MODVIEW *view) {
+    return view->count;
+}
+
+int gpa_pe_loaded_open(gpa_MODVIEW *view, ptr image, u64 size) {
+    view->base = image;
+    view->end  = size ? (u8*)image + size : (u8*)~(u64)0;
+    u32 *datadir = gpa_pe_exportdatadir(view, &view->sections, &view->numsections);
+    if (!datadir || datadir[0] == 0) {
+        return 0;
+    }
+    view->exportrva  = datadir[0];
+    view->exportsize = datadir[1];
+    GPA_PE_OPEN_EXPORTS(pe_loaded, view);
+    return 1;
+}
+
+inline static int gpa_pe_loaded_export(gpa_MODVIEW *view, u32 i, gpa_EXPORT *exp) {
+    GPA_PE_EXPORT(pe_loaded, view, i, exp);
+}
+
+// --- pe_file -----------------------------------------------------------------------------
+
+#define gpa_pe_file_SORTED 1
+
+inline static ptr gpa_pe_file_rva(gpa_MODVIEW *view, u32 rva, u64 length) {
+    if (rva - view->fastlo < view->fasthi - view->fastlo) {
+        return gpa_modview_check(view, view->base + view->fastraw + (rva - view->fastlo), length);
+    }
+    u8 *section = view->sections;
+    for (u32 i = 0; i < view->numsections; i++, section += 40) {
+        u32 virtualsize    = *(u32*)(section + 0x08);
+        u32 virtualaddress = *(u32*)(section + 0x0c);
+        u32 rawsize        = *(u32*)(section + 0x10);
+        u32 rawoffset      = *(u32*)(section + 0x14);
+        u32 span           = rawsize < virtualsize || virtualsize == 0 ? rawsize : virtualsize;
+        if (rva - virtualaddress < span) {
+            return gpa_modview_check(view, view->base + rawoffset + (rva - virtualaddress), length);
+        }
+    }
+    // the headers are mapped 1:1
+    return rva < 0x1000 ? gpa_modview_check(view, view->base + rva, length) : 0;
+}
+
+inline static char *gpa_pe_file_name(gpa_MODVIEW *view, u32 i) {
+    return gpa_pe_file_rva(view, view->names[i], 1);
+}
+
+inline static u32 gpa_pe_file_count(gpa_MODVIEW *view) {
+    return view->count;
+}
+
+int gpa_pe_file_open(gpa_MODVIEW *view, ptr image, u64 size) {
+    view->base   = image;
+    view->end    = (u8*)image + size;
+    view->fastlo = view->fasthi = 0;
+    u32 *datadir = gpa_pe_exportdatadir(view, &view->sections, &view->numsections);
+    if (!datadir || datadir[0] == 0) {
+        return 0;
+    }
+    view->exportrva  = datadir[0];
+    view->exportsize = datadir[1];
+    u8 *section = view->sections;
+    for (u32 i = 0; i < view->numsections; i++, section += 40) {
+        u32 virtualaddress = *(u32*)(section + 0x0c);
+        u32 rawsize        = *(u32*)(section + 0x10);
+        if (view->exportrva - virtualaddress < rawsize) {
+            view->fastlo  = virtualaddress;
+            view->fasthi  = virtualaddress + rawsize;
+            view->fastraw = *(u32*)(section + 0x14);
+            break;
+        }
+    }
+    GPA_PE_OPEN_EXPORTS(pe_file, view);
+    return 1;
+}
+
+inline static int gpa_pe_file_export(gpa_MODVIEW *view, u32 i, gpa_EXPORT *exp) {
+    GPA_PE_EXPORT(pe_file, view, i, exp);
+}
+
+// --- elf ---------------------------------------------------------------------------------
+
+#define gpa_elf_SORTED 0
+
+inline static u32 gpa_elf_count(gpa_MODVIEW *view) {
+    return view->count;
+}
+
+// defined, global or weak, default or protected visibility, not a section/file symbol
+inline static char *gpa_elf_name(gpa_MODVIEW *view, u32 i) {
+    u8 *sym  = view->symbols + 24ull * i;
+    u8  bind = sym[4] >> 4;
+    u8  type = sym[4] & 0xf;
+    u8  vis  = sym[5] & 3;
+    u32 name = *(u32*)sym;
+    if (*(u16*)(sym + 6) == 0 || (bind != 1 && bind != 2) || type == 3 || type == 4
+        || (vis != 0 && vis != 3) || name == 0 || name >= view->stringsize) {
+        return 0;
+    }
+    return view->strings + name;
+}
+
+int gpa_elf_open(gpa_MODVIEW *view, ptr image, u64 size) {
+    u8 *elf = image;
+    view->base = image;
+    view->end  = elf + size;
+    view->count = 0;
+    view->exportdir = 0;
+    if (size < 64 || *(u32*)elf != 0x464c457f || elf[4] != 2 || elf[5] != 1) {
+        return 0;       // only 64-bit little-endian
+    }
+    u64 shoff = *(u64*)(elf + 0x28);
+    u16 shnum = *(u16*)(elf + 0x3c);
+    if (*(u16*)(elf + 0x3a) != 64 || !gpa_modview_check(view, elf + shoff, 64ull * shnum)) {
+        return 0;
+    }
+    for (u32 i = 0; i < shnum; i++) {
+        u8 *sh = elf + shoff + 64ull * i;
+        if (*(u32*)(sh + 4) != 11) {    // SHT_DYNSYM
+            continue;
+        }
+        u32 link = *(u32*)(sh + 0x28);
+        u8 *strsh = elf + shoff + 64ull * link;
+        if (link >= shnum) {
+            return 0;
+        }
+        view->symbols    = gpa_modview_check(view, elf + *(u64*)(sh + 0x18), *(u64*)(sh + 0x20));
+        view->strings    = gpa_modview_check(view, elf + *(u64*)(strsh + 0x18), *(u64*)(strsh + 0x20));
+        view->stringsize = *(u64*)(strsh + 0x20);
+        view->count      = *(u64*)(sh + 0x20) / 24;
+        return view->symbols && view->strings;
+    }
+    return 0;
+}
+
+inline static int gpa_elf_export(gpa_MODVIEW *view, u32 i, gpa_EXPORT *exp) {
+    exp->name = gpa_elf_name(view, i);
+    if (!exp->name) {
+        return 0;
+    }
+    exp->address   = *(u64*)(view->symbols + 24ull * i + 8);
+    exp->index     = i;
+    exp->ordinal   = i;
+    exp->forwarder = 0;
+    return 1;
+}
+
+// --- the generic half --------------------------------------------------------------------
+
+#define GPA_MODVIEW_DEFINE(backend)                                                             \
+    int gpa_##backend##_lookup(gpa_MODVIEW *view, char *name, gpa_EXPORT *exp) {                \
+        u32 count = gpa_##backend##_count(view);                                                \
+        if (gpa_##backend##_SORTED) {                                                           \
+            u32 lo = 0, hi = count;                                                             \
+            while (lo < hi) {                                                                   \
+                u32 mid = lo + (hi - lo) / 2;                                                   \
+                char *candidate = gpa_##backend##_name(view, mid);                              \
+                int cmp = candidate ? gpa_modview_strcmp(view, name, candidate) : -1;           \
+                if (cmp == 0) {                                                                 \
+                    return gpa_##backend##_export(view, mid, exp);                              \
+                }                                                                               \
+                if (cmp < 0) {                                                                  \
+                    hi = mid;                                                                   \
+                } else {                                                                        \
+                    lo = mid + 1;                                                               \
+                }                                                                               \
+            }                                                                                   \
+            return 0;                                                                           \
+        }                                                                                       \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            char *candidate = gpa_##backend##_name(view, i);                                    \
+            if (candidate && gpa_modview_strcmp(view, name, candidate) == 0) {                  \
+                return gpa_##backend##_export(view, i, exp);                                    \
+            }                                                                                   \
+        }                                                                                       \
+        return 0;                                                                               \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_symbolize(gpa_MODVIEW *view, u64 address, gpa_EXPORT *exp, u64 *displacement) { \
+        gpa_EXPORT candidate;                                                                   \
+        int found = 0;                                                                          \
+        u32 count = gpa_##backend##_count(view);                                                \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            if (!gpa_##backend##_export(view, i, &candidate) || candidate.forwarder             \
+                || candidate.address > address) {                                               \
+                continue;                                                                       \
+            }                                                                                   \
+            if (!found || candidate.address > exp->address) {                                   \
+                *exp  = candidate;                                                              \
+                found = 1;                                                                      \
+            }                                                                                   \
+        }                                                                                       \
+        if (found) {                                                                            \
+            *displacement = address - exp->address;                                             \
+        }                                                                                       \
+        return found;                                                                           \
+    }                                                                                           \
+                                                                                                \
+    u32 gpa_##backend##_enumerate(gpa_MODVIEW *view, gpa_EXPORT_CALLBACK callback, ptr context) { \
+        gpa_EXPORT exp;                                                                         \
+        u32 n = 0;                                                                              \
+        u32 count = gpa_##backend##_count(view);                                                \
+        for (u32 i = 0; i < count; i++) {                                                       \
+            if (gpa_##backend##_export(view, i, &exp)) {                                        \
+                n++;                                                                            \
+                if (!callback(context, &exp)) {                                                 \
+                    break;                                                                      \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+        return n;                                                                               \
+    }
+
+GPA_MODVIEW_DEFINE(pe_loaded)
+GPA_MODVIEW_DEFINE(pe_file)
+GPA_MODVIEW_DEFINE(elf)
+
+// development code: one harness, instantiated once per backend over the same
+// synthetic export list
+#if _GPA_MODVIEW_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_modview_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_modview_countcb(ptr context, gpa_EXPORT *exp) {
+    *(u64*)context += exp->address;
+    return 1;
+}
+
+#define GPA_MODVIEW_BENCH(backend, image, size, exports, count)                                 \
+    do {                                                                                        \
+        gpa_MODVIEW view;                                                                       \
+        gpa_EXPORT exp;                                                                         \
+        u64 sum = 0, displacement;                                                              \
+        if (!gpa_modview(backend, open)(&view, image, size)) {                                  \
+            printf("%-10s open failed\n", #backend);                                            \
+            break;                                                                              \
+        }                                                                                       \
+        double t0 = gpa_modview_now();                                                          \
+        u32 n = gpa_modview(backend, enumerate)(&view, gpa_modview_countcb, &sum);              \
+        double t1 = gpa_modview_now();                                                          \
+        u32 found = 0, queries = count < 20000 ? count : 20000;                                 \
+        for (u32 i = 0; i < queries; i++) {                                                     \
+            gpa_SYNTH_EXPORT *e = &exports[(i * 7919u) % count];                                \
+            found += gpa_modview(backend, lookup)(&view, e->name, &exp) && exp.address == e->rva; \
+        }                                                                                       \
+        double t2 = gpa_modview_now();                                                          \
+        u32 symbolized = 0, samples = 200;                                                      \
+        for (u32 i = 0; i < samples; i++) {                                                     \
+            gpa_SYNTH_EXPORT *e = &exports[(i * 7919u) % count];                                \
+            symbolized += gpa_modview(backend, symbolize)(&view, e->rva + 5, &exp, &displacement) \
+                          && strcmp(exp.name, e->name) == 0 && displacement == 5;               \
+        }                                                                                       \
+        double t3 = gpa_modview_now();                                                          \
+        printf("%-10s enumerate %6u in %7.1f us | lookup %u/%u %7.1f ns | symbolize %u/%u %8.1f ns\n", \
+               #backend, n, (t1 - t0) * 1e6, found, queries, (t2 - t1) * 1e9 / queries,        \
+               symbolized, samples, (t3 - t2) * 1e9 / samples);                                 \
+    } while (0)
+
+int main(int argc, char *argv[]) {
+    u32 count = argc > 1 ? atoi(argv[1]) : 5000;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, "Export%08u", i);
+        exports[i].slot = count - 1 - i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count) + 0x10000;
+    u8 *loaded = malloc(capacity), *file = malloc(capacity), *elf = malloc(capacity);
+    u64 loadedsize = gpa_synth_pe(loaded, capacity, exports, count, 0x5f000000, 0);
+    u64 filesize   = gpa_synth_pe(file, capacity, exports, count, 0x5f000000, 1);
+    u64 elfsize    = gpa_synth_elf(elf, capacity, exports, count);
+    printf("%u exports: pe loaded %llu bytes, pe file %llu bytes, elf %llu bytes\n", count,
+           (unsigned long long)loadedsize, (unsigned long long)filesize, (unsigned long long)elfsize);
+
+    GPA_MODVIEW_BENCH(pe_loaded, loaded, loadedsize, exports, count);
+    GPA_MODVIEW_BENCH(pe_file, file, filesize, exports, count);
+    GPA_MODVIEW_BENCH(elf, elf, elfsize, exports, count);
+
+    // the original asm path must agree with the loaded backend
+    gpa_PIMAGE_EXPORT_DIRECTORY dir = gpa_getexportdir(loaded);
+    printf("gpa_getexportdir agrees: %s\n", dir->NumberOfNames == count ? "yes" : "no");
+    return 0;
+}
+#endif // _GPA_MODVIEW_DEBUG
+#endif // _GPA_MODVIEW_C
@@ -0,0 +1,419 @@
+/*
+    gpa_once.c
+    one-time initialization without the CRT, and cached bootstrap accessors.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    gpa_getkernel32 walks the loader list and gpa_getgetprocaddress scans the
+    whole kernel32 export table on every call. Callers that want to do that
+    once have had no safe way to, short of pulling in a threading library.
+
+    gpa_ONCE is a single u32 driven by atomics. The first caller runs init;
+    everyone arriving while it runs spins for a short, backed-off while (most
+    inits finish within it) and then parks on the word itself: a private futex
+    on Linux, WaitOnAddress on Windows. The Windows wait functions live in
+    kernelbase and are resolved by this library through gpa_getgetprocaddress,
+    so nothing is linked. Without them (before Windows 8) parked callers yield
+    with SwitchToThread instead. The state only goes forward:
+
+        0 new -> 1 running -> 2 running with parked callers -> 3 done
+
+    init must not call gpa_once on the same object, and is not retried: a
+    gpa_ONCE is done once init returns, whatever init did.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_once(gpa_ONCE *once, gpa_ONCE_INIT init, ptr context)
+        runs init(context) exactly once across all threads; every caller returns
+        after it has completed and sees its writes. returns 1 in the caller that
+        ran it, 0 elsewhere. done is one acquire load
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_once_spin(gpa_ONCE *once, gpa_ONCE_INIT init, ptr context, u32 spin)
+        the same with an explicit spin budget before parking: 0 parks right
+        away, GPA_ONCE_NOPARK never parks
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_BOOTSTRAP *gpa_bootstrap()
+        {kernel32, GetProcAddress}, computed once per process. after the first
+        call this is a single load of a published pointer
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_getkernel32_once() / GetProcAddress_t gpa_getgetprocaddress_once()
+        the two fields, for call sites that want just one
+*/
+
+#ifndef _GPA_ONCE_C
+#define _GPA_ONCE_C
+#define _GPA_ONCE_DEBUG 0
+#if defined(__linux__)
+#include "gpa_linux.c"
+#else
+#include "getprocaddress.c"
+#endif
+
+#define GPA_ONCE_NEW            0
+#define GPA_ONCE_RUNNING        1
+#define GPA_ONCE_PARKED         2
+#define GPA_ONCE_DONE           3
+#define GPA_ONCE_SPIN           64          // backed-off spin rounds before parking
+#define GPA_ONCE_MAXPAUSE       64          // pauses per round, doubling up to this
+#define GPA_ONCE_NOPARK         0xffffffff
+
+typedef struct _gpa_ONCE {
+    u32   state;
+} gpa_ONCE;
+
+typedef void (*gpa_ONCE_INIT)(ptr context);
+
+inline static void gpa_once_pause() {
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+#if defined(_WIN32)
+typedef i32  (*gpa_WAITONADDRESS)(volatile ptr address, ptr compare, u64 size, u32 milliseconds);
+typedef void (*gpa_WAKEBYADDRESSALL)(ptr address);
+typedef ptr  (*gpa_GETMODULEHANDLEA)(char *name);
+typedef i32  (*gpa_SWITCHTOTHREAD)();
+
+// racing resolvers all find and store the same pointers
+static struct {
+    gpa_WAITONADDRESS    wait;
+    gpa_WAKEBYADDRESSALL wake;
+    gpa_SWITCHTOTHREAD   yield;
+    u32                  resolved;
+} gpa_once_win;
+
+static void gpa_once_resolve() {
+    if (__atomic_load_n(&gpa_once_win.resolved, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    ptr kernel32 = gpa_getkernel32();
+    GetProcAddress_t getprocaddress = gpa_getgetprocaddress(kernel32);
+    gpa_GETMODULEHANDLEA getmodulehandle = (gpa_GETMODULEHANDLEA)getprocaddress(kernel32, "GetModuleHandleA");
+    ptr kernelbase = getmodulehandle ? getmodulehandle("kernelbase.dll") : 0;
+    ptr wait = kernelbase ? getprocaddress(kernelbase, "WaitOnAddress") : 0;
+    ptr wake = kernelbase ? getprocaddress(kernelbase, "WakeByAddressAll") : 0;
+    if (!wait || !wake) {
+        wait = wake = 0;
+    }
+    __atomic_store_n(&gpa_once_win.wait, (gpa_WAITONADDRESS)wait, __ATOMIC_RELAXED);
+    __atomic_store_n(&gpa_once_win.wake, (gpa_WAKEBYADDRESSALL)wake, __ATOMIC_RELAXED);
+    __atomic_store_n(&gpa_once_win.yield, (gpa_SWITCHTOTHREAD)getprocaddress(kernel32, "SwitchToThread"), __ATOMIC_RELAXED);
+    __atomic_store_n(&gpa_once_win.resolved, 1, __ATOMIC_RELEASE);
+}
+
+static void gpa_once_wait(u32 *state, u32 value) {
+    gpa_once_resolve();
+    if (gpa_once_win.wait) {
+        gpa_once_win.wait(state, &value, sizeof(value), 0xffffffff);
+    } else if (gpa_once_win.yield) {
+        gpa_once_win.yield();
+    } else {
+        gpa_once_pause();
+    }
+}
+
+static void gpa_once_wake(u32 *state) {
+    gpa_once_resolve();
+    if (gpa_once_win.wake) {
+        gpa_once_win.wake(state);
+    }
+}
+#elif defined(__linux__)
+static void gpa_once_wait(u32 *state, u32 value) {
+    gpa_sys_futexwait(state, value);
+}
+
+static void gpa_once_wake(u32 *state) {
+    gpa_sys_futexwake(state, 0x7fffffff);
+}
+#else
+// nothing to park on: waiters keep spinning
+static void gpa_once_wait(u32 *state, u32 value) {
+    gpa_once_pause();
+}
+
+static void gpa_once_wake(u32 *state) {
+}
+#endif
+
+int gpa_once_spin(gpa_ONCE *once, gpa_ONCE_INIT init, ptr context, u32 spin) {
+    u32 state = __atomic_load_n(&once->state, __ATOMIC_ACQUIRE);
+    if (state == GPA_ONCE_NEW &&
+        __atomic_compare_exchange_n(&once->state, &state, GPA_ONCE_RUNNING, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        init(context);
+        // only pay for the wake if somebody announced they were parking
+        if (__atomic_exchange_n(&once->state, GPA_ONCE_DONE, __ATOMIC_RELEASE) == GPA_ONCE_PARKED) {
+            gpa_once_wake(&once->state);
+        }
+        return 1;
+    }
+    for (u32 i = 0, pauses = 1; state != GPA_ONCE_DONE && (spin == GPA_ONCE_NOPARK || i < spin); i++) {
+        for (u32 p = 0; p < pauses; p++) {
+            gpa_once_pause();
+        }
+        pauses = pauses < GPA_ONCE_MAXPAUSE ? pauses * 2 : pauses;
+        state = __atomic_load_n(&once->state, __ATOMIC_ACQUIRE);
+    }
+    while (state != GPA_ONCE_DONE) {
+        // a failed exchange reloads state, which is then parked or done
+        if (state == GPA_ONCE_PARKED ||
+            __atomic_compare_exchange_n(&once->state, &state, GPA_ONCE_PARKED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            gpa_once_wait(&once->state, GPA_ONCE_PARKED);
+            state = __atomic_load_n(&once->state, __ATOMIC_ACQUIRE);
+        }
+    }
+    return 0;
+}
+
+inline static int gpa_once(gpa_ONCE *once, gpa_ONCE_INIT init, ptr context) {
+    if (__builtin_expect(__atomic_load_n(&once->state, __ATOMIC_ACQUIRE) == GPA_ONCE_DONE, 1)) {
+        return 0;
+    }
+    return gpa_once_spin(once, init, context, GPA_ONCE_SPIN);
+}
+
+typedef struct _gpa_BOOTSTRAP {
+    ptr              kernel32;
+    GetProcAddress_t getprocaddress;
+} gpa_BOOTSTRAP;
+
+// where the kernel32 handle comes from; the debug build points this at a
+// synthetic image so the accessors can be exercised on Linux
+#if _GPA_ONCE_DEBUG && !defined(_WIN32)
+static ptr gpa_once_debugkernel32();
+#define GPA_BOOTSTRAP_KERNEL32() gpa_once_debugkernel32()
+#endif
+#ifndef GPA_BOOTSTRAP_KERNEL32
+#define GPA_BOOTSTRAP_KERNEL32() gpa_getkernel32()
+#endif
+
+static gpa_BOOTSTRAP  gpa_bootstrap_storage;
+static gpa_BOOTSTRAP *gpa_bootstrap_published;
+static gpa_ONCE       gpa_bootstrap_once;
+
+static void gpa_bootstrap_init(ptr context) {
+    (void)context;              // the storage is static
+    gpa_bootstrap_storage.kernel32       = GPA_BOOTSTRAP_KERNEL32();
+    gpa_bootstrap_storage.getprocaddress = gpa_getgetprocaddress(gpa_bootstrap_storage.kernel32);
+    __atomic_store_n(&gpa_bootstrap_published, &gpa_bootstrap_storage, __ATOMIC_RELEASE);
+}
+
+gpa_BOOTSTRAP *gpa_bootstrap() {
+    gpa_BOOTSTRAP *bootstrap = __atomic_load_n(&gpa_bootstrap_published, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(bootstrap != 0, 1)) {
+        return bootstrap;
+    }
+    gpa_once(&gpa_bootstrap_once, gpa_bootstrap_init, 0);
+    // gpa_once returned, so the store above happened before it
+    return __atomic_load_n(&gpa_bootstrap_published, __ATOMIC_RELAXED);
+}
+
+ptr gpa_getkernel32_once() {
+    return gpa_bootstrap()->kernel32;
+}
+
+GetProcAddress_t gpa_getgetprocaddress_once() {
+    return gpa_bootstrap()->getprocaddress;
+}
+
+// just some debug code used during development
+#if _GPA_ONCE_DEBUG
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpa_synth.c"
+
+static double gpa_once_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double gpa_once_cpu() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static u8  *gpa_once_image;
+static u32  gpa_once_bootstraps;
+
+static ptr gpa_once_debugkernel32() {
+    __atomic_fetch_add(&gpa_once_bootstraps, 1, __ATOMIC_RELAXED);
+    return gpa_once_image;
+}
+
+// one contended round per barrier: every thread races a fresh gpa_ONCE
+typedef struct _gpa_ONCE_BENCH {
+    pthread_barrier_t start;
+    pthread_barrier_t end;
+    gpa_ONCE         *onces;
+    u32              *payload;
+    double           *began;
+    double           *finished;
+    u32               rounds;
+    u32               threads;
+    u32               spin;
+    double            initcost;
+    u32               runs;
+    u32               stale;
+} gpa_ONCE_BENCH;
+
+typedef struct _gpa_ONCE_ARG {
+    gpa_ONCE_BENCH *bench;
+    u32             round;
+} gpa_ONCE_ARG;
+
+static void gpa_once_work(ptr context) {
+    gpa_ONCE_ARG *arg = context;
+    double until = gpa_once_now() + arg->bench->initcost;
+    while (gpa_once_now() < until) {
+    }
+    arg->bench->payload[arg->round] = arg->round + 1;
+    __atomic_fetch_add(&arg->bench->runs, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct _gpa_ONCE_THREAD {
+    gpa_ONCE_BENCH *bench;
+    u32             id;
+} gpa_ONCE_THREAD;
+
+static void *gpa_once_thread(void *p) {
+    gpa_ONCE_THREAD *t = p;
+    gpa_ONCE_BENCH  *b = t->bench;
+    for (u32 r = 0; r < b->rounds; r++) {
+        gpa_ONCE_ARG arg = { b, r };
+        pthread_barrier_wait(&b->start);
+        b->began[t->id] = gpa_once_now();
+        gpa_once_spin(&b->onces[r], gpa_once_work, &arg, b->spin);
+        if (b->payload[r] != r + 1) {
+            __atomic_fetch_add(&b->stale, 1, __ATOMIC_RELAXED);
+        }
+        b->finished[t->id] = gpa_once_now();
+        pthread_barrier_wait(&b->end);
+        if (t->id == 0) {
+            double first = b->began[0], last = b->finished[0];
+            for (u32 i = 1; i < b->threads; i++) {
+                first = b->began[i] < first ? b->began[i] : first;
+                last  = b->finished[i] > last ? b->finished[i] : last;
+            }
+            b->began[b->threads] += last - first;
+        }
+    }
+    return 0;
+}
+
+static void gpa_once_bench(char *policy, u32 spin, u32 threads, double initcost, u32 rounds) {
+    gpa_ONCE_BENCH b = { 0 };
+    b.onces    = calloc(rounds, sizeof(gpa_ONCE));
+    b.payload  = calloc(rounds, sizeof(u32));
+    b.began    = calloc(threads + 1, sizeof(double));
+    b.finished = calloc(threads, sizeof(double));
+    b.rounds   = rounds;
+    b.threads  = threads;
+    b.spin     = spin;
+    b.initcost = initcost;
+    pthread_barrier_init(&b.start, 0, threads);
+    pthread_barrier_init(&b.end, 0, threads);
+    pthread_t        *handles = calloc(threads, sizeof(pthread_t));
+    gpa_ONCE_THREAD  *args    = calloc(threads, sizeof(gpa_ONCE_THREAD));
+    double cpu = gpa_once_cpu();
+    for (u32 i = 0; i < threads; i++) {
+        args[i].bench = &b;
+        args[i].id    = i;
+        pthread_create(&handles[i], 0, gpa_once_thread, &args[i]);
+    }
+    for (u32 i = 0; i < threads; i++) {
+        pthread_join(handles[i], 0);
+    }
+    cpu = gpa_once_cpu() - cpu;
+    printf("  %-10s %2u threads, init %6.0f us: latency %8.1f us/round, cpu %8.1f us/round, "
+           "inits %u/%u, stale %u\n",
+           policy, threads, initcost * 1e6, b.began[threads] / rounds * 1e6, cpu / rounds * 1e6,
+           b.runs, rounds, b.stale);
+    pthread_barrier_destroy(&b.start);
+    pthread_barrier_destroy(&b.end);
+    free(b.onces);
+    free(b.payload);
+    free(b.began);
+    free(b.finished);
+    free(handles);
+    free(args);
+}
+
+static void *gpa_once_firstcall(void *p) {
+    *(GetProcAddress_t*)p = gpa_getgetprocaddress_once();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // a kernel32-sized export table with GetProcAddress somewhere in the middle
+    u32 count = 1600;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, i == count / 2 ? "GetProcAddress" : i < count / 2 ? "Fn%05u" : "Set%05u", i);
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + i * 16;
+    }
+    u64 size = gpa_synth_pe_size(exports, count);
+    gpa_once_image = calloc(1, size);
+    gpa_synth_pe(gpa_once_image, size, exports, count, 0, 0);
+    GetProcAddress_t expected = gpa_getgetprocaddress(gpa_once_image);
+    printf("gpa_once: synthetic kernel32 %p, GetProcAddress at %p\n", gpa_once_image, expected);
+
+    // everybody's first call at once: one bootstrap, one answer
+    u32 racers = 32;
+    pthread_t handles[32];
+    GetProcAddress_t seen[32];
+    for (u32 i = 0; i < racers; i++) {
+        pthread_create(&handles[i], 0, gpa_once_firstcall, &seen[i]);
+    }
+    u32 agree = 0;
+    for (u32 i = 0; i < racers; i++) {
+        pthread_join(handles[i], 0);
+        agree += seen[i] == expected;
+    }
+    printf("first call from %u threads: %u bootstrap(s), %u/%u agree, kernel32 %s\n",
+           racers, gpa_once_bootstraps, agree, racers,
+           gpa_getkernel32_once() == gpa_once_image ? "ok" : "WRONG");
+
+    // steady state: the cached accessor against recomputing
+    u32 calls = 100000000;
+    GetProcAddress_t result = 0;
+    double t = gpa_once_now();
+    for (u32 i = 0; i < calls; i++) {
+        result = gpa_getgetprocaddress_once();
+        __asm__ volatile ("" : "+r" (result));
+    }
+    double cached = (gpa_once_now() - t) / calls;
+    u32 recalls = 20000;
+    t = gpa_once_now();
+    for (u32 i = 0; i < recalls; i++) {
+        result = gpa_getgetprocaddress(gpa_once_image);
+        __asm__ volatile ("" : "+r" (result));
+    }
+    double recomputed = (gpa_once_now() - t) / recalls;
+    printf("gpa_getgetprocaddress_once %.2f ns, gpa_getgetprocaddress %.0f ns (%.0fx)\n",
+           cached * 1e9, recomputed * 1e9, recomputed / cached);
+
+    // contention: spin-then-park against parking right away and spinning forever
+    printf("contention, %ld cpu(s):\n", sysconf(_SC_NPROCESSORS_ONLN));
+    u32    threadcounts[] = { 2, 8, 32 };
+    double initcosts[]    = { 2e-6, 200e-6 };
+    for (u32 c = 0; c < 2; c++) {
+        for (u32 n = 0; n < 3; n++) {
+            gpa_once_bench("spin+park", GPA_ONCE_SPIN,   threadcounts[n], initcosts[c], 200);
+            gpa_once_bench("park",      0,               threadcounts[n], initcosts[c], 200);
+            gpa_once_bench("spin",      GPA_ONCE_NOPARK, threadcounts[n], initcosts[c], 200);
+        }
+    }
+    return 0;
+}
+#endif // _GPA_ONCE_DEBUG
+#endif // _GPA_ONCE_C
@@ -0,0 +1,346 @@
+/*
+    gpa_parbuild.c
+    gpa_index construction split across a thread pool.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    gpa_<backend>_indexbuild hashes and inserts one name at a time, which is
+    most of the cost of indexing a million-entry synthetic table or a huge
+    real module. This builds the same gpa_INDEX format (any gpa_index reader
+    or gpa_shidx.c takes it unchanged) in a radix-partitioned pass:
+
+        1. each worker hashes a contiguous chunk of the name table into a
+           staging array and counts its names per partition, where the
+           partition is the top bits of the hash, i.e. of the home slot
+        2. the caller turns the counts into per-(partition, worker) cursors
+        3. each worker scatters its chunk to its cursors, so every partition's
+           names end up contiguous and still in name order
+        4. workers claim partitions and insert them into that partition's own
+           slot range, which nobody else writes. a probe that would run off
+           the end of the range is set aside instead
+        5. the caller inserts the set-aside names with the ordinary insert
+
+    Probe runs only ever grow, so a name set aside in step 4 still sits at the
+    end of an unbroken run from its home slot, as lookups expect. At half load
+    only a handful of names per partition spill.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_parbuild_scratchsize(u32 count, u32 workers)
+        bytes of scratch a build over count names with that many workers needs
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_INDEX *gpa_<backend>_parbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint,
+                                      gpa_POOL *pool, u32 workers, ptr scratch)
+        builds into buffer (gpa_index_size bytes) like gpa_<backend>_indexbuild.
+        pool may be 0, and workers is clamped to the pool's threads
+*/
+
+#ifndef _GPA_PARBUILD_C
+#define _GPA_PARBUILD_C
+#define _GPA_PARBUILD_DEBUG 0
+#include "gpa_index.c"
+#include "gpa_pool.c"
+
+#define GPA_PARBUILD_PARTBITS   8           // at most 256 partitions
+#define GPA_PARBUILD_MINSLOTS   16          // ... of at least this many slots
+
+typedef struct _gpa_PARBUILD {
+    gpa_MODVIEW    *view;
+    gpa_INDEX      *index;
+    u32             count;
+    u32             workers;
+    u32             chunk;          // names per worker
+    u32             partbits;
+    u32             partitions;
+    u32             partslots;      // slots per partition
+    u32             nextpart;       // partitions claimed so far in step 4
+    gpa_INDEX_SLOT *staging;        // step 1 output, chunk-major
+    gpa_INDEX_SLOT *pairs;          // step 3 output, partition-major
+    u32            *cursors;        // [worker][partition]
+    u32            *present;        // [worker] names staged
+    u32            *partstart;      // [partition + 1]
+    u32            *spilled;        // [partition] set aside at the front of its pairs
+} gpa_PARBUILD;
+
+inline static u32 gpa_parbuild_partbits(u32 count) {
+    u32 bits = 0;
+    while (bits < GPA_PARBUILD_PARTBITS && (gpa_index_numslots(count) >> (bits + 1)) >= GPA_PARBUILD_MINSLOTS) {
+        bits++;
+    }
+    return bits;
+}
+
+inline static u32 gpa_parbuild_partition(gpa_PARBUILD *build, u32 hash) {
+    return (u32)(((u64)hash << build->partbits) >> 32);
+}
+
+u64 gpa_parbuild_scratchsize(u32 count, u32 workers) {
+    u64 partitions = 1ull << gpa_parbuild_partbits(count);
+    workers = workers < 1 ? 1 : workers > GPA_POOL_MAX ? GPA_POOL_MAX : workers;
+    return 2ull * count * sizeof(gpa_INDEX_SLOT)
+         + 4ull * ((u64)workers * partitions + workers + 2 * partitions + 1);
+}
+
+// steps 2-5 do not depend on the backend
+static void gpa_parbuild_scatter(ptr context, u32 worker) {
+    gpa_PARBUILD   *build   = context;
+    gpa_INDEX_SLOT *staged  = build->staging + (u64)worker * build->chunk;
+    u32            *cursors = build->cursors + (u64)worker * build->partitions;
+    for (u32 i = 0; i < build->present[worker]; i++) {
+        build->pairs[cursors[gpa_parbuild_partition(build, staged[i].hash)]++] = staged[i];
+    }
+}
+
+static void gpa_parbuild_insert(ptr context, u32 worker) {
+    gpa_PARBUILD   *build = context;
+    gpa_INDEX_SLOT *slots = gpa_index_slots(build->index);
+    (void)worker;               // partitions are claimed, not assigned
+    u32 p;
+    while ((p = __atomic_fetch_add(&build->nextpart, 1, __ATOMIC_RELAXED)) < build->partitions) {
+        u32 lo = p * build->partslots;
+        u32 hi = lo + build->partslots;
+        for (u32 s = lo; s < hi; s++) {
+            slots[s].hash  = 0;
+            slots[s].index = 0;
+        }
+        gpa_INDEX_SLOT *pairs = build->pairs + build->partstart[p];
+        u32 n = build->partstart[p + 1] - build->partstart[p];
+        u32 spilled = 0;
+        for (u32 i = 0; i < n; i++) {
+            u32 slot = gpa_index_home(build->index, pairs[i].hash);
+            while (slot < hi && slots[slot].index) {
+                slot++;
+            }
+            if (slot < hi) {
+                slots[slot] = pairs[i];
+            } else {
+                pairs[spilled++] = pairs[i];    // never ahead of i
+            }
+        }
+        build->spilled[p] = spilled;
+    }
+}
+
+static gpa_INDEX *gpa_parbuild_run(gpa_PARBUILD *build, gpa_POOL_TASK hash, gpa_POOL *pool) {
+    gpa_pool_run(pool, hash, build, build->workers);
+    u32 total = 0;
+    for (u32 p = 0; p < build->partitions; p++) {
+        build->partstart[p] = total;
+        for (u32 w = 0; w < build->workers; w++) {
+            u32 n = build->cursors[w * build->partitions + p];
+            build->cursors[w * build->partitions + p] = total;
+            total += n;
+        }
+    }
+    build->partstart[build->partitions] = total;
+    gpa_pool_run(pool, gpa_parbuild_scatter, build, build->workers);
+    gpa_pool_run(pool, gpa_parbuild_insert, build, build->workers);
+    for (u32 p = 0; p < build->partitions; p++) {
+        gpa_INDEX_SLOT *pairs = build->pairs + build->partstart[p];
+        for (u32 i = 0; i < build->spilled[p]; i++) {
+            gpa_index_insert(build->index, pairs[i].hash, pairs[i].index - 1);
+        }
+    }
+    return build->index;
+}
+
+// a 0 pool runs every task on the caller, one worker
+static gpa_POOL gpa_parbuild_nopool = { .threads = 1 };
+
+inline static void gpa_parbuild_setup(gpa_PARBUILD *build, gpa_MODVIEW *view, ptr buffer, u64 fingerprint,
+                                      gpa_POOL *pool, u32 workers, u32 count, ptr scratch) {
+    workers = workers < 1 ? 1 : workers > pool->threads ? pool->threads : workers;
+    build->view       = view;
+    build->index      = buffer;
+    build->count      = count;
+    build->workers    = workers;
+    build->chunk      = (u32)(((u64)count + workers - 1) / workers);
+    build->partbits   = gpa_parbuild_partbits(count);
+    build->partitions = 1u << build->partbits;
+    build->nextpart   = 0;
+    gpa_index_header(build->index, count, fingerprint);
+    build->partslots  = build->index->numslots >> build->partbits;
+    build->staging    = scratch;
+    build->pairs      = build->staging + count;
+    build->cursors    = (u32*)(build->pairs + count);
+    build->present    = build->cursors + (u64)workers * build->partitions;
+    build->partstart  = build->present + workers;
+    build->spilled    = build->partstart + build->partitions + 1;
+}
+
+#define GPA_PARBUILD_DEFINE(backend)                                                            \
+    static void gpa_##backend##_parbuildhash(ptr context, u32 worker) {                         \
+        gpa_PARBUILD   *build   = context;                                                      \
+        gpa_INDEX_SLOT *staged  = build->staging + (u64)worker * build->chunk;                  \
+        u32            *counts  = build->cursors + (u64)worker * build->partitions;             \
+        u64             lo      = (u64)worker * build->chunk;                                   \
+        u64             hi      = lo + build->chunk < build->count ? lo + build->chunk : build->count; \
+        u32             n       = 0;                                                            \
+        for (u32 p = 0; p < build->partitions; p++) {                                           \
+            counts[p] = 0;                                                                      \
+        }                                                                                       \
+        for (u64 i = lo; i < hi; i++) {                                                         \
+            char *name = gpa_##backend##_name(build->view, (u32)i);                             \
+            if (name) {                                                                         \
+                staged[n].hash  = gpa_hashn(name, gpa_modview_remaining(build->view, name));    \
+                staged[n].index = (u32)i + 1;                                                   \
+                counts[gpa_parbuild_partition(build, staged[n].hash)]++;                        \
+                n++;                                                                            \
+            }                                                                                   \
+        }                                                                                       \
+        build->present[worker] = n;                                                             \
+    }                                                                                           \
+                                                                                                \
+    gpa_INDEX *gpa_##backend##_parbuild(gpa_MODVIEW *view, ptr buffer, u64 fingerprint,         \
+                                        gpa_POOL *pool, u32 workers, ptr scratch) {             \
+        gpa_PARBUILD build;                                                                     \
+        if (!gpa_index_numslots(gpa_##backend##_count(view))) {                                 \
+            return 0;                                                                           \
+        }                                                                                       \
+        pool = pool ? pool : &gpa_parbuild_nopool;                                              \
+        gpa_parbuild_setup(&build, view, buffer, fingerprint, pool, workers,                    \
+                           gpa_##backend##_count(view), scratch);                               \
+        return gpa_parbuild_run(&build, gpa_##backend##_parbuildhash, pool);                    \
+    }
+
+GPA_PARBUILD_DEFINE(pe_loaded)
+GPA_PARBUILD_DEFINE(pe_file)
+GPA_PARBUILD_DEFINE(elf)
+
+// just some debug code used during development
+#if _GPA_PARBUILD_DEBUG
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpa_synth.c"
+
+static double gpa_parbuild_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *gpa_parbuild_thread(void *worker) {
+    gpa_pool_worker(worker);
+    return 0;
+}
+
+static int gpa_parbuild_spawn(gpa_POOL_WORKER *worker) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, gpa_parbuild_thread, worker)) {
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+static int gpa_parbuild_compare(const void *a, const void *b) {
+    return strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+// every name must be found, and through the index it was built into
+static u32 gpa_parbuild_check(gpa_MODVIEW *view, gpa_INDEX *index, u64 size) {
+    u32 misses = !gpa_index_validate(index, size, 0x1234);
+    for (u32 i = 0; i < gpa_pe_loaded_count(view); i++) {
+        gpa_EXPORT exp;
+        char *name = gpa_pe_loaded_name(view, i);
+        misses += !gpa_pe_loaded_indexlookup(view, index, name, &exp) || strcmp(exp.name, name) != 0;
+    }
+    return misses;
+}
+
+int main(int argc, char *argv[]) {
+    // small tables first: 0 and 1 names, a single partition, a few
+    u32 smalls[] = { 0, 1, 7, 100, 3000 };
+    for (u32 c = 0; c < 5; c++) {
+        u32 count = smalls[c];
+        gpa_SYNTH_EXPORT *exports = calloc(count + 1, sizeof(gpa_SYNTH_EXPORT));
+        for (u32 i = 0; i < count; i++) {
+            exports[i].name = malloc(16);
+            snprintf(exports[i].name, 16, "Fn%07u", i);
+            exports[i].slot = i;
+            exports[i].rva  = 0x1000 + i;
+        }
+        u64 capacity = gpa_synth_pe_size(exports, count);
+        u8 *image = calloc(1, capacity);
+        gpa_MODVIEW view;
+        gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+        u64 size = gpa_index_size(count);
+        ptr buffer  = malloc(size);
+        ptr scratch = malloc(gpa_parbuild_scratchsize(count, 1));
+        memset(buffer, 0xcc, size);
+        printf("%7u names, %3u partitions: %u misses\n", count, 1u << gpa_parbuild_partbits(count),
+               gpa_parbuild_check(&view, gpa_pe_loaded_parbuild(&view, buffer, 0x1234, 0, 4, scratch), size));
+        free(buffer);
+        free(scratch);
+        free(image);
+        for (u32 i = 0; i < count; i++) {
+            free(exports[i].name);
+        }
+        free(exports);
+    }
+
+    // a million names; ordinals wrap, names do not need unique slots
+    u32 count = 1000000;
+    char *heads[] = { "Create", "Get", "Nt", "Query", "Rtl", "Set", "Zw" };
+    char *tails[] = { "", "A", "Ex", "ExW", "W" };
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(40);
+        snprintf(exports[i].name, 40, "%sObject%06u%s", heads[i * 7ull / count], i % (count / 7 + 1),
+                 tails[i % 5]);
+        exports[i].slot = i & 0xffff;
+        exports[i].rva  = 0x1000 + (i & 0xffff) * 16;
+    }
+    // sorted input is a synth requirement
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_parbuild_compare);
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = calloc(1, capacity);
+    gpa_MODVIEW view;
+    gpa_pe_loaded_open(&view, image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+    u64 size = gpa_index_size(count);
+    gpa_INDEX *serial = malloc(size);
+    gpa_INDEX *index  = malloc(size);
+    ptr scratch = malloc(gpa_parbuild_scratchsize(count, 32));
+    printf("%u names, %u partitions, index %.1f MB, scratch %.1f MB, %ld cpu(s)\n",
+           count, 1u << gpa_parbuild_partbits(count), size / 1e6,
+           gpa_parbuild_scratchsize(count, 32) / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+
+    u32 reps = 5;
+    double best = 1e9;
+    for (u32 r = 0; r < reps; r++) {
+        double t = gpa_parbuild_now();
+        gpa_pe_loaded_indexbuild(&view, serial, 0x1234);
+        t = gpa_parbuild_now() - t;
+        best = t < best ? t : best;
+    }
+    printf("  indexbuild      %7.2f ms, %u misses\n", best * 1e3, gpa_parbuild_check(&view, serial, size));
+    double serialtime = best;
+
+    u32 threadcounts[] = { 1, 2, 4, 8, 16, 32 };
+    for (u32 n = 0; n < 6; n++) {
+        gpa_POOL pool;
+        u32 threads = gpa_pool_init(&pool, threadcounts[n], gpa_parbuild_spawn);
+        best = 1e9;
+        for (u32 r = 0; r < reps; r++) {
+            memset(index, 0xcc, size);
+            double t = gpa_parbuild_now();
+            gpa_pe_loaded_parbuild(&view, index, 0x1234, &pool, threads, scratch);
+            t = gpa_parbuild_now() - t;
+            best = t < best ? t : best;
+        }
+        u32 moved = 0;
+        gpa_INDEX_SLOT *a = gpa_index_slots(serial), *b = gpa_index_slots(index);
+        for (u32 s = 0; s < serial->numslots; s++) {
+            moved += a[s].index != b[s].index;
+        }
+        printf("  parbuild %2u thr %7.2f ms (%.2fx), %u misses, %u slots differ from indexbuild\n",
+               threads, best * 1e3, serialtime / best, gpa_parbuild_check(&view, index, size), moved);
+        gpa_pool_stop(&pool);
+    }
+    return 0;
+}
+#endif // _GPA_PARBUILD_DEBUG
+#endif // _GPA_PARBUILD_C
@@ -0,0 +1,167 @@
+/*
+    gpa_pool.c
+    a small fork-join thread pool without the CRT.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    The pool keeps up to GPA_POOL_MAX workers parked on a generation counter
+    (gpa_once's futex / WaitOnAddress wait). gpa_pool_run publishes a task,
+    bumps the generation, runs worker 0's share on the calling thread and
+    parks until the others have counted themselves out. Runs are serialized
+    by the caller. Every worker checks in on every run, including those a
+    smaller run leaves idle, so none can still be reading the previous run's
+    task when the next one is published.
+
+    Thread creation is the one thing that needs an OS API. On Windows the
+    default is CreateThread, resolved through gpa_getgetprocaddress_once.
+    Elsewhere a spawn function must be supplied (the debug build uses pthreads);
+    without one the pool runs everything on the caller.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_pool_init(gpa_POOL *pool, u32 threads, gpa_POOL_SPAWN spawn)
+        starts threads - 1 workers (the caller is worker 0), spawn may be 0 for
+        the platform default. returns the number of workers including the caller
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_pool_run(gpa_POOL *pool, gpa_POOL_TASK task, ptr context, u32 workers)
+        calls task(context, worker) for worker in [0, workers) and returns when
+        all are done. workers is clamped to the pool size
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_pool_stop(gpa_POOL *pool)
+        tells the workers to exit and waits until none of them touch the pool
+*/
+
+#ifndef _GPA_POOL_C
+#define _GPA_POOL_C
+#include "gpa_once.c"
+
+#define GPA_POOL_MAX            64
+#define GPA_POOL_SPIN           256         // pause rounds before a worker parks
+
+typedef void (*gpa_POOL_TASK)(ptr context, u32 worker);
+
+typedef struct _gpa_POOL gpa_POOL;
+
+typedef struct _gpa_POOL_WORKER {
+    gpa_POOL *pool;
+    u32       id;
+} gpa_POOL_WORKER;
+
+// starts a thread that calls gpa_pool_worker(worker), returns 0 on failure
+typedef int (*gpa_POOL_SPAWN)(gpa_POOL_WORKER *worker);
+
+struct _gpa_POOL {
+    u32             generation;     // bumped per run, workers wait on it
+    u32             pending;        // workers still in the current run, the caller waits on it
+    u32             exited;
+    u32             stop;
+    u32             threads;        // including the caller
+    u32             active;
+    gpa_POOL_TASK   task;
+    ptr             context;
+    gpa_POOL_WORKER workers[GPA_POOL_MAX];
+};
+
+void gpa_pool_worker(gpa_POOL_WORKER *worker) {
+    gpa_POOL *pool = worker->pool;
+    u32 id   = worker->id;
+    u32 seen = 0;               // a late starter must still take part in the first run
+    for (;;) {
+        u32 generation;
+        for (u32 i = 0; (generation = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE)) == seen; i++) {
+            if (i < GPA_POOL_SPIN) {
+                gpa_once_pause();
+            } else {
+                gpa_once_wait(&pool->generation, seen);
+            }
+        }
+        seen = generation;
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (id < pool->active) {
+            pool->task(pool->context, id);
+        }
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            gpa_once_wake(&pool->pending);
+        }
+    }
+    // the increment is the last access to the pool
+    u32 others = pool->threads - 1;
+    if (__atomic_add_fetch(&pool->exited, 1, __ATOMIC_ACQ_REL) == others) {
+        gpa_once_wake(&pool->exited);
+    }
+}
+
+#if defined(_WIN32)
+typedef ptr (*gpa_CREATETHREAD)(ptr attributes, u64 stacksize, u32 (*start)(ptr), ptr parameter,
+                                 u32 flags, u32 *threadid);
+typedef i32 (*gpa_CLOSEHANDLE)(ptr handle);
+
+static u32 gpa_pool_winstart(ptr worker) {
+    gpa_pool_worker(worker);
+    return 0;
+}
+
+static int gpa_pool_defaultspawn(gpa_POOL_WORKER *worker) {
+    gpa_BOOTSTRAP *bootstrap = gpa_bootstrap();
+    gpa_CREATETHREAD createthread = (gpa_CREATETHREAD)bootstrap->getprocaddress(bootstrap->kernel32, "CreateThread");
+    gpa_CLOSEHANDLE  closehandle  = (gpa_CLOSEHANDLE)bootstrap->getprocaddress(bootstrap->kernel32, "CloseHandle");
+    ptr thread = createthread ? createthread(0, 0, gpa_pool_winstart, worker, 0, 0) : 0;
+    if (thread && closehandle) {
+        closehandle(thread);
+    }
+    return thread != 0;
+}
+#else
+#define gpa_pool_defaultspawn 0
+#endif
+
+u32 gpa_pool_init(gpa_POOL *pool, u32 threads, gpa_POOL_SPAWN spawn) {
+    spawn = spawn ? spawn : gpa_pool_defaultspawn;
+    threads = threads < 1 ? 1 : threads > GPA_POOL_MAX ? GPA_POOL_MAX : threads;
+    pool->generation = 0;
+    pool->pending    = 0;
+    pool->exited     = 0;
+    pool->stop       = 0;
+    pool->threads    = 1;
+    pool->active     = 0;
+    for (u32 i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id   = i;
+    }
+    // ids stay dense: stop at the first spawn that fails
+    while (spawn && pool->threads < threads && spawn(&pool->workers[pool->threads])) {
+        pool->threads++;
+    }
+    return pool->threads;
+}
+
+void gpa_pool_run(gpa_POOL *pool, gpa_POOL_TASK task, ptr context, u32 workers) {
+    workers = workers < 1 ? 1 : workers > pool->threads ? pool->threads : workers;
+    if (workers > 1) {
+        pool->task    = task;
+        pool->context = context;
+        pool->active  = workers;
+        __atomic_store_n(&pool->pending, pool->threads - 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+        gpa_once_wake(&pool->generation);
+    }
+    task(context, 0);
+    u32 pending;
+    while (workers > 1 && (pending = __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE)) != 0) {
+        gpa_once_wait(&pool->pending, pending);
+    }
+}
+
+void gpa_pool_stop(gpa_POOL *pool) {
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+    gpa_once_wake(&pool->generation);
+    u32 exited;
+    while ((exited = __atomic_load_n(&pool->exited, __ATOMIC_ACQUIRE)) != pool->threads - 1) {
+        gpa_once_wait(&pool->exited, exited);
+    }
+}
+
+#endif // _GPA_POOL_C
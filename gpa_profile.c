@@ -0,0 +1,526 @@
+/*
+    gpa_profile.c
+    profile-guided precomputation of hot lookups.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    A program resolves mostly the same few names on every run. Record mode
+    counts each resolution in a log, keyed by (module fingerprint, name
+    index). An offline step merges logs from one or more representative runs
+    and keeps the hottest entries in a small prebuilt table of
+    (fingerprint, name hash, name index) slots. At startup the program maps
+    the table. Every module whose fingerprint it covers then resolves its hot
+    names with a hash probe and one name compare instead of a search. Cold
+    names, and modules that changed since the profile was taken, fall back to
+    the normal lookup.
+
+    Both the log and the table are offset-only like gpa_index.c, so they go
+    to and from disk as-is. The fingerprint is gpa_fingerprint_view(view, 0).
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_profile_logsize(u32 capacity)
+    gpa_PROFILE_LOG *gpa_profile_loginit(ptr buffer, u32 capacity)
+        a record log with room for capacity distinct resolutions (a power of two).
+        the log is full at 3/4 of that; later new names are counted as dropped
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_profilerecord(gpa_MODVIEW *view, gpa_PROFILE_LOG *log, u64 fingerprint,
+                                    char *name, gpa_EXPORT *exp)
+        record mode: an ordinary lookup that also counts the hit in log
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_profile_merge(gpa_PROFILE_LOG *into, gpa_PROFILE_LOG *from)
+    gpa_PROFILE *gpa_profile_compile(gpa_PROFILE_LOG *log, ptr buffer, u32 maxentries)
+        the offline step: sum logs, then build a table of the maxentries most
+        frequent resolutions into buffer (gpa_profile_size(maxentries) bytes).
+        compile reorders the log. size is 0 and compile returns 0 for a
+        maxentries beyond GPA_PROFILE_MAXENTRIES or a table past 4 GB
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_profile_validate(gpa_PROFILE *profile, u64 size)
+    int gpa_profile_covers(gpa_PROFILE *profile, u64 fingerprint)
+        startup checks: the table is well formed / has entries for a module
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_profilelookup(gpa_MODVIEW *view, gpa_PROFILE *profile, u64 fingerprint,
+                                    char *name, gpa_EXPORT *exp)
+        replay: precomputed answer if there is one, normal lookup otherwise.
+        profile may be 0
+
+    Building with _GPA_PROFILE_TOOL set turns this file into the offline tool:
+        gpa_profile [-n maxentries] out.gpap in.gpal...
+*/
+
+#ifndef _GPA_PROFILE_C
+#define _GPA_PROFILE_C
+#define _GPA_PROFILE_DEBUG 0
+#define _GPA_PROFILE_TOOL 0
+#include "gpa_modview.c"
+
+#define GPA_PROFILE_LOGMAGIC    0x4c415047      // "GPAL"
+#define GPA_PROFILE_MAGIC       0x50415047      // "GPAP"
+#define GPA_PROFILE_VERSION     1
+#define GPA_PROFILE_MAXENTRIES  (1u << 30)      // stops the slot doubling short of 32 bits
+
+typedef struct _gpa_PROFILE_RECORD {
+    u64   fingerprint;
+    u32   hash;
+    u32   index;                // name index + 1, 0 marks an empty record
+    u64   count;
+} gpa_PROFILE_RECORD;
+
+typedef struct _gpa_PROFILE_LOG {
+    u32   magic;
+    u32   version;
+    u32   capacity;             // power of two
+    u32   used;
+    u64   dropped;              // resolutions not counted because the log was full
+    u32   records;              // offset of the record array from the header
+    u32   size;
+} gpa_PROFILE_LOG;
+
+typedef struct _gpa_PROFILE_SLOT {
+    u64   fingerprint;
+    u32   hash;
+    u32   index;                // name index + 1, 0 marks an empty slot
+} gpa_PROFILE_SLOT;
+
+typedef struct _gpa_PROFILE {
+    u32   magic;
+    u32   version;
+    u32   count;
+    u32   numslots;             // power of two
+    u32   slots;                // offset of the slot array from the header
+    u32   size;
+} gpa_PROFILE;
+
+inline static gpa_PROFILE_RECORD *gpa_profile_records(gpa_PROFILE_LOG *log) {
+    return (gpa_PROFILE_RECORD*)((u8*)log + log->records);
+}
+
+inline static gpa_PROFILE_SLOT *gpa_profile_slots(gpa_PROFILE *profile) {
+    return (gpa_PROFILE_SLOT*)((u8*)profile + profile->slots);
+}
+
+// the module matters as much as the name, so both go into the home slot
+inline static u32 gpa_profile_home(u64 fingerprint, u32 hash, u32 numslots) {
+    u32 mixed = hash ^ (u32)(fingerprint * 0x9e3779b97f4a7c15ull >> 32);
+    return (u32)(((u64)mixed * numslots) >> 32);
+}
+
+// --- record ------------------------------------------------------------------------------
+
+u64 gpa_profile_logsize(u32 capacity) {
+    return sizeof(gpa_PROFILE_LOG) + (u64)capacity * sizeof(gpa_PROFILE_RECORD);
+}
+
+gpa_PROFILE_LOG *gpa_profile_loginit(ptr buffer, u32 capacity) {
+    gpa_PROFILE_LOG *log = buffer;
+    log->magic    = GPA_PROFILE_LOGMAGIC;
+    log->version  = GPA_PROFILE_VERSION;
+    log->capacity = capacity;
+    log->used     = 0;
+    log->dropped  = 0;
+    log->records  = sizeof(gpa_PROFILE_LOG);
+    log->size     = (u32)gpa_profile_logsize(capacity);
+    gpa_PROFILE_RECORD *records = gpa_profile_records(log);
+    for (u32 i = 0; i < capacity; i++) {
+        records[i].index = 0;
+    }
+    return log;
+}
+
+int gpa_profile_logvalidate(gpa_PROFILE_LOG *log, u64 size) {
+    if (size < sizeof(gpa_PROFILE_LOG) || log->magic != GPA_PROFILE_LOGMAGIC || log->version != GPA_PROFILE_VERSION
+        || log->size > size) {
+        return 0;
+    }
+    u32 n = log->capacity;
+    return n && (n & (n - 1)) == 0 && log->used <= n && log->records >= sizeof(gpa_PROFILE_LOG)
+        && (u64)log->records + (u64)n * sizeof(gpa_PROFILE_RECORD) <= log->size;
+}
+
+// adds count to the (fingerprint, index) record, 0 if the log is full
+inline static int gpa_profile_count(gpa_PROFILE_LOG *log, u64 fingerprint, u32 hash, u32 index, u64 count) {
+    gpa_PROFILE_RECORD *records = gpa_profile_records(log);
+    u32 mask = log->capacity - 1;
+    u32 slot = gpa_profile_home(fingerprint, hash, log->capacity);
+    while (records[slot].index) {
+        if (records[slot].index == index + 1 && records[slot].fingerprint == fingerprint) {
+            records[slot].count += count;
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (log->used >= log->capacity / 4 * 3) {
+        log->dropped += count;
+        return 0;
+    }
+    log->used++;
+    records[slot].fingerprint = fingerprint;
+    records[slot].hash        = hash;
+    records[slot].index       = index + 1;
+    records[slot].count       = count;
+    return 1;
+}
+
+// --- compile -----------------------------------------------------------------------------
+
+int gpa_profile_merge(gpa_PROFILE_LOG *into, gpa_PROFILE_LOG *from) {
+    gpa_PROFILE_RECORD *records = gpa_profile_records(from);
+    int complete = 1;
+    for (u32 i = 0; i < from->capacity; i++) {
+        if (records[i].index) {
+            complete &= gpa_profile_count(into, records[i].fingerprint, records[i].hash,
+                                          records[i].index - 1, records[i].count);
+        }
+    }
+    into->dropped += from->dropped;
+    return complete;
+}
+
+// the table's size is a u32, and the slot count must not run past 32 bits
+u64 gpa_profile_size(u32 maxentries) {
+    if (maxentries > GPA_PROFILE_MAXENTRIES) {
+        return 0;
+    }
+    u64 n = 16;
+    while (n < 2ull * maxentries) {
+        n <<= 1;
+    }
+    u64 size = sizeof(gpa_PROFILE) + n * sizeof(gpa_PROFILE_SLOT);
+    return size <= 0xffffffffull ? size : 0;
+}
+
+// hottest first; ties broken on identity so the same logs give the same table
+inline static int gpa_profile_before(gpa_PROFILE_RECORD *a, gpa_PROFILE_RECORD *b) {
+    if (a->count != b->count) {
+        return a->count > b->count;
+    }
+    if (a->fingerprint != b->fingerprint) {
+        return a->fingerprint < b->fingerprint;
+    }
+    return a->index < b->index;
+}
+
+inline static void gpa_profile_siftdown(gpa_PROFILE_RECORD *records, u32 root, u32 n) {
+    for (;;) {
+        u32 child = 2 * root + 1;
+        if (child >= n) {
+            return;
+        }
+        if (child + 1 < n && gpa_profile_before(&records[child], &records[child + 1])) {
+            child++;
+        }
+        if (!gpa_profile_before(&records[root], &records[child])) {
+            return;
+        }
+        gpa_PROFILE_RECORD t = records[root];
+        records[root]  = records[child];
+        records[child] = t;
+        root = child;
+    }
+}
+
+gpa_PROFILE *gpa_profile_compile(gpa_PROFILE_LOG *log, ptr buffer, u32 maxentries) {
+    // pack the used records to the front, then heapsort them hottest first
+    gpa_PROFILE_RECORD *records = gpa_profile_records(log);
+    u32 n = 0;
+    for (u32 i = 0; i < log->capacity; i++) {
+        if (records[i].index) {
+            records[n++] = records[i];
+        }
+    }
+    for (u32 i = n; i < log->capacity; i++) {
+        records[i].index = 0;
+    }
+    for (u32 i = n / 2; i-- > 0; ) {
+        gpa_profile_siftdown(records, i, n);
+    }
+    for (u32 end = n; end > 1; end--) {
+        gpa_PROFILE_RECORD t = records[0];
+        records[0]       = records[end - 1];
+        records[end - 1] = t;
+        gpa_profile_siftdown(records, 0, end - 1);
+    }
+    log->used = n;
+
+    gpa_PROFILE *profile = buffer;
+    u32 count = n < maxentries ? n : maxentries;
+    u64 size  = gpa_profile_size(maxentries);
+    if (!size) {
+        return 0;
+    }
+    profile->magic    = GPA_PROFILE_MAGIC;
+    profile->version  = GPA_PROFILE_VERSION;
+    profile->count    = count;
+    profile->numslots = (u32)((size - sizeof(gpa_PROFILE)) / sizeof(gpa_PROFILE_SLOT));
+    profile->slots    = sizeof(gpa_PROFILE);
+    profile->size     = (u32)size;
+    gpa_PROFILE_SLOT *slots = gpa_profile_slots(profile);
+    u32 mask = profile->numslots - 1;
+    for (u32 i = 0; i < profile->numslots; i++) {
+        slots[i].index = 0;
+    }
+    for (u32 i = 0; i < count; i++) {
+        u32 slot = gpa_profile_home(records[i].fingerprint, records[i].hash, profile->numslots);
+        while (slots[slot].index) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot].fingerprint = records[i].fingerprint;
+        slots[slot].hash        = records[i].hash;
+        slots[slot].index       = records[i].index;
+    }
+    return profile;
+}
+
+// --- replay ------------------------------------------------------------------------------
+
+int gpa_profile_validate(gpa_PROFILE *profile, u64 size) {
+    if (size < sizeof(gpa_PROFILE) || profile->magic != GPA_PROFILE_MAGIC || profile->version != GPA_PROFILE_VERSION
+        || profile->size > size) {
+        return 0;
+    }
+    u32 n = profile->numslots;
+    return n >= 16 && (n & (n - 1)) == 0 && profile->count <= n / 2 && profile->slots >= sizeof(gpa_PROFILE)
+        && (u64)profile->slots + (u64)n * sizeof(gpa_PROFILE_SLOT) <= profile->size;
+}
+
+int gpa_profile_covers(gpa_PROFILE *profile, u64 fingerprint) {
+    gpa_PROFILE_SLOT *slots = gpa_profile_slots(profile);
+    for (u32 i = 0; i < profile->numslots; i++) {
+        if (slots[i].index && slots[i].fingerprint == fingerprint) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#define GPA_PROFILE_DEFINE(backend)                                                             \
+    int gpa_##backend##_profilerecord(gpa_MODVIEW *view, gpa_PROFILE_LOG *log, u64 fingerprint, \
+                                      char *name, gpa_EXPORT *exp) {                            \
+        if (!gpa_##backend##_lookup(view, name, exp)) {                                         \
+            return 0;                                                                           \
+        }                                                                                       \
+        gpa_profile_count(log, fingerprint, gpa_hash(name), exp->index, 1);                     \
+        return 1;                                                                               \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_profilelookup(gpa_MODVIEW *view, gpa_PROFILE *profile, u64 fingerprint, \
+                                      char *name, gpa_EXPORT *exp) {                            \
+        if (profile) {                                                                          \
+            gpa_PROFILE_SLOT *slots = gpa_profile_slots(profile);                               \
+            u32 count = gpa_##backend##_count(view);                                            \
+            u32 hash  = gpa_hash(name);                                                         \
+            u32 mask  = profile->numslots - 1;                                                  \
+            u32 slot  = gpa_profile_home(fingerprint, hash, profile->numslots);                 \
+            for (u32 probes = 0; probes < profile->numslots && slots[slot].index; probes++) {   \
+                u32 i = slots[slot].index - 1;                                                  \
+                if (slots[slot].hash == hash && slots[slot].fingerprint == fingerprint && i < count) { \
+                    char *candidate = gpa_##backend##_name(view, i);                            \
+                    if (candidate && gpa_modview_strcmp(view, name, candidate) == 0) {          \
+                        return gpa_##backend##_export(view, i, exp);                            \
+                    }                                                                           \
+                }                                                                               \
+                slot = (slot + 1) & mask;                                                       \
+            }                                                                                   \
+        }                                                                                       \
+        return gpa_##backend##_lookup(view, name, exp);                                         \
+    }
+
+GPA_PROFILE_DEFINE(pe_loaded)
+GPA_PROFILE_DEFINE(pe_file)
+
+// development code: record a zipfian run against a synthetic module, compile,
+// replay, and check that a changed module falls back to plain lookups
+#if _GPA_PROFILE_DEBUG
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gpa_linux.c"
+#include "gpa_synth.c"
+#include "gpa_fingerprint.c"
+
+static double gpa_profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    u32 count   = 20000;
+    u32 queries = 2000000;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, "Nt%08uRoutine", i);
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image   = malloc(capacity);
+    u8 *changed = malloc(capacity);
+    u64 size = gpa_synth_pe(image, capacity, exports, count, 0x5f000000, 0);
+    gpa_synth_pe(changed, capacity, exports, count, 0x5f000001, 0);
+    gpa_MODVIEW view, changedview;
+    gpa_pe_loaded_open(&view, image, size);
+    gpa_pe_loaded_open(&changedview, changed, size);
+    u64 fingerprint        = gpa_fingerprint_view(&view, 0);
+    u64 changedfingerprint = gpa_fingerprint_view(&changedview, 0);
+
+    // zipf 1.0 stream, popular ranks scattered over the table
+    double *cdf = malloc(count * sizeof(double));
+    u32 *stream = malloc(queries * sizeof(u32));
+    double total = 0;
+    for (u32 i = 0; i < count; i++) {
+        cdf[i] = (total += 1.0 / (i + 1));
+    }
+    u64 rng = 88172645463325252ull;
+    for (u32 q = 0; q < queries; q++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        double u = (rng >> 11) * (1.0 / 9007199254740992.0) * total;
+        u32 lo = 0, hi = count - 1;
+        while (lo < hi) {
+            u32 mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        stream[q] = (lo * 7919u) % count;
+    }
+
+    // record, then round-trip the log through a file like the tool would
+    u32 logcapacity = 1 << 15;
+    u64 logsize = gpa_profile_logsize(logcapacity);
+    gpa_PROFILE_LOG *log = gpa_profile_loginit(malloc(logsize), logcapacity);
+    gpa_EXPORT exp;
+    for (u32 q = 0; q < queries / 4; q++) {
+        gpa_pe_loaded_profilerecord(&view, log, fingerprint, exports[stream[q]].name, &exp);
+    }
+    i32 fd = gpa_sys_open("/tmp/gpa_profile.gpal", GPA_O_RDWR | GPA_O_CREAT, 0644);
+    gpa_sys_ftruncate(fd, 0);
+    gpa_sys_write(fd, log, log->size);
+    gpa_sys_close(fd);
+    u64 mappedsize;
+    gpa_PROFILE_LOG *mapped = gpa_mapfile("/tmp/gpa_profile.gpal", &mappedsize);
+    printf("recorded %u distinct names, %llu dropped, log valid: %d\n", log->used,
+           (unsigned long long)log->dropped, mapped && gpa_profile_logvalidate(mapped, mappedsize));
+    gpa_PROFILE_LOG *merged = gpa_profile_loginit(malloc(logsize), logcapacity);
+    gpa_profile_merge(merged, mapped);
+    gpa_unmapfile(mapped, mappedsize);
+    gpa_sys_unlink("/tmp/gpa_profile.gpal");
+
+    u32 sizes[] = { 64, 256, 1024 };
+    for (u32 s = 0; s < 3; s++) {
+        u64 profilesize = gpa_profile_size(sizes[s]);
+        gpa_PROFILE *profile = gpa_profile_compile(merged, malloc(profilesize), sizes[s]);
+        if (!gpa_profile_validate(profile, profilesize) || !gpa_profile_covers(profile, fingerprint)
+            || gpa_profile_covers(profile, changedfingerprint)) {
+            printf("bad profile\n");
+            return 1;
+        }
+        u64 coveredcount = 0;
+        gpa_PROFILE_RECORD *records = gpa_profile_records(merged);
+        for (u32 i = 0; i < profile->count; i++) {
+            coveredcount += records[i].count;
+        }
+        // replay on the rest of the stream, which the profile has not seen
+        u32 wrong = 0;
+        u64 sum = 0;
+        double t0 = gpa_profile_now();
+        for (u32 q = queries / 4; q < queries; q++) {
+            gpa_pe_loaded_profilelookup(&view, profile, fingerprint, exports[stream[q]].name, &exp);
+            sum += exp.address;
+            wrong += exp.address != exports[stream[q]].rva;
+        }
+        double t1 = gpa_profile_now();
+        for (u32 q = queries / 4; q < queries; q++) {
+            gpa_pe_loaded_lookup(&view, exports[stream[q]].name, &exp);
+            sum += exp.address;
+        }
+        double t2 = gpa_profile_now();
+        u32 n = queries - queries / 4;
+        printf("%4u entries (%5u bytes, %4.1f%% of recorded lookups): replay %5.1f ns, search %5.1f ns, %u wrong (%llx)\n",
+               sizes[s], profile->size, 100.0 * coveredcount / (queries / 4), (t1 - t0) * 1e9 / n,
+               (t2 - t1) * 1e9 / n, wrong, (unsigned long long)sum);
+        // a changed module must still resolve everything correctly
+        wrong = 0;
+        for (u32 i = 0; i < count; i += 7) {
+            wrong += !gpa_pe_loaded_profilelookup(&changedview, profile, changedfingerprint, exports[i].name, &exp)
+                  || exp.address != exports[i].rva;
+        }
+        printf("      changed module: %u wrong\n", wrong);
+    }
+    return 0;
+}
+
+// the offline step as a command line tool
+#elif _GPA_PROFILE_TOOL
+#include <stdio.h>
+#include <stdlib.h>
+#include "gpa_linux.c"
+
+int main(int argc, char *argv[]) {
+    u32 maxentries = 256;
+    int arg = 1;
+    if (arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] == 'n') {
+        maxentries = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg < 2 || maxentries == 0) {
+        fprintf(stderr, "usage: %s [-n maxentries] out.gpap in.gpal...\n", argv[0]);
+        return 2;
+    }
+    char *out = argv[arg++];
+    // room for every record of every input, at the same 3/4 load the logs allow
+    u64 total = 0;
+    for (int i = arg; i < argc; i++) {
+        u64 size;
+        gpa_PROFILE_LOG *log = gpa_mapfile(argv[i], &size);
+        if (!log || !gpa_profile_logvalidate(log, size)) {
+            fprintf(stderr, "%s: not a valid profile log\n", argv[i]);
+            return 1;
+        }
+        total += log->used;
+        gpa_unmapfile(log, size);
+    }
+    u64 capacity = 16;
+    while (capacity / 4 * 3 < total) {
+        capacity <<= 1;
+    }
+    if (capacity > 0x80000000ull || !gpa_profile_size(maxentries)) {
+        fprintf(stderr, "too many records or entries\n");
+        return 1;
+    }
+    u64 mergedsize = gpa_profile_logsize(capacity);
+    gpa_PROFILE_LOG *merged = gpa_profile_loginit(gpa_allocpages(mergedsize), capacity);
+    for (int i = arg; i < argc; i++) {
+        u64 size;
+        gpa_PROFILE_LOG *log = gpa_mapfile(argv[i], &size);
+        gpa_profile_merge(merged, log);
+        gpa_unmapfile(log, size);
+    }
+    u64 size = gpa_profile_size(maxentries);
+    gpa_PROFILE *profile = gpa_profile_compile(merged, gpa_allocpages(size), maxentries);
+    i32 fd = gpa_sys_open(out, GPA_O_RDWR | GPA_O_CREAT, 0644);
+    if (fd < 0 || gpa_sys_ftruncate(fd, 0) < 0 || gpa_sys_write(fd, profile, size) != (i64)size) {
+        fprintf(stderr, "%s: write failed\n", out);
+        return 1;
+    }
+    gpa_sys_close(fd);
+    u64 all = 0, kept = 0;
+    gpa_PROFILE_RECORD *records = gpa_profile_records(merged);
+    for (u32 i = 0; i < merged->used; i++) {
+        all  += records[i].count;
+        kept += i < profile->count ? records[i].count : 0;
+    }
+    printf("%u of %u names kept, covering %.1f%% of %llu recorded lookups (%llu dropped)\n", profile->count,
+           merged->used, all ? 100.0 * kept / all : 0.0, (unsigned long long)all, (unsigned long long)merged->dropped);
+    return 0;
+}
+#endif // _GPA_PROFILE_DEBUG / _GPA_PROFILE_TOOL
+#endif // _GPA_PROFILE_C
@@ -0,0 +1,413 @@
+/*
+    gpa_registry.c
+    incremental tracking of the loader's module list.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    A process that loads and unloads plugins either lets a process-wide export
+    cache go stale or throws it all away on every change. The registry walks
+    the same list gpa_getkernel32 does, remembers the modules it has seen, and
+    on each sync calls back only for modules that appeared (build) or
+    disappeared (drop). Whatever the build callback returns (typically an
+    index) is kept with the entry.
+
+    The entry array is kept sorted by DllBase and guarded by a sequence
+    counter: readers that cache derived state compare the generation with one
+    atomic load, and readers of the entries themselves retry if a sync ran
+    while they looked (gpa_registry_readbegin / gpa_registry_readretry).
+    Syncs must be serialized by the caller; the build callbacks run before the
+    counter goes odd, so readers never wait on an index build.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_registry_init(gpa_REGISTRY *reg, gpa_REGISTRY_ENTRY *entries, u32 capacity,
+                           gpa_REGISTRY_BUILD build, gpa_REGISTRY_DROP drop, ptr context)
+        sets up an empty registry over caller-provided entry storage
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_registry_sync(gpa_REGISTRY *reg, ptr listhead)
+        walks the list (gpa_getmodulelist() on Windows) and applies the difference.
+        returns 1 if anything changed, 0 if not, -1 if capacity ran out
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_registry_generation(gpa_REGISTRY *reg)
+        the change counter, even while stable
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_registry_find(gpa_REGISTRY *reg, ptr address, gpa_REGISTRY_ENTRY *entry)
+        binary searches the [DllBase, DllBase + SizeOfImage) ranges for an address
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_registry_module(gpa_REGISTRY *reg, ptr listhead, ptr address)
+        the module base containing address. a miss syncs and tries once more, but
+        only if the list has a new tail: loads append to it, so misses on
+        addresses outside any module (heap, stacks) stay cheap
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    ptr gpa_module_from_address(ptr address)
+        the same over a process-wide registry of the real loader list. a module
+        unloaded since the last sync is still reported until something misses
+        or gpa_module_refresh() is called
+*/
+
+#ifndef _GPA_REGISTRY_C
+#define _GPA_REGISTRY_C
+#define _GPA_REGISTRY_DEBUG 0
+#include "getprocaddress.c"
+
+// LDR_DATA_TABLE_ENTRY fields relative to InMemoryOrderLinks, see gpa_getmodulelist
+#define GPA_LDR_DLLBASE         0x20
+#define GPA_LDR_SIZEOFIMAGE     0x30
+#define GPA_LDR_MAXWALK         65536
+#define GPA_MODULE_MAX          1024
+
+typedef struct _gpa_LIST_ENTRY {
+    struct _gpa_LIST_ENTRY *Flink;
+    struct _gpa_LIST_ENTRY *Blink;
+} gpa_LIST_ENTRY, *gpa_PLIST_ENTRY;
+
+typedef struct _gpa_REGISTRY_ENTRY {
+    ptr   link;                 // the loader entry, identifies the module with base
+    u8   *base;
+    u32   size;
+    u32   seen;                 // last sync pass that found it
+    ptr   index;                // from the build callback
+} gpa_REGISTRY_ENTRY;
+
+typedef ptr  (*gpa_REGISTRY_BUILD)(ptr context, ptr base, u32 size);
+typedef void (*gpa_REGISTRY_DROP)(ptr context, ptr base, ptr index);
+
+typedef struct _gpa_REGISTRY {
+    u64   generation;           // odd while a sync is rewriting the entries
+    u32   count;
+    u32   capacity;
+    gpa_REGISTRY_ENTRY *entries;
+    gpa_REGISTRY_BUILD build;
+    gpa_REGISTRY_DROP drop;
+    ptr   context;
+    ptr   tail;                 // the list's last entry as of the last sync
+    u32   pass;
+    u32   built;                // statistics of the last sync
+    u32   dropped;
+} gpa_REGISTRY;
+
+void gpa_registry_init(gpa_REGISTRY *reg, gpa_REGISTRY_ENTRY *entries, u32 capacity,
+                       gpa_REGISTRY_BUILD build, gpa_REGISTRY_DROP drop, ptr context) {
+    reg->generation = 0;
+    reg->count      = 0;
+    reg->capacity   = capacity;
+    reg->entries    = entries;
+    reg->build      = build;
+    reg->drop       = drop;
+    reg->context    = context;
+    reg->tail       = 0;
+    reg->pass       = 0;
+    reg->built      = 0;
+    reg->dropped    = 0;
+}
+
+u64 gpa_registry_generation(gpa_REGISTRY *reg) {
+    return __atomic_load_n(&reg->generation, __ATOMIC_ACQUIRE);
+}
+
+// optimistic readers: read the entries between these two, retry if told to
+inline static u64 gpa_registry_readbegin(gpa_REGISTRY *reg) {
+    u64 generation;
+    while ((generation = __atomic_load_n(&reg->generation, __ATOMIC_ACQUIRE)) & 1) {
+        __builtin_ia32_pause();
+    }
+    return generation;
+}
+
+inline static int gpa_registry_readretry(gpa_REGISTRY *reg, u64 generation) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&reg->generation, __ATOMIC_RELAXED) != generation;
+}
+
+// first entry with base >= the given one
+inline static u32 gpa_registry_lowerbound(gpa_REGISTRY_ENTRY *entries, u32 count, u8 *base) {
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (entries[mid].base < base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int gpa_registry_sync(gpa_REGISTRY *reg, ptr listhead) {
+    gpa_PLIST_ENTRY head = listhead;
+    gpa_REGISTRY_ENTRY *entries = reg->entries;
+    u32 count = reg->count;
+    u32 added = 0, present = 0, overflow = 0;
+    reg->pass++;
+    reg->built = reg->dropped = 0;
+    reg->tail  = head->Blink;
+
+    // phase 1, nothing visible to readers changes: mark known modules,
+    // build new ones into the scratch space past count
+    u32 steps = 0;
+    for (gpa_PLIST_ENTRY link = head->Flink; link != head && steps < GPA_LDR_MAXWALK; link = link->Flink, steps++) {
+        u8 *base = *(u8**)((u8*)link + GPA_LDR_DLLBASE);
+        u32 size = *(u32*)((u8*)link + GPA_LDR_SIZEOFIMAGE);
+        if (!base) {
+            continue;
+        }
+        u32 i = gpa_registry_lowerbound(entries, count, base);
+        if (i < count && entries[i].base == base && entries[i].link == link && entries[i].size == size) {
+            entries[i].seen = reg->pass;
+            present++;
+            continue;
+        }
+        if (count + added >= reg->capacity) {
+            overflow = 1;
+            break;
+        }
+        gpa_REGISTRY_ENTRY *entry = &entries[count + added++];
+        entry->link  = link;
+        entry->base  = base;
+        entry->size  = size;
+        entry->seen  = reg->pass;
+        entry->index = reg->build ? reg->build(reg->context, base, size) : 0;
+        reg->built++;
+    }
+    if (overflow) {
+        // undo the builds, leave the registry as it was
+        for (u32 i = 0; i < added; i++) {
+            if (reg->drop) {
+                reg->drop(reg->context, entries[count + i].base, entries[count + i].index);
+            }
+        }
+        reg->built = 0;
+        reg->tail  = 0;
+        return -1;
+    }
+    if (added == 0 && present == count) {
+        return 0;
+    }
+
+    // phase 2, under the odd generation: drop what is gone, merge what is new
+    __atomic_store_n(&reg->generation, reg->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    u32 kept = 0;
+    for (u32 i = 0; i < count + added; i++) {
+        if (i < count && entries[i].seen != reg->pass) {
+            if (reg->drop) {
+                reg->drop(reg->context, entries[i].base, entries[i].index);
+            }
+            reg->dropped++;
+            continue;
+        }
+        // insertion sort; the existing part is already in order and
+        // a sync rarely adds more than a handful of modules
+        gpa_REGISTRY_ENTRY entry = entries[i];
+        u32 j = kept;
+        while (j > 0 && entries[j - 1].base > entry.base) {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = entry;
+        kept++;
+    }
+    __atomic_store_n(&reg->count, kept, __ATOMIC_RELAXED);
+    __atomic_store_n(&reg->generation, reg->generation + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int gpa_registry_find(gpa_REGISTRY *reg, ptr address, gpa_REGISTRY_ENTRY *entry) {
+    u64 generation;
+    int found;
+    do {
+        generation = gpa_registry_readbegin(reg);
+        u32 count = __atomic_load_n(&reg->count, __ATOMIC_RELAXED);
+        // the last range starting at or below address is the only candidate
+        u32 i = gpa_registry_lowerbound(reg->entries, count, (u8*)address + 1);
+        found = 0;
+        if (i > 0) {
+            *entry = reg->entries[i - 1];
+            found  = (u64)((u8*)address - entry->base) < entry->size;
+        }
+    } while (gpa_registry_readretry(reg, generation));
+    return found;
+}
+
+ptr gpa_registry_module(gpa_REGISTRY *reg, ptr listhead, ptr address) {
+    gpa_REGISTRY_ENTRY entry;
+    if (gpa_registry_find(reg, address, &entry)) {
+        return entry.base;
+    }
+    if (((gpa_PLIST_ENTRY)listhead)->Blink != reg->tail && gpa_registry_sync(reg, listhead) > 0
+        && gpa_registry_find(reg, address, &entry)) {
+        return entry.base;
+    }
+    return 0;
+}
+
+static gpa_REGISTRY gpa_moduleregistry;
+static gpa_REGISTRY_ENTRY gpa_moduleentries[GPA_MODULE_MAX];
+static u32 gpa_modulelock;
+
+// syncs have to be serialized; finds don't take the lock
+inline static void gpa_module_lock() {
+    while (__atomic_exchange_n(&gpa_modulelock, 1, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+    if (!gpa_moduleregistry.entries) {
+        gpa_registry_init(&gpa_moduleregistry, gpa_moduleentries, GPA_MODULE_MAX, 0, 0, 0);
+    }
+}
+
+inline static void gpa_module_unlock() {
+    __atomic_store_n(&gpa_modulelock, 0, __ATOMIC_RELEASE);
+}
+
+void gpa_module_refresh() {
+    gpa_module_lock();
+    gpa_registry_sync(&gpa_moduleregistry, gpa_getmodulelist());
+    gpa_module_unlock();
+}
+
+ptr gpa_module_from_address(ptr address) {
+    gpa_REGISTRY_ENTRY entry;
+    if (__atomic_load_n(&gpa_moduleregistry.entries, __ATOMIC_ACQUIRE)
+        && gpa_registry_find(&gpa_moduleregistry, address, &entry)) {
+        return entry.base;
+    }
+    gpa_module_lock();
+    ptr base = gpa_registry_module(&gpa_moduleregistry, gpa_getmodulelist(), address);
+    gpa_module_unlock();
+    return base;
+}
+
+// development code: a fake loader list on the heap, mutated between syncs
+#if _GPA_REGISTRY_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double gpa_registry_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// shaped like LDR_DATA_TABLE_ENTRY as far as the registry cares
+typedef struct _gpa_FAKE_LDR_ENTRY {
+    gpa_LIST_ENTRY InLoadOrderLinks;
+    gpa_LIST_ENTRY InMemoryOrderLinks;
+    gpa_LIST_ENTRY InInitializationOrderLinks;
+    ptr   DllBase;
+    ptr   EntryPoint;
+    u32   SizeOfImage;
+} gpa_FAKE_LDR_ENTRY;
+
+static gpa_LIST_ENTRY gpa_fakehead = { &gpa_fakehead, &gpa_fakehead };
+
+static gpa_FAKE_LDR_ENTRY *gpa_fakeload(u64 base, u32 size) {
+    gpa_FAKE_LDR_ENTRY *e = calloc(1, sizeof(*e));
+    e->DllBase = (ptr)base;
+    e->SizeOfImage = size;
+    e->InMemoryOrderLinks.Flink = &gpa_fakehead;
+    e->InMemoryOrderLinks.Blink = gpa_fakehead.Blink;
+    gpa_fakehead.Blink->Flink = &e->InMemoryOrderLinks;
+    gpa_fakehead.Blink = &e->InMemoryOrderLinks;
+    return e;
+}
+
+static void gpa_fakeunload(gpa_FAKE_LDR_ENTRY *e) {
+    e->InMemoryOrderLinks.Blink->Flink = e->InMemoryOrderLinks.Flink;
+    e->InMemoryOrderLinks.Flink->Blink = e->InMemoryOrderLinks.Blink;
+    free(e);
+}
+
+static ptr gpa_debugbuild(ptr context, ptr base, u32 size) {
+    (*(u32*)context)++;
+    return base + size;     // stands in for an index
+}
+
+static void gpa_debugdrop(ptr context, ptr base, ptr index) {
+    (void)base;             // nothing was allocated for the stand-in
+    (void)index;
+    (*(u32*)context)++;
+}
+
+int main(int argc, char *argv[]) {
+    gpa_REGISTRY reg;
+    gpa_REGISTRY_ENTRY entries[64];
+    gpa_FAKE_LDR_ENTRY *modules[32];
+    u32 calls = 0;
+    gpa_registry_init(&reg, entries, 64, gpa_debugbuild, gpa_debugdrop, &calls);
+
+    // load order deliberately differs from address order
+    for (u32 i = 0; i < 32; i++) {
+        modules[i] = gpa_fakeload(0x7ff800000000ull + ((i * 37) % 32) * 0x100000, 0x80000);
+    }
+    int changed = gpa_registry_sync(&reg, &gpa_fakehead);
+    printf("initial:   changed %d, built %u, dropped %u, count %u, generation %llu\n", changed,
+           reg.built, reg.dropped, reg.count, (unsigned long long)gpa_registry_generation(&reg));
+    changed = gpa_registry_sync(&reg, &gpa_fakehead);
+    printf("no change: changed %d, built %u, dropped %u, count %u, generation %llu\n", changed,
+           reg.built, reg.dropped, reg.count, (unsigned long long)gpa_registry_generation(&reg));
+
+    // unload three plugins, load two new ones, reload one at the same base
+    gpa_fakeunload(modules[3]);
+    gpa_fakeunload(modules[10]);
+    u64 reused = (u64)modules[20]->DllBase;
+    gpa_fakeunload(modules[20]);
+    gpa_fakeload(0x7ff900000000ull, 0x1000);
+    gpa_fakeload(0x10000000ull, 0x1000);
+    gpa_fakeload(reused, 0x90000);
+    changed = gpa_registry_sync(&reg, &gpa_fakehead);
+    printf("mutated:   changed %d, built %u, dropped %u, count %u, generation %llu\n", changed,
+           reg.built, reg.dropped, reg.count, (unsigned long long)gpa_registry_generation(&reg));
+
+    int sorted = 1;
+    for (u32 i = 1; i < reg.count; i++) {
+        sorted &= entries[i - 1].base < entries[i].base;
+    }
+    printf("sorted: %s, callbacks: %u\n", sorted ? "yes" : "NO", calls);
+
+    gpa_REGISTRY small;
+    gpa_registry_init(&small, entries, 8, 0, 0, 0);
+    printf("overflow: %d, count %u\n", gpa_registry_sync(&small, &gpa_fakehead), small.count);
+
+    // address to module: grow to 600 modules with gaps between them, then
+    // compare the binary search with walking the list
+    static gpa_REGISTRY_ENTRY many[GPA_MODULE_MAX];
+    gpa_REGISTRY big;
+    gpa_registry_init(&big, many, GPA_MODULE_MAX, 0, 0, 0);
+    u32 nummodules = argc > 1 ? atoi(argv[1]) : 600;
+    for (u32 i = reg.count; i < nummodules; i++) {
+        gpa_fakeload(0x180000000ull + (u64)((i * 7919u) % 4096) * 0x200000, 0x100000 + (i % 7) * 0x10000);
+    }
+    u32 queries = 1000000, hits = 0, agree = 0;
+    u64 *addresses = malloc(queries * sizeof(u64));
+    for (u32 i = 0; i < queries; i++) {
+        addresses[i] = 0x180000000ull + (u64)((i * 2654435761u) % 4096) * 0x200000 + (i % 0x1c0000);
+    }
+    gpa_registry_sync(&big, &gpa_fakehead);
+    double t0 = gpa_registry_now();
+    for (u32 i = 0; i < queries; i++) {
+        hits += gpa_registry_module(&big, &gpa_fakehead, (ptr)addresses[i]) != 0;
+    }
+    double t1 = gpa_registry_now();
+    u32 walked = queries / 100;
+    for (u32 i = 0; i < walked; i++) {
+        ptr found = 0;
+        for (gpa_PLIST_ENTRY link = gpa_fakehead.Flink; link != &gpa_fakehead; link = link->Flink) {
+            u8 *base = *(u8**)((u8*)link + GPA_LDR_DLLBASE);
+            if ((u64)((u8*)addresses[i] - base) < *(u32*)((u8*)link + GPA_LDR_SIZEOFIMAGE)) {
+                found = base;
+                break;
+            }
+        }
+        agree += found == gpa_registry_module(&big, &gpa_fakehead, (ptr)addresses[i]);
+    }
+    double t2 = gpa_registry_now();
+    printf("%u modules: binary search %.1f ns/lookup (%u hits), list walk %.1f ns/lookup (%u/%u agree)\n",
+           big.count, (t1 - t0) * 1e9 / queries, hits, (t2 - t1) * 1e9 / walked, agree, walked);
+    return 0;
+}
+#endif // _GPA_REGISTRY_DEBUG
+#endif // _GPA_REGISTRY_C
@@ -0,0 +1,339 @@
+/*
+    gpa_resolver.c
+    picks the lookup strategy for a module from its size and query count.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    No one strategy wins everywhere. One query against a dozen names is
+    cheapest as a plain walk, a few hundred against a sorted PE table as a
+    binary search, and thousands against the same module repay building a
+    gpa_index. The resolver estimates each strategy's total cost from the
+    table size and the number of queries the caller expects, and starts with
+    the cheapest:
+
+        linear      WALK + SCAN * (count / 2 + 1)     per query
+        binary      (PROBE + STEP2 * steps) * steps   per query, sorted tables only,
+                    steps = log2(count) + 1
+        index       BUILD * count once, + HIT         per query, needs caller storage
+
+    The costs are averages for the heads/bodies/tails name corpus the other
+    debug builds use, calibrated by the debug main below, which prints them in
+    the form they are defined here (1/16 ns units) for pasting.
+
+    Estimates can be wrong, and an expected count of 0 means "don't know".
+    Either way the resolver counts what each query cost beyond an index hit,
+    and once that overspend reaches the cost of building the index it builds
+    one and switches. That is the ski-rental rule: never worse than twice the
+    cost of having known the query count up front.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_resolver_choose(u32 count, u64 expected, int sorted, int canindex)
+        the strategy the cost model picks, GPA_RESOLVER_LINEAR/BINARY/INDEX
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_<backend>_resolverinit(gpa_RESOLVER *res, gpa_MODVIEW *view, u64 expected,
+                                    ptr buffer, u64 capacity)
+        sets up a resolver over an open view. buffer is where an index may be
+        built later (gpa_index_size(count) bytes), or 0 to never build one
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_<backend>_resolve(gpa_RESOLVER *res, char *name, gpa_EXPORT *exp)
+        looks name up with the current strategy, upgrading first if it is due
+*/
+
+#ifndef _GPA_RESOLVER_C
+#define _GPA_RESOLVER_C
+#define _GPA_RESOLVER_DEBUG 0
+#include "gpa_index.c"
+
+#define GPA_RESOLVER_LINEAR     0
+#define GPA_RESOLVER_BINARY     1
+#define GPA_RESOLVER_INDEX      2
+
+// calibrated by the debug main, 1/16 ns each
+#define GPA_RESOLVER_COST_WALK  520         // per walk, on top of the names
+#define GPA_RESOLVER_COST_SCAN  52          // per name walked
+#define GPA_RESOLVER_COST_PROBE 88          // per binary search step
+#define GPA_RESOLVER_COST_STEP2 15          // ... times the step count, for cache misses
+#define GPA_RESOLVER_COST_BUILD 640         // per name hashed and inserted
+#define GPA_RESOLVER_COST_HIT   1730        // per index lookup
+#define GPA_RESOLVER_NEVER      (~0ull >> 1)
+
+typedef struct _gpa_RESOLVER {
+    gpa_MODVIEW *view;
+    u32          count;
+    u32          strategy;
+    u64          queries;
+    u64          overspend;     // cost above index hits since the last choice
+    u64          buildcost;     // GPA_RESOLVER_NEVER without storage for an index
+    gpa_INDEX   *index;
+    ptr          buffer;
+} gpa_RESOLVER;
+
+inline static u32 gpa_resolver_log2(u32 count) {
+    u32 bits = 0;
+    while (count >> bits > 1) {
+        bits++;
+    }
+    return bits;
+}
+
+// what one query costs with a strategy, leaving the build out
+inline static u64 gpa_resolver_querycost(u32 strategy, u32 count) {
+    switch (strategy) {
+    case GPA_RESOLVER_LINEAR:
+        return GPA_RESOLVER_COST_WALK + GPA_RESOLVER_COST_SCAN * ((u64)count / 2 + 1);
+    case GPA_RESOLVER_BINARY:
+        return (GPA_RESOLVER_COST_PROBE + GPA_RESOLVER_COST_STEP2 * ((u64)gpa_resolver_log2(count) + 1))
+               * ((u64)gpa_resolver_log2(count) + 1);
+    default:
+        return GPA_RESOLVER_COST_HIT;
+    }
+}
+
+u32 gpa_resolver_choose(u32 count, u64 expected, int sorted, int canindex) {
+    expected = expected ? expected : 1;
+    u32 best = GPA_RESOLVER_LINEAR;
+    u64 bestcost = expected * gpa_resolver_querycost(GPA_RESOLVER_LINEAR, count);
+    if (sorted && expected * gpa_resolver_querycost(GPA_RESOLVER_BINARY, count) < bestcost) {
+        best = GPA_RESOLVER_BINARY;
+        bestcost = expected * gpa_resolver_querycost(GPA_RESOLVER_BINARY, count);
+    }
+    if (canindex && GPA_RESOLVER_COST_BUILD * (u64)count + expected * GPA_RESOLVER_COST_HIT < bestcost) {
+        best = GPA_RESOLVER_INDEX;
+    }
+    return best;
+}
+
+// counts a query against the running strategy, returns 1 when the index has paid for itself
+inline static int gpa_resolver_due(gpa_RESOLVER *res) {
+    res->queries++;
+    if (res->strategy == GPA_RESOLVER_INDEX) {
+        return 0;
+    }
+    u64 cost = gpa_resolver_querycost(res->strategy, res->count);
+    res->overspend += cost > GPA_RESOLVER_COST_HIT ? cost - GPA_RESOLVER_COST_HIT : 0;
+    return res->buffer && res->overspend >= res->buildcost;
+}
+
+#define GPA_RESOLVER_DEFINE(backend)                                                            \
+    void gpa_##backend##_resolverinit(gpa_RESOLVER *res, gpa_MODVIEW *view, u64 expected,       \
+                                      ptr buffer, u64 capacity) {                               \
+        res->view      = view;                                                                  \
+        res->count     = gpa_##backend##_count(view);                                           \
+        res->queries   = 0;                                                                     \
+        res->overspend = 0;                                                                     \
+        res->index     = 0;                                                                     \
+        u64 need       = gpa_index_size(res->count);                                            \
+        res->buffer    = buffer && need && capacity >= need ? buffer : 0;                       \
+        res->buildcost = res->buffer ? GPA_RESOLVER_COST_BUILD * (u64)res->count : GPA_RESOLVER_NEVER; \
+        res->strategy  = gpa_resolver_choose(res->count, expected, gpa_##backend##_SORTED,      \
+                                             res->buffer != 0);                                 \
+        if (res->strategy == GPA_RESOLVER_INDEX) {                                              \
+            res->index = gpa_##backend##_indexbuild(view, res->buffer, 0);                      \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    int gpa_##backend##_resolve(gpa_RESOLVER *res, char *name, gpa_EXPORT *exp) {               \
+        gpa_MODVIEW *view = res->view;                                                          \
+        if (gpa_resolver_due(res)) {                                                            \
+            res->index    = gpa_##backend##_indexbuild(view, res->buffer, 0);                   \
+            res->strategy = GPA_RESOLVER_INDEX;                                                 \
+        }                                                                                       \
+        if (res->strategy == GPA_RESOLVER_INDEX) {                                              \
+            return gpa_##backend##_indexlookup(view, res->index, name, exp);                    \
+        }                                                                                       \
+        if (res->strategy == GPA_RESOLVER_BINARY) {                                             \
+            return gpa_##backend##_lookup(view, name, exp);                                     \
+        }                                                                                       \
+        for (u32 i = 0; i < res->count; i++) {                                                  \
+            char *candidate = gpa_##backend##_name(view, i);                                    \
+            if (candidate && gpa_modview_strcmp(view, name, candidate) == 0) {                  \
+                return gpa_##backend##_export(view, i, exp);                                    \
+            }                                                                                   \
+        }                                                                                       \
+        return 0;                                                                               \
+    }
+
+GPA_RESOLVER_DEFINE(pe_loaded)
+GPA_RESOLVER_DEFINE(pe_file)
+GPA_RESOLVER_DEFINE(elf)
+
+// calibration, and a check of the choices against every fixed strategy
+#if _GPA_RESOLVER_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gpa_synth.c"
+
+static double gpa_resolver_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_resolver_byname(const void *a, const void *b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+static char *gpa_resolver_strategies[] = { "linear", "binary", "index" };
+
+// one scenario: a fresh resolver, then queries lookups. strategy -1 lets it choose
+// from expected, otherwise the strategy is pinned and the index (if any) built up front
+static double gpa_resolver_scenario(gpa_MODVIEW *view, char **names, u32 count, u64 queries, u64 expected,
+                                    int strategy, ptr buffer, u32 reps, u32 *chosen, u32 *found) {
+    double t = gpa_resolver_now();
+    gpa_EXPORT exp;
+    *found = 0;
+    for (u32 r = 0; r < reps; r++) {
+        gpa_RESOLVER res;
+        gpa_pe_loaded_resolverinit(&res, view, strategy < 0 ? expected : 1, buffer, strategy < 0 ? ~0ull : 0);
+        if (strategy >= 0) {
+            res.strategy = strategy;
+            if (strategy == GPA_RESOLVER_INDEX) {
+                res.index = gpa_pe_loaded_indexbuild(view, buffer, 0);
+            }
+        }
+        for (u64 q = 0; q < queries; q++) {
+            *found += gpa_pe_loaded_resolve(&res, names[(q * 2654435761u + r) % count], &exp);
+        }
+        *chosen = res.strategy;
+    }
+    return (gpa_resolver_now() - t) / reps;
+}
+
+int main(int argc, char *argv[]) {
+    char *heads[] = { "Nt", "Zw", "Rtl", "Ldr", "Etw", "Create", "Get", "Set", "Query", "Open", "Close",
+                      "Enum", "Reg", "Crypt", "Wsa", "Virtual", "Heap", "Local", "Global", "Find" };
+    char *bodies[] = { "File", "Process", "Thread", "Key", "Value", "Event", "Mutex", "Section", "Memory",
+                       "Token", "Object", "Module", "Window", "Path", "String", "Unicode", "Time", "Info",
+                       "Information", "Handle", "Pipe", "Port", "Timer", "Semaphore" };
+    char *tails[] = { "", "A", "W", "Ex", "ExA", "ExW", "2", "Internal" };
+    u32 nh = sizeof(heads) / sizeof(*heads), nb = sizeof(bodies) / sizeof(*bodies), nt = sizeof(tails) / sizeof(*tails);
+    char **corpus = malloc(sizeof(char*) * nh * nb * nb * nt);
+    u32 total = 0;
+    for (u32 h = 0; h < nh; h++) {
+        for (u32 b1 = 0; b1 < nb; b1++) {
+            for (u32 b2 = 0; b2 < nb; b2++) {
+                for (u32 t = 0; t < nt; t++) {
+                    if (((h * 131 + b1 * 31 + b2 * 7 + t) * 2654435761u >> 16) % 4 == 0) {
+                        char *name = malloc(64);
+                        snprintf(name, 64, "%s%s%s%s", heads[h], bodies[b1], b1 == b2 ? "" : bodies[b2], tails[t]);
+                        corpus[total++] = name;
+                    }
+                }
+            }
+        }
+    }
+    qsort(corpus, total, sizeof(char*), gpa_resolver_byname);
+    u32 unique = 0;
+    for (u32 i = 0; i < total; i++) {
+        if (unique == 0 || strcmp(corpus[unique - 1], corpus[i]) != 0) {
+            corpus[unique++] = corpus[i];
+        }
+    }
+    total = unique;
+
+    // tables of several sizes, each an evenly spread sorted sample of the corpus
+    u32 sizes[] = { 8, 64, 512, 4096, 16384 };
+    u32 numsizes = sizeof(sizes) / sizeof(*sizes);
+    gpa_MODVIEW views[5];
+    char **names[5];
+    ptr buffers[5];
+    for (u32 s = 0; s < numsizes; s++) {
+        u32 count = sizes[s];
+        gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+        names[s] = malloc(sizeof(char*) * count);
+        for (u32 i = 0; i < count; i++) {
+            names[s][i]     = corpus[(u64)i * total / count];
+            exports[i].name = names[s][i];
+            exports[i].slot = i;
+            exports[i].rva  = 0x1000 + 16 * i;
+        }
+        u64 capacity = gpa_synth_pe_size(exports, count);
+        u8 *image = malloc(capacity);
+        gpa_pe_loaded_open(&views[s], image, gpa_synth_pe(image, capacity, exports, count, 0, 0));
+        buffers[s] = malloc(gpa_index_size(count));
+        free(exports);
+    }
+
+    // calibration: a line through the walk's per-query time over all sizes, and
+    // a x + b x^2 through the origin for the search, whose steps get dearer as the
+    // table outgrows the caches. both fitted for relative error, so the small
+    // tables count as much as the big ones
+    u32 chosen, found;
+    double w1 = 0, x1 = 0, y1 = 0, xx1 = 0, xy1 = 0;            // walk sums
+    double xx2 = 0, xxx2 = 0, xxxx2 = 0, xy2 = 0, xxy2 = 0;     // search sums
+    double build = 0, hit = 0;
+    for (u32 s = 0; s < numsizes; s++) {
+        u32 count = sizes[s];
+        u64 queries = 4000000 / count + 20000;
+        double x = count / 2 + 1;
+        double y = gpa_resolver_scenario(&views[s], names[s], count, queries, 0, GPA_RESOLVER_LINEAR,
+                                         buffers[s], 1, &chosen, &found) / queries;
+        double w = 1 / (y * y);
+        w1 += w, x1 += w * x, y1 += w * y, xx1 += w * x * x, xy1 += w * x * y;
+        x = gpa_resolver_log2(count) + 1;
+        y = gpa_resolver_scenario(&views[s], names[s], count, 400000, 0, GPA_RESOLVER_BINARY,
+                                  buffers[s], 1, &chosen, &found) / 400000;
+        w = 1 / (y * y);
+        xx2 += w * x * x, xxx2 += w * x * x * x, xxxx2 += w * x * x * x * x;
+        xy2 += w * x * y, xxy2 += w * x * x * y;
+        u32 builds = 2000000 / count + 1;
+        double t = gpa_resolver_now();
+        for (u32 r = 0; r < builds; r++) {
+            gpa_pe_loaded_indexbuild(&views[s], buffers[s], 0);
+        }
+        double built = (gpa_resolver_now() - t) / builds;
+        hit   += (gpa_resolver_scenario(&views[s], names[s], count, 400000, 0, GPA_RESOLVER_INDEX,
+                                        buffers[s], 1, &chosen, &found) - built) / 400000;
+        build += built / count;
+    }
+    double scan   = (w1 * xy1 - x1 * y1) / (w1 * xx1 - x1 * x1);
+    double walk   = (y1 - scan * x1) / w1;
+    double det    = xx2 * xxxx2 - xxx2 * xxx2;
+    double probe  = (xy2 * xxxx2 - xxy2 * xxx2) / det;
+    double probe2 = (xx2 * xxy2 - xxx2 * xy2) / det;
+    printf("calibrated on %u names (1/16 ns units):\n", total);
+    printf("#define GPA_RESOLVER_COST_WALK  %.0f\n", (walk > 0 ? walk : 0) * 16e9);
+    printf("#define GPA_RESOLVER_COST_SCAN  %.0f\n", scan * 16e9);
+    printf("#define GPA_RESOLVER_COST_PROBE %.0f\n", (probe > 0 ? probe : 0) * 16e9);
+    printf("#define GPA_RESOLVER_COST_STEP2 %.0f\n", (probe2 > 0 ? probe2 : 0) * 16e9);
+    printf("#define GPA_RESOLVER_COST_BUILD %.0f\n", build / numsizes * 16e9);
+    printf("#define GPA_RESOLVER_COST_HIT   %.0f\n", hit / numsizes * 16e9);
+
+    // every fixed strategy against the resolver told the query count, and the resolver left to learn it
+    u64 querycounts[] = { 1, 16, 256, 4096, 65536 };
+    double worsttold = 1, worstlearned = 1;
+    printf("%6s %6s | %10s %10s %10s | %-7s %10s %5s | %-7s %10s %5s\n", "names", "quer", "linear us",
+           "binary us", "index us", "told", "us", "x", "learned", "us", "x");
+    for (u32 s = 0; s < numsizes; s++) {
+        u32 count = sizes[s];
+        for (u32 q = 0; q < 5; q++) {
+            u64 queries = querycounts[q];
+            u32 reps = (u32)(400000 / (queries + count / 4) + 3);
+            double fixed[3], best = 1e9;
+            for (u32 k = 0; k < 3; k++) {
+                fixed[k] = gpa_resolver_scenario(&views[s], names[s], count, queries, 0, k, buffers[s], reps,
+                                                 &chosen, &found);
+                best = fixed[k] < best ? fixed[k] : best;
+            }
+            u32 told, learned, foundtold, foundlearned;
+            double ttold    = gpa_resolver_scenario(&views[s], names[s], count, queries, queries, -1, buffers[s],
+                                                    reps, &told, &foundtold);
+            double tlearned = gpa_resolver_scenario(&views[s], names[s], count, queries, 0, -1, buffers[s],
+                                                    reps, &learned, &foundlearned);
+            worsttold    = ttold / best > worsttold ? ttold / best : worsttold;
+            worstlearned = tlearned / best > worstlearned ? tlearned / best : worstlearned;
+            printf("%6u %6llu | %10.2f %10.2f %10.2f | %-7s %10.2f %5.2f | %-7s %10.2f %5.2f%s\n", count,
+                   (unsigned long long)queries, fixed[0] * 1e6, fixed[1] * 1e6, fixed[2] * 1e6,
+                   gpa_resolver_strategies[told], ttold * 1e6, ttold / best,
+                   gpa_resolver_strategies[learned], tlearned * 1e6, tlearned / best,
+                   foundtold == queries * reps && foundlearned == queries * reps ? "" : "  MISSES");
+        }
+    }
+    printf("worst against the best fixed strategy: told %.2fx, learned %.2fx\n", worsttold, worstlearned);
+    return 0;
+}
+#endif // _GPA_RESOLVER_DEBUG
+#endif // _GPA_RESOLVER_C
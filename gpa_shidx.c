@@ -0,0 +1,264 @@
+/*
+    gpa_shidx.c
+    export indexes shared between processes through named shared memory.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Every worker that resolves names in the same system modules would otherwise
+    build the same gpa_index.c index for itself. Here the first process builds
+    it into /dev/shm (which is what shm_open uses on Linux) and later processes
+    map it read-only. The index is all offsets, so it does not matter where
+    each process maps it or the module.
+
+    Publishing is build-to-temp-then-rename, so an attacher never sees a half
+    written index, and racing builders simply replace each other's identical
+    result. Every build gets a temporary of its own (pid plus a per-process
+    serial), so builders in one process cannot publish each other's. A stale index (the module changed) fails fingerprint validation
+    and gets rebuilt the same way.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_INDEX *gpa_shidx_attach(char *name, u64 fingerprint, u64 *size)
+        maps an existing shared index read-only if it is valid for fingerprint
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    gpa_INDEX *gpa_<backend>_shidx(gpa_MODVIEW *view, char *name, u64 fingerprint, u64 *size)
+        attaches, or builds and publishes first if there is nothing valid to attach to
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_shidx_detach(gpa_INDEX *index, u64 size) / int gpa_shidx_remove(char *name)
+        unmaps an attached index / deletes the shared object
+
+    The fingerprint is normally gpa_fingerprint_view(view, 0) from gpa_fingerprint.c.
+*/
+
+#ifndef _GPA_SHIDX_C
+#define _GPA_SHIDX_C
+#define _GPA_SHIDX_DEBUG 0
+#include "gpa_linux.c"
+#include "gpa_index.c"
+#include "gpa_fingerprint.c"
+
+#define GPA_SHIDX_PREFIX    "/dev/shm/gpa-"
+#define GPA_SHIDX_MAXPATH   256
+#define GPA_SHIDX_ATTEMPTS  16
+
+static u32 gpa_shidx_serial;
+
+inline static char *gpa_shidx_digits(char *p, u32 value) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    *p++ = '.';
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// "/dev/shm/gpa-<name>", with ".<pid>.<serial>" appended for a temporary copy
+inline static int gpa_shidx_path(char *path, char *name, i32 pid, u32 serial) {
+    char *prefix = GPA_SHIDX_PREFIX;
+    char *p = path, *end = path + GPA_SHIDX_MAXPATH - 24;
+    while (*prefix) {
+        *p++ = *prefix++;
+    }
+    while (*name) {
+        if (p >= end || *name == '/') {
+            return 0;
+        }
+        *p++ = *name++;
+    }
+    if (pid > 0) {
+        p = gpa_shidx_digits(p, (u32)pid);
+        p = gpa_shidx_digits(p, serial);
+    }
+    *p = '\0';
+    return 1;
+}
+
+gpa_INDEX *gpa_shidx_attach(char *name, u64 fingerprint, u64 *size) {
+    char path[GPA_SHIDX_MAXPATH];
+    gpa_STAT st;
+    gpa_INDEX *index = 0;
+    if (!gpa_shidx_path(path, name, 0, 0)) {
+        return 0;
+    }
+    i32 fd = gpa_sys_open(path, GPA_O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    if (gpa_sys_fstat(fd, &st) == 0 && st.st_size >= (i64)sizeof(gpa_INDEX)) {
+        index = gpa_sys_mmap(0, st.st_size, GPA_PROT_READ, GPA_MAP_SHARED, fd, 0);
+        if (GPA_MAP_FAILED(index)) {
+            index = 0;
+        } else if (!gpa_index_validate(index, st.st_size, fingerprint)) {
+            gpa_sys_munmap(index, st.st_size);
+            index = 0;
+        } else {
+            *size = st.st_size;
+        }
+    }
+    gpa_sys_close(fd);
+    return index;
+}
+
+void gpa_shidx_detach(gpa_INDEX *index, u64 size) {
+    if (index) {
+        gpa_sys_munmap(index, size);
+    }
+}
+
+int gpa_shidx_remove(char *name) {
+    char path[GPA_SHIDX_MAXPATH];
+    return gpa_shidx_path(path, name, 0, 0) && gpa_sys_unlink(path) == 0;
+}
+
+// creates the temporary object and maps it writable. the caller builds into
+// it, then gpa_shidx_commit publishes it under the final name. the name is
+// this call's alone: a taken one (another build, or a leftover from a crashed
+// process with our pid) is skipped, never unlinked
+inline static ptr gpa_shidx_create(char *name, char *temp, u64 size) {
+    i32 fd = -1;
+    for (u32 attempt = 0; fd < 0 && attempt < GPA_SHIDX_ATTEMPTS; attempt++) {
+        u32 serial = __atomic_fetch_add(&gpa_shidx_serial, 1, __ATOMIC_RELAXED);
+        if (!gpa_shidx_path(temp, name, gpa_sys_getpid(), serial)) {
+            return 0;
+        }
+        fd = gpa_sys_open(temp, GPA_O_RDWR | GPA_O_CREAT | GPA_O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        return 0;
+    }
+    ptr base = 0;
+    if (gpa_sys_ftruncate(fd, size) == 0) {
+        base = gpa_sys_mmap(0, size, GPA_PROT_READ | GPA_PROT_WRITE, GPA_MAP_SHARED, fd, 0);
+        if (GPA_MAP_FAILED(base)) {
+            base = 0;
+        }
+    }
+    gpa_sys_close(fd);
+    if (!base) {
+        gpa_sys_unlink(temp);
+    }
+    return base;
+}
+
+inline static int gpa_shidx_commit(char *name, char *temp, ptr base, u64 size) {
+    char path[GPA_SHIDX_MAXPATH];
+    gpa_sys_munmap(base, size);
+    if (!gpa_shidx_path(path, name, 0, 0) || gpa_sys_rename(temp, path) != 0) {
+        gpa_sys_unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+#define GPA_SHIDX_DEFINE(backend)                                                               \
+    gpa_INDEX *gpa_##backend##_shidx(gpa_MODVIEW *view, char *name, u64 fingerprint, u64 *size) { \
+        char temp[GPA_SHIDX_MAXPATH];                                                           \
+        gpa_INDEX *index = gpa_shidx_attach(name, fingerprint, size);                           \
+        if (index) {                                                                            \
+            return index;                                                                       \
+        }                                                                                       \
+        u64 bytes = gpa_index_size(gpa_##backend##_count(view));                                \
+        ptr base  = bytes ? gpa_shidx_create(name, temp, bytes) : 0;                            \
+        if (!base) {                                                                            \
+            return 0;                                                                           \
+        }                                                                                       \
+        gpa_##backend##_indexbuild(view, base, fingerprint);                                    \
+        if (!gpa_shidx_commit(name, temp, base, bytes)) {                                       \
+            return 0;                                                                           \
+        }                                                                                       \
+        return gpa_shidx_attach(name, fingerprint, size);                                       \
+    }
+
+GPA_SHIDX_DEFINE(pe_loaded)
+GPA_SHIDX_DEFINE(pe_file)
+
+// development code: forks workers that all need the same index and reports
+// how long each one takes to get it, against building a private copy
+#if _GPA_SHIDX_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "gpa_synth.c"
+
+static double gpa_shidx_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    u32 count   = argc > 1 ? atoi(argv[1]) : 65535;
+    u32 workers = argc > 2 ? atoi(argv[2]) : 8;
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        exports[i].name = malloc(32);
+        snprintf(exports[i].name, 32, "Rtl%08uWorker", i);
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity);
+    u64 size  = gpa_synth_pe(image, capacity, exports, count, 0x5f000000, 0);
+    gpa_MODVIEW view;
+    gpa_pe_loaded_open(&view, image, size);
+    u64 fingerprint = gpa_fingerprint_view(&view, 0);
+    gpa_shidx_remove("debug");
+
+    ptr buffer = malloc(gpa_index_size(count));
+    double t0 = gpa_shidx_now();
+    gpa_pe_loaded_indexbuild(&view, buffer, fingerprint);
+    double t1 = gpa_shidx_now();
+    printf("%u exports, private index build: %.3f ms\n", count, (t1 - t0) * 1e3);
+    fflush(stdout);
+
+    for (u32 w = 0; w < workers; w++) {
+        if (fork() == 0) {
+            u64 indexsize = 0;
+            gpa_EXPORT exp;
+            double t2 = gpa_shidx_now();
+            gpa_INDEX *index = gpa_pe_loaded_shidx(&view, "debug", fingerprint, &indexsize);
+            double t3 = gpa_shidx_now();
+            u32 found = 0;
+            for (u32 i = 0; index && i < count; i += 97) {
+                found += gpa_pe_loaded_indexlookup(&view, index, exports[i].name, &exp) && exp.address == exports[i].rva;
+            }
+            printf("worker %u: index ready in %.3f ms (%s), %u/%u lookups ok\n", w, (t3 - t2) * 1e3,
+                   w == 0 ? "built+published" : "attached", found, (count + 96) / 97);
+            fflush(stdout);
+            _exit(0);
+        }
+        wait(0);    // sequential, so worker 0 is the one that builds
+    }
+
+    // a different fingerprint must not attach
+    u64 indexsize;
+    printf("stale fingerprint rejected: %s\n", gpa_shidx_attach("debug", fingerprint + 1, &indexsize) ? "no" : "yes");
+
+    // two builds in flight in one process: distinct temporaries, and the
+    // first commit publishes the first build, whatever the second does
+    char tempa[GPA_SHIDX_MAXPATH], tempb[GPA_SHIDX_MAXPATH];
+    u64 bytes = gpa_index_size(count);
+    ptr a = gpa_shidx_create("debug", tempa, bytes);
+    ptr b = gpa_shidx_create("debug", tempb, bytes);
+    gpa_pe_loaded_indexbuild(&view, a, fingerprint);
+    int published = a && b && strcmp(tempa, tempb) != 0 && gpa_shidx_commit("debug", tempa, a, bytes);
+    gpa_INDEX *attached = published ? gpa_shidx_attach("debug", fingerprint, &indexsize) : 0;
+    printf("concurrent builds kept apart: %s\n", attached ? "yes" : "no");
+    gpa_shidx_detach(attached, indexsize);
+    if (b) {
+        gpa_sys_munmap(b, bytes);
+        gpa_sys_unlink(tempb);
+    }
+    gpa_shidx_remove("debug");
+    return !attached;
+}
+#endif // _GPA_SHIDX_DEBUG
+#endif // _GPA_SHIDX_C
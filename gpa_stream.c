@@ -0,0 +1,698 @@
+/*
+    gpa_stream.c
+    reads the exports of a PE file that arrives as a stream, front to back, once.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    A DLL coming down a pipe or out of a tar archive cannot be mapped and
+    cannot be seeked in, and holding all of it just to read a few kilobytes
+    of export data is a lot of memory for a 30 MB file. The parser here is
+    fed the file in chunks of any size and keeps only what it has to look at
+    again:
+
+        the DOS header, the NT headers up to the data directories and the
+        section table, each captured as it goes by and parsed when complete
+        the export directory, 40 bytes
+        AddressOfFunctions, AddressOfNames and AddressOfNameOrdinals
+
+    Once the three arrays are in, it knows the file offset of every name and
+    of every forwarder string, sorts them by offset, and from then on picks
+    the strings out of the chunks as they pass, handing each export to the
+    callback the moment its strings are complete. Exports therefore come in
+    the order their names are laid out in the file (which, for the usual
+    linker output, is AddressOfNames order). A string cut by a chunk
+    boundary is carried over in a small buffer; the first of a forwarded
+    export's two strings is held until the second arrives.
+
+    Memory is the fixed gpa_STREAM (about 5 KB) plus an arena for the arrays
+    and the string offsets: 4 bytes per function and 18 per name, 4 more per
+    name if any are forwarded and 8 more per forwarded one, whatever the
+    size of the file. 128 KB of arena is enough for 4,000 names, 3 MB for
+    100,000.
+
+    What has gone by is gone. Tables that sit in the file before the export
+    directory that points to them make the image unreadable this way
+    (GPA_STREAM_BEHIND); so do names that precede AddressOfNames, and these
+    are skipped and counted one by one. No linker lays files out like that.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    void gpa_stream_init(gpa_STREAM *stream, ptr arena, u64 size, gpa_EXPORT_CALLBACK callback, ptr context)
+        starts a parse. callback(context, exp) receives the exports, exp and
+        its strings valid during the call; returning 0 ends the parse
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    int gpa_stream_feed(gpa_STREAM *stream, ptr data, u64 length)
+        passes the next length bytes of the file. returns 1 while the parser
+        wants more, 0 once it is finished (stream->status says how)
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u32 gpa_stream_end(gpa_STREAM *stream)
+        the input is over. returns the final status
+*/
+
+#ifndef _GPA_STREAM_C
+#define _GPA_STREAM_C
+#define _GPA_STREAM_DEBUG 0
+#include "gpa_modview.c"
+
+#define GPA_STREAM_NAMEMAX      512         // longest name or forwarder string
+#define GPA_STREAM_MAXSECTIONS  96          // the loader's limit
+#define GPA_STREAM_NTSIZE       (0x18 + 0x78)   // NT headers up to the end of the export data directory, PE32+
+#define GPA_STREAM_HELD         0x80000000u // held[i]: set once the name was skipped
+
+// status
+#define GPA_STREAM_RUNNING      0
+#define GPA_STREAM_DONE         1           // every name was emitted or skipped
+#define GPA_STREAM_NOEXPORTS    2
+#define GPA_STREAM_BADIMAGE     3
+#define GPA_STREAM_BEHIND       4           // a table was needed after it had gone by
+#define GPA_STREAM_NOMEMORY     5           // the arena is too small for the tables
+#define GPA_STREAM_TRUNCATED    6           // the input ended first
+#define GPA_STREAM_STOPPED      7           // the callback returned 0
+
+enum { GPA_STREAM_DOS, GPA_STREAM_NT, GPA_STREAM_SECTIONS, GPA_STREAM_DIRECTORY, GPA_STREAM_ARRAYS, GPA_STREAM_STRINGS };
+
+// a piece of the file to capture as it goes by
+typedef struct _gpa_STREAM_REGION {
+    u64   offset;
+    u64   length;
+    u64   got;
+    u8   *dst;
+} gpa_STREAM_REGION;
+
+typedef struct _gpa_STREAM {
+    u64   pos;                  // file offset of the next byte fed
+    u32   status;
+    u32   stage;
+    gpa_EXPORT_CALLBACK callback;
+    ptr   context;
+    u32   emitted;
+    u32   skipped;              // names lost: behind, outside the file, bad ordinal, too long
+    // headers
+    u8    dos[0x40];
+    u8    nt[GPA_STREAM_NTSIZE];
+    u8    sections[40 * GPA_STREAM_MAXSECTIONS];
+    u32   numsections;
+    u32   exportrva;
+    u32   exportsize;
+    gpa_IMAGE_EXPORT_DIRECTORY dir;
+    gpa_STREAM_REGION regions[3];
+    u32   numregions;
+    // tables, in the arena
+    u8   *arena;
+    u64   arenasize;
+    u64   used;
+    u32  *functions;
+    u32  *names;
+    u16  *ordinals;
+    u64  *requests;             // file offset << 32 | name index << 1 | 1 for a forwarder string
+    u32   numrequests;
+    u32   next;
+    u32  *held;                 // per name, if any are forwarded: hold pool offset + 1
+    u64   pool;                 // hold pool start, in the arena after the tables
+    u64   pooltop;
+    u32   outstanding;          // strings in the pool waiting for their partner
+    // a string cut by the end of a chunk, from carrylo on
+    u64   carrylo;
+    u32   carrylen;
+    u8    carry[2 * GPA_STREAM_NAMEMAX];
+} gpa_STREAM;
+
+inline static void gpa_stream_copy(u8 *dst, u8 *src, u64 n) {
+    while (n--) {
+        *dst++ = *src++;
+    }
+}
+
+// file offset of [rva, rva + length) if one section has all of it in the
+// file, else ~0. the same translation as gpa_pe_file_rva
+static u64 gpa_stream_offset(gpa_STREAM *stream, u32 rva, u64 length) {
+    u8 *section = stream->sections;
+    for (u32 i = 0; i < stream->numsections; i++, section += 40) {
+        u32 virtualsize    = *(u32*)(section + 0x08);
+        u32 virtualaddress = *(u32*)(section + 0x0c);
+        u32 rawsize        = *(u32*)(section + 0x10);
+        u32 rawoffset      = *(u32*)(section + 0x14);
+        u32 span           = rawsize < virtualsize || virtualsize == 0 ? rawsize : virtualsize;
+        if (rva - virtualaddress < span) {
+            return length <= span - (rva - virtualaddress) ? rawoffset + (u64)(rva - virtualaddress) : ~0ull;
+        }
+    }
+    return rva < 0x1000 && length <= 0x1000 - rva ? rva : ~0ull;
+}
+
+static ptr gpa_stream_alloc(gpa_STREAM *stream, u64 size) {
+    u64 at = (stream->used + 7) & ~7ull;
+    if (size > stream->arenasize || at > stream->arenasize - size) {
+        return 0;
+    }
+    stream->used = at + size;
+    return stream->arena + at;
+}
+
+// queues a capture. from is the offset of the chunk being fed: anything
+// before it has gone by
+static int gpa_stream_region(gpa_STREAM *stream, u64 offset, u64 length, ptr dst, u64 from) {
+    if (offset == ~0ull) {
+        stream->status = GPA_STREAM_BADIMAGE;
+        return 0;
+    }
+    if (offset < from) {
+        stream->status = GPA_STREAM_BEHIND;
+        return 0;
+    }
+    gpa_STREAM_REGION *region = &stream->regions[stream->numregions++];
+    region->offset = offset;
+    region->length = length;
+    region->got    = 0;
+    region->dst    = dst;
+    return 1;
+}
+
+// heapsort; the requests are nearly always in order already, which is checked first
+static void gpa_stream_sort(u64 *a, u32 n) {
+    u32 sorted = 1;
+    for (u32 i = 1; i < n && sorted; i++) {
+        sorted = a[i - 1] <= a[i];
+    }
+    if (sorted) {
+        return;
+    }
+    for (u32 end = n, start = n / 2; end > 1; ) {
+        if (start > 0) {
+            start--;
+        } else {
+            u64 top = a[--end];
+            a[end] = a[0];
+            a[0] = top;
+        }
+        for (u32 root = start, child; (child = 2 * root + 1) < end; root = child) {
+            child += child + 1 < end && a[child] < a[child + 1];
+            if (a[root] >= a[child]) {
+                break;
+            }
+            u64 t = a[root];
+            a[root] = a[child];
+            a[child] = t;
+        }
+    }
+}
+
+// the arrays are in: lay out the offsets of every string still to come
+static void gpa_stream_plan(gpa_STREAM *stream, u64 from) {
+    u32 count = stream->dir.NumberOfNames;
+    u32 forwarded = 0;
+    for (u32 i = 0; i < count; i++) {
+        u32 ordinal = stream->ordinals[i];
+        forwarded += ordinal < stream->dir.NumberOfFunctions
+                     && stream->functions[ordinal] - stream->exportrva < stream->exportsize;
+    }
+    stream->requests = gpa_stream_alloc(stream, 8ull * (count + forwarded));
+    stream->held     = forwarded ? gpa_stream_alloc(stream, 4ull * count) : 0;
+    if (!stream->requests || (forwarded && !stream->held)) {
+        stream->status = GPA_STREAM_NOMEMORY;
+        return;
+    }
+    u32 n = 0;
+    for (u32 i = 0; i < count; i++) {
+        u32 ordinal = stream->ordinals[i];
+        if (ordinal >= stream->dir.NumberOfFunctions) {
+            stream->skipped++;
+            continue;
+        }
+        u32 address = stream->functions[ordinal];
+        u64 name = gpa_stream_offset(stream, stream->names[i], 1);
+        u64 forwarder = address - stream->exportrva < stream->exportsize ? gpa_stream_offset(stream, address, 1) : 0;
+        // both offsets go in a request's top 32 bits
+        if (name == ~0ull || name < from || name > 0xffffffff
+            || (forwarder && (forwarder == ~0ull || forwarder < from || forwarder > 0xffffffff))) {
+            stream->skipped++;
+            continue;
+        }
+        stream->requests[n++] = name << 32 | (u64)i << 1;
+        if (forwarder) {
+            stream->held[i] = 0;
+            stream->requests[n++] = forwarder << 32 | (u64)i << 1 | 1;
+        }
+    }
+    gpa_stream_sort(stream->requests, n);
+    stream->numrequests = n;
+    stream->next        = 0;
+    stream->pool = stream->pooltop = stream->used;
+    stream->outstanding = 0;
+    stream->stage       = GPA_STREAM_STRINGS;
+    if (!n) {
+        stream->status = GPA_STREAM_DONE;
+    }
+}
+
+// everything the current stage waited for has been captured: parse it and
+// queue what comes next
+static void gpa_stream_advance(gpa_STREAM *stream, u64 from) {
+    stream->numregions = 0;
+    switch (stream->stage) {
+        case GPA_STREAM_DOS: {
+            if (*(u16*)stream->dos != 0x5a4d) {
+                stream->status = GPA_STREAM_BADIMAGE;
+                return;
+            }
+            stream->stage = GPA_STREAM_NT;
+            gpa_stream_region(stream, *(u32*)(stream->dos + 0x3c), GPA_STREAM_NTSIZE, stream->nt, from);
+            return;
+        }
+        case GPA_STREAM_NT: {
+            u8 *nt = stream->nt;
+            u16 magic       = *(u16*)(nt + 0x18);
+            u32 dataoff     = magic == 0x20b ? 0x70 : 0x60;
+            u32 numdirs     = *(u32*)(nt + 0x18 + dataoff - 4);
+            u32 numsections = *(u16*)(nt + 0x06);
+            if (*(u32*)nt != 0x00004550 || (magic != 0x20b && magic != 0x10b) || numsections > GPA_STREAM_MAXSECTIONS) {
+                stream->status = GPA_STREAM_BADIMAGE;
+                return;
+            }
+            stream->exportrva  = numdirs ? *(u32*)(nt + 0x18 + dataoff) : 0;
+            stream->exportsize = numdirs ? *(u32*)(nt + 0x18 + dataoff + 4) : 0;
+            if (!stream->exportrva) {
+                stream->status = GPA_STREAM_NOEXPORTS;
+                return;
+            }
+            stream->numsections = numsections;
+            stream->stage = GPA_STREAM_SECTIONS;
+            gpa_stream_region(stream, *(u32*)(stream->dos + 0x3c) + 0x18ull + *(u16*)(nt + 0x14),
+                              40ull * numsections, stream->sections, from);
+            return;
+        }
+        case GPA_STREAM_SECTIONS: {
+            stream->stage = GPA_STREAM_DIRECTORY;
+            gpa_stream_region(stream, gpa_stream_offset(stream, stream->exportrva, sizeof(gpa_IMAGE_EXPORT_DIRECTORY)),
+                              sizeof(gpa_IMAGE_EXPORT_DIRECTORY), &stream->dir, from);
+            return;
+        }
+        case GPA_STREAM_DIRECTORY: {
+            gpa_PIMAGE_EXPORT_DIRECTORY dir = &stream->dir;
+            if (!dir->NumberOfNames) {
+                stream->status = GPA_STREAM_DONE;
+                return;
+            }
+            stream->functions = gpa_stream_alloc(stream, 4ull * dir->NumberOfFunctions);
+            stream->names     = gpa_stream_alloc(stream, 4ull * dir->NumberOfNames);
+            stream->ordinals  = gpa_stream_alloc(stream, 2ull * dir->NumberOfNames);
+            if (!stream->functions || !stream->names || !stream->ordinals) {
+                stream->status = GPA_STREAM_NOMEMORY;
+                return;
+            }
+            stream->stage = GPA_STREAM_ARRAYS;
+            if (gpa_stream_region(stream, gpa_stream_offset(stream, dir->AddressOfFunctions, 4ull * dir->NumberOfFunctions),
+                                  4ull * dir->NumberOfFunctions, stream->functions, from)
+                && gpa_stream_region(stream, gpa_stream_offset(stream, dir->AddressOfNames, 4ull * dir->NumberOfNames),
+                                     4ull * dir->NumberOfNames, stream->names, from)) {
+                gpa_stream_region(stream, gpa_stream_offset(stream, dir->AddressOfNameOrdinals, 2ull * dir->NumberOfNames),
+                                  2ull * dir->NumberOfNames, stream->ordinals, from);
+            }
+            return;
+        }
+        case GPA_STREAM_ARRAYS: {
+            gpa_stream_plan(stream, from);
+            return;
+        }
+    }
+}
+
+// a complete string for request r
+static void gpa_stream_string(gpa_STREAM *stream, u64 request, char *s) {
+    u32 i = (u32)request >> 1;
+    gpa_EXPORT exp;
+    exp.index     = i;
+    exp.ordinal   = stream->ordinals[i] + stream->dir.Base;
+    exp.address   = stream->functions[stream->ordinals[i]];
+    exp.name      = s;
+    exp.forwarder = 0;
+    if (exp.address - stream->exportrva < stream->exportsize) {
+        // the first of the two strings waits in the pool for the second
+        u32 held = stream->held[i];
+        if (held & GPA_STREAM_HELD) {
+            return;
+        }
+        if (!held) {
+            u64 length = 0;
+            while (s[length++]);
+            if (length > stream->arenasize - stream->pooltop) {
+                stream->held[i] = GPA_STREAM_HELD;
+                stream->skipped++;
+                return;
+            }
+            gpa_stream_copy(stream->arena + stream->pooltop, (u8*)s, length);
+            stream->held[i] = (u32)(stream->pooltop - stream->pool) + 1;
+            stream->pooltop += length;
+            stream->outstanding++;
+            return;
+        }
+        char *other = (char*)stream->arena + stream->pool + held - 1;
+        exp.name      = request & 1 ? other : s;
+        exp.forwarder = request & 1 ? s : other;
+        stream->held[i] = GPA_STREAM_HELD;
+        if (!--stream->outstanding) {
+            stream->pooltop = stream->pool;
+        }
+    }
+    stream->emitted++;
+    if (!stream->callback(stream->context, &exp)) {
+        stream->status = GPA_STREAM_STOPPED;
+    }
+}
+
+// the length of the string at s, if it ends within n bytes, else ~0
+inline static u64 gpa_stream_strlen(u8 *s, u64 n) {
+    for (u64 i = 0; i < n; i++) {
+        if (!s[i]) {
+            return i;
+        }
+    }
+    return ~0ull;
+}
+
+inline static void gpa_stream_skip(gpa_STREAM *stream) {
+    u64 request = stream->requests[stream->next++];
+    u32 i = (u32)request >> 1;
+    if (stream->held && stream->functions[stream->ordinals[i]] - stream->exportrva < stream->exportsize) {
+        if (stream->held[i] & GPA_STREAM_HELD) {
+            return;
+        }
+        stream->outstanding -= stream->held[i] != 0;
+        stream->held[i] = GPA_STREAM_HELD;
+    }
+    stream->skipped++;
+}
+
+// picks the strings out of a chunk covering [lo, hi)
+static void gpa_stream_strings(gpa_STREAM *stream, u8 *chunk, u64 lo, u64 hi) {
+    u64 cursor = lo;
+    // strings that started in an earlier chunk, from the carry
+    while (stream->carrylen && stream->status == GPA_STREAM_RUNNING) {
+        u64 room = sizeof(stream->carry) - stream->carrylen;
+        u64 take = hi - cursor < room ? hi - cursor : room;
+        gpa_stream_copy(stream->carry + stream->carrylen, chunk + (cursor - lo), take);
+        stream->carrylen += (u32)take;
+        cursor += take;
+        while (stream->next < stream->numrequests && stream->status == GPA_STREAM_RUNNING) {
+            u64 request = stream->requests[stream->next];
+            u64 at = (request >> 32) - stream->carrylo;
+            if ((request >> 32) >= lo) {
+                stream->carrylen = 0;
+                break;
+            }
+            u64 length = gpa_stream_strlen(stream->carry + at, stream->carrylen - at);
+            if (length != ~0ull) {
+                stream->next++;
+                gpa_stream_string(stream, request, (char*)stream->carry + at);
+            } else if (stream->carrylen - at >= GPA_STREAM_NAMEMAX) {
+                gpa_stream_skip(stream);
+            } else if (cursor == hi) {
+                return;
+            } else {
+                // full, and the string starts past its beginning: drop what is before it
+                gpa_stream_copy(stream->carry, stream->carry + at, stream->carrylen - at);
+                stream->carrylo  += at;
+                stream->carrylen -= (u32)at;
+                break;
+            }
+        }
+        if (stream->next == stream->numrequests) {
+            stream->carrylen = 0;
+        }
+    }
+    // strings that start in this chunk
+    while (stream->next < stream->numrequests && stream->status == GPA_STREAM_RUNNING) {
+        u64 request = stream->requests[stream->next];
+        u64 offset  = request >> 32;
+        if (offset >= hi) {
+            return;
+        }
+        u64 at = offset - lo;
+        u64 n  = hi - offset < GPA_STREAM_NAMEMAX ? hi - offset : GPA_STREAM_NAMEMAX;
+        if (gpa_stream_strlen(chunk + at, n) != ~0ull) {
+            stream->next++;
+            gpa_stream_string(stream, request, (char*)chunk + at);
+        } else if (n == GPA_STREAM_NAMEMAX) {
+            gpa_stream_skip(stream);
+        } else {
+            // runs past the end of the chunk
+            stream->carrylo  = offset;
+            stream->carrylen = (u32)n;
+            gpa_stream_copy(stream->carry, chunk + at, n);
+            return;
+        }
+    }
+    if (stream->next == stream->numrequests && stream->status == GPA_STREAM_RUNNING) {
+        stream->status = GPA_STREAM_DONE;
+    }
+}
+
+void gpa_stream_init(gpa_STREAM *stream, ptr arena, u64 size, gpa_EXPORT_CALLBACK callback, ptr context) {
+    for (u8 *p = (u8*)stream; p < (u8*)(stream + 1); p++) {
+        *p = 0;
+    }
+    stream->arena     = arena;
+    stream->arenasize = size;
+    stream->callback  = callback;
+    stream->context   = context;
+    stream->stage     = GPA_STREAM_DOS;
+    stream->numregions = 1;
+    stream->regions[0].length = sizeof(stream->dos);
+    stream->regions[0].dst    = stream->dos;
+}
+
+int gpa_stream_feed(gpa_STREAM *stream, ptr data, u64 length) {
+    u8 *chunk = data;
+    u64 lo = stream->pos, hi = lo + length;
+    while (stream->status == GPA_STREAM_RUNNING && stream->stage < GPA_STREAM_STRINGS) {
+        u32 open = 0;
+        for (u32 i = 0; i < stream->numregions; i++) {
+            gpa_STREAM_REGION *region = &stream->regions[i];
+            u64 at  = region->offset + region->got;
+            u64 end = region->offset + region->length < hi ? region->offset + region->length : hi;
+            if (at >= lo && at < end) {
+                gpa_stream_copy(region->dst + region->got, chunk + (at - lo), end - at);
+                region->got += end - at;
+            }
+            open += region->got < region->length;
+        }
+        if (open) {
+            break;
+        }
+        gpa_stream_advance(stream, lo);
+    }
+    if (stream->status == GPA_STREAM_RUNNING && stream->stage == GPA_STREAM_STRINGS) {
+        gpa_stream_strings(stream, chunk, lo, hi);
+    }
+    stream->pos = hi;
+    return stream->status == GPA_STREAM_RUNNING;
+}
+
+u32 gpa_stream_end(gpa_STREAM *stream) {
+    if (stream->status == GPA_STREAM_RUNNING) {
+        stream->status = GPA_STREAM_TRUNCATED;
+    }
+    return stream->status;
+}
+
+// development code: synthetic images through a pipe, checked against
+// gpa_pe_file on the same bytes. "gen <names>" writes one to stdout and "-"
+// reads one from stdin, for trying it on a shell pipe
+#if _GPA_STREAM_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "gpa_synth.c"
+
+static double gpa_stream_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static u32 gpa_stream_random(u32 n) {
+    static u64 state = 0x2545f4914f6cdd1dull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (u32)((state >> 11) % n);
+}
+
+static int gpa_stream_byname(const void *a, const void *b) {
+    return strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+typedef struct _gpa_STREAM_TALLY {
+    u64   sum;
+    u32   count;
+} gpa_STREAM_TALLY;
+
+static int gpa_stream_tally(ptr context, gpa_EXPORT *exp) {
+    gpa_STREAM_TALLY *tally = context;
+    tally->sum += (u64)gpa_hash(exp->name) * 31 + exp->address + exp->ordinal * 7ull + exp->index * 13ull
+                  + (exp->forwarder ? gpa_hash(exp->forwarder) : 0);
+    tally->count++;
+    return 1;
+}
+
+// a file-layout image of count names with a gap of pad bytes before .edata
+static u8 *gpa_stream_image(u32 count, u32 pad, u64 *size) {
+    gpa_SYNTH_EXPORT *exports = calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    for (u32 i = 0; i < count; i++) {
+        u32 length = 4 + gpa_stream_random(gpa_stream_random(50) ? 24 : 400);
+        exports[i].name = malloc(length + 12);
+        snprintf(exports[i].name, 12, "N%08x", gpa_stream_random(~0u));
+        for (u32 j = 9; j < length; j++) {
+            exports[i].name[j] = 'a' + gpa_stream_random(26);
+        }
+        exports[i].name[length] = 0;
+        if (!gpa_stream_random(8)) {
+            exports[i].forwarder = "OTHER.Forwarded";
+        }
+    }
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_stream_byname);
+    for (u32 i = 0; i < count; i++) {
+        exports[i].slot = i % 65536;
+        exports[i].rva  = 0x1000 + 16 * (i % 65536);
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = malloc(capacity + pad);
+    u64 length = gpa_synth_pe(image, capacity, exports, count, count, 1);
+    u8 *sections = image + 0x40 + 0x18 + 0xf0;
+    u32 edataraw = *(u32*)(sections + 40 + 0x14);
+    memmove(image + edataraw + pad, image + edataraw, length - edataraw);
+    memset(image + edataraw, 0xcc, pad);
+    *(u32*)(sections + 40 + 0x14) += pad;
+    *size = length + pad;
+    for (u32 i = 0; i < count; i++) {
+        free(exports[i].name);
+    }
+    free(exports);
+    return image;
+}
+
+static void gpa_stream_reference(u8 *image, u64 size, gpa_STREAM_TALLY *tally) {
+    gpa_MODVIEW view;
+    if (gpa_pe_file_open(&view, image, size)) {
+        for (u32 i = 0; i < gpa_pe_file_count(&view); i++) {
+            gpa_EXPORT exp;
+            if (gpa_pe_file_export(&view, i, &exp)) {
+                gpa_stream_tally(tally, &exp);
+            }
+        }
+    }
+}
+
+// writes image into a pipe from a child in random-sized pieces, parses it
+// from the other end in random-sized reads
+static u32 gpa_stream_piped(u8 *image, u64 size, ptr arena, u64 arenasize, u32 maxread, gpa_STREAM_TALLY *tally, u64 *bytesread) {
+    int fds[2];
+    pipe(fds);
+    if (!fork()) {
+        close(fds[0]);
+        for (u64 at = 0; at < size; ) {
+            u64 n = 1 + gpa_stream_random(maxread);
+            n = n < size - at ? n : size - at;
+            write(fds[1], image + at, n);
+            at += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    static u8 buffer[1 << 16];
+    gpa_STREAM stream;
+    gpa_stream_init(&stream, arena, arenasize, gpa_stream_tally, tally);
+    *bytesread = 0;
+    for (;;) {
+        u32 want = 1 + gpa_stream_random(maxread < sizeof(buffer) ? maxread : sizeof(buffer));
+        ssize_t n = read(fds[0], buffer, want);
+        if (n <= 0) {
+            break;
+        }
+        *bytesread += n;
+        if (!gpa_stream_feed(&stream, buffer, n)) {
+            break;
+        }
+    }
+    close(fds[0]);
+    wait(0);
+    return gpa_stream_end(&stream);
+}
+
+int main(int argc, char *argv[]) {
+    static u8 arena[4 << 20];
+    if (argc > 2 && !strcmp(argv[1], "gen")) {
+        u64 size;
+        u8 *image = gpa_stream_image(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 0, &size);
+        fwrite(image, 1, size, stdout);
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "-")) {
+        static u8 buffer[1 << 16];
+        gpa_STREAM_TALLY tally = {0};
+        gpa_STREAM stream;
+        gpa_stream_init(&stream, arena, sizeof(arena), gpa_stream_tally, &tally);
+        ssize_t n;
+        while ((n = read(0, buffer, sizeof(buffer))) > 0 && gpa_stream_feed(&stream, buffer, n));
+        u32 status = gpa_stream_end(&stream);
+        printf("status %u, %u exports, %u skipped, %llu bytes read, %llu bytes of arena, sum %016llx\n", status,
+               tally.count, stream.skipped, (unsigned long long)stream.pos, (unsigned long long)stream.used,
+               (unsigned long long)tally.sum);
+        return status != GPA_STREAM_DONE;
+    }
+
+    u32 wrong = 0;
+    u32 counts[] = { 1, 7, 300, 4000, 100000 };
+    u32 pads[]   = { 0, 3 << 20 };
+    u32 reads[]  = { 1, 37, 4096, 65536 };
+    for (u32 c = 0; c < sizeof(counts) / 4; c++) {
+        for (u32 p = 0; p < sizeof(pads) / 4; p++) {
+            u64 size;
+            u8 *image = gpa_stream_image(counts[c], pads[p], &size);
+            gpa_STREAM_TALLY expected = {0};
+            gpa_stream_reference(image, size, &expected);
+            for (u32 r = 0; r < sizeof(reads) / 4; r++) {
+                if (reads[r] < 4096 && size > (1 << 20)) {
+                    continue;
+                }
+                gpa_STREAM_TALLY tally = {0};
+                u64 bytesread;
+                double t0 = gpa_stream_now();
+                u32 status = gpa_stream_piped(image, size, arena, sizeof(arena), reads[r], &tally, &bytesread);
+                double t1 = gpa_stream_now();
+                u32 bad = status != GPA_STREAM_DONE || tally.count != expected.count || tally.sum != expected.sum;
+                wrong += bad;
+                printf("%6u names, %8llu bytes, reads <= %5u: status %u, %6u exports%s, read %llu bytes, %.2f ms\n",
+                       counts[c], (unsigned long long)size, reads[r], status, tally.count, bad ? " WRONG" : "",
+                       (unsigned long long)bytesread, (t1 - t0) * 1e3);
+            }
+            if (c == 3) {
+                // cut short, and an arena too small
+                gpa_STREAM stream;
+                gpa_STREAM_TALLY tally = {0};
+                gpa_stream_init(&stream, arena, sizeof(arena), gpa_stream_tally, &tally);
+                gpa_stream_feed(&stream, image, size - 4000);
+                wrong += gpa_stream_end(&stream) != GPA_STREAM_TRUNCATED;
+                gpa_stream_init(&stream, arena, 20000, gpa_stream_tally, &tally);
+                gpa_stream_feed(&stream, image, size);
+                wrong += gpa_stream_end(&stream) != GPA_STREAM_NOMEMORY;
+                gpa_stream_init(&stream, arena, sizeof(arena), gpa_stream_tally, &tally);
+                gpa_stream_feed(&stream, image, size);
+                printf("arena used for %u names: %llu bytes\n", counts[c], (unsigned long long)stream.used);
+            }
+            free(image);
+        }
+    }
+    // not an image
+    gpa_STREAM stream;
+    gpa_stream_init(&stream, arena, sizeof(arena), gpa_stream_tally, 0);
+    gpa_stream_feed(&stream, argv[0], 0x40);
+    wrong += stream.status != GPA_STREAM_BADIMAGE;
+    printf("%u wrong\n", wrong);
+    return wrong != 0;
+}
+#endif // _GPA_STREAM_DEBUG
+#endif // _GPA_STREAM_C
@@ -0,0 +1,466 @@
+/*
+    gpa_switch.hpp
+    a compile-time name set turned into nested switches over name bytes.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    typedef gpa::names<"GetProcAddress", "VirtualAlloc", "VirtualFree"> wanted;
+    ptr slots[wanted::count];
+    wanted::resolve(k32, slots);
+    auto alloc = (gpa::signature<"VirtualAlloc">::type)slots[wanted::index<"VirtualAlloc">()];
+
+    gpa_getgetprocaddress walks the export names once and gpa_strcmp's each of
+    them against the one name it wants; doing that for N names costs N
+    compares per export. gpa::names does the same single walk, but classifies
+    every export name in one pass over its bytes. This is the same decision
+    tree gpa_jit compiles at runtime, generated by the C++ compiler instead,
+    so nothing is mapped writable or executable and it works where JIT is
+    not allowed.
+
+    The set is sorted at compile time and the tree is laid out from the
+    sorted ranges. Bytes every remaining candidate shares are compared one by
+    one; where candidates differ, a switch on the byte picks the subrange.
+    The terminating NUL is part of every name, so the leaf that returns a
+    name's index is only reached when the whole string has matched. Each
+    switch gets one case per byte the candidates have at that point, and
+    the compiler is free to build a jump table or a compare tree from them.
+    Reads never go past the NUL of the string being classified.
+
+    Code size grows with the number of bytes in the set's trie, not with the
+    number of names it is matched against. On the debug build's sets (17 to
+    257 names, 2137 exports) it comes to 95-120 bytes per name at -O2 and
+    62-71 at -Os, where the shared runs stay compare loops. One walk with the
+    switch costs 4-9 ns per export name at -O2, 7-30x less than the
+    gpa_strcmp-per-name loop, against 1.5x slower at -Os. On a sorted PE
+    table a binary search per wanted name (gpa.hpp's) is still cheaper; the
+    switch is for when the names are walked anyway. Compile time is the
+    limit: a 257 name set takes about 10 s of g++.
+
+    Like gpa.hpp it is header-only and freestanding, and resolve follows its
+    conventions: forwarded exports go to kernel32's GetProcAddress, looked up
+    at most once per resolve, and a name the module does not export gives a
+    null slot.
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    template <gpa::name... Names> i32 gpa::names<Names...>::classify(const char *name)
+        the index of name in Names, or -1. a repeated name gives its first index
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    template <gpa::name... Names> u32 gpa::names<Names...>::resolve(ptr modulehandle, ptr *slots)
+        one walk over the module's export names. fills slots[k] (count of them,
+        cleared first) for every name k the module exports, returns how many
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    template <gpa::name... Names> template <gpa::name Name> consteval u32 gpa::names<Names...>::index()
+        the slot of Name, a compile error if it is not in the set
+*/
+
+#ifndef _GPA_SWITCH_HPP
+#define _GPA_SWITCH_HPP
+#define _GPA_SWITCH_HPP_DEBUG 0
+#include "gpa.hpp"
+
+// n case labels X(0) .. X(n - 1), for a switch over up to n distinct bytes
+#define GPA_SWITCH_SLOTS4(X, h)   X(h + 0) X(h + 1) X(h + 2) X(h + 3)
+#define GPA_SWITCH_SLOTS16(X, h)  GPA_SWITCH_SLOTS4(X, h) GPA_SWITCH_SLOTS4(X, h + 4) \
+                                  GPA_SWITCH_SLOTS4(X, h + 8) GPA_SWITCH_SLOTS4(X, h + 12)
+#define GPA_SWITCH_SLOTS64(X, h)  GPA_SWITCH_SLOTS16(X, h) GPA_SWITCH_SLOTS16(X, h + 16) \
+                                  GPA_SWITCH_SLOTS16(X, h + 32) GPA_SWITCH_SLOTS16(X, h + 48)
+#define GPA_SWITCH_SLOTS256(X, h) GPA_SWITCH_SLOTS64(X, h) GPA_SWITCH_SLOTS64(X, h + 64) \
+                                  GPA_SWITCH_SLOTS64(X, h + 128) GPA_SWITCH_SLOTS64(X, h + 192)
+
+namespace gpa {
+
+namespace detail {
+
+constexpr int switchcmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (u8)*a - (u8)*b;
+}
+
+// set indices sorted by name, repeated names by index
+template <u32 Count>
+struct switchorder {
+    u32 at[Count];
+};
+
+// never defined: calling it from a constant expression is the compile error
+void notinset();
+
+} // namespace detail
+
+template <name... Names>
+struct names {
+    static constexpr u32 count = sizeof...(Names);
+    static_assert(count > 0, "gpa::names needs at least one name");
+
+    static constexpr const char *text[count] = {Names.text...};
+
+    static constexpr detail::switchorder<count> order = [] {
+        detail::switchorder<count> sorted{};
+        for (u32 i = 0; i < count; i++) {
+            u32 k = i;
+            for (; k > 0 && detail::switchcmp(text[sorted.at[k - 1]], text[i]) > 0; k--) {
+                sorted.at[k] = sorted.at[k - 1];
+            }
+            sorted.at[k] = i;
+        }
+        return sorted;
+    }();
+
+    // byte depth of the k-th name in sorted order
+    static constexpr u8 byte(u32 k, u32 depth) {
+        return (u8)text[order.at[k]][depth];
+    }
+
+    // the bytes from depth on that every name in [lo, hi) shares. sorted, so
+    // the first and last are enough. stops short of a NUL the two share
+    static constexpr u32 run(u32 lo, u32 hi, u32 depth) {
+        u32 r = 0;
+        while (byte(lo, depth + r) && byte(lo, depth + r) == byte(hi - 1, depth + r)) {
+            r++;
+        }
+        return r;
+    }
+
+    // the names in [lo, hi) whose byte depth is value: [first(.., value), first(.., value + 1))
+    static constexpr u32 first(u32 lo, u32 hi, u32 depth, u32 value) {
+        while (lo < hi && byte(lo, depth) < value) {
+            lo++;
+        }
+        return lo;
+    }
+
+    // how many distinct bytes the names in [lo, hi) have at depth
+    static constexpr u32 fanout(u32 lo, u32 hi, u32 depth) {
+        u32 n = 0;
+        for (; lo < hi; lo = first(lo, hi, depth, byte(lo, depth) + 1)) {
+            n++;
+        }
+        return n;
+    }
+
+    // the slot-th of those bytes, or 256 + slot past the last: a label that
+    // can never match, but is still distinct
+    static constexpr u32 label(u32 lo, u32 hi, u32 depth, u32 slot) {
+        for (; lo < hi; lo = first(lo, hi, depth, byte(lo, depth) + 1)) {
+            if (slot-- == 0) {
+                return byte(lo, depth);
+            }
+        }
+        return 256 + slot;
+    }
+
+    template <u32 Lo, u32 Hi, u32 Depth, u32 Slot>
+    [[gnu::always_inline]] static inline i32 edge(const u8 *s) {
+        constexpr u32 value = label(Lo, Hi, Depth, Slot);
+        if constexpr (value > 255) {
+            return -1;
+        } else if constexpr (value == 0) {
+            return order.at[Lo];    // the names that end here sort first, and are all the same name
+        } else {
+            constexpr u32 lo = first(Lo, Hi, Depth, value);
+            constexpr u32 hi = first(lo, Hi, Depth, value + 1);
+            return node<lo, hi, Depth + 1>(s);
+        }
+    }
+
+    template <u32 Lo, u32 Hi, u32 Depth>
+    [[gnu::always_inline]] static inline i32 node(const u8 *s) {
+        constexpr u32 shared = run(Lo, Hi, Depth);
+        // constant bounds and constant bytes: unrolled, these are immediate compares
+#pragma GCC unroll 64
+        for (u32 i = Depth; i < Depth + shared; i++) {
+            if (s[i] != byte(Lo, i)) {
+                return -1;
+            }
+        }
+        constexpr u32 at = Depth + shared;
+        constexpr u32 fan = fanout(Lo, Hi, at);
+#define GPA_SWITCH_CASE(slot) case label(Lo, Hi, at, slot): return edge<Lo, Hi, at, slot>(s);
+        if constexpr (fan == 1) {
+            // a single name, or copies of one: the shared run ended at the NUL
+            return s[at] == 0 ? (i32)order.at[Lo] : -1;
+        } else if constexpr (fan <= 4) {
+            switch ((u32)s[at]) {
+                GPA_SWITCH_SLOTS4(GPA_SWITCH_CASE, 0)
+            }
+        } else if constexpr (fan <= 16) {
+            switch ((u32)s[at]) {
+                GPA_SWITCH_SLOTS16(GPA_SWITCH_CASE, 0)
+            }
+        } else if constexpr (fan <= 64) {
+            switch ((u32)s[at]) {
+                GPA_SWITCH_SLOTS64(GPA_SWITCH_CASE, 0)
+            }
+        } else {
+            switch ((u32)s[at]) {
+                GPA_SWITCH_SLOTS256(GPA_SWITCH_CASE, 0)
+            }
+        }
+#undef GPA_SWITCH_CASE
+        return -1;
+    }
+
+    static inline i32 classify(const char *name) {
+        return node<0, count, 0>((const u8*)name);
+    }
+
+    template <name Name>
+    static consteval u32 index() {
+        for (u32 i = 0; i < count; i++) {
+            if (detail::switchcmp(text[i], Name.text) == 0) {
+                return i;
+            }
+        }
+        detail::notinset();
+        return count;
+    }
+
+    static u32 resolve(ptr modulehandle, ptr *slots) {
+        for (u32 k = 0; k < count; k++) {
+            slots[k] = 0;
+        }
+        u8 *base = (u8*)modulehandle;
+        u8 *nt   = base + *(u32*)(base + 0x3c);
+        u8 *dirs = nt + 0x18 + (*(u16*)(nt + 0x18) == 0x20b ? 0x70 : 0x60);
+        u32 exportrva  = *(u32*)dirs;
+        u32 exportsize = *(u32*)(dirs + 4);
+        if (!exportrva) {
+            return 0;
+        }
+        u32 *dir       = (u32*)(base + exportrva);
+        u32  exports   = dir[6];           // NumberOfNames
+        u32 *functions = (u32*)(base + dir[7]);
+        u32 *namerva   = (u32*)(base + dir[8]);
+        u16 *ordinals  = (u16*)(base + dir[9]);
+        u32 resolved = 0;
+        GetProcAddress_t getprocaddress = 0;    // kernel32's, on the first forwarder
+        for (u32 i = 0; i < exports && resolved < count; i++) {
+            char *name = (char*)base + namerva[i];
+            i32 k = classify(name);
+            if (k < 0 || slots[k]) {
+                continue;
+            }
+            u32 rva = functions[ordinals[i]];
+            if (rva - exportrva < exportsize) {
+                getprocaddress = getprocaddress ? getprocaddress : gpa_getgetprocaddress(gpa_getkernel32());
+                slots[k] = getprocaddress ? getprocaddress(modulehandle, name) : 0;
+            } else {
+                slots[k] = base + rva;
+            }
+            resolved += slots[k] != 0;
+        }
+        return resolved;
+    }
+};
+
+} // namespace gpa
+
+// development code: classify speed and code size for a few set sizes,
+// against the gpa_strcmp loop and a per-name binary search. build with
+//     gcc -O2 -c gpa_synth.c -o synth.o
+//     g++ -std=c++20 -O2 -x c++ gpa_switch.hpp -x none synth.o     (with _GPA_SWITCH_HPP_DEBUG set)
+#if _GPA_SWITCH_HPP_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+typedef struct _gpa_SYNTH_EXPORT {
+    char *name;
+    u32   slot;
+    u32   rva;
+    char *forwarder;
+} gpa_SYNTH_EXPORT;
+u64 gpa_synth_pe_size(gpa_SYNTH_EXPORT *exports, u32 count);
+u64 gpa_synth_pe(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count, u32 timestamp, int filelayout);
+}
+
+static double gpa_switch_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gpa_switch_byname(const void *a, const void *b) {
+    return strcmp(((gpa_SYNTH_EXPORT*)a)->name, ((gpa_SYNTH_EXPORT*)b)->name);
+}
+
+// a grid of heads x bodies; the sets are GetProcAddress plus a corner of it
+#define GPA_SWITCH_HEADS4(X, b)  X("Virtual" b) X("Heap" b) X("Create" b) X("Get" b)
+#define GPA_SWITCH_HEADS8(X, b)  GPA_SWITCH_HEADS4(X, b) X("Set" b) X("Read" b) X("Write" b) X("Open" b)
+#define GPA_SWITCH_HEADS16(X, b) GPA_SWITCH_HEADS8(X, b) X("Close" b) X("Find" b) X("Load" b) X("Free" b) \
+                                 X("Query" b) X("Reg" b) X("Wait" b) X("Map" b)
+#define GPA_SWITCH_GRID(X, H, B) GPA_SWITCH_GRID##B(X, H)
+#define GPA_SWITCH_GRID4(X, H)   H(X, "Alloc") H(X, "Free") H(X, "File") H(X, "Handle")
+#define GPA_SWITCH_GRID8(X, H)   GPA_SWITCH_GRID4(X, H) H(X, "Process") H(X, "Thread") H(X, "Event") H(X, "Mutex")
+#define GPA_SWITCH_GRID16(X, H)  GPA_SWITCH_GRID8(X, H) H(X, "Module") H(X, "Library") H(X, "Value") H(X, "Key") \
+                                 H(X, "Object") H(X, "View") H(X, "Section") H(X, "Token")
+#define GPA_SWITCH_NAME(n)       , n
+#define GPA_SWITCH_STRING(n)     n,
+
+typedef gpa::names<"GetProcAddress" GPA_SWITCH_GRID(GPA_SWITCH_NAME, GPA_SWITCH_HEADS4, 4)>   gpa_switch_set17;
+typedef gpa::names<"GetProcAddress" GPA_SWITCH_GRID(GPA_SWITCH_NAME, GPA_SWITCH_HEADS8, 8)>   gpa_switch_set65;
+typedef gpa::names<"GetProcAddress" GPA_SWITCH_GRID(GPA_SWITCH_NAME, GPA_SWITCH_HEADS16, 16)> gpa_switch_set257;
+
+// each classifier flattened into its own section, so __start/__stop measure it
+#define GPA_SWITCH_MEASURED(n)                                                  \
+    extern "C" u8 __start_gpa_switch_##n[], __stop_gpa_switch_##n[];            \
+    [[gnu::flatten, gnu::noinline, gnu::section("gpa_switch_" #n)]]             \
+    static i32 gpa_switch_classify##n(const char *name) {                       \
+        return gpa_switch_set##n::classify(name);                               \
+    }
+GPA_SWITCH_MEASURED(17)
+GPA_SWITCH_MEASURED(65)
+GPA_SWITCH_MEASURED(257)
+
+typedef i32 (*gpa_switch_fn)(const char *name);
+
+// the gpa_getgetprocaddress loop generalized to a set: every wanted name
+// compared against every export name
+static u32 gpa_switch_strcmploop(ptr modulehandle, const char **wanted, u32 count, ptr *slots) {
+    u8 *base = (u8*)modulehandle;
+    u8 *nt   = base + *(u32*)(base + 0x3c);
+    u32 *dir = (u32*)(base + *(u32*)(nt + 0x18 + 0x70));
+    u32 *functions = (u32*)(base + dir[7]);
+    u32 *namerva   = (u32*)(base + dir[8]);
+    u16 *ordinals  = (u16*)(base + dir[9]);
+    u32 resolved = 0;
+    memset(slots, 0, count * sizeof(ptr));
+    for (u32 i = 0; i < dir[6] && resolved < count; i++) {
+        const char *name = (char*)base + namerva[i];
+        for (u32 k = 0; k < count; k++) {
+            if (!slots[k] && gpa::detail::strcmp(name, wanted[k]) == 0) {
+                slots[k] = base + functions[ordinals[i]];
+                resolved++;
+                break;
+            }
+        }
+    }
+    return resolved;
+}
+
+static u32 gpa_switch_searchloop(ptr modulehandle, const char **wanted, u32 count, ptr *slots) {
+    u32 resolved = 0;
+    for (u32 k = 0; k < count; k++) {
+        slots[k] = gpa::detail::search(modulehandle, wanted[k]);
+        resolved += slots[k] != 0;
+    }
+    return resolved;
+}
+
+template <typename Set>
+static u32 gpa_switch_run(const char *label, gpa_switch_fn classify, u64 codesize, ptr image,
+                          char **modulenames, u32 modulecount) {
+    u32 count = Set::count, wrong = 0;
+    const char **wanted = (const char**)Set::text;
+
+    // classify: every module name, and the set names themselves
+    for (u32 i = 0; i < modulecount; i++) {
+        i32 k = classify(modulenames[i]), expect = -1;
+        for (u32 j = 0; j < count && expect < 0; j++) {
+            expect = strcmp(modulenames[i], wanted[j]) == 0 ? (i32)j : -1;
+        }
+        wrong += k != expect || k != Set::classify(modulenames[i]);
+    }
+    u32 rounds = 2000;
+    volatile i32 sink = 0;
+    double t0 = gpa_switch_now();
+    for (u32 r = 0; r < rounds; r++) {
+        for (u32 i = 0; i < modulecount; i++) {
+            sink = sink + classify(modulenames[i]);
+        }
+    }
+    double t1 = gpa_switch_now();
+    double perclassify = (t1 - t0) * 1e9 / ((double)rounds * modulecount);
+
+    // resolve three ways, all must agree
+    ptr *a = (ptr*)calloc(count, sizeof(ptr)), *b = (ptr*)calloc(count, sizeof(ptr)), *c = (ptr*)calloc(count, sizeof(ptr));
+    u32 ra = Set::resolve(image, a);
+    u32 rb = gpa_switch_strcmploop(image, wanted, count, b);
+    u32 rc = gpa_switch_searchloop(image, wanted, count, c);
+    wrong += ra != count || rb != count || rc != count || memcmp(a, b, count * sizeof(ptr)) || memcmp(a, c, count * sizeof(ptr));
+
+    double times[3];
+    for (int way = 0; way < 3; way++) {
+        u32 n = way == 1 ? 20 : 200;
+        double s = gpa_switch_now();
+        for (u32 r = 0; r < n; r++) {
+            if (way == 0) {
+                Set::resolve(image, a);
+            } else if (way == 1) {
+                gpa_switch_strcmploop(image, wanted, count, b);
+            } else {
+                gpa_switch_searchloop(image, wanted, count, c);
+            }
+            __asm__ volatile("" ::: "memory");
+        }
+        times[way] = (gpa_switch_now() - s) * 1e6 / n;
+    }
+    printf("%-4s %6llu code bytes (%3llu per name)  classify %5.2f ns  "
+           "resolve: switch %7.1f us, strcmp loop %8.1f us, binary search %6.1f us  %u wrong\n",
+           label, (unsigned long long)codesize, (unsigned long long)(codesize / count), perclassify,
+           times[0], times[1], times[2], wrong);
+    free(a);
+    free(b);
+    free(c);
+    return wrong;
+}
+
+int main(int argc, char *argv[]) {
+    // the whole grid with suffixed near-misses around it, padded with filler
+    const char *grid[] = {GPA_SWITCH_GRID(GPA_SWITCH_STRING, GPA_SWITCH_HEADS16, 16)};
+    const char *suffixes[] = {"", "Ex", "A", "W", "ExW", "Internal"};
+    u32 ngrid = sizeof(grid) / sizeof(*grid), nsuffixes = sizeof(suffixes) / sizeof(*suffixes);
+    u32 count = 1 + ngrid * nsuffixes + 600;
+    gpa_SYNTH_EXPORT *exports = (gpa_SYNTH_EXPORT*)calloc(count, sizeof(gpa_SYNTH_EXPORT));
+    char **modulenames = (char**)calloc(count, sizeof(char*));
+    u32 n = 0;
+    exports[n++].name = strdup("GetProcAddress");
+    for (u32 s = 0; s < nsuffixes; s++) {
+        for (u32 g = 0; g < ngrid; g++) {
+            exports[n].name = (char*)malloc(48);
+            snprintf(exports[n++].name, 48, "%s%s", grid[g], suffixes[s]);
+        }
+    }
+    while (n < count) {
+        exports[n].name = (char*)malloc(48);
+        snprintf(exports[n].name, 48, "%sFiller%04u", grid[n % ngrid], n);
+        n++;
+    }
+    qsort(exports, count, sizeof(gpa_SYNTH_EXPORT), gpa_switch_byname);
+    for (u32 i = 0; i < count; i++) {
+        exports[i].slot = i;
+        exports[i].rva  = 0x1000 + 16 * i;
+        modulenames[i]  = exports[i].name;
+    }
+    u64 capacity = gpa_synth_pe_size(exports, count);
+    u8 *image = (u8*)malloc(capacity);
+    gpa_synth_pe(image, capacity, exports, count, 0, 0);
+    printf("%u export names\n", count);
+
+    u32 wrong = 0;
+#define GPA_SWITCH_RUN(n) \
+    wrong += gpa_switch_run<gpa_switch_set##n>(#n, gpa_switch_classify##n, __stop_gpa_switch_##n - __start_gpa_switch_##n, image, modulenames, count);
+    GPA_SWITCH_RUN(17)
+    GPA_SWITCH_RUN(65)
+    GPA_SWITCH_RUN(257)
+
+    // index is the set order, repeats give the first index
+    static_assert(gpa_switch_set17::index<"GetProcAddress">() == 0);
+    static_assert(gpa_switch_set17::index<"HeapFree">() == 6);
+    typedef gpa::names<"b", "a", "ab", "a", "", "abc"> gpa_switch_small;
+    const char *small[] = {"b", "a", "ab", "a", "", "abc", "abcd", "c", "aa"};
+    i32 expect[]        = { 0,   1,   2,    1,   4,  5,     -1,     -1,  -1};
+    for (u32 i = 0; i < sizeof(small) / sizeof(*small); i++) {
+        wrong += gpa_switch_small::classify(small[i]) != expect[i];
+    }
+    printf("%u wrong\n", wrong);
+    return wrong != 0;
+}
+#endif // _GPA_SWITCH_HPP_DEBUG
+#endif // _GPA_SWITCH_HPP
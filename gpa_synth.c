@@ -0,0 +1,245 @@
+/*
+    gpa_synth.c
+    synthetic PE and ELF images for developing and benchmarking the lookup code.
+    (C) 2023, MIT License, https://github.com/martona/getprocaddress
+
+    Builds minimal but well-formed images around an export list, so the parsers
+    can be exercised on Linux without real Windows binaries. PE images come in
+    either layout: loaded (RVA == offset) or file (sections at their raw
+    offsets, with different section and file alignments so that the two layouts
+    really differ).
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_synth_pe_size(gpa_SYNTH_EXPORT *exports, u32 count)
+        upper bound on the bytes gpa_synth_pe needs, for either layout
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_synth_pe(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count,
+                     u32 timestamp, int filelayout)
+        writes a PE32+ image exporting the given names (which must be sorted).
+        returns the image size, or 0 if capacity is too small
+
+    ///////////////////////////////////////////////////////////////////////////////////////
+    u64 gpa_synth_elf(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count)
+        writes an ELF64 shared object with the names in .dynsym, returns its size
+*/
+
+#ifndef _GPA_SYNTH_C
+#define _GPA_SYNTH_C
+#include "getprocaddress.c"
+
+#define GPA_SYNTH_FILE_ALIGNMENT        0x200
+#define GPA_SYNTH_SECTION_ALIGNMENT     0x1000
+
+typedef struct _gpa_SYNTH_EXPORT {
+    char *name;                 // sorted ascending
+    u32   slot;                 // index into AddressOfFunctions (ordinal - Base), < 65536
+    u32   rva;                  // ignored for forwarders
+    char *forwarder;            // "DLL.Name", or 0
+} gpa_SYNTH_EXPORT;
+
+inline static u64 gpa_synth_align(u64 value, u64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+inline static u8 *gpa_synth_copy(u8 *dst, char *src) {
+    while ((*dst++ = *src++)) {
+    }
+    return dst;
+}
+
+inline static void gpa_synth_zero(u8 *p, u64 n) {
+    while (n--) {
+        *p++ = 0;
+    }
+}
+
+#define GPA_SYNTH_PUT(p, type, value) (*(type*)(p) = (type)(value))
+
+// everything the export data directory holds, laid out back to back
+inline static u64 gpa_synth_edatasize(gpa_SYNTH_EXPORT *exports, u32 count, u32 *numfunctions, u32 *maxrva) {
+    u64 strings = 0;
+    *numfunctions = 0;
+    *maxrva = 0;
+    for (u32 i = 0; i < count; i++) {
+        strings += gpa_strlen(exports[i].name) + 1;
+        if (exports[i].forwarder) {
+            strings += gpa_strlen(exports[i].forwarder) + 1;
+        } else if (exports[i].rva > *maxrva) {
+            *maxrva = exports[i].rva;
+        }
+        if (exports[i].slot + 1 > *numfunctions) {
+            *numfunctions = exports[i].slot + 1;
+        }
+    }
+    return sizeof(gpa_IMAGE_EXPORT_DIRECTORY) + 4ull * *numfunctions + 6ull * count + 16 + strings;
+}
+
+u64 gpa_synth_pe_size(gpa_SYNTH_EXPORT *exports, u32 count) {
+    u32 numfunctions, maxrva;
+    u64 edata = gpa_synth_edatasize(exports, count, &numfunctions, &maxrva);
+    return 2 * GPA_SYNTH_SECTION_ALIGNMENT + gpa_synth_align(edata, GPA_SYNTH_SECTION_ALIGNMENT)
+         + gpa_synth_align(maxrva + 16, GPA_SYNTH_SECTION_ALIGNMENT);
+}
+
+u64 gpa_synth_pe(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count, u32 timestamp, int filelayout) {
+    u32 numfunctions, maxrva;
+    u64 edatasize = gpa_synth_edatasize(exports, count, &numfunctions, &maxrva);
+
+    // .text covers every function rva, .edata follows it
+    u32 textrva   = GPA_SYNTH_SECTION_ALIGNMENT;
+    u32 textsize  = gpa_synth_align(maxrva + 16 > textrva ? maxrva + 16 - textrva : 1, GPA_SYNTH_SECTION_ALIGNMENT);
+    u32 edatarva  = textrva + textsize;
+    u32 imagesize = edatarva + gpa_synth_align(edatasize, GPA_SYNTH_SECTION_ALIGNMENT);
+    u32 headersraw = GPA_SYNTH_FILE_ALIGNMENT * 2;
+    u32 textraw   = headersraw;
+    u32 edataraw  = textraw + GPA_SYNTH_FILE_ALIGNMENT;
+    u64 size      = filelayout ? edataraw + gpa_synth_align(edatasize, GPA_SYNTH_FILE_ALIGNMENT) : imagesize;
+    if (size > capacity) {
+        return 0;
+    }
+    gpa_synth_zero(image, size);
+
+    // dos header, nt headers, optional header (PE32+), two sections
+    u8 *nt = image + 0x40;
+    GPA_SYNTH_PUT(image + 0x00, u16, 0x5a4d);                   // "MZ"
+    GPA_SYNTH_PUT(image + 0x3c, u32, 0x40);                     // e_lfanew
+    GPA_SYNTH_PUT(nt + 0x00, u32, 0x00004550);                  // "PE\0\0"
+    GPA_SYNTH_PUT(nt + 0x04, u16, 0x8664);                      // Machine
+    GPA_SYNTH_PUT(nt + 0x06, u16, 2);                           // NumberOfSections
+    GPA_SYNTH_PUT(nt + 0x08, u32, timestamp);
+    GPA_SYNTH_PUT(nt + 0x14, u16, 0xf0);                        // SizeOfOptionalHeader
+    GPA_SYNTH_PUT(nt + 0x16, u16, 0x2022);                      // dll, large address aware
+    u8 *opt = nt + 0x18;
+    GPA_SYNTH_PUT(opt + 0x00, u16, 0x20b);                      // PE32+
+    GPA_SYNTH_PUT(opt + 0x18, u64, 0x180000000ull);             // ImageBase
+    GPA_SYNTH_PUT(opt + 0x20, u32, GPA_SYNTH_SECTION_ALIGNMENT);
+    GPA_SYNTH_PUT(opt + 0x24, u32, GPA_SYNTH_FILE_ALIGNMENT);
+    GPA_SYNTH_PUT(opt + 0x38, u32, imagesize);
+    GPA_SYNTH_PUT(opt + 0x3c, u32, headersraw);
+    GPA_SYNTH_PUT(opt + 0x6c, u32, 16);                         // NumberOfRvaAndSizes
+    GPA_SYNTH_PUT(opt + 0x70, u32, edatarva);                   // export directory
+    GPA_SYNTH_PUT(opt + 0x74, u32, edatasize);
+    u8 *sections = opt + 0xf0;
+    gpa_synth_copy(sections, ".text");
+    GPA_SYNTH_PUT(sections + 0x08, u32, textsize);
+    GPA_SYNTH_PUT(sections + 0x0c, u32, textrva);
+    GPA_SYNTH_PUT(sections + 0x10, u32, GPA_SYNTH_FILE_ALIGNMENT);
+    GPA_SYNTH_PUT(sections + 0x14, u32, textraw);
+    GPA_SYNTH_PUT(sections + 0x24, u32, 0x60000020);            // code, execute, read
+    sections += 40;
+    gpa_synth_copy(sections, ".edata");
+    GPA_SYNTH_PUT(sections + 0x08, u32, edatasize);
+    GPA_SYNTH_PUT(sections + 0x0c, u32, edatarva);
+    GPA_SYNTH_PUT(sections + 0x10, u32, gpa_synth_align(edatasize, GPA_SYNTH_FILE_ALIGNMENT));
+    GPA_SYNTH_PUT(sections + 0x14, u32, edataraw);
+    GPA_SYNTH_PUT(sections + 0x24, u32, 0x40000040);            // initialized data, read
+
+    // export data: directory, functions, names, ordinals, dll name, strings
+    u8 *edata = image + (filelayout ? edataraw : edatarva);
+    gpa_PIMAGE_EXPORT_DIRECTORY dir = (gpa_PIMAGE_EXPORT_DIRECTORY)edata;
+    u32 functionsrva = edatarva + sizeof(gpa_IMAGE_EXPORT_DIRECTORY);
+    u32 namesrva     = functionsrva + 4 * numfunctions;
+    u32 ordinalsrva  = namesrva + 4 * count;
+    u32 dllnamerva   = ordinalsrva + 2 * count;
+    u32 stringsrva   = dllnamerva + 16;
+    dir->TimeDateStamp         = timestamp;
+    dir->Name                  = dllnamerva;
+    dir->Base                  = 1;
+    dir->NumberOfFunctions     = numfunctions;
+    dir->NumberOfNames         = count;
+    dir->AddressOfFunctions    = functionsrva;
+    dir->AddressOfNames        = namesrva;
+    dir->AddressOfNameOrdinals = ordinalsrva;
+    gpa_synth_copy(edata + (dllnamerva - edatarva), "synth.dll");
+    u32 *functions = (u32*)(edata + (functionsrva - edatarva));
+    u32 *names     = (u32*)(edata + (namesrva - edatarva));
+    u16 *ordinals  = (u16*)(edata + (ordinalsrva - edatarva));
+    u8 *strings    = edata + (stringsrva - edatarva);
+    for (u32 i = 0; i < count; i++) {
+        names[i]    = edatarva + (u32)(strings - edata);
+        ordinals[i] = exports[i].slot;
+        strings     = gpa_synth_copy(strings, exports[i].name);
+        if (exports[i].forwarder) {
+            functions[exports[i].slot] = edatarva + (u32)(strings - edata);
+            strings = gpa_synth_copy(strings, exports[i].forwarder);
+        } else {
+            functions[exports[i].slot] = exports[i].rva;
+        }
+    }
+    return size;
+}
+
+u64 gpa_synth_elf(u8 *image, u64 capacity, gpa_SYNTH_EXPORT *exports, u32 count) {
+    char shstrtab[] = "\0.text\0.dynsym\0.dynstr\0.shstrtab";
+    u64 strsize = 1;
+    for (u32 i = 0; i < count; i++) {
+        strsize += gpa_strlen(exports[i].name) + 1;
+    }
+    u64 symoff   = 0x100;
+    u64 symsize  = 24ull * (count + 1);
+    u64 stroff   = symoff + symsize;
+    u64 shstroff = stroff + strsize;
+    u64 shoff    = gpa_synth_align(shstroff + sizeof(shstrtab), 8);
+    u64 size     = shoff + 5 * 64;
+    if (size > capacity) {
+        return 0;
+    }
+    gpa_synth_zero(image, size);
+
+    // ELF64 header: 64-bit, little-endian, ET_DYN, x86-64
+    GPA_SYNTH_PUT(image + 0x00, u32, 0x464c457f);
+    image[4] = 2;
+    image[5] = 1;
+    image[6] = 1;
+    GPA_SYNTH_PUT(image + 0x10, u16, 3);
+    GPA_SYNTH_PUT(image + 0x12, u16, 62);
+    GPA_SYNTH_PUT(image + 0x14, u32, 1);
+    GPA_SYNTH_PUT(image + 0x28, u64, shoff);
+    GPA_SYNTH_PUT(image + 0x34, u16, 64);                       // e_ehsize
+    GPA_SYNTH_PUT(image + 0x3a, u16, 64);                       // e_shentsize
+    GPA_SYNTH_PUT(image + 0x3c, u16, 5);                        // e_shnum
+    GPA_SYNTH_PUT(image + 0x3e, u16, 4);                        // e_shstrndx
+
+    // symbols: the null symbol, then global functions in .text
+    u8 *sym = image + symoff + 24;
+    u8 *str = image + stroff + 1;
+    for (u32 i = 0; i < count; i++, sym += 24) {
+        GPA_SYNTH_PUT(sym + 0x00, u32, str - (image + stroff));
+        sym[4] = 0x12;                                          // STB_GLOBAL, STT_FUNC
+        GPA_SYNTH_PUT(sym + 0x06, u16, 1);
+        GPA_SYNTH_PUT(sym + 0x08, u64, exports[i].rva);
+        GPA_SYNTH_PUT(sym + 0x10, u64, 16);
+        str = gpa_synth_copy(str, exports[i].name);
+    }
+    for (u32 i = 0; i < sizeof(shstrtab); i++) {
+        image[shstroff + i] = shstrtab[i];
+    }
+
+    // section headers: null, .text, .dynsym (-> .dynstr), .dynstr, .shstrtab
+    u8 *sh = image + shoff + 64;
+    GPA_SYNTH_PUT(sh + 0x00, u32, 1);
+    GPA_SYNTH_PUT(sh + 0x04, u32, 8);                           // SHT_NOBITS
+    GPA_SYNTH_PUT(sh + 0x08, u64, 6);                           // alloc, exec
+    sh += 64;
+    GPA_SYNTH_PUT(sh + 0x00, u32, 7);
+    GPA_SYNTH_PUT(sh + 0x04, u32, 11);                          // SHT_DYNSYM
+    GPA_SYNTH_PUT(sh + 0x18, u64, symoff);
+    GPA_SYNTH_PUT(sh + 0x20, u64, symsize);
+    GPA_SYNTH_PUT(sh + 0x28, u32, 3);
+    GPA_SYNTH_PUT(sh + 0x2c, u32, 1);
+    GPA_SYNTH_PUT(sh + 0x38, u64, 24);
+    sh += 64;
+    GPA_SYNTH_PUT(sh + 0x00, u32, 15);
+    GPA_SYNTH_PUT(sh + 0x04, u32, 3);                           // SHT_STRTAB
+    GPA_SYNTH_PUT(sh + 0x18, u64, stroff);
+    GPA_SYNTH_PUT(sh + 0x20, u64, strsize);
+    sh += 64;
+    GPA_SYNTH_PUT(sh + 0x00, u32, 23);
+    GPA_SYNTH_PUT(sh + 0x04, u32, 3);
+    GPA_SYNTH_PUT(sh + 0x18, u64, shstroff);
+    GPA_SYNTH_PUT(sh + 0x20, u64, sizeof(shstrtab));
+    return size;
+}
+
+#endif // _GPA_SYNTH_C